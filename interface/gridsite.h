@@ -134,6 +134,28 @@ typedef struct { GRSTgaclEntry *firstentry; } GRSTgaclAcl;
  
 typedef struct { GRSTgaclCred *firstcred; char *dnlists; } GRSTgaclUser;
 
+/* compiled form of a GRSTgaclAcl, made by GRSTgaclAclCompile() */
+
+typedef struct { GRSTgaclPerm    allowed;
+                 GRSTgaclPerm    denied;
+                 int             never;       /* has a NULL AURI cred */
+                 int             anyuseronly; /* only gacl:any-user creds */
+                 int             authuser;    /* has gacl:auth-user cred */
+                 int             hasnistloa;  /* has nist-loa:N creds ... */
+                 int             nistloa;     /* ... and this is largest N */
+                 unsigned long  *atoms;       /* bitset of other creds */
+               } GRSTgaclCompiledEntry;
+
+typedef struct { int                    nentries;
+                 GRSTgaclCompiledEntry *entries;
+                 int                    natoms;
+                 int                    nwords;   /* longs per bitset */
+                 char                 **atoms;    /* AURIs or dns: globs */
+                 int                   *isdns;
+                 int                    nhash;
+                 int                   *hash;     /* exact AURI -> atom+1 */
+               } GRSTgaclCompiledAcl;
+
 #define GRST_PERM_NONE   0
 #define GRST_PERM_READ   1
 #define GRST_PERM_EXEC   2
@@ -339,6 +361,10 @@ GRSTgaclAcl   *GRSTgaclAclLoadFile(char *);
 /*  #define GACLfindAclForFile(x)	GRSTgaclFileFindAclname((x)) */
 char      *GRSTgaclFileFindAclname(char *);
 
+int        GRSTgaclFileFindAclnameCache(int);
+
+void       GRSTgaclFileFindAclnameUpdate(void);
+
 /*  #define GACLloadAclForFile(x)	GRSTgaclFileLoadAcl((x)) */
 GRSTgaclAcl   *GRSTgaclAclLoadforFile(char *);
 
@@ -363,6 +389,8 @@ int       GRSTgaclUserSetDNlists(GRSTgaclUser *, char *);
 
 int       GRSTgaclUserLoadDNlists(GRSTgaclUser *, char *);
 
+int       GRSTgaclDNlistsIndex(int);
+
 /*  #define GACLuserFindCredType(x,y) GRSTgaclUserFindCredtype((x),(y)) */
 GRSTgaclCred *GRSTgaclUserFindCredtype(GRSTgaclUser *, char *);
 
@@ -374,6 +402,11 @@ int GRSTgaclUserHasAURI(GRSTgaclUser *, char *);
 /*  #define GACLtestUserAcl(x,y)	GRSTgaclAclTestUser((x),(y)) */
 GRSTgaclPerm   GRSTgaclAclTestUser(GRSTgaclAcl *, GRSTgaclUser *);
 
+GRSTgaclCompiledAcl *GRSTgaclAclCompile(GRSTgaclAcl *);
+int            GRSTgaclCompiledAclFree(GRSTgaclCompiledAcl *);
+GRSTgaclPerm   GRSTgaclCompiledAclTestUser(GRSTgaclCompiledAcl *, 
+                                           GRSTgaclUser *);
+
 /*  #define GACLtestExclAcl(x,y)	GRSTgaclAclTestexclUser((x),(y)) */
 GRSTgaclPerm   GRSTgaclAclTestexclUser(GRSTgaclAcl *, GRSTgaclUser *);
 
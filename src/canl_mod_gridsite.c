@@ -66,6 +66,11 @@
 #include <apr_strings.h>
 #include <apr_tables.h>
 #include <apr_network_io.h>
+#include <apr_hash.h>
+#include <apr_shm.h>
+#include <apr_global_mutex.h>
+#include <apr_buckets.h>
+#include <apr_thread_mutex.h>
 
 #include <ap_config.h>
 #include <httpd.h>
@@ -74,6 +79,7 @@
 #include <http_log.h>
 #include <http_protocol.h>
 #include <http_request.h>
+#include <util_filter.h>
 /* for ap_uname2id() */
 #include <mpm_common.h>
 
@@ -95,6 +101,7 @@
 #include <string.h>
 #include <dirent.h>
 #include <ctype.h>
+#include <errno.h>
 #include <time.h>
 
 #include <sys/select.h> 
@@ -110,6 +117,11 @@
 #include "canl_mod_ssl-private.h"
 #include "mod_ap-compat.h"
 
+#ifdef GRST_AP_SOCACHE
+#include <ap_provider.h>
+#include <ap_socache.h>
+#endif
+
 #include "gridsite.h"
 
 #include <canl.h>
@@ -127,6 +139,38 @@
 
 #define GRST_SESSIONS_DIR "/var/www/sessions"
 
+#define GRST_ACL_CACHE_SIZE 1048576
+
+#define GRST_ACLNAME_CACHE_ENTRIES 4096
+
+#define GRST_SESSIONS_STORE_MAXDATA 16384
+
+#define GRST_PASSCODE_STORE_EXPIRY 86400
+
+#define GRST_SESSIONS_SWEEP 300
+
+#define GRST_SESSIONS_SWEEP_RATE 1000
+
+#define GRST_SESSIONS_SWEEP_BATCH 100
+
+#define GRST_SESSIONS_STATUS_HANDLER "gridsite-sessions-status"
+
+#define GRST_FRAGMENT_CACHE_ENTRIES 256
+
+#define GRST_FRAGMENT_CACHE_MAXSIZE 65536
+
+#define GRST_LISTING_CACHE_ENTRIES 64
+
+#define GRST_LISTING_STATS_MAXAGE 10
+
+#define GRST_COMPILED_ACL_ENTRIES 256
+
+#define GRST_PUT_BUFFER_SIZE 1048576
+
+#define GRST_PUT_ALIGN 4096
+
+#define GRST_PUT_ALLOCATE_MIN 16384
+
 module AP_MODULE_DECLARE_DATA gridsite_module;
 
 #define GRST_SITECAST_GROUPS 32
@@ -147,6 +191,17 @@ int gridhttpport = 0; /* set by create_gridsite_srv_config, used as flag */
 char                    *sessionsdir = NULL;
 char			*sitecastdnlists = NULL;
 char 			*ocspmodes = NULL;
+apr_size_t		aclcachesize = 0;
+apr_shm_t		*aclcache_shm = NULL;
+apr_global_mutex_t	*aclcache_mutex = NULL;
+#ifdef GRST_AP_SOCACHE
+const ap_socache_provider_t *sessionsstore_provider = NULL;
+ap_socache_instance_t	*sessionsstore = NULL;
+apr_global_mutex_t	*sessionsstore_mutex = NULL;
+#endif
+int			sessionssweep = 0;
+int			sessionssweeprate = 0;
+apr_shm_t		*sweeper_shm = NULL;
 struct sitecast_group	sitecastgroups[GRST_SITECAST_GROUPS+1];
 struct sitecast_alias	sitecastaliases[GRST_SITECAST_ALIASES];
 
@@ -190,6 +245,11 @@ typedef struct
    char			*delegationuri;
    ap_unix_identity_t	execugid;
    apr_fileperms_t	diskmode;
+   int			putbuffer;
+   int			putallocate;
+   apr_off_t		putwritebehind;
+   int			putsync;
+   int			putdirect;
 }  mod_gridsite_dir_cfg; /* per-directory config choices */
 
 
@@ -461,17 +521,248 @@ void delegation_header(request_rec *r, mod_gridsite_dir_cfg *conf)
 
 }
 
+/*
+    Per-process cache of the header and footer files used by html_format
+    and html_dir_list, keyed by path and checked against inode, mtime and
+    size. Entries are shared by threads and are immutable: a changed file
+    gets a new entry, and the old one is freed when the last request using
+    it is finished.
+*/
+
+typedef struct
+{
+   apr_ino_t		inode;
+   apr_dev_t		device;
+   apr_time_t		mtime;
+   apr_off_t		size;
+   char			*path;
+   char			*data;
+   int			refs;
+   int			retired;
+}  grst_fragment;
+
+static apr_hash_t *fragment_cache = NULL;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *fragment_mutex = NULL;
+#endif
+
+static void fragment_lock(void)
+{
+#if APR_HAS_THREADS
+   if (fragment_mutex != NULL) apr_thread_mutex_lock(fragment_mutex);
+#endif
+}
+
+static void fragment_unlock(void)
+{
+#if APR_HAS_THREADS
+   if (fragment_mutex != NULL) apr_thread_mutex_unlock(fragment_mutex);
+#endif
+}
+
+static void fragment_free(grst_fragment *fragment)
+{
+   free(fragment->path);
+   free(fragment->data);
+   free(fragment);
+}
+
+static apr_status_t fragment_release(void *data)
+/*
+    Request pool cleanup, run once the request's buckets have been sent
+*/
+{
+   grst_fragment *fragment = (grst_fragment *) data;
+   
+   fragment_lock();
+
+   if ((--(fragment->refs) == 0) && fragment->retired) fragment_free(fragment);
+
+   fragment_unlock();
+
+   return APR_SUCCESS;
+}
+
+static void fragment_cache_init(apr_pool_t *pPool)
+{
+   fragment_cache = apr_hash_make(pPool);
+#if APR_HAS_THREADS
+   if (apr_thread_mutex_create(&fragment_mutex, APR_THREAD_MUTEX_DEFAULT, 
+                               pPool) != APR_SUCCESS) fragment_cache = NULL;
+#endif
+}
+
+static void brigade_pool_puts(apr_bucket_brigade *bb, apr_pool_t *pool,
+                              const char *str)
+/*
+    Append a string which lives as long as pool, without copying it
+*/
+{
+   apr_size_t len = strlen(str);
+
+   if (len > 0) APR_BRIGADE_INSERT_TAIL(bb,
+                  apr_bucket_pool_create(str, len, pool, bb->bucket_alloc));
+}
+
+static void fragment_insert(request_rec *r, apr_bucket_brigade *bb,
+                            grst_fragment *fragment)
+/*
+    Append fragment's data to bb as a pool bucket on r->pool. Its cleanup
+    is registered after fragment_release's, so runs first and copies the
+    data to the heap if a filter has set the bucket aside past the end of
+    the request.
+*/
+{
+   if (fragment->size > 0) APR_BRIGADE_INSERT_TAIL(bb,
+                  apr_bucket_pool_create(fragment->data, fragment->size,
+                                         r->pool, bb->bucket_alloc));
+}
+
+static int fragment_append(request_rec *r, apr_bucket_brigade *bb,
+                           const char *path)
+/*
+    Append the contents of the file path to bb, from the fragment cache
+    if possible or else as a file bucket (so sendfile or mmap can be used.)
+    Returns 0 if the file does not exist.
+*/
+{
+   apr_finfo_t    finfo;
+   apr_file_t    *fp;
+   apr_size_t     nbytes;
+   grst_fragment *fragment, *old;
+
+   if ((apr_stat(&finfo, path, APR_FINFO_MIN | APR_FINFO_INODE | 
+                 APR_FINFO_DEV, r->pool) != APR_SUCCESS) ||
+       (finfo.filetype != APR_REG)) return 0;
+
+   if (fragment_cache != NULL)
+     {
+       fragment_lock();
+
+       fragment = apr_hash_get(fragment_cache, path, APR_HASH_KEY_STRING);
+
+       if ((fragment != NULL) &&
+           (fragment->inode  == finfo.inode) &&
+           (fragment->device == finfo.device) &&
+           (fragment->mtime  == finfo.mtime) &&
+           (fragment->size   == finfo.size))
+         {
+           ++(fragment->refs);
+           fragment_unlock();
+
+           apr_pool_cleanup_register(r->pool, fragment, fragment_release,
+                                     apr_pool_cleanup_null);
+
+           fragment_insert(r, bb, fragment);
+           return 1;
+         }
+
+       fragment_unlock();
+     }
+
+   if (apr_file_open(&fp, path, APR_READ | APR_SENDFILE_ENABLED, 0,
+                     r->pool) != APR_SUCCESS) return 0;
+
+   /* files still being written, or too big, are just sent from disk */
+
+   if ((fragment_cache == NULL) ||
+       (finfo.size > GRST_FRAGMENT_CACHE_MAXSIZE) ||
+       (finfo.mtime > apr_time_now() - apr_time_from_sec(1)) ||
+       ((fragment = calloc(1, sizeof(grst_fragment))) == NULL))
+     {
+       apr_brigade_insert_file(bb, fp, 0, finfo.size, r->pool);
+       return 1;
+     }
+
+   fragment->inode  = finfo.inode;
+   fragment->device = finfo.device;
+   fragment->mtime  = finfo.mtime;
+   fragment->size   = finfo.size;
+   fragment->path   = strdup(path);
+   fragment->data   = malloc(finfo.size + 1);
+
+   if ((fragment->path == NULL) || (fragment->data == NULL) ||
+       (apr_file_read_full(fp, fragment->data, finfo.size, &nbytes) 
+                                                        != APR_SUCCESS))
+     {
+       fragment_free(fragment);
+       apr_brigade_insert_file(bb, fp, 0, finfo.size, r->pool);
+       return 1;
+     }
+
+   apr_file_close(fp);
+
+   fragment->refs = 1; /* this request */
+
+   fragment_lock();
+
+   old = apr_hash_get(fragment_cache, path, APR_HASH_KEY_STRING);
+
+   if (old != NULL)
+     {
+       apr_hash_set(fragment_cache, old->path, APR_HASH_KEY_STRING, NULL);
+       old->retired = 1;
+       if (old->refs == 0) fragment_free(old);
+     }
+
+   if ((old != NULL) || 
+       (apr_hash_count(fragment_cache) < GRST_FRAGMENT_CACHE_ENTRIES))
+     {
+       apr_hash_set(fragment_cache, fragment->path, APR_HASH_KEY_STRING, 
+                    fragment);
+     }
+   else fragment->retired = 1; /* cache full, freed after this request */
+
+   fragment_unlock();
+
+   apr_pool_cleanup_register(r->pool, fragment, fragment_release,
+                             apr_pool_cleanup_null);
+
+   fragment_insert(r, bb, fragment);
+   return 1;
+}
+
+static int fragment_find(request_rec *r, apr_bucket_brigade *bb, 
+                         const char *name)
+/*
+    Append the header or footer file name, either an absolute path or
+    the first one found in the directory of r->filename or its parents.
+    Returns 0 if none was found.
+*/
+{
+   char *s, *p;
+
+   if (name[0] == '/') return fragment_append(r, bb, name);
+
+   /* first make a buffer big enough to hold path names we want to try */
+   s = apr_palloc(r->pool, strlen(r->filename) + strlen(name) + 1);
+   strcpy(s, r->filename);
+
+   for (;;)
+      {
+        p = rindex(s, '/');
+        if (p == NULL) return 0; /* failed to find one */
+
+        p[1] = '\0';
+        strcat(p, name);
+
+        if (fragment_append(r, bb, s)) return 1; /* found one */
+
+        *p = '\0';
+      }
+}
+
 int html_format(request_rec *r, mod_gridsite_dir_cfg *conf)
 /*
     try to do GridSite formatting of .html files (NOT .shtml etc)
 */
 {
-    int   fd;
-    char  *buf, *p, *file, *s, *head_formatted, *header_formatted,
-          *body_formatted, *admin_formatted, *footer_formatted;
-    size_t length;
-    struct stat statbuf;
+    char  *buf, *p, *file, *head_formatted, *body_formatted, 
+          *admin_formatted;
+    apr_size_t length;
+    apr_off_t  total;
     apr_file_t *fp;
+    apr_bucket_brigade *bb, *headerbb;
 
     if (r->finfo.filetype == APR_NOFILE) return HTTP_NOT_FOUND;
 
@@ -491,56 +782,26 @@ int html_format(request_rec *r, mod_gridsite_dir_cfg *conf)
     buf[r->finfo.size] = '\0';
     apr_file_close(fp);
 
-    /* **** try to find a header file in this or parent directories **** */
-
-    fd = -1;
-
-    if (conf->headfile[0] == '/') /* try absolute */
-      {
-        fd = open(conf->headfile, O_RDONLY);
-      }
-    else /* try relative */
-      {
-        /* first make a buffer big enough to hold path names we want to try */
-        s = apr_palloc(r->pool, 
-                       strlen(r->filename) + strlen(conf->headfile) + 1);
-        strcpy(s, r->filename);
-
-        for (;;)
-           {
-             p = rindex(s, '/');
-             if (p == NULL) break; /* failed to find one */
-             p[1] = '\0';
-             strcat(p, conf->headfile);
-
-             fd = open(s, O_RDONLY);
-             if (fd != -1) break; /* found one */
+    bb       = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    headerbb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
 
-             *p = '\0';
-           }
-      }
+    /* **** try to find a header file in this or parent directories **** */
 
-    if (fd == -1) /* not found, so set up not to output one */
+    if (!fragment_find(r, headerbb, conf->headfile)) 
       {
-        head_formatted   = apr_pstrdup(r->pool, "");
-        header_formatted = apr_pstrdup(r->pool, "");
+        /* not found, so set up not to output one */
+        head_formatted   = "";
         body_formatted   = buf;
       }
     else /* found a header file, so set up head and body to surround it */
       {
-        fstat(fd, &statbuf);
-        header_formatted = apr_palloc(r->pool, statbuf.st_size + 1);
-        read(fd, header_formatted, statbuf.st_size);
-        header_formatted[statbuf.st_size] = '\0';
-        close(fd);
-
         p = strstr(buf, "<body");
         if (p == NULL) p = strstr(buf, "<BODY");
         if (p == NULL) p = strstr(buf, "<Body");
 
         if (p == NULL)
           {
-            head_formatted = apr_pstrdup(r->pool, "");
+            head_formatted = "";
             body_formatted = buf;
           }
         else
@@ -576,65 +837,28 @@ int html_format(request_rec *r, mod_gridsite_dir_cfg *conf)
 
     admin_formatted = make_admin_footer(r, conf, FALSE);
 
-    /* **** try to find a footer file in this or parent directories **** */
-
-    fd = -1;
-
-    if (conf->footfile[0] == '/') /* try absolute */
-      {
-        fd = open(conf->footfile, O_RDONLY);
-      }
-    else /* try relative */
-      {
-        /* first make a buffer big enough to hold path names we want to try */
-        s = apr_palloc(r->pool, 
-                       strlen(r->filename) + strlen(conf->footfile) + 1);
-        strcpy(s, r->filename);
-
-        for (;;)
-           {
-             p = rindex(s, '/');
-             if (p == NULL) break; /* failed to find one */
-
-             p[1] = '\0';
-             strcat(p, conf->footfile);
+    /* **** assemble HTML Head+Body, from cached files where possible **** */
 
-             fd = open(s, O_RDONLY);
-             if (fd != -1) break; /* found one */
+    brigade_pool_puts(bb, r->pool, head_formatted);
+    APR_BRIGADE_CONCAT(bb, headerbb);
+    brigade_pool_puts(bb, r->pool, body_formatted);
+    brigade_pool_puts(bb, r->pool, admin_formatted);
 
-             *p = '\0';
-           }
-       }
+    /* **** try to find a footer file in this or parent directories **** */
 
-    if (fd == -1) /* failed to find a footer, so set up empty default */
-      {
-        footer_formatted = apr_pstrdup(r->pool, "");
-      }
-    else /* found a footer, so set up to use it */
-      {
-        fstat(fd, &statbuf);
-        footer_formatted = apr_palloc(r->pool, statbuf.st_size + 1);
-        read(fd, footer_formatted, statbuf.st_size);
-        footer_formatted[statbuf.st_size] = '\0';
-        close(fd);
-      }
+    fragment_find(r, bb, conf->footfile);
 
     /* **** can now calculate the Content-Length and output headers **** */
 
-    length = strlen(head_formatted) + strlen(header_formatted) +
-             strlen(body_formatted) + strlen(admin_formatted)  +
-             strlen(footer_formatted);
+    apr_brigade_length(bb, 1, &total);
 
-    ap_set_content_length(r, length);
+    ap_set_content_length(r, total);
     ap_set_content_type(r, "text/html");
 
     /* ** output the HTTP body (HTML Head+Body) ** */
 
-    ap_rputs(head_formatted,   r);
-    ap_rputs(header_formatted, r);
-    ap_rputs(body_formatted,   r);
-    ap_rputs(admin_formatted,  r);
-    ap_rputs(footer_formatted, r);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+    ap_pass_brigade(r->output_filters, bb);
 
     return OK;
 }
@@ -645,100 +869,62 @@ int html_dir_list(request_rec *r, mod_gridsite_dir_cfg *conf)
     by GridSiteHtmlFormat/conf->format
 */
 {
-    int   fd, n, nn;
-    char  *p, *s, *head_formatted, *header_formatted,
-          *body_formatted, *admin_formatted, *footer_formatted, *temp,
-           modified[999], *d_namepath, *indexheaderpath, *indexheadertext,
-           *encoded, *escaped;
-    size_t length;
+    int   n, nn, dir_fd;
+    char  *head_formatted, modified[999], *encoded, *escaped;
+    apr_off_t length;
     struct stat statbuf;
     struct tm   mtime_tm;
     struct dirent **namelist;
+    apr_bucket_brigade *bb;
     
     if (r->finfo.filetype == APR_NOFILE) return HTTP_NOT_FOUND;
 
     /* Put in Delegation service header if required */
     if (conf->delegationuri) delegation_header(r, conf);
 
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+
     head_formatted = apr_psprintf(r->pool,
       "<head><title>Directory listing %s</title></head>\n", r->uri);
 
-    if (conf->format)
-      {
-        /* **** try to find a header file in this or parent directories **** */
-
-        /* first make a buffer big enough to hold path names we want to try */
-        fd = -1;
-        s = apr_palloc(r->pool, 
-                       strlen(r->filename) + strlen(conf->headfile) + 1);
-        strcpy(s, r->filename);
+    brigade_pool_puts(bb, r->pool, head_formatted);
 
-        for (;;)
-           {
-             p = rindex(s, '/');
-             if (p == NULL) break; /* failed to find one */
-             p[1] = '\0';
-             strcat(p, conf->headfile);
-    
-             fd = open(s, O_RDONLY);
-             if (fd != -1) break; /* found one */
+    /* **** try to find a header file in this or parent directories **** */
 
-             *p = '\0';
-           }
-            
-        if (fd == -1) /* not found, so set up to output sensible default */
-          {
-            header_formatted = apr_pstrdup(r->pool, "<body bgcolor=white>");
-          }
-        else /* found a header file, so set up head and body to surround it */
-          {
-            fstat(fd, &statbuf);
-            header_formatted = apr_palloc(r->pool, statbuf.st_size + 1);
-            read(fd, header_formatted, statbuf.st_size);
-            header_formatted[statbuf.st_size] = '\0';
-            close(fd);
-          }
+    if (!conf->format || !fragment_find(r, bb, conf->headfile))
+      {
+        /* not found, so output sensible default */
+        brigade_pool_puts(bb, r->pool, "<body bgcolor=white>");
       }
-    else header_formatted = apr_pstrdup(r->pool, "<body bgcolor=white>");
             
-    body_formatted = apr_psprintf(r->pool, 
-      "<h1>Directory listing %s</h1>\n", r->uri);
+    brigade_pool_puts(bb, r->pool, apr_psprintf(r->pool, 
+      "<h1>Directory listing %s</h1>\n", r->uri));
       
     if (conf->indexheader != NULL)
       {
-        indexheaderpath = apr_psprintf(r->pool, "%s/%s", r->filename, 
-                                                         conf->indexheader);
-        fd = open(indexheaderpath, O_RDONLY);
-        if (fd != -1)
-          {
-            fstat(fd, &statbuf);
-            indexheadertext = apr_palloc(r->pool, statbuf.st_size + 1);
-            read(fd, indexheadertext, statbuf.st_size);
-            indexheadertext[statbuf.st_size] = '\0';
-            close(fd);
-            
-            body_formatted = apr_pstrcat(r->pool, body_formatted,
-                                         indexheadertext, NULL);
-          }
+        fragment_append(r, bb, apr_psprintf(r->pool, "%s/%s", r->filename,
+                                                          conf->indexheader));
       }
 
-    body_formatted = apr_pstrcat(r->pool, body_formatted, "<p><table>\n", NULL);
+    /* rows are written straight into the brigade's buffers, and each
+       entry is stat()ed relative to the open directory */
+
+    apr_brigade_puts(bb, NULL, NULL, "<p><table>\n");
 
     if (r->unparsed_uri[1] != '\0')
-     body_formatted = apr_pstrcat(r->pool, body_formatted, 
-        "<tr><td colspan=3>[<a href=\"../\">Parent directory</a>]</td></tr>\n", 
-         NULL);
+     apr_brigade_puts(bb, NULL, NULL,
+        "<tr><td colspan=3>[<a href=\"../\">Parent directory</a>]</td></tr>\n");
       
+    dir_fd = open(r->filename, O_RDONLY | O_DIRECTORY);
+
     nn = scandir(r->filename, &namelist, 0, versionsort);
     for (n=0; n < nn; ++n)
          {
            if ((namelist[n]->d_name[0] != '.') && 
                ((conf->indexheader == NULL) || 
-                (strcmp(conf->indexheader, namelist[n]->d_name) != 0)))
+                (strcmp(conf->indexheader, namelist[n]->d_name) != 0)) &&
+               (fstatat(dir_fd, namelist[n]->d_name, &statbuf, 0) == 0))
              {
-               d_namepath = apr_psprintf(r->pool, "%s/%s", r->filename,
-                                                  namelist[n]->d_name);
-               stat(d_namepath, &statbuf);
                
                localtime_r(&(statbuf.st_mtime), &mtime_tm);
                strftime(modified, sizeof(modified), 
@@ -749,7 +935,7 @@ int html_dir_list(request_rec *r, mod_gridsite_dir_cfg *conf)
                escaped = html_escape(r->pool, namelist[n]->d_name);
 
                if (S_ISDIR(statbuf.st_mode))
-                    temp = apr_psprintf(r->pool, 
+                    apr_brigade_printf(bb, NULL, NULL, 
                       "<tr><td><a href=\"%s/\" content-length=\"%ld\" "
                       "last-modified=\"%ld\">"
                       "%s/</a></td>"
@@ -757,7 +943,7 @@ int html_dir_list(request_rec *r, mod_gridsite_dir_cfg *conf)
                       encoded, statbuf.st_size, statbuf.st_mtime,
                       escaped, 
                       statbuf.st_size, modified);
-               else temp = apr_psprintf(r->pool, 
+               else apr_brigade_printf(bb, NULL, NULL, 
                       "<tr><td><a href=\"%s\" content-length=\"%ld\" "
                       "last-modified=\"%ld\">"
                       "%s</a></td>"
@@ -768,1117 +954,2105 @@ int html_dir_list(request_rec *r, mod_gridsite_dir_cfg *conf)
                       
                free(encoded);
                /* escaped done with pool so no free() */
-
-               body_formatted = apr_pstrcat(r->pool,body_formatted,temp,NULL);
              }
 
            free(namelist[n]);
          }
                  
-    free(namelist);
+    if (nn >= 0) free(namelist);
+    if (dir_fd != -1) close(dir_fd);
     
-    body_formatted = apr_pstrcat(r->pool, body_formatted, "</table>\n", NULL);
+    apr_brigade_puts(bb, NULL, NULL, "</table>\n");
 
     if (conf->format)
       {
         /* **** set up dynamic part of footer to go at end of body **** */
 
-        admin_formatted = make_admin_footer(r, conf, TRUE);
+        brigade_pool_puts(bb, r->pool, make_admin_footer(r, conf, TRUE));
     
         /* **** try to find a footer file in this or parent directories **** */
 
-        /* first make a buffer big enough to hold path names we want to try */
-        fd = -1;
-        s = apr_palloc(r->pool, 
-                       strlen(r->filename) + strlen(conf->footfile) + 1);
-        strcpy(s, r->filename);
-    
-        for (;;)
-           {
-             p = rindex(s, '/');
-             if (p == NULL) break; /* failed to find one */
-    
-             p[1] = '\0';
-             strcat(p, conf->footfile);
-    
-             fd = open(s, O_RDONLY);
-             if (fd != -1) break; /* found one */
-
-             *p = '\0';
-           }
-            
-        if (fd == -1) /* failed to find a footer, so use standard default */
-          {
-            footer_formatted = apr_pstrdup(r->pool, "</body>");
-          }
-        else /* found a footer, so set up to use it */
+        if (!fragment_find(r, bb, conf->footfile))
           {
-            fstat(fd, &statbuf);
-            footer_formatted = apr_palloc(r->pool, statbuf.st_size + 1);
-            read(fd, footer_formatted, statbuf.st_size);
-            footer_formatted[statbuf.st_size] = '\0';
-            close(fd);
+            /* failed to find a footer, so use standard default */
+            brigade_pool_puts(bb, r->pool, "</body>");
           }
       }
-    else
-      {
-        admin_formatted = apr_pstrdup(r->pool, "");
-        footer_formatted = apr_pstrdup(r->pool, "</body>");
-      }
+    else brigade_pool_puts(bb, r->pool, "</body>");
 
     /* **** can now calculate the Content-Length and output headers **** */
       
-    length = strlen(head_formatted) + strlen(header_formatted) + 
-             strlen(body_formatted) + strlen(admin_formatted)  +
-             strlen(footer_formatted);
+    apr_brigade_length(bb, 1, &length);
 
     ap_set_content_length(r, length);
     ap_set_content_type(r, "text/html");
 
     /* ** output the HTTP body (HTML Head+Body) ** */
 
-    ap_rputs(head_formatted,   r);
-    ap_rputs(header_formatted, r);
-    ap_rputs(body_formatted,   r);
-    ap_rputs(admin_formatted,  r);
-    ap_rputs(footer_formatted, r);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+    ap_pass_brigade(r->output_filters, bb);
 
     return OK;
 }
 
-char *make_passcode_file(request_rec *r, mod_gridsite_dir_cfg *conf, 
-                         char *path, apr_time_t expires_time)
+/*
+    Per-process cache of sorted directory listings for json_dir_list,
+    keyed by directory path and checked against the directory's inode and
+    mtime, which change whenever an entry is added, removed or renamed.
+    Writing to a file does not change the directory, so sizes and times
+    sorted for sort=size|mtime are only kept for GRST_LISTING_STATS_MAXAGE
+    seconds. Entries are reference counted like grst_fragment.
+*/
+
+typedef struct
 {
-    int           i;
-    char         *filetemplate, *notename_i, *grst_cred_i, *cookievalue=NULL;
-    apr_uint64_t  gridauthcookie;
-    apr_file_t   *fp;
+   char			*name;
+   struct stat		statbuf;
+}  grst_listing_stat;
 
-    /* create random for use in GRIDHTTP_PASSCODE cookies and file name */
+typedef struct
+{
+   apr_ino_t		inode;
+   apr_dev_t		device;
+   apr_time_t		mtime;
+   char			*path;
+   char			**names;   /* in versionsort() order */
+   int			count;
+   grst_listing_stat	*sorted[2];  /* by size, by mtime: made on first use */
+   int			nsorted[2];
+   apr_time_t		statted[2];
+   int			refs;
+   int			retired;
+}  grst_listing;
+
+static apr_hash_t *listing_cache = NULL;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *listing_mutex = NULL;
+#endif
 
-    if (apr_generate_random_bytes((char *) &gridauthcookie, 
-                                  sizeof(gridauthcookie))
-         != APR_SUCCESS) return NULL;
-    
-    filetemplate = apr_psprintf(r->pool, "%s/passcode-%016lxXXXXXX", 
-     ap_server_root_relative(r->pool,
-     sessionsdir),
-     gridauthcookie);
+static void listing_lock(void)
+{
+#if APR_HAS_THREADS
+   if (listing_mutex != NULL) apr_thread_mutex_lock(listing_mutex);
+#endif
+}
 
-    if (apr_file_mktemp(&fp, 
-                        filetemplate, 
-                        APR_CREATE | APR_WRITE | APR_EXCL,
-                        r->pool)
-                      != APR_SUCCESS) return NULL;
-                      
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-               "Created passcode file %s", filetemplate);
+static void listing_unlock(void)
+{
+#if APR_HAS_THREADS
+   if (listing_mutex != NULL) apr_thread_mutex_unlock(listing_mutex);
+#endif
+}
 
-    if (expires_time > 0) apr_file_printf(fp, "expires=%lu\n",
-                                      (time_t) apr_time_sec(expires_time));
+static void listing_cache_init(apr_pool_t *pPool)
+{
+   listing_cache = apr_hash_make(pPool);
+#if APR_HAS_THREADS
+   if (apr_thread_mutex_create(&listing_mutex, APR_THREAD_MUTEX_DEFAULT, 
+                               pPool) != APR_SUCCESS) listing_cache = NULL;
+#endif
+}
 
-    apr_file_printf(fp, "domain=%s\npath=%s\n", r->hostname, path);
+static void listing_free(grst_listing *listing)
+{
+   int i;
+   
+   for (i=0; i < listing->count; ++i) free(listing->names[i]);
 
-    for (i=0; ; ++i)
-       {
-         notename_i = apr_psprintf(r->pool, "GRST_CRED_AURI_%d", i);
-         if (grst_cred_i = (char *)
-                           apr_table_get(r->connection->notes, notename_i))
-           {
-             apr_file_printf(fp, "%s=%s\n", notename_i, grst_cred_i);
-           }
-         else break; /* GRST_CRED_AURI_i are numbered consecutively */
+   free(listing->sorted[0]);
+   free(listing->sorted[1]);
+   free(listing->names);
+   free(listing->path);
+   free(listing);
+}
 
-         notename_i = apr_psprintf(r->pool, "GRST_CRED_VALID_%d", i);
-         if (grst_cred_i = (char *)
-                           apr_table_get(r->connection->notes, notename_i))
-           {
-             apr_file_printf(fp, "%s=%s\n", notename_i, grst_cred_i);
-           }
-         else break; /* GRST_CRED_VALID_i are numbered consecutively */
-       }
+static apr_status_t listing_release(void *data)
+{
+   grst_listing *listing = (grst_listing *) data;
+   
+   listing_lock();
 
-    if (apr_file_close(fp) != APR_SUCCESS) 
-      {
-        apr_file_remove(filetemplate, r->pool); /* try to clean up */
-        return NULL;
-      }
-      
-    cookievalue = rindex(filetemplate, '-');
-    if (cookievalue != NULL) 
-      {
-        ++cookievalue;
-        return cookievalue;
-      }
-    else return NULL;
-}
+   if ((--(listing->refs) == 0) && listing->retired) listing_free(listing);
 
-int http_gridhttp(request_rec *r, mod_gridsite_dir_cfg *conf)
-{ 
-    char        *httpurl, *cookievalue, expires_str[APR_RFC822_DATE_LEN];
-    apr_time_t   expires_time;
+   listing_unlock();
 
-    /* passcode cookies are valid for only 5 mins! */
-    expires_time = apr_time_now() + apr_time_from_sec(300);
+   return APR_SUCCESS;
+}
 
-    /* try to generate passcode and make passcode file */
-    cookievalue = make_passcode_file(r, conf, r->uri, expires_time);
-    
-    if (cookievalue == NULL) return HTTP_INTERNAL_SERVER_ERROR;
-    
-    /* send redirection header back to client */
-       
-    apr_rfc822_date(expires_str, expires_time);
+static grst_listing *listing_get(request_rec *r, mod_gridsite_dir_cfg *conf)
+/*
+    Get the sorted names in the directory r->filename, excluding dot files
+    and GridSiteIndexHeader as html_dir_list does. The listing belongs to
+    the request and must not be modified or freed.
+*/
+{
+   int             n, nn;
+   apr_time_t      stale;
+   apr_finfo_t     finfo;
+   struct dirent **namelist;
+   grst_listing   *listing = NULL, *old;
 
-    apr_table_add(r->headers_out, 
-                  apr_pstrdup(r->pool, "Set-Cookie"),
-                  apr_psprintf(r->pool,
-                  "GRIDHTTP_PASSCODE=%s; "
-                  "expires=%s; "
-                  "domain=%s; "
-                  "path=%s",
-                  cookievalue, expires_str, r->hostname, r->uri));
+   if (apr_stat(&finfo, r->filename, APR_FINFO_MIN | APR_FINFO_INODE |
+                APR_FINFO_DEV, r->pool) != APR_SUCCESS) return NULL;
 
-    if (gridhttpport != DEFAULT_HTTP_PORT)
-         httpurl = apr_psprintf(r->pool, "http://%s:%d%s", r->hostname,
-                                gridhttpport, ap_escape_uri(r->pool, r->uri));
-    else httpurl = apr_pstrcat(r->pool, "http://", r->hostname,
-                                ap_escape_uri(r->pool, r->uri), NULL);
+   if (listing_cache != NULL)
+     {
+       listing_lock();
 
-    apr_table_setn(r->headers_out, apr_pstrdup(r->pool, "Location"), httpurl);
+       listing = apr_hash_get(listing_cache, r->filename, APR_HASH_KEY_STRING);
+       stale   = apr_time_now() - apr_time_from_sec(GRST_LISTING_STATS_MAXAGE);
 
-    r->status = HTTP_MOVED_TEMPORARILY;  
-    return OK;
-}
+       if ((listing != NULL) &&
+           (listing->inode  == finfo.inode) &&
+           (listing->device == finfo.device) &&
+           (listing->mtime  == finfo.mtime) &&
+           ((listing->sorted[0] == NULL) || (listing->statted[0] > stale)) &&
+           ((listing->sorted[1] == NULL) || (listing->statted[1] > stale)))
+         {
+           ++(listing->refs);
+           listing_unlock();
 
-int http_put_method(request_rec *r, mod_gridsite_dir_cfg *conf)
-{
-  char        buf[2048], *filename, *dirname, *basename;
-  const char  *p;
-  size_t      block_length, length_sent;
-  int         retcode, stat_ret;
-  apr_file_t *fp;
-  struct stat statbuf;
-  int       has_range = 0, is_done = 0;
-  apr_off_t range_start, range_end, range_length, length_to_send, length = 0;
-  
-  /* ***  check if directory creation: PUT /.../  *** */
+           apr_pool_cleanup_register(r->pool, listing, listing_release,
+                                     apr_pool_cleanup_null);
+           return listing;
+         }
 
-  if ((r->unparsed_uri    != NULL) && 
-      (r->unparsed_uri[0] != '\0') &&
-      (r->unparsed_uri[strlen(r->unparsed_uri) - 1] == '/'))
-    {
-      if (apr_dir_make(r->filename, 
-                       conf->diskmode 
-                       | APR_UEXECUTE | APR_GEXECUTE | APR_WEXECUTE, 
-                       r->pool) != 0) return HTTP_INTERNAL_SERVER_ERROR;
+       listing_unlock();
+     }
 
-      /* we force the permissions, rather than accept any existing ones */
+   if ((nn = scandir(r->filename, &namelist, 0, versionsort)) < 0) 
+                                                               return NULL;
 
-      apr_file_perms_set(r->filename, conf->diskmode
-                             | APR_UEXECUTE | APR_GEXECUTE | APR_WEXECUTE);
-                             
-      ap_set_content_length(r, 0);
-      ap_set_content_type(r, "text/html");
-      return OK;
-    }
+   if ((listing = calloc(1, sizeof(grst_listing))) != NULL)
+     {
+       listing->inode  = finfo.inode;
+       listing->device = finfo.device;
+       listing->mtime  = finfo.mtime;
+       listing->path   = strdup(r->filename);
+       listing->names  = malloc(sizeof(char *) * (nn + 1));
+     }
 
-  /* ***  otherwise assume trying to create a regular file *** */
+   for (n=0; n < nn; ++n)
+      {
+        if ((listing != NULL) && (listing->names != NULL) &&
+            (namelist[n]->d_name[0] != '.') &&
+            ((conf->indexheader == NULL) || 
+             (strcmp(conf->indexheader, namelist[n]->d_name) != 0)))
+          {
+            if ((listing->names[listing->count] = 
+                                   strdup(namelist[n]->d_name)) != NULL)
+              ++(listing->count);
+          }
 
-  stat_ret = stat(r->filename, &statbuf);
+        free(namelist[n]);
+      }
 
-  /* find if a range is specified */
+   free(namelist);
 
-  has_range = parse_content_range(r, &range_start, &range_end, &range_length);
+   if ((listing == NULL) || (listing->path == NULL) || 
+       (listing->names == NULL))
+     {
+       if (listing != NULL) listing_free(listing);
+       return NULL;
+     }
 
-  if (has_range)
-    {
-       if ((range_start == 0) && (range_end == 0)) /* truncate? */
+   listing->refs = 1; /* this request */
+
+   /* directories still being changed are not cached */
+
+   if ((listing_cache == NULL) ||
+       (finfo.mtime > apr_time_now() - apr_time_from_sec(1)))
+     listing->retired = 1;
+   else
+     {
+       listing_lock();
+
+       old = apr_hash_get(listing_cache, r->filename, APR_HASH_KEY_STRING);
+
+       if (old != NULL)
          {
-           if (stat_ret != 0) return HTTP_NOT_FOUND;
-          
-           if (truncate(r->filename, range_length) != 0)
-                return HTTP_INTERNAL_SERVER_ERROR;
-           else return OK;
+           apr_hash_set(listing_cache, old->path, APR_HASH_KEY_STRING, NULL);
+           old->retired = 1;
+           if (old->refs == 0) listing_free(old);
          }
-    
-       filename = r->filename;
 
-       if (apr_file_open(&fp, filename, APR_WRITE | APR_CREATE | APR_BUFFERED,
-            conf->diskmode, r->pool) != 0) return HTTP_INTERNAL_SERVER_ERROR;
-    }
-  else /* use temporary file if not a partial transfer */ 
-    {
-      dirname = apr_pstrdup(r->pool, r->filename);
-      basename = rindex(dirname, '/');
-      if (basename == NULL) return HTTP_INTERNAL_SERVER_ERROR;
-        
-      *basename = '\0';
-      ++basename;
+       if ((old != NULL) || 
+           (apr_hash_count(listing_cache) < GRST_LISTING_CACHE_ENTRIES))
+         {
+           apr_hash_set(listing_cache, listing->path, APR_HASH_KEY_STRING, 
+                        listing);
+         }
+       else listing->retired = 1; /* cache full, freed after this request */
 
-      filename = apr_psprintf(r->pool,
-                             "%s/.grsttmp-%s-XXXXXX", dirname, basename);
+       listing_unlock();
+     }
 
-      if (apr_file_mktemp(&fp, filename,
-                    APR_CREATE | APR_WRITE | APR_BUFFERED | APR_EXCL, r->pool)
-                    != APR_SUCCESS) return HTTP_INTERNAL_SERVER_ERROR;
-/*
-      p = apr_table_get(r->headers_in, "Content-Length");
-      if (p != NULL) 
-        {
-          length = (apr_off_t) atol(p);
-          if (length > 16384)
-            {
-              if (apr_file_seek(fp, APR_SET, &length) == 0)
-                {
-                  block_length = 1;
-                  apr_file_write(fp, "0", &block_length);
-                }
+   apr_pool_cleanup_register(r->pool, listing, listing_release,
+                             apr_pool_cleanup_null);
+   return listing;
+}
 
-              apr_file_seek(fp, APR_SET, 0);
-            }
-        }
+static int json_sort_size(const void *a, const void *b)
+{
+   const grst_listing_stat *x = a, *y = b;
+   
+   if (x->statbuf.st_size < y->statbuf.st_size) return -1;
+   if (x->statbuf.st_size > y->statbuf.st_size) return  1;
+   return strverscmp(x->name, y->name);
+}
+
+static int json_sort_mtime(const void *a, const void *b)
+{
+   const grst_listing_stat *x = a, *y = b;
+   
+   if (x->statbuf.st_mtime < y->statbuf.st_mtime) return -1;
+   if (x->statbuf.st_mtime > y->statbuf.st_mtime) return  1;
+   return strverscmp(x->name, y->name);
+}
+
+static grst_listing_stat *listing_sorted(grst_listing *listing, int sort,
+                                         int dir_fd, int *count)
+/*
+    Get the entries of listing stat()ed and sorted by size (sort 1) or
+    mtime (sort 2). This is done once and kept with the listing, rather
+    than for every page. The array must not be modified or freed.
 */
-    }
+{
+   int                i, n, k = sort - 1;
+   grst_listing_stat *stats;
 
-  /* we force the permissions, rather than accept any existing ones */
+   listing_lock();
+   
+   if ((stats = listing->sorted[k]) != NULL)
+     {
+       *count = listing->nsorted[k];
+       listing_unlock();
+       return stats;
+     }
 
-  apr_file_perms_set(filename, conf->diskmode);
+   listing_unlock();
 
-  if (has_range)
-    {
-      if (apr_file_seek(fp, APR_SET, &range_start) != 0) 
-        {
-          retcode = HTTP_INTERNAL_SERVER_ERROR;
-          return retcode;
-        }
+   stats = malloc(sizeof(grst_listing_stat) * (listing->count + 1));
+   if (stats == NULL) return NULL;
 
-      length_to_send = range_end - range_start + 1;
-    }
+   for (i=0, n=0; i < listing->count; ++i)
+      {
+        stats[n].name = listing->names[i];
+        if (fstatat(dir_fd, stats[n].name, &(stats[n].statbuf), 0) == 0) ++n;
+      }
 
-  retcode = ap_setup_client_block(r, REQUEST_CHUNKED_DECHUNK);
-  if (retcode == OK)
-    {
-      if (has_range) length_sent = 0;
+   qsort(stats, n, sizeof(grst_listing_stat), 
+         (sort == 1) ? json_sort_size : json_sort_mtime);
 
-      if (ap_should_client_block(r))
-          while ((block_length = ap_get_client_block(r, buf, sizeof(buf))) > 0)
-            {
-              if (has_range && (length_sent + block_length > length_to_send))
-                {
-                  block_length = length_to_send - length_sent;
-                  is_done = 1;
-                }
+   listing_lock();
 
-              if (apr_file_write(fp, buf, &block_length) != 0) 
-                {
-                  retcode = HTTP_INTERNAL_SERVER_ERROR;
-                  break;
-                }
+   if (listing->sorted[k] == NULL) /* unless another thread got there first */
+     {
+       listing->sorted[k]  = stats;
+       listing->nsorted[k] = n;
+       listing->statted[k] = apr_time_now();
+     }
+   else
+     {
+       free(stats);
+       stats = listing->sorted[k];
+       n     = listing->nsorted[k];
+     }
 
-              if (has_range)
-                {
-                  if (is_done) break;
-                  else length_sent += block_length;
-                }
-            }
-      ap_set_content_length(r, 0);
-      ap_set_content_type(r, "text/html");
-    }
+   listing_unlock();
 
-  if ((apr_file_close(fp) != 0) || (retcode == HTTP_INTERNAL_SERVER_ERROR))
-    {
-      if (strcmp(filename, r->filename) != 0) remove(filename);
-      return HTTP_INTERNAL_SERVER_ERROR;
-    }
+   *count = n;
+   return stats;
+}
 
-  if ((strcmp(filename, r->filename) != 0) &&
-      (apr_file_rename(filename, r->filename, r->pool) != 0))
-      return HTTP_FORBIDDEN; /* best guess as to the problem ... */
+static char *get_query_arg(request_rec *r, const char *name)
+/*
+    Return the unescaped value of name=value in the query string, or NULL
+*/
+{
+   char   *args, *pair, *value, *last;
+   size_t  len = strlen(name);
 
-  if ((retcode == OK) && (stat_ret != 0))
-    {
-      retcode = HTTP_CREATED;
-      ap_custom_response(r, HTTP_CREATED, "");
-    }
+   if (r->args == NULL) return NULL;
 
-  return retcode;
+   args = apr_pstrdup(r->pool, r->args);
+
+   for (pair = apr_strtok(args, "&", &last); pair != NULL;
+        pair = apr_strtok(NULL, "&", &last))
+      {
+        if ((strncmp(pair, name, len) == 0) && (pair[len] == '='))
+          {
+            value = &pair[len + 1];
+            for (args = value; *args != '\0'; ++args) 
+                                        if (*args == '+') *args = ' ';
+                                        
+            if (ap_unescape_url(value) != OK) return NULL;
+            return value;
+          }
+      }
+
+   return NULL;
 }
 
-int http_delete_method(request_rec *r, mod_gridsite_dir_cfg *conf)
+static int json_wanted(request_rec *r)
+/*
+    JSON listings are requested by ?format=json or Accept: application/json
+*/
 {
-  ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-               "Try remove(%s)", r->filename);
+   const char *accept, *format;
 
-  if (remove(r->filename) != 0) return HTTP_FORBIDDEN;
-       
-  ap_set_content_length(r, 0);
-  ap_set_content_type(r, "text/html");
+   if ((format = get_query_arg(r, "format")) != NULL)
+                                       return (strcmp(format, "json") == 0);
 
-  return OK;
+   accept = apr_table_get(r->headers_in, "Accept");
+
+   return ((accept != NULL) && (ap_strstr_c(accept, "application/json")
+                                                                   != NULL));
 }
 
-int http_move_method(request_rec *r, mod_gridsite_dir_cfg *conf)
+static int utf8_length(const unsigned char *p)
+/*
+    Return the length of the valid UTF-8 sequence starting at p, or 0 if
+    it is not one (overlong forms, surrogates and values above U+10FFFF
+    are all invalid.)
+*/
 {
-  char *destination_translated = NULL;
-  
-  if (r->notes != NULL) destination_translated = 
-            (char *) apr_table_get(r->notes, "GRST_DESTINATION_TRANSLATED");
+   int i, len;
+   unsigned long c;
 
-  if (destination_translated == NULL) return HTTP_BAD_REQUEST;
-  
-  if (strcmp(r->filename, destination_translated) == 0)
-                                      return HTTP_FORBIDDEN;
-  
-  if (apr_file_rename(r->filename, destination_translated, r->pool) != 0)
-                                                       return HTTP_FORBIDDEN;
+   if      (p[0] < 0x80)           return 1;
+   else if ((p[0] & 0xe0) == 0xc0) { len = 2; c = p[0] & 0x1f; }
+   else if ((p[0] & 0xf0) == 0xe0) { len = 3; c = p[0] & 0x0f; }
+   else if ((p[0] & 0xf8) == 0xf0) { len = 4; c = p[0] & 0x07; }
+   else return 0;
 
-  ap_set_content_length(r, 0);
-  ap_set_content_type(r, "text/html");
+   for (i=1; i < len; ++i)
+      {
+        if ((p[i] & 0xc0) != 0x80) return 0; /* includes the final \0 */
+        c = (c << 6) | (p[i] & 0x3f);
+      }
 
-  return OK;
+   if (((len == 2) && (c < 0x80))  ||
+       ((len == 3) && (c < 0x800)) ||
+       ((len == 4) && (c < 0x10000)) ||
+       ((c >= 0xd800) && (c <= 0xdfff)) || (c > 0x10ffff)) return 0;
+
+   return len;
 }
 
-static int mod_gridsite_dir_handler(request_rec *r, mod_gridsite_dir_cfg *conf)
+static void json_puts(apr_bucket_brigade *bb, const char *str)
 /*
-   handler switch for directories
+    Write str as a JSON string, with quotes. Filenames need not be UTF-8,
+    so any byte which is not part of a valid sequence becomes U+FFFD.
 */
 {
-    /* *** is this a write method? only possible if  GridSiteAuth on *** */
+   const char *p;
+   char        esc[7];
+   int         len;
 
-    if (conf->auth)
+   apr_brigade_putc(bb, NULL, NULL, '"');
+
+   for (p = str; *p != '\0'; p += len)
       {
-        if ((r->method_number == M_PUT) && 
-            (conf->methods != NULL) &&
-            (strstr(conf->methods, " PUT "   ) != NULL))
-                                           return http_put_method(r, conf);
+        len = utf8_length((const unsigned char *) p);
 
-        if ((r->method_number == M_DELETE) &&
-            (conf->methods != NULL) &&
-            (strstr(conf->methods, " DELETE ") != NULL)) 
-                                           return http_delete_method(r, conf);
+        if (len == 0)
+          {
+            apr_brigade_puts(bb, NULL, NULL, "\\ufffd");
+            len = 1;
+          }
+        else if (len > 1) apr_brigade_write(bb, NULL, NULL, p, len);
+        else if ((*p == '"') || (*p == '\\'))
+          {
+            apr_brigade_putc(bb, NULL, NULL, '\\');
+            apr_brigade_putc(bb, NULL, NULL, *p);
+          }
+        else if ((unsigned char) *p < 0x20)
+          {
+            snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char) *p);
+            apr_brigade_write(bb, NULL, NULL, esc, 6);
+          }
+        else apr_brigade_putc(bb, NULL, NULL, *p);
       }
-      
-    /* *** directory listing? *** */
-    if ((r->method_number == M_GET) && (conf->indexes))       
-                       return html_dir_list(r, conf); /* directory listing */
-    
-    return DECLINED; /* *** nothing to see here, move along *** */
+
+   apr_brigade_putc(bb, NULL, NULL, '"');
 }
 
-static int mod_gridsite_nondir_handler(request_rec *r, mod_gridsite_dir_cfg *conf)
+int json_dir_list(request_rec *r, mod_gridsite_dir_cfg *conf)
 /*
-   one big handler switch for everything other than directories, since we 
-   might be responding to MIME * / * for local PUT, MOVE, COPY and DELETE, 
-   and GET inside ghost directories.
+    output JSON directory listing for clients and scripts, paged with
+    ?limit=N&marker=MARKER (next_marker from the previous page) and
+    sorted with ?sort=name|size|mtime&order=asc|desc. For sort=name the
+    marker is the last name of the previous page; for size and mtime it
+    is that entry's size or mtime, then /, then its name.
 */
 {
-    char *upgradeheader, *upgradespaced, *p;
-    const char *https_env;
+    int   i, n, first, step, limit = 0, dir_fd, sort = 0, isdir, lo, hi;
+    char  *p, *marker;
+    long  value;
+    apr_off_t length;
+    grst_listing      *listing;
+    grst_listing_stat *stats = NULL, *st, *last = NULL, onestat, markerstat;
+    int (*compare)(const void *, const void *) = NULL;
+    apr_bucket_brigade *bb;
 
-    /* *** is this a write method or GridHTTP HTTPS->HTTP redirection? 
-           only possible if  GridSiteAuth on *** */
-    
-    if (conf->auth)
+    if (r->finfo.filetype == APR_NOFILE) return HTTP_NOT_FOUND;
+
+    if ((p = get_query_arg(r, "limit")) != NULL) limit = atoi(p);
+    if (limit < 0) return HTTP_BAD_REQUEST;
+
+    if ((p = get_query_arg(r, "sort")) != NULL)
       {
-        if ((conf->gridhttp) &&
-            ((r->method_number == M_GET) || 
-             ((r->method_number == M_PUT) && 
-              (strstr(conf->methods, " PUT ") != NULL))) &&
-            ((upgradeheader = (char *) apr_table_get(r->headers_in,
-                                                     "Upgrade")) != NULL) &&
-            ((https_env=apr_table_get(r->subprocess_env,"HTTPS")) != NULL) &&
-            (strcasecmp(https_env, "on") == 0))
-          {
-            upgradespaced = apr_psprintf(r->pool, " %s ", upgradeheader);
+        if      (strcmp(p, "name")  == 0) sort = 0;
+        else if (strcmp(p, "size")  == 0) sort = 1;
+        else if (strcmp(p, "mtime") == 0) sort = 2;
+        else return HTTP_BAD_REQUEST;
+      }
 
-            for (p=upgradespaced; *p != '\0'; ++p)
-             if ((*p == ',') || (*p == '\t')) *p = ' ';
+    step = 1;
+    if ((p = get_query_arg(r, "order")) != NULL)
+      {
+        if      (strcmp(p, "asc")  == 0) step = 1;
+        else if (strcmp(p, "desc") == 0) step = -1;
+        else return HTTP_BAD_REQUEST;
+      }
 
-// TODO: what if we're pointing at a CGI or some dynamic content???
- 
-            if (strstr(upgradespaced, " GridHTTP/1.0 ") != NULL)
-                                            return http_gridhttp(r, conf);
-          }
+    marker = get_query_arg(r, "marker");
 
-        if ((r->method_number == M_PUT) && 
-            (conf->methods != NULL) &&
-            (strstr(conf->methods, " PUT "   ) != NULL))
-                                           return http_put_method(r, conf);
+    if ((sort != 0) && (marker != NULL) && (*marker != '\0'))
+      {
+        /* the marker is the sort key of the last entry sent: VALUE/NAME */
+        if ((sscanf(marker, "%ld/", &value) != 1) ||
+            ((p = index(marker, '/')) == NULL)) return HTTP_BAD_REQUEST;
+
+        memset(&markerstat, 0, sizeof(markerstat));
+        markerstat.name = &p[1];
+        if (sort == 1) markerstat.statbuf.st_size  = (off_t)  value;
+        else           markerstat.statbuf.st_mtime = (time_t) value;
+      }
 
-        if ((r->method_number == M_DELETE) &&
-            (conf->methods != NULL) &&
-            (strstr(conf->methods, " DELETE ") != NULL)) 
-                                           return http_delete_method(r, conf);
+    if ((listing = listing_get(r, conf)) == NULL) 
+                                       return HTTP_INTERNAL_SERVER_ERROR;
 
-        if ((r->method_number == M_MOVE) &&
-            (conf->methods != NULL) &&
-            (strstr(conf->methods, " MOVE ") != NULL)) 
-                                           return http_move_method(r, conf);
-      }
+    if ((dir_fd = open(r->filename, O_RDONLY | O_DIRECTORY)) == -1)
+                                       return HTTP_INTERNAL_SERVER_ERROR;
 
-    /* *** check if a special ghost admin CGI *** */
-      
-    if (conf->adminfile && conf->adminuri &&
-        (strlen(r->filename) > strlen(conf->adminfile) + 1) &&
-        (strcmp(&(r->filename[strlen(r->filename) - strlen(conf->adminfile)]),
-                                                    conf->adminfile) == 0) &&
-        (r->filename[strlen(r->filename)-strlen(conf->adminfile)-1] == '/') &&
-        ((r->method_number == M_POST) ||
-         (r->method_number == M_GET))) 
+    /* sorting by size or mtime needs all the entries stat()ed */
+
+    if (sort != 0)
       {
-        ap_internal_redirect(conf->adminuri, r);
-        return OK;
-      }
-      
-    /* *** finally look for .html files that we should format *** */
+        if ((stats = listing_sorted(listing, sort, dir_fd, &n)) == NULL)
+          {
+            close(dir_fd);
+            return HTTP_INTERNAL_SERVER_ERROR;
+          }
 
-    if ((conf->format) &&  /* conf->format set by  GridSiteHtmlFormat on */ 
-        (strlen(r->filename) > 5) &&
-        (strcmp(&(r->filename[strlen(r->filename)-5]), ".html") == 0) &&
-        (r->method_number == M_GET)) return html_format(r, conf);
-     
-    return DECLINED; /* *** nothing to see here, move along *** */
-}
+        compare = (sort == 1) ? json_sort_size : json_sort_mtime;
+      }
+    else n = listing->count;
 
-static void recurse4dirlist(char *dirname, time_t *dirs_time,
-                             char *fulluri, int fullurilen,
-                             char *encfulluri, int enclen,
-                             request_rec *r, char **body,
-                             int recurse_level)
-/* try to find DN Lists in dir[] and its subdirs that match the fulluri[]
-   prefix. add blobs of HTML to body as they are found. */
-{
-   char          *unencname, modified[99], *oneline, *d_namepath,
-                 *mildencoded;
-   DIR           *oneDIR;
-   struct dirent *onedirent;
-   struct tm      mtime_tm;
-   struct stat    statbuf;
+    /* find where this page starts */
 
-   if ((stat(dirname, &statbuf) != 0) ||
-       (!S_ISDIR(statbuf.st_mode)) ||
-       ((oneDIR = opendir(dirname)) == NULL)) return;
+    first = (step == 1) ? 0 : n - 1;
 
-   if (statbuf.st_mtime > *dirs_time) *dirs_time = statbuf.st_mtime;
+    if ((marker != NULL) && (*marker != '\0'))
+      {
+        if (sort == 0) /* names are sorted, so can binary search */
+          {
+            lo = 0;
+            hi = n;
+            
+            while (lo < hi)
+                 {
+                   i = (lo + hi) / 2;
+                   if (strverscmp(listing->names[i], marker) <= 0) lo = i + 1;
+                   else hi = i;
+                 }
 
-   while ((onedirent = readdir(oneDIR)) != NULL)
-        {
-          if (onedirent->d_name[0] == '.') continue;
-        
-          d_namepath = apr_psprintf(r->pool, "%s/%s", dirname, onedirent->d_name);
+            /* lo is now the first name after marker */
+            if (step == 1) first = lo;
+            else
+              {
+                for (first = lo - 1; (first >= 0) && 
+                     (strverscmp(listing->names[first], marker) >= 0); --first) ;
+              }
+          }
+        else /* so are the stats, and the marker need not still exist */
+          {
+            lo = 0;
+            hi = n;
+            
+            while (lo < hi)
+                 {
+                   i = (lo + hi) / 2;
+                   if (compare(&stats[i], &markerstat) <= 0) lo = i + 1;
+                   else hi = i;
+                 }
 
-          if (stat(d_namepath, &statbuf) != 0) continue;
+            if (step == 1) first = lo;
+            else
+              {
+                for (first = lo - 1; (first >= 0) && 
+                     (compare(&stats[first], &markerstat) >= 0); --first) ;
+              }
+          }
+      }
 
-          if (S_ISDIR(statbuf.st_mode))
-            {
-              if (recurse_level < GRST_RECURS_LIMIT)
-                 recurse4dirlist(d_namepath, dirs_time, fulluri,
-                                 fullurilen, encfulluri, enclen, 
-                                 r, body, recurse_level + 1);
-            }
-          else if ((strncmp(onedirent->d_name, encfulluri, enclen) == 0) &&
-                   (onedirent->d_name[strlen(onedirent->d_name) - 1] != '~'))
-            {
-              unencname = GRSThttpUrlDecode(onedirent->d_name);
-                    
-              if (strncmp(unencname, fulluri, fullurilen) == 0)
-                {
-                  if (statbuf.st_mtime > *dirs_time) 
-                                                *dirs_time = statbuf.st_mtime;
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
 
-                  localtime_r(&(statbuf.st_mtime), &mtime_tm);
-                  strftime(modified, sizeof(modified), 
-              "<td align=right>%R</td><td align=right>%e&nbsp;%b&nbsp;%y</td>",
-                       &mtime_tm);
-                  
-                  mildencoded = GRSThttpUrlMildencode(&unencname[fullurilen]);
-                 
-                  oneline = apr_psprintf(r->pool,
-                                     "<tr><td><a href=\"%s\" "
-                                     "content-length=\"%ld\" "
-                                     "last-modified=\"%ld\">"
-                                     "%s</a></td>"
-                                     "<td align=right>%ld</td>%s</tr>\n", 
-                                     mildencoded, statbuf.st_size, 
-                                     statbuf.st_mtime, 
-                                     html_escape(r->pool, unencname), 
-                                     statbuf.st_size, modified);
+    apr_brigade_puts(bb, NULL, NULL, "{\"directory\":");
+    json_puts(bb, r->uri);
+    apr_brigade_puts(bb, NULL, NULL, ",\"entries\":[");
 
-                  free(mildencoded);
+    for (i = first, marker = NULL; (i >= 0) && (i < n); i += step)
+       {
+         if (sort != 0) st = &stats[i];
+         else
+           {
+             st = &onestat;
+             st->name = listing->names[i];
+             if (fstatat(dir_fd, st->name, &(st->statbuf), 0) != 0) continue;
+           }
 
-                  *body = apr_pstrcat(r->pool, *body, oneline, NULL);
-                }      
-                      
-              free(unencname); /* libgridsite doesnt use pools */
-            }
-        }
-        
-   closedir(oneDIR);
-}
+         isdir = S_ISDIR(st->statbuf.st_mode);
 
-static int mod_gridsite_dnlistsuri_dir_handler(request_rec *r, 
-                                               mod_gridsite_dir_cfg *conf)
-/*
-    virtual DN-list file lister: make all DN lists on the dn-lists
-    path of this server appear to be in the dn-lists directory itself
-    (ie where they appear in the DN lists path doesnt matter, as long
-    as their name matches)
-*/
-{
-    int            enclen, fullurilen, fd;
-    char          *fulluri, *encfulluri, *dn_list_ptr, *dirname,
-                  *body, *oneline, *p, *s,
-                  *head_formatted, *header_formatted, *footer_formatted,
-                  *permstr = NULL;
-    struct stat    statbuf;
-    size_t         length;
-    time_t         dirs_time = 0;
-    GRSTgaclPerm   perm = GRST_PERM_NONE;
-        
-    if (r->notes != NULL)
-           permstr = (char *) apr_table_get(r->notes, "GRST_PERM");
+         apr_brigade_puts(bb, NULL, NULL, (marker == NULL) ? "\n{\"name\":" 
+                                                           : ",\n{\"name\":");
+         json_puts(bb, st->name);
+         apr_brigade_printf(bb, NULL, NULL, 
+                  ",\"type\":\"%s\",\"size\":%" APR_OFF_T_FMT ",\"mtime\":%ld}",
+                  isdir ? "directory" : "file", 
+                  (apr_off_t) st->statbuf.st_size, (long) st->statbuf.st_mtime);
 
-    if (permstr != NULL) sscanf(permstr, "%d", &perm);
+         marker = st->name;
+         last   = st;
 
-    fulluri = apr_psprintf(r->pool, "https://%s%s",
-                                    r->hostname, conf->dnlistsuri);
-    fullurilen = strlen(fulluri);
+         if ((limit > 0) && (--limit == 0)) 
+           {
+             i += step;
+             break;
+           }
+       }
 
-    encfulluri = GRSThttpUrlEncode(fulluri);
-    enclen     = strlen(encfulluri);
+    close(dir_fd);
 
-    if (conf->dnlists != NULL) p = conf->dnlists;
-    else p = getenv("GRST_DN_LISTS");
+    apr_brigade_puts(bb, NULL, NULL, "\n]");
 
-    if (p == NULL) p = GRST_DN_LISTS;
-    dn_list_ptr = apr_pstrdup(r->pool, p);
+    if ((i >= 0) && (i < n) && (marker != NULL))
+      {
+        /* more entries remain, so give the marker for the next page */
+        apr_brigade_puts(bb, NULL, NULL, ",\"truncated\":true,\"next_marker\":");
+
+        if (sort == 0) json_puts(bb, marker);
+        else json_puts(bb, apr_psprintf(r->pool, "%ld/%s", 
+                                    (sort == 1) ? (long) last->statbuf.st_size
+                                              : (long) last->statbuf.st_mtime,
+                                    last->name));
+      }
+    else apr_brigade_puts(bb, NULL, NULL, ",\"truncated\":false");
+    
+    apr_brigade_puts(bb, NULL, NULL, "}\n");
 
-    head_formatted = apr_psprintf(r->pool, 
-      "<head><title>Directory listing %s</title></head>\n", r->uri);
+    apr_brigade_length(bb, 1, &length);
 
-    if (conf->format)
-      {
-        /* **** try to find a header file in this or parent directories **** */
+    ap_set_content_length(r, length);
+    ap_set_content_type(r, "application/json");
 
-        fd = -1;
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+    ap_pass_brigade(r->output_filters, bb);
 
-        if (conf->headfile[0] == '/') /* try absolute */
-          {
-            fd = open(conf->headfile, O_RDONLY);
-          }
-        else /* try relative */
-          {
-            /* first make a buffer big enough to hold path names we want to try */
-            s = malloc(strlen(r->filename) + strlen(conf->headfile) + 1);
-            strcpy(s, r->filename);
-    
-            for (;;)
-               {
-                 p = rindex(s, '/');
-                 if (p == NULL) break; /* failed to find one */
-                 p[1] = '\0';
-                 strcat(p, conf->headfile);
-    
-                 fd = open(s, O_RDONLY);
-                 if (fd != -1) break; /* found one */
+    return OK;
+}
 
-                 *p = '\0';
-               }
-            
-             free(s);
-           }
-           
-        if (fd == -1) /* not found, so set up to output sensible default */
-          {
-            header_formatted = apr_pstrdup(r->pool, "<body bgcolor=white>");
-          }
-        else /* found a header file, so set up head and body to surround it */
-          {
-            fstat(fd, &statbuf);
-            header_formatted = apr_palloc(r->pool, statbuf.st_size + 1);
-            read(fd, header_formatted, statbuf.st_size);
-            header_formatted[statbuf.st_size] = '\0';
-            close(fd);
-          }
-      }
-    else header_formatted = apr_pstrdup(r->pool, "<body bgcolor=white>");
-            
-    body = apr_psprintf(r->pool, 
-      "<h1>Directory listing %s</h1>\n<table>", r->uri);
+#ifdef GRST_AP_SOCACHE
+static apr_status_t sessionsstore_destroy(void *data)
+{
+   if ((sessionsstore_provider != NULL) && (sessionsstore != NULL))
+     sessionsstore_provider->destroy(sessionsstore, (server_rec *) data);
 
-    if ((r->uri)[1] != '\0')
-     body = apr_pstrcat(r->pool, body, 
-       "<tr><td>[<a href=\"../\">Parent directory</a>]</td></tr>\n",
-       NULL);
+   return APR_SUCCESS;
+}
+#endif
 
-    while ((dirname = strsep(&dn_list_ptr, ":")) != NULL)
-        recurse4dirlist(dirname, &dirs_time, fulluri, fullurilen,
-                                 encfulluri, enclen, r, &body, 0);
+static void sessionsstore_init(apr_pool_t *pPool, server_rec *main_server)
+/*
+    Initialise the shared object cache given by GridSiteSessionsStore, if
+    any. On failure we fall back to files in GridSiteSessionsDir.
+*/
+{
+#ifdef GRST_AP_SOCACHE
+   apr_status_t status;
+   struct ap_socache_hints hints;
 
-    p = (char *) apr_table_get(r->subprocess_env, "HTTPS");
-    if ((p != NULL) && (strcmp(p, "on") == 0))
-      {
-        oneline = apr_psprintf(r->pool,
-           "<form action=\"%s%s\" method=post>\n"
-           "<input type=hidden name=cmd value=managednlists>"
-           "<tr><td colspan=4 align=center><small><input type=submit "
-           "value=\"Manage DN lists\"></small></td></tr></form>\n",
-           r->uri, conf->adminfile);
-          
-        body = apr_pstrcat(r->pool, body, oneline, NULL);
-      }
+   sessionsstore_mutex = NULL;
 
-    body = apr_pstrcat(r->pool, body, "</table>\n", NULL);
+   if ((sessionsstore_provider == NULL) || (sessionsstore == NULL)) return;
 
-    free(encfulluri); /* libgridsite doesnt use pools */
+   if ((sessionsstore_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) &&
+       (((status = apr_global_mutex_create(&sessionsstore_mutex, NULL, 
+                                 APR_LOCK_DEFAULT, pPool)) != APR_SUCCESS) ||
+        ((status = ap_unixd_set_global_mutex_perms(sessionsstore_mutex)) 
+                                                            != APR_SUCCESS)))
+     {
+       ap_log_error(APLOG_MARK, APLOG_ERR, status, main_server,
+              "mod_gridsite: Failed to create sessions store mutex, "
+              "using files in %s instead", sessionsdir);
+       sessionsstore_mutex = NULL;
+       sessionsstore       = NULL;
+       return;
+     }
 
-    if (conf->format)
-      {
-        /* **** try to find a footer file in this or parent directories **** */
+   hints.avg_id_len      = 2 * SSL_MAX_SSL_SESSION_ID_LENGTH + 9;
+   hints.avg_obj_size    = 1024;
+   hints.expiry_interval = apr_time_from_sec(30);
 
-        fd = -1;
+   if ((status = sessionsstore_provider->init(sessionsstore, "mod_gridsite",
+                          &hints, main_server, pPool)) != APR_SUCCESS)
+     {
+       ap_log_error(APLOG_MARK, APLOG_ERR, status, main_server,
+              "mod_gridsite: Failed to initialise %s sessions store, "
+              "using files in %s instead", 
+              sessionsstore_provider->name, sessionsdir);
+       sessionsstore = NULL;
+       return;
+     }
 
-        if (conf->headfile[0] == '/') /* try absolute */
-          {
-            fd = open(conf->headfile, O_RDONLY);
-          }
-        else /* try relative */
-          {
-            /* first make a buffer big enough to hold path names we want to try */
-            s  = malloc(strlen(r->filename) + strlen(conf->footfile));
-            strcpy(s, r->filename);
-    
-            for (;;)
-               {
-                 p = rindex(s, '/');
-                 if (p == NULL) break; /* failed to find one */
+   apr_pool_cleanup_register(pPool, main_server, sessionsstore_destroy,
+                             apr_pool_cleanup_null);
 
-                 p[1] = '\0';
-                 strcat(p, conf->footfile);
-    
-                 fd = open(s, O_RDONLY);
-                 if (fd != -1) break; /* found one */
+   ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, main_server,
+          "mod_gridsite: sessions store is %s", sessionsstore_provider->name);
+#endif
+}
 
-                 *p = '\0';
-               }
-            
-            free(s);
-          }
+static apr_status_t sessionsstore_put(server_rec *s, const char *key,
+                                      const char *value, apr_time_t expiry,
+                                      apr_pool_t *pool)
+/*
+    Store value under key in the sessions store until expiry. Returns
+    APR_ENOTIMPL if no store is configured, so callers use files instead.
+*/
+{
+#ifdef GRST_AP_SOCACHE
+   apr_status_t status;
+   size_t       len = strlen(value);
 
-        if (fd == -1) /* failed to find a footer, so use standard default */
-          {
-            footer_formatted = apr_pstrdup(r->pool, "</body>");
-          }
-        else /* found a footer, so set up to use it */
-          {
-            fstat(fd, &statbuf);
-            footer_formatted = apr_palloc(r->pool, statbuf.st_size + 1);
-            read(fd, footer_formatted, statbuf.st_size);
-            footer_formatted[statbuf.st_size] = '\0';
-            close(fd);
-          }
-      }
-    else footer_formatted = apr_pstrdup(r->pool, "</body>");
+   if (sessionsstore == NULL) return APR_ENOTIMPL;
+   
+   if (len + 1 > GRST_SESSIONS_STORE_MAXDATA) return APR_ENOSPC;
 
-    /* **** can now calculate the Content-Length and output headers **** */
-      
-    length = strlen(head_formatted) + strlen(header_formatted) + 
-             strlen(body) + strlen(footer_formatted);
+   if ((sessionsstore_mutex != NULL) &&
+       (apr_global_mutex_lock(sessionsstore_mutex) != APR_SUCCESS))
+     return APR_EGENERAL;
 
-    ap_set_content_length(r, length);
-    r->mtime = apr_time_from_sec(dirs_time);
-    ap_set_last_modified(r);
-    ap_set_content_type(r, "text/html");
+   status = sessionsstore_provider->store(sessionsstore, s,
+                     (const unsigned char *) key, strlen(key), expiry,
+                     (unsigned char *) value, len + 1, pool);
 
-    /* ** output the HTTP body (HTML Head+Body) ** */
-    ap_rputs(head_formatted,   r);
-    ap_rputs(header_formatted, r);
-    ap_rputs(body,		   r);
-    ap_rputs(footer_formatted, r);
+   if (sessionsstore_mutex != NULL) 
+     apr_global_mutex_unlock(sessionsstore_mutex);
 
-    return OK;
+   return status;
+#else
+   return APR_ENOTIMPL;
+#endif
 }
 
-static char *recurse4file(char *dir, char *file, apr_pool_t *pool, 
-                          int recurse_level)
-/* try to find file[] in dir[]. try subdirs if not found.
-   return full path to first found version or NULL on failure */
+static apr_status_t sessionsstore_get(server_rec *s, const char *key,
+                                      char **value, apr_pool_t *pool)
+/*
+    Retrieve the value stored under key into *value, allocated from pool.
+    Returns APR_ENOTIMPL if no store is configured, APR_NOTFOUND if the
+    key is not present (or has expired.)
+*/
 {
-    char          *fullfilename, *fulldirname;
-    struct stat    statbuf;
-    DIR           *dirDIR;
-    struct dirent *file_ent;
+#ifdef GRST_AP_SOCACHE
+   apr_status_t  status;
+   unsigned int  len = GRST_SESSIONS_STORE_MAXDATA;
+   unsigned char *buf;
 
-    /* try to find in current directory */
+   if (sessionsstore == NULL) return APR_ENOTIMPL;
 
-    fullfilename = apr_psprintf(pool, "%s/%s", dir, file);
+   buf = apr_palloc(pool, len);
 
-    if (stat(fullfilename, &statbuf) == 0) return fullfilename;
+   if ((sessionsstore_mutex != NULL) &&
+       (apr_global_mutex_lock(sessionsstore_mutex) != APR_SUCCESS))
+     return APR_EGENERAL;
 
-    /* maybe search in subdirectories */
+   status = sessionsstore_provider->retrieve(sessionsstore, s,
+                     (const unsigned char *) key, strlen(key),
+                     buf, &len, pool);
 
-    if (recurse_level >= GRST_RECURS_LIMIT) return NULL;
+   if (sessionsstore_mutex != NULL) 
+     apr_global_mutex_unlock(sessionsstore_mutex);
 
-    dirDIR = opendir(dir);
+   if (status != APR_SUCCESS) return status;
 
-    if (dirDIR == NULL) return NULL;
+   if ((len == 0) || (buf[len - 1] != '\0')) return APR_NOTFOUND;
 
-    while ((file_ent = readdir(dirDIR)) != NULL)
-       {
-         if (file_ent->d_name[0] == '.') continue;
+   *value = (char *) buf;
+   return APR_SUCCESS;
+#else
+   return APR_ENOTIMPL;
+#endif
+}
 
-         fulldirname = apr_psprintf(pool, "%s/%s", dir, file_ent->d_name);
-         if ((stat(fulldirname, &statbuf) == 0) &&
-             S_ISDIR(statbuf.st_mode) &&
-             ((fullfilename = recurse4file(fulldirname, file,
-                                           pool, recurse_level + 1)) != NULL))
-           {
-             closedir(dirDIR);
-             return fullfilename;
-           }
-       }
+static apr_status_t sessionsstore_remove(server_rec *s, const char *key,
+                                         apr_pool_t *pool)
+/*
+    Remove key from the sessions store. Returns APR_ENOTIMPL if no store
+    is configured.
+*/
+{
+#ifdef GRST_AP_SOCACHE
+   apr_status_t status;
 
-    closedir(dirDIR);
+   if (sessionsstore == NULL) return APR_ENOTIMPL;
 
-    return NULL;
+   if ((sessionsstore_mutex != NULL) &&
+       (apr_global_mutex_lock(sessionsstore_mutex) != APR_SUCCESS))
+     return APR_EGENERAL;
+
+   status = sessionsstore_provider->remove(sessionsstore, s,
+                     (const unsigned char *) key, strlen(key), pool);
+
+   if (sessionsstore_mutex != NULL) 
+     apr_global_mutex_unlock(sessionsstore_mutex);
+
+   return status;
+#else
+   return APR_ENOTIMPL;
+#endif
 }
 
-static int mod_gridsite_dnlistsuri_handler(request_rec *r, 
-                                           mod_gridsite_dir_cfg *conf)
+static apr_time_t sessionsstore_expiry(server_rec *s)
 /*
-    virtual DN-list file generator
+    SSL session creds are kept as long as mod_ssl keeps the session
 */
 {
-    int          fd;
-    char        *fulluri, *encfulluri, *dn_list_ptr, *filename, *dirname, *p,
-                *buf;
-    struct stat  statbuf;
-    
-    /* *** check if a special ghost admin CGI *** */
-      
-    if (conf->adminfile && conf->adminuri &&
-        (strlen(r->filename) > strlen(conf->adminfile) + 1) &&
-        (strcmp(&(r->filename[strlen(r->filename) - strlen(conf->adminfile)]),
-                                                    conf->adminfile) == 0) &&
-        (r->filename[strlen(r->filename)-strlen(conf->adminfile)-1] == '/') &&
-        ((r->method_number == M_POST) ||
-         (r->method_number == M_GET))) 
+   SSLSrvConfigRec *sc = ap_get_module_config(s->module_config, &ssl_module);
+
+   if ((sc != NULL) && (sc->session_cache_timeout > 0))
+     return apr_time_now() + apr_time_from_sec(sc->session_cache_timeout);
+
+   return apr_time_now() + apr_time_from_sec(300);
+}
+
+char *make_passcode_file(request_rec *r, mod_gridsite_dir_cfg *conf, 
+                         char *path, apr_time_t expires_time)
+/*
+    Make a new passcode for the creds in the connection notes, in the
+    sessions store if we have one or else in a passcode-* file, and
+    return the passcode cookie value.
+*/
+{
+    int           i;
+    char         *filetemplate, *notename_i, *grst_cred_i, *cookievalue=NULL,
+                 *record;
+    apr_uint64_t  gridauthcookie;
+    apr_uint32_t  gridauthsuffix;
+    apr_file_t   *fp;
+    apr_status_t  status;
+
+    /* create random for use in GRIDHTTP_PASSCODE cookies and file name */
+
+    if (apr_generate_random_bytes((char *) &gridauthcookie, 
+                                  sizeof(gridauthcookie))
+         != APR_SUCCESS) return NULL;
+
+    record = (expires_time > 0) ? apr_psprintf(r->pool, "expires=%lu\n",
+                                    (time_t) apr_time_sec(expires_time)) : "";
+
+    record = apr_psprintf(r->pool, "%sdomain=%s\npath=%s\n", 
+                                   record, r->hostname, path);
+
+    for (i=0; ; ++i)
+       {
+         notename_i = apr_psprintf(r->pool, "GRST_CRED_AURI_%d", i);
+         if (grst_cred_i = (char *)
+                           apr_table_get(r->connection->notes, notename_i))
+           {
+             record = apr_psprintf(r->pool, "%s%s=%s\n", 
+                                            record, notename_i, grst_cred_i);
+           }
+         else break; /* GRST_CRED_AURI_i are numbered consecutively */
+
+         notename_i = apr_psprintf(r->pool, "GRST_CRED_VALID_%d", i);
+         if (grst_cred_i = (char *)
+                           apr_table_get(r->connection->notes, notename_i))
+           {
+             record = apr_psprintf(r->pool, "%s%s=%s\n", 
+                                            record, notename_i, grst_cred_i);
+           }
+         else break; /* GRST_CRED_VALID_i are numbered consecutively */
+       }
+
+    /* passcodes in the sessions store expire by themselves */
+
+    if (apr_generate_random_bytes((char *) &gridauthsuffix, 
+                                  sizeof(gridauthsuffix)) == APR_SUCCESS)
       {
-        ap_internal_redirect(conf->adminuri, r);
-        return OK;
+        cookievalue = apr_psprintf(r->pool, "%016lx%08x", 
+                                   gridauthcookie, gridauthsuffix);
+
+        if (sessionsstore_put(r->server,
+                apr_pstrcat(r->pool, "passcode-", cookievalue, NULL), record,
+                (expires_time > 0) ? expires_time : apr_time_now() + 
+                        apr_time_from_sec(GRST_PASSCODE_STORE_EXPIRY),
+                r->pool) == APR_SUCCESS)
+          {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                         "Stored passcode %s", cookievalue);
+            return cookievalue;
+          }
+      }
+
+    filetemplate = apr_psprintf(r->pool, "%s/passcode-%016lxXXXXXX", 
+     ap_server_root_relative(r->pool,
+     sessionsdir),
+     gridauthcookie);
+
+    if (apr_file_mktemp(&fp, 
+                        filetemplate, 
+                        APR_CREATE | APR_WRITE | APR_EXCL,
+                        r->pool)
+                      != APR_SUCCESS) return NULL;
+                      
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+               "Created passcode file %s", filetemplate);
+
+    status = apr_file_puts(record, fp);
+
+    if ((apr_file_close(fp) != APR_SUCCESS) || (status != APR_SUCCESS))
+      {
+        apr_file_remove(filetemplate, r->pool); /* try to clean up */
+        return NULL;
       }
       
-    if (r->uri[strlen(r->uri) - 1] == '/') 
+    cookievalue = rindex(filetemplate, '-');
+    if (cookievalue != NULL) 
       {
-        apr_table_setn(r->headers_out, apr_pstrdup(r->pool, "Location"), 
-                                       apr_pstrdup(r->pool, conf->dnlistsuri));
-
-        r->status = HTTP_MOVED_TEMPORARILY;
-        return OK;                   
+        ++cookievalue;
+        return cookievalue;
       }
+    else return NULL;
+}
 
-    fulluri = apr_psprintf(r->pool, "https://%s%s", 
-                                    r->hostname, r->uri);
+int http_gridhttp(request_rec *r, mod_gridsite_dir_cfg *conf)
+{ 
+    char        *httpurl, *cookievalue, expires_str[APR_RFC822_DATE_LEN];
+    apr_time_t   expires_time;
 
-    encfulluri = GRSThttpUrlEncode(fulluri);
+    /* passcode cookies are valid for only 5 mins! */
+    expires_time = apr_time_now() + apr_time_from_sec(300);
+
+    /* try to generate passcode and make passcode file */
+    cookievalue = make_passcode_file(r, conf, r->uri, expires_time);
     
-    if (conf->dnlists != NULL) p = conf->dnlists;
-    else p = getenv("GRST_DN_LISTS");
- 
-    if (p == NULL) p = GRST_DN_LISTS;
-    dn_list_ptr = apr_pstrdup(r->pool, p);
+    if (cookievalue == NULL) return HTTP_INTERNAL_SERVER_ERROR;
+    
+    /* send redirection header back to client */
+       
+    apr_rfc822_date(expires_str, expires_time);
 
-    while ((dirname = strsep(&dn_list_ptr, ":")) != NULL)
-       {
-         filename = recurse4file(dirname, encfulluri, r->pool, 0);
+    apr_table_add(r->headers_out, 
+                  apr_pstrdup(r->pool, "Set-Cookie"),
+                  apr_psprintf(r->pool,
+                  "GRIDHTTP_PASSCODE=%s; "
+                  "expires=%s; "
+                  "domain=%s; "
+                  "path=%s",
+                  cookievalue, expires_str, r->hostname, r->uri));
 
-         if (filename == NULL) continue;
-    
-         fd = open(filename, O_RDONLY);
+    if (gridhttpport != DEFAULT_HTTP_PORT)
+         httpurl = apr_psprintf(r->pool, "http://%s:%d%s", r->hostname,
+                                gridhttpport, ap_escape_uri(r->pool, r->uri));
+    else httpurl = apr_pstrcat(r->pool, "http://", r->hostname,
+                                ap_escape_uri(r->pool, r->uri), NULL);
 
-         if (fd == -1) continue;
+    apr_table_setn(r->headers_out, apr_pstrdup(r->pool, "Location"), httpurl);
 
-         fstat(fd, &statbuf);         
-         ap_set_content_length(r, (apr_off_t) statbuf.st_size);
-         r->mtime = apr_time_from_sec(statbuf.st_mtime);
-         ap_set_content_type(r, "text/plain");
-         ap_set_last_modified(r);
+    r->status = HTTP_MOVED_TEMPORARILY;  
+    return OK;
+}
 
-         buf = apr_palloc(r->pool, statbuf.st_size + 1);
-         read(fd, buf, statbuf.st_size);
-         buf[statbuf.st_size] = '\0';
-            
-         ap_rputs(buf, r);
+typedef struct
+{
+   char   *buf;
+   size_t  size;
+}  grst_put_buffer; /* aligned PUT buffer reused within one connection */
 
-         close(fd);
+static apr_status_t put_buffer_free(void *data)
+/*
+    Connection pool cleanup, run once the keep-alive connection is closed
+*/
+{
+  grst_put_buffer *putbuf = (grst_put_buffer *) data;
 
-         return OK;
-       }
+  free(putbuf->buf);
+  putbuf->buf  = NULL;
+  putbuf->size = 0;
 
-    return HTTP_NOT_FOUND;
+  return APR_SUCCESS;
 }
 
-static void *create_gridsite_srv_config(apr_pool_t *p, server_rec *s)
+static char *put_buffer(request_rec *r, size_t size)
+/* return an aligned buffer of at least size bytes, shared by all the
+   PUTs sent over the same keep-alive connection. A larger request
+   replaces the old buffer rather than adding to it. NULL on failure. */
 {
-    int i;
+  void            *data = NULL;
+  grst_put_buffer *putbuf;
 
-    /* only run once (in base server) */
-    if (!(s->is_virtual) && (gridhttpport == 0))
-      {
-        gridhttpport = GRST_HTTP_PORT;
-      
-        sessionsdir = apr_pstrdup(p, GRST_SESSIONS_DIR);
-                                      /* GridSiteSessionsDir dir-path   */
+  apr_pool_userdata_get(&data, "grst-put-buffer", r->connection->pool);
+  putbuf = (grst_put_buffer *) data;
 
-        sitecastdnlists = NULL;
+  if ((putbuf != NULL) && (putbuf->size >= size)) return putbuf->buf;
 
-        sitecastgroups[0].port  = GRST_HTCP_PORT;
-                                      /* GridSiteCastUniPort udp-port */
+  if (putbuf == NULL)
+    {
+      putbuf = apr_pcalloc(r->connection->pool, sizeof(grst_put_buffer));
+      apr_pool_userdata_set(putbuf, "grst-put-buffer", NULL,
+                            r->connection->pool);
+      apr_pool_cleanup_register(r->connection->pool, putbuf, put_buffer_free,
+                                apr_pool_cleanup_null);
+    }
 
-        for (i=1; i <= GRST_SITECAST_GROUPS; ++i)
-           {
-             sitecastgroups[i].port = 0; /* GridSiteCastGroup mcast-list */
-           }
+  put_buffer_free(putbuf);
 
-        for (i=0; i < GRST_SITECAST_ALIASES; ++i)
-           {
-             sitecastaliases[i].sitecast_url   = NULL;
-             sitecastaliases[i].port           = 0;
-             sitecastaliases[i].scheme         = NULL;
-             sitecastaliases[i].local_path     = NULL;
-             sitecastaliases[i].local_hostname = NULL;
-           }                              /* GridSiteCastAlias url path */
-      }
+  if (posix_memalign((void **) &(putbuf->buf), GRST_PUT_ALIGN, size) != 0)
+    {
+      putbuf->buf = NULL;
+      return NULL;
+    }
 
-    return NULL;
+  putbuf->size = size;
+
+  return putbuf->buf;
 }
 
-static void *create_gridsite_dir_config(apr_pool_t *p, char *path)
+static int put_write_block(int fd, const char *buf, size_t length,
+                           apr_off_t offset, int *direct)
+/* write all of buf at offset, dropping O_DIRECT for a short final block
+   or if the filesystem turns out not to support it */
 {
-    mod_gridsite_dir_cfg *conf = apr_palloc(p, sizeof(*conf));
+  ssize_t n;
+  int     flags;
 
-    if (path == NULL) /* set up document root defaults */
-      {
-        conf->auth          = 0;     /* GridSiteAuth          on/off       */
-        conf->autopasscode  = 1;     /* GridSiteAutoPasscode  on/off       */
-        conf->requirepasscode = 0;   /* GridSiteRequirePasscode on/off     */
-        conf->zoneslashes   = 1;     /* GridSiteZoneSlashes   number       */
-        conf->envs          = 1;     /* GridSiteEnvs          on/off       */
-        conf->format        = 0;     /* GridSiteHtmlFormat    on/off       */
-        conf->indexes       = 0;     /* GridSiteIndexes       on/off       */
-        conf->indexheader   = NULL;  /* GridSiteIndexHeader   File-value   */
-        conf->gridsitelink  = 1;     /* GridSiteLink          on/off       */
-        conf->adminfile     = apr_pstrdup(p, GRST_ADMIN_FILE);
-                                /* GridSiteAdminFile      File-value   */
-        conf->adminuri      = NULL;  /* GridSiteAdminURI      URI-value    */
-        conf->helpuri       = NULL;  /* GridSiteHelpURI       URI-value    */
-        conf->loginuri      = NULL;  /* GridSiteLoginURI      URI-value    */
-        conf->dnlists       = NULL;  /* GridSiteDNlists       Search-path  */
-        conf->dnlistsuri    = NULL;  /* GridSiteDNlistsURI    URI-value    */
-        conf->adminlist     = NULL;  /* GridSiteAdminList     URI-value    */
-        conf->gsiproxylimit = 1000;  /* GridSiteGSIProxyLimit number       */
-        conf->unzip         = NULL;  /* GridSiteUnzip         file-path    */
+  if (*direct && (length % GRST_PUT_ALIGN != 0))
+    {
+      flags = fcntl(fd, F_GETFL);
+      fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+      *direct = 0;
+    }
 
-        conf->methods    = apr_pstrdup(p, " GET ");
-                                        /* GridSiteMethods      methods    */
+  while (length > 0)
+       {
+         n = pwrite(fd, buf, length, offset);
 
-        conf->editable = apr_pstrdup(p, " txt shtml html htm css js php jsp ");
-                                        /* GridSiteEditable     types   */
+         if (n < 0)
+           {
+             if (errno == EINTR) continue;
 
-        conf->headfile = apr_pstrdup(p, GRST_HEADFILE);
-        conf->footfile = apr_pstrdup(p, GRST_FOOTFILE);
-               /* GridSiteHeadFile and GridSiteFootFile  file name */
+             if ((errno == EINVAL) && *direct)
+               {
+                 flags = fcntl(fd, F_GETFL);
+                 fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+                 *direct = 0;
+                 continue;
+               }
 
-        conf->gridhttp      = 0;     /* GridSiteGridHTTP      on/off       */
-	conf->aclformat     = apr_pstrdup(p, "GACL");
-                                     /* GridSiteACLFormat     gacl/xacml   */
-	conf->aclpath       = NULL;  /* GridSiteACLPath       acl-path     */
-	conf->delegationuri = NULL;  /* GridSiteDelegationURI URI-value    */
-	conf->execmethod    = NULL;
-               /* GridSiteExecMethod  nosetuid/suexec/X509DN/directory */
-               
-        conf->execugid.uid     = 0;	/* GridSiteUserGroup User Group */
-        conf->execugid.gid     = 0;	/* ditto */
-        conf->execugid.userdir = 0;	/* ditto */
-        
-        conf->diskmode	= APR_UREAD | APR_UWRITE; 
-              /* GridSiteDiskMode group-mode world-mode
-                 GroupNone | GroupRead | GroupWrite   WorldNone | WorldRead */
-      }
-    else
-      {
-        conf->auth          = UNSET; /* GridSiteAuth          on/off       */
-        conf->autopasscode  = UNSET; /* GridSiteAutoPasscode  on/off       */
-        conf->requirepasscode = UNSET; /* GridSiteRequirePasscode on/off   */
-        conf->zoneslashes   = UNSET; /* GridSiteZoneSlashes   number       */
-        conf->envs          = UNSET; /* GridSiteEnvs          on/off       */
-        conf->format        = UNSET; /* GridSiteHtmlFormat    on/off       */
-        conf->indexes       = UNSET; /* GridSiteIndexes       on/off       */
-        conf->indexheader   = NULL;  /* GridSiteIndexHeader   File-value   */
-        conf->gridsitelink  = UNSET; /* GridSiteLink          on/off       */
-        conf->adminfile     = NULL;  /* GridSiteAdminFile     File-value   */
-        conf->adminuri      = NULL;  /* GridSiteAdminURI      URI-value    */
-        conf->helpuri       = NULL;  /* GridSiteHelpURI       URI-value    */
-        conf->loginuri      = NULL;  /* GridSiteLoginURI      URI-value    */
-        conf->dnlists       = NULL;  /* GridSiteDNlists       Search-path  */
-        conf->dnlistsuri    = NULL;  /* GridSiteDNlistsURI    URI-value    */
-        conf->adminlist     = NULL;  /* GridSiteAdminList     URI-value    */
-        conf->gsiproxylimit = UNSET; /* GridSiteGSIProxyLimit number       */
-        conf->unzip         = NULL;  /* GridSiteUnzip         file-path    */
-        conf->methods       = NULL;  /* GridSiteMethods       methods      */
-        conf->editable      = NULL;  /* GridSiteEditable      types        */
-        conf->headfile      = NULL;  /* GridSiteHeadFile      file name    */
-        conf->footfile      = NULL;  /* GridSiteFootFile      file name    */
-        conf->gridhttp      = UNSET; /* GridSiteGridHTTP      on/off       */
-	conf->aclformat     = NULL;  /* GridSiteACLFormat     gacl/xacml   */
-	conf->aclpath       = NULL;  /* GridSiteACLPath       acl-path     */
-	conf->delegationuri = NULL;  /* GridSiteDelegationURI URI-value    */
-	conf->execmethod    = NULL;  /* GridSiteExecMethod */
-        conf->execugid.uid     = UNSET;	/* GridSiteUserGroup User Group */
-        conf->execugid.gid     = UNSET; /* ditto */
-        conf->execugid.userdir = UNSET; /* ditto */
-        conf->diskmode	    = UNSET; /* GridSiteDiskMode group world */
-      }
+             return -1;
+           }
 
-    return conf;
+         buf    += n;
+         length -= n;
+         offset += n;
+       }
+
+  return 0;
 }
 
-static void *merge_gridsite_dir_config(apr_pool_t *p, void *vserver,
-                                                      void *vdirect)
-/* merge directory with server-wide directory configs */
+static void put_write_behind(int fd, apr_off_t *flushed, apr_off_t *waited,
+                             apr_off_t written)
+/* start writeback of everything written since the last call, then wait
+   for the previous window and drop it from the page cache, so a large
+   upload never builds up more than two windows of dirty pages */
 {
-    mod_gridsite_dir_cfg *conf, *server, *direct;
+#ifdef SYNC_FILE_RANGE_WRITE
+  sync_file_range(fd, *flushed, written - *flushed, SYNC_FILE_RANGE_WRITE);
 
-    server = (mod_gridsite_dir_cfg *) vserver;
-    direct = (mod_gridsite_dir_cfg *) vdirect;
-    conf = apr_palloc(p, sizeof(*conf));
+  if (*flushed > *waited)
+    {
+      sync_file_range(fd, *waited, *flushed - *waited,
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                      | SYNC_FILE_RANGE_WAIT_AFTER);
+      posix_fadvise(fd, *waited, *flushed - *waited, POSIX_FADV_DONTNEED);
+      *waited = *flushed;
+    }
+#else
+  fdatasync(fd);
+  *waited = written;
+#endif
 
-    if (direct->auth != UNSET) conf->auth = direct->auth;
-    else                       conf->auth = server->auth;
+  *flushed = written;
+}
 
-    if (direct->autopasscode != UNSET) conf->autopasscode = direct->autopasscode;
-    else                               conf->autopasscode = server->autopasscode;
+int http_put_method(request_rec *r, mod_gridsite_dir_cfg *conf)
+{
+  char        *buf, *filename, *dirname, *basename;
+  const char  *p, *data;
+  apr_size_t  data_length;
+  size_t      bufsize, fill = 0, n;
+  int         retcode = OK, stat_ret, fd, flags, direct = 0, seen_eos = 0;
+  apr_file_t *fp;
+  apr_status_t       rv;
+  apr_os_file_t      osfd;
+  apr_bucket_brigade *bb;
+  apr_bucket         *bucket;
+  struct stat statbuf;
+  int       has_range = 0, is_done = 0;
+  apr_off_t range_start, range_end, range_length, length_to_send = 0,
+            length = 0, offset = 0, received = 0, flushed, waited;
+  
+  /* ***  check if directory creation: PUT /.../  *** */
 
-    if (direct->requirepasscode != UNSET) conf->requirepasscode = direct->requirepasscode;
-    else                               conf->requirepasscode = server->requirepasscode;
+  if ((r->unparsed_uri    != NULL) && 
+      (r->unparsed_uri[0] != '\0') &&
+      (r->unparsed_uri[strlen(r->unparsed_uri) - 1] == '/'))
+    {
+      if (apr_dir_make(r->filename, 
+                       conf->diskmode 
+                       | APR_UEXECUTE | APR_GEXECUTE | APR_WEXECUTE, 
+                       r->pool) != 0) return HTTP_INTERNAL_SERVER_ERROR;
 
-    if (direct->zoneslashes != UNSET) conf->zoneslashes = direct->zoneslashes;
-    else                              conf->zoneslashes = server->zoneslashes;
+      /* we force the permissions, rather than accept any existing ones */
 
-    if (direct->envs != UNSET) conf->envs = direct->envs;
-    else                       conf->envs = server->envs;
-        
-    if (direct->format != UNSET) conf->format = direct->format;
-    else                         conf->format = server->format;
-        
-    if (direct->indexes != UNSET) conf->indexes = direct->indexes;
-    else                          conf->indexes = server->indexes;
-        
-    if (direct->gridsitelink != UNSET) conf->gridsitelink=direct->gridsitelink;
-    else                               conf->gridsitelink=server->gridsitelink;
+      apr_file_perms_set(r->filename, conf->diskmode
+                             | APR_UEXECUTE | APR_GEXECUTE | APR_WEXECUTE);
+                             
+      ap_set_content_length(r, 0);
+      ap_set_content_type(r, "text/html");
+      return OK;
+    }
 
-    if (direct->indexheader != NULL) conf->indexheader = direct->indexheader;
-    else                             conf->indexheader = server->indexheader;
-        
-    if (direct->adminfile != NULL) conf->adminfile = direct->adminfile;
-    else                           conf->adminfile = server->adminfile;
-        
-    if (direct->adminuri != NULL) conf->adminuri = direct->adminuri;
-    else                          conf->adminuri = server->adminuri;
-        
-    if (direct->helpuri != NULL) conf->helpuri = direct->helpuri;
-    else                         conf->helpuri = server->helpuri;
-        
-    if (direct->loginuri != NULL) conf->loginuri = direct->loginuri;
-    else                          conf->loginuri = server->loginuri;
+  /* ***  otherwise assume trying to create a regular file *** */
 
-    if (direct->dnlists != NULL) conf->dnlists = direct->dnlists;
-    else                         conf->dnlists = server->dnlists;
-        
-    if (direct->dnlistsuri != NULL) conf->dnlistsuri = direct->dnlistsuri;
-    else                            conf->dnlistsuri = server->dnlistsuri;
+  stat_ret = stat(r->filename, &statbuf);
 
-    if (direct->adminlist != NULL) conf->adminlist = direct->adminlist;
-    else                           conf->adminlist = server->adminlist;
+  /* find if a range is specified */
 
-    if (direct->gsiproxylimit != UNSET)
-                         conf->gsiproxylimit = direct->gsiproxylimit;
-    else                 conf->gsiproxylimit = server->gsiproxylimit;
+  has_range = parse_content_range(r, &range_start, &range_end, &range_length);
 
-    if (direct->unzip != NULL) conf->unzip = direct->unzip;
-    else                       conf->unzip = server->unzip;
+  if (has_range)
+    {
+       if ((range_start == 0) && (range_end == 0)) /* truncate? */
+         {
+           if (stat_ret != 0) return HTTP_NOT_FOUND;
+          
+           if (truncate(r->filename, range_length) != 0)
+                return HTTP_INTERNAL_SERVER_ERROR;
+           else return OK;
+         }
+    
+       filename = r->filename;
 
-    if (direct->methods != NULL) conf->methods = direct->methods;
-    else                         conf->methods = server->methods;
+       if (apr_file_open(&fp, filename, APR_WRITE | APR_CREATE,
+            conf->diskmode, r->pool) != 0) return HTTP_INTERNAL_SERVER_ERROR;
 
-    if (direct->editable != NULL) conf->editable = direct->editable;
-    else                          conf->editable = server->editable;
+       offset         = range_start;
+       length_to_send = range_end - range_start + 1;
+       length         = length_to_send;
+    }
+  else /* use temporary file if not a partial transfer */ 
+    {
+      dirname = apr_pstrdup(r->pool, r->filename);
+      basename = rindex(dirname, '/');
+      if (basename == NULL) return HTTP_INTERNAL_SERVER_ERROR;
+        
+      *basename = '\0';
+      ++basename;
 
-    if (direct->headfile != NULL) conf->headfile = direct->headfile;
-    else                          conf->headfile = server->headfile;
+      filename = apr_psprintf(r->pool,
+                             "%s/.grsttmp-%s-XXXXXX", dirname, basename);
 
-    if (direct->footfile != NULL) conf->footfile = direct->footfile;
-    else                          conf->footfile = server->footfile;
+      if (apr_file_mktemp(&fp, filename,
+                    APR_CREATE | APR_WRITE | APR_EXCL, r->pool)
+                    != APR_SUCCESS) return HTTP_INTERNAL_SERVER_ERROR;
 
-    if (direct->gridhttp != UNSET) conf->gridhttp = direct->gridhttp;
-    else                           conf->gridhttp = server->gridhttp;
-        
-    if (direct->aclformat != NULL) conf->aclformat = direct->aclformat;
-    else                           conf->aclformat = server->aclformat;
+      p = apr_table_get(r->headers_in, "Content-Length");
+      if ((p == NULL) || 
+          (apr_strtoff(&length, p, NULL, 10) != APR_SUCCESS)) length = 0;
+    }
 
-    if (direct->aclpath != NULL)   conf->aclpath = direct->aclpath;
-    else                           conf->aclpath = server->aclpath;
+  /* we force the permissions, rather than accept any existing ones */
 
-    if (direct->delegationuri != NULL) conf->delegationuri = direct->delegationuri;
-    else                               conf->delegationuri = server->delegationuri;
+  apr_file_perms_set(filename, conf->diskmode);
 
-    if (direct->execmethod != NULL) conf->execmethod = direct->execmethod;
-    else                            conf->execmethod = server->execmethod;
+  /* we do our own buffering, so write straight to the descriptor */
 
-    if (direct->execugid.uid != UNSET)
-      { conf->execugid.uid = direct->execugid.uid;
-        conf->execugid.gid = direct->execugid.gid;
-        conf->execugid.userdir = direct->execugid.userdir; }
-    else
-      { conf->execugid.uid = server->execugid.uid;
-        conf->execugid.gid = server->execugid.gid;
-        conf->execugid.userdir = server->execugid.userdir; }
+  apr_os_file_get(&osfd, fp);
+  fd = osfd;
 
-    if (direct->diskmode != UNSET) conf->diskmode = direct->diskmode;
-    else                            conf->diskmode = server->diskmode;
-        
-    return conf;
-}
+  /* reserve the blocks in one go to avoid fragmenting large files, but
+     leave the size alone in case the body turns out to be shorter */
 
-static const char *mod_gridsite_take1_cmds(cmd_parms *a, void *cfg,
-                                           const char *parm)
-{
-    int   n, i;
-    char *p;
-  
-    if (strcasecmp(a->cmd->name, "GridSiteSessionsDir") == 0)
+#ifdef FALLOC_FL_KEEP_SIZE
+  if (conf->putallocate && (length >= GRST_PUT_ALLOCATE_MIN))
+                    fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, length);
+#endif
+
+  /* O_DIRECT needs every write to start on an aligned offset */
+
+  if (conf->putdirect && (offset % GRST_PUT_ALIGN == 0))
     {
-      if (a->server->is_virtual)
-       return "GridSiteSessionsDir cannot be used inside a virtual server";
-    
-      sessionsdir = apr_pstrdup(a->pool, parm);
+      flags = fcntl(fd, F_GETFL);
+      if ((flags != -1) && (fcntl(fd, F_SETFL, flags | O_DIRECT) == 0))
+                                                                 direct = 1;
     }
-/* GridSiteOnetimesDir is deprecated in favour of GridSiteSessionsDir */
-    else if (strcasecmp(a->cmd->name, "GridSiteOnetimesDir") == 0)
+
+  bufsize = conf->putbuffer;
+  buf     = put_buffer(r, bufsize);
+  flushed = offset;
+
+  if (buf == NULL) retcode = HTTP_INTERNAL_SERVER_ERROR;
+  waited  = offset;
+
+  bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+
+  while (!seen_eos && !is_done && (retcode == OK))
+       {
+         rv = ap_get_brigade(r->input_filters, bb, AP_MODE_READBYTES,
+                             APR_BLOCK_READ, bufsize);
+         if (rv != APR_SUCCESS)
+           {
+             /* so LimitRequestBody gives 413, a timeout 408 and so on */
+             retcode = GRST_AP_MAP_REQUEST_ERROR(rv, HTTP_BAD_REQUEST);
+             break;
+           }
+
+         for (bucket = APR_BRIGADE_FIRST(bb);
+              bucket != APR_BRIGADE_SENTINEL(bb);
+              bucket = APR_BUCKET_NEXT(bucket))
+            {
+              if (APR_BUCKET_IS_EOS(bucket))
+                {
+                  seen_eos = 1;
+                  break;
+                }
+
+              if (APR_BUCKET_IS_METADATA(bucket)) continue;
+
+              if (apr_bucket_read(bucket, &data, &data_length,
+                                  APR_BLOCK_READ) != APR_SUCCESS)
+                {
+                  retcode = HTTP_BAD_REQUEST;
+                  break;
+                }
+
+              if (has_range && (received + data_length > length_to_send))
+                {
+                  data_length = length_to_send - received;
+                  is_done = 1;
+                }
+
+              received += data_length;
+
+              while (data_length > 0)
+                   {
+                     n = bufsize - fill;
+                     if (n > data_length) n = data_length;
+
+                     memcpy(&buf[fill], data, n);
+                     fill        += n;
+                     data        += n;
+                     data_length -= n;
+
+                     if (fill < bufsize) continue;
+
+                     if (put_write_block(fd, buf, fill, offset, &direct) != 0)
+                       {
+                         retcode = HTTP_INTERNAL_SERVER_ERROR;
+                         break;
+                       }
+
+                     offset += fill;
+                     fill    = 0;
+
+                     if ((conf->putwritebehind > 0) &&
+                         (offset - flushed >= conf->putwritebehind))
+                       put_write_behind(fd, &flushed, &waited, offset);
+                   }
+
+              if (is_done || (retcode != OK)) break;
+            }
+
+         apr_brigade_cleanup(bb);
+       }
+
+  if ((retcode == OK) && (fill > 0) &&
+      (put_write_block(fd, buf, fill, offset, &direct) != 0))
+                                       retcode = HTTP_INTERNAL_SERVER_ERROR;
+
+  if ((retcode == OK) && conf->putsync && (fsync(fd) != 0))
+                                       retcode = HTTP_INTERNAL_SERVER_ERROR;
+
+  if ((apr_file_close(fp) != 0) || (retcode != OK))
     {
-      if (a->server->is_virtual)
-       return "GridSiteOnetimesDir cannot be used inside a virtual server";
-    
-      sessionsdir = apr_pstrdup(a->pool, parm);
+      if (strcmp(filename, r->filename) != 0) remove(filename);
+      return (retcode != OK) ? retcode : HTTP_INTERNAL_SERVER_ERROR;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteZoneSlashes") == 0)
+
+  ap_set_content_length(r, 0);
+  ap_set_content_type(r, "text/html");
+
+  if ((strcmp(filename, r->filename) != 0) &&
+      (apr_file_rename(filename, r->filename, r->pool) != 0))
+      return HTTP_FORBIDDEN; /* best guess as to the problem ... */
+
+  if (stat_ret != 0)
+    {
+      retcode = HTTP_CREATED;
+      ap_custom_response(r, HTTP_CREATED, "");
+    }
+
+  return retcode;
+}
+
+int http_delete_method(request_rec *r, mod_gridsite_dir_cfg *conf)
+{
+  ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+               "Try remove(%s)", r->filename);
+
+  if (remove(r->filename) != 0) return HTTP_FORBIDDEN;
+       
+  ap_set_content_length(r, 0);
+  ap_set_content_type(r, "text/html");
+
+  return OK;
+}
+
+int http_move_method(request_rec *r, mod_gridsite_dir_cfg *conf)
+{
+  char *destination_translated = NULL;
+  
+  if (r->notes != NULL) destination_translated = 
+            (char *) apr_table_get(r->notes, "GRST_DESTINATION_TRANSLATED");
+
+  if (destination_translated == NULL) return HTTP_BAD_REQUEST;
+  
+  if (strcmp(r->filename, destination_translated) == 0)
+                                      return HTTP_FORBIDDEN;
+  
+  if (apr_file_rename(r->filename, destination_translated, r->pool) != 0)
+                                                       return HTTP_FORBIDDEN;
+
+  ap_set_content_length(r, 0);
+  ap_set_content_type(r, "text/html");
+
+  return OK;
+}
+
+static int mod_gridsite_dir_handler(request_rec *r, mod_gridsite_dir_cfg *conf)
+/*
+   handler switch for directories
+*/
+{
+    /* *** is this a write method? only possible if  GridSiteAuth on *** */
+
+    if (conf->auth)
+      {
+        if ((r->method_number == M_PUT) && 
+            (conf->methods != NULL) &&
+            (strstr(conf->methods, " PUT "   ) != NULL))
+                                           return http_put_method(r, conf);
+
+        if ((r->method_number == M_DELETE) &&
+            (conf->methods != NULL) &&
+            (strstr(conf->methods, " DELETE ") != NULL)) 
+                                           return http_delete_method(r, conf);
+      }
+      
+    /* *** directory listing? *** */
+    if ((r->method_number == M_GET) && (conf->indexes))       
+      {
+        /* the same URL gives HTML or JSON, so shared caches must know */
+        apr_table_merge(r->headers_out, "Vary", "Accept");
+
+        if (json_wanted(r)) return json_dir_list(r, conf); /* for clients */
+        
+        return html_dir_list(r, conf); /* directory listing */
+      }
+    
+    return DECLINED; /* *** nothing to see here, move along *** */
+}
+
+static int mod_gridsite_nondir_handler(request_rec *r, mod_gridsite_dir_cfg *conf)
+/*
+   one big handler switch for everything other than directories, since we 
+   might be responding to MIME * / * for local PUT, MOVE, COPY and DELETE, 
+   and GET inside ghost directories.
+*/
+{
+    char *upgradeheader, *upgradespaced, *p;
+    const char *https_env;
+
+    /* *** is this a write method or GridHTTP HTTPS->HTTP redirection? 
+           only possible if  GridSiteAuth on *** */
+    
+    if (conf->auth)
+      {
+        if ((conf->gridhttp) &&
+            ((r->method_number == M_GET) || 
+             ((r->method_number == M_PUT) && 
+              (strstr(conf->methods, " PUT ") != NULL))) &&
+            ((upgradeheader = (char *) apr_table_get(r->headers_in,
+                                                     "Upgrade")) != NULL) &&
+            ((https_env=apr_table_get(r->subprocess_env,"HTTPS")) != NULL) &&
+            (strcasecmp(https_env, "on") == 0))
+          {
+            upgradespaced = apr_psprintf(r->pool, " %s ", upgradeheader);
+
+            for (p=upgradespaced; *p != '\0'; ++p)
+             if ((*p == ',') || (*p == '\t')) *p = ' ';
+
+// TODO: what if we're pointing at a CGI or some dynamic content???
+ 
+            if (strstr(upgradespaced, " GridHTTP/1.0 ") != NULL)
+                                            return http_gridhttp(r, conf);
+          }
+
+        if ((r->method_number == M_PUT) && 
+            (conf->methods != NULL) &&
+            (strstr(conf->methods, " PUT "   ) != NULL))
+                                           return http_put_method(r, conf);
+
+        if ((r->method_number == M_DELETE) &&
+            (conf->methods != NULL) &&
+            (strstr(conf->methods, " DELETE ") != NULL)) 
+                                           return http_delete_method(r, conf);
+
+        if ((r->method_number == M_MOVE) &&
+            (conf->methods != NULL) &&
+            (strstr(conf->methods, " MOVE ") != NULL)) 
+                                           return http_move_method(r, conf);
+      }
+
+    /* *** check if a special ghost admin CGI *** */
+      
+    if (conf->adminfile && conf->adminuri &&
+        (strlen(r->filename) > strlen(conf->adminfile) + 1) &&
+        (strcmp(&(r->filename[strlen(r->filename) - strlen(conf->adminfile)]),
+                                                    conf->adminfile) == 0) &&
+        (r->filename[strlen(r->filename)-strlen(conf->adminfile)-1] == '/') &&
+        ((r->method_number == M_POST) ||
+         (r->method_number == M_GET))) 
+      {
+        ap_internal_redirect(conf->adminuri, r);
+        return OK;
+      }
+      
+    /* *** finally look for .html files that we should format *** */
+
+    if ((conf->format) &&  /* conf->format set by  GridSiteHtmlFormat on */ 
+        (strlen(r->filename) > 5) &&
+        (strcmp(&(r->filename[strlen(r->filename)-5]), ".html") == 0) &&
+        (r->method_number == M_GET)) return html_format(r, conf);
+     
+    return DECLINED; /* *** nothing to see here, move along *** */
+}
+
+static void recurse4dirlist(char *dirname, time_t *dirs_time,
+                             char *fulluri, int fullurilen,
+                             char *encfulluri, int enclen,
+                             request_rec *r, apr_bucket_brigade *bb,
+                             int recurse_level)
+/* try to find DN Lists in dir[] and its subdirs that match the fulluri[]
+   prefix. add blobs of HTML to bb as they are found. */
+{
+   char          *unencname, modified[99], *mildencoded;
+   DIR           *oneDIR;
+   struct dirent *onedirent;
+   struct tm      mtime_tm;
+   struct stat    statbuf;
+   int            isdir;
+
+   if ((stat(dirname, &statbuf) != 0) ||
+       (!S_ISDIR(statbuf.st_mode)) ||
+       ((oneDIR = opendir(dirname)) == NULL)) return;
+
+   if (statbuf.st_mtime > *dirs_time) *dirs_time = statbuf.st_mtime;
+
+   while ((onedirent = readdir(oneDIR)) != NULL)
+        {
+          if (onedirent->d_name[0] == '.') continue;
+
+          /* d_type lets us skip files which cannot be DN lists unstat()ed */
+
+          if ((onedirent->d_type == DT_REG) &&
+              (strncmp(onedirent->d_name, encfulluri, enclen) != 0)) continue;
+
+          if ((onedirent->d_type == DT_DIR) ||
+              (onedirent->d_type == DT_REG)) 
+               isdir = (onedirent->d_type == DT_DIR);
+          else if (fstatat(dirfd(oneDIR), onedirent->d_name, &statbuf, 0) 
+                                                                     == 0)
+               isdir = S_ISDIR(statbuf.st_mode);
+          else continue;
+
+          if (isdir)
+            {
+              if (recurse_level < GRST_RECURS_LIMIT)
+                 recurse4dirlist(apr_psprintf(r->pool, "%s/%s", dirname, 
+                                              onedirent->d_name),
+                                 dirs_time, fulluri,
+                                 fullurilen, encfulluri, enclen, 
+                                 r, bb, recurse_level + 1);
+            }
+          else if ((strncmp(onedirent->d_name, encfulluri, enclen) == 0) &&
+                   (onedirent->d_name[strlen(onedirent->d_name) - 1] != '~') &&
+                   (fstatat(dirfd(oneDIR), onedirent->d_name, &statbuf, 0)
+                                                                     == 0))
+            {
+              unencname = GRSThttpUrlDecode(onedirent->d_name);
+                    
+              if (strncmp(unencname, fulluri, fullurilen) == 0)
+                {
+                  if (statbuf.st_mtime > *dirs_time) 
+                                                *dirs_time = statbuf.st_mtime;
+
+                  localtime_r(&(statbuf.st_mtime), &mtime_tm);
+                  strftime(modified, sizeof(modified), 
+              "<td align=right>%R</td><td align=right>%e&nbsp;%b&nbsp;%y</td>",
+                       &mtime_tm);
+                  
+                  mildencoded = GRSThttpUrlMildencode(&unencname[fullurilen]);
+                 
+                  apr_brigade_printf(bb, NULL, NULL,
+                                     "<tr><td><a href=\"%s\" "
+                                     "content-length=\"%ld\" "
+                                     "last-modified=\"%ld\">"
+                                     "%s</a></td>"
+                                     "<td align=right>%ld</td>%s</tr>\n", 
+                                     mildencoded, statbuf.st_size, 
+                                     statbuf.st_mtime, 
+                                     html_escape(r->pool, unencname), 
+                                     statbuf.st_size, modified);
+
+                  free(mildencoded);
+                }      
+                      
+              free(unencname); /* libgridsite doesnt use pools */
+            }
+        }
+        
+   closedir(oneDIR);
+}
+
+static int mod_gridsite_dnlistsuri_dir_handler(request_rec *r, 
+                                               mod_gridsite_dir_cfg *conf)
+/*
+    virtual DN-list file lister: make all DN lists on the dn-lists
+    path of this server appear to be in the dn-lists directory itself
+    (ie where they appear in the DN lists path doesnt matter, as long
+    as their name matches)
+*/
+{
+    int            enclen, fullurilen;
+    char          *fulluri, *encfulluri, *dn_list_ptr, *dirname, *p,
+                  *permstr = NULL;
+    apr_off_t      length;
+    time_t         dirs_time = 0;
+    GRSTgaclPerm   perm = GRST_PERM_NONE;
+    apr_bucket_brigade *bb;
+        
+    if (r->notes != NULL)
+           permstr = (char *) apr_table_get(r->notes, "GRST_PERM");
+
+    if (permstr != NULL) sscanf(permstr, "%d", &perm);
+
+    fulluri = apr_psprintf(r->pool, "https://%s%s",
+                                    r->hostname, conf->dnlistsuri);
+    fullurilen = strlen(fulluri);
+
+    encfulluri = GRSThttpUrlEncode(fulluri);
+    enclen     = strlen(encfulluri);
+
+    if (conf->dnlists != NULL) p = conf->dnlists;
+    else p = getenv("GRST_DN_LISTS");
+
+    if (p == NULL) p = GRST_DN_LISTS;
+    dn_list_ptr = apr_pstrdup(r->pool, p);
+
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+
+    brigade_pool_puts(bb, r->pool, apr_psprintf(r->pool, 
+      "<head><title>Directory listing %s</title></head>\n", r->uri));
+
+    /* **** try to find a header file in this or parent directories **** */
+
+    if (!conf->format || !fragment_find(r, bb, conf->headfile))
+      {
+        /* not found, so output sensible default */
+        brigade_pool_puts(bb, r->pool, "<body bgcolor=white>");
+      }
+            
+    apr_brigade_printf(bb, NULL, NULL,
+      "<h1>Directory listing %s</h1>\n<table>", r->uri);
+
+    if ((r->uri)[1] != '\0')
+     apr_brigade_puts(bb, NULL, NULL,
+       "<tr><td>[<a href=\"../\">Parent directory</a>]</td></tr>\n");
+
+    while ((dirname = strsep(&dn_list_ptr, ":")) != NULL)
+        recurse4dirlist(dirname, &dirs_time, fulluri, fullurilen,
+                                 encfulluri, enclen, r, bb, 0);
+
+    p = (char *) apr_table_get(r->subprocess_env, "HTTPS");
+    if ((p != NULL) && (strcmp(p, "on") == 0))
+      {
+        apr_brigade_printf(bb, NULL, NULL,
+           "<form action=\"%s%s\" method=post>\n"
+           "<input type=hidden name=cmd value=managednlists>"
+           "<tr><td colspan=4 align=center><small><input type=submit "
+           "value=\"Manage DN lists\"></small></td></tr></form>\n",
+           r->uri, conf->adminfile);
+      }
+
+    apr_brigade_puts(bb, NULL, NULL, "</table>\n");
+
+    free(encfulluri); /* libgridsite doesnt use pools */
+
+    /* **** try to find a footer file in this or parent directories **** */
+
+    if (!conf->format || !fragment_find(r, bb, conf->footfile))
+      {
+        /* failed to find a footer, so use standard default */
+        brigade_pool_puts(bb, r->pool, "</body>");
+      }
+
+    /* **** can now calculate the Content-Length and output headers **** */
+      
+    apr_brigade_length(bb, 1, &length);
+
+    ap_set_content_length(r, length);
+    r->mtime = apr_time_from_sec(dirs_time);
+    ap_set_last_modified(r);
+    ap_set_content_type(r, "text/html");
+
+    /* ** output the HTTP body (HTML Head+Body) ** */
+
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+    ap_pass_brigade(r->output_filters, bb);
+
+    return OK;
+}
+
+static char *recurse4file(char *dir, char *file, apr_pool_t *pool, 
+                          int recurse_level)
+/* try to find file[] in dir[]. try subdirs if not found.
+   return full path to first found version or NULL on failure */
+{
+    char          *fullfilename, *fulldirname;
+    struct stat    statbuf;
+    DIR           *dirDIR;
+    struct dirent *file_ent;
+
+    /* try to find in current directory */
+
+    fullfilename = apr_psprintf(pool, "%s/%s", dir, file);
+
+    if (stat(fullfilename, &statbuf) == 0) return fullfilename;
+
+    /* maybe search in subdirectories */
+
+    if (recurse_level >= GRST_RECURS_LIMIT) return NULL;
+
+    dirDIR = opendir(dir);
+
+    if (dirDIR == NULL) return NULL;
+
+    while ((file_ent = readdir(dirDIR)) != NULL)
+       {
+         if (file_ent->d_name[0] == '.') continue;
+
+         fulldirname = apr_psprintf(pool, "%s/%s", dir, file_ent->d_name);
+         if ((stat(fulldirname, &statbuf) == 0) &&
+             S_ISDIR(statbuf.st_mode) &&
+             ((fullfilename = recurse4file(fulldirname, file,
+                                           pool, recurse_level + 1)) != NULL))
+           {
+             closedir(dirDIR);
+             return fullfilename;
+           }
+       }
+
+    closedir(dirDIR);
+
+    return NULL;
+}
+
+static int mod_gridsite_dnlistsuri_handler(request_rec *r, 
+                                           mod_gridsite_dir_cfg *conf)
+/*
+    virtual DN-list file generator
+*/
+{
+    int          fd;
+    char        *fulluri, *encfulluri, *dn_list_ptr, *filename, *dirname, *p,
+                *buf;
+    struct stat  statbuf;
+    
+    /* *** check if a special ghost admin CGI *** */
+      
+    if (conf->adminfile && conf->adminuri &&
+        (strlen(r->filename) > strlen(conf->adminfile) + 1) &&
+        (strcmp(&(r->filename[strlen(r->filename) - strlen(conf->adminfile)]),
+                                                    conf->adminfile) == 0) &&
+        (r->filename[strlen(r->filename)-strlen(conf->adminfile)-1] == '/') &&
+        ((r->method_number == M_POST) ||
+         (r->method_number == M_GET))) 
+      {
+        ap_internal_redirect(conf->adminuri, r);
+        return OK;
+      }
+      
+    if (r->uri[strlen(r->uri) - 1] == '/') 
+      {
+        apr_table_setn(r->headers_out, apr_pstrdup(r->pool, "Location"), 
+                                       apr_pstrdup(r->pool, conf->dnlistsuri));
+
+        r->status = HTTP_MOVED_TEMPORARILY;
+        return OK;                   
+      }
+
+    fulluri = apr_psprintf(r->pool, "https://%s%s", 
+                                    r->hostname, r->uri);
+
+    encfulluri = GRSThttpUrlEncode(fulluri);
+    
+    if (conf->dnlists != NULL) p = conf->dnlists;
+    else p = getenv("GRST_DN_LISTS");
+ 
+    if (p == NULL) p = GRST_DN_LISTS;
+    dn_list_ptr = apr_pstrdup(r->pool, p);
+
+    while ((dirname = strsep(&dn_list_ptr, ":")) != NULL)
+       {
+         filename = recurse4file(dirname, encfulluri, r->pool, 0);
+
+         if (filename == NULL) continue;
+    
+         fd = open(filename, O_RDONLY);
+
+         if (fd == -1) continue;
+
+         fstat(fd, &statbuf);         
+         ap_set_content_length(r, (apr_off_t) statbuf.st_size);
+         r->mtime = apr_time_from_sec(statbuf.st_mtime);
+         ap_set_content_type(r, "text/plain");
+         ap_set_last_modified(r);
+
+         buf = apr_palloc(r->pool, statbuf.st_size + 1);
+         read(fd, buf, statbuf.st_size);
+         buf[statbuf.st_size] = '\0';
+            
+         ap_rputs(buf, r);
+
+         close(fd);
+
+         return OK;
+       }
+
+    return HTTP_NOT_FOUND;
+}
+
+static void *create_gridsite_srv_config(apr_pool_t *p, server_rec *s)
+{
+    int i;
+
+    /* only run once (in base server) */
+    if (!(s->is_virtual) && (gridhttpport == 0))
+      {
+        gridhttpport = GRST_HTTP_PORT;
+      
+        sessionsdir = apr_pstrdup(p, GRST_SESSIONS_DIR);
+                                      /* GridSiteSessionsDir dir-path   */
+
+#ifdef GRST_AP_SOCACHE
+        sessionsstore_provider = NULL;
+        sessionsstore          = NULL;
+                                      /* GridSiteSessionsStore files */
+#endif
+
+        sitecastdnlists = NULL;
+
+        aclcachesize = GRST_ACL_CACHE_SIZE;
+                                      /* GridSiteACLCache bytes */
+
+        sessionssweep = GRST_SESSIONS_SWEEP;
+                                      /* GridSiteSessionsSweep seconds */
+        sessionssweeprate = GRST_SESSIONS_SWEEP_RATE;
+                                      /* GridSiteSessionsSweepRate files */
+
+        sitecastgroups[0].port  = GRST_HTCP_PORT;
+                                      /* GridSiteCastUniPort udp-port */
+
+        for (i=1; i <= GRST_SITECAST_GROUPS; ++i)
+           {
+             sitecastgroups[i].port = 0; /* GridSiteCastGroup mcast-list */
+           }
+
+        for (i=0; i < GRST_SITECAST_ALIASES; ++i)
+           {
+             sitecastaliases[i].sitecast_url   = NULL;
+             sitecastaliases[i].port           = 0;
+             sitecastaliases[i].scheme         = NULL;
+             sitecastaliases[i].local_path     = NULL;
+             sitecastaliases[i].local_hostname = NULL;
+           }                              /* GridSiteCastAlias url path */
+      }
+
+    return NULL;
+}
+
+static void *create_gridsite_dir_config(apr_pool_t *p, char *path)
+{
+    mod_gridsite_dir_cfg *conf = apr_palloc(p, sizeof(*conf));
+
+    if (path == NULL) /* set up document root defaults */
+      {
+        conf->auth          = 0;     /* GridSiteAuth          on/off       */
+        conf->autopasscode  = 1;     /* GridSiteAutoPasscode  on/off       */
+        conf->requirepasscode = 0;   /* GridSiteRequirePasscode on/off     */
+        conf->zoneslashes   = 1;     /* GridSiteZoneSlashes   number       */
+        conf->envs          = 1;     /* GridSiteEnvs          on/off       */
+        conf->format        = 0;     /* GridSiteHtmlFormat    on/off       */
+        conf->indexes       = 0;     /* GridSiteIndexes       on/off       */
+        conf->indexheader   = NULL;  /* GridSiteIndexHeader   File-value   */
+        conf->gridsitelink  = 1;     /* GridSiteLink          on/off       */
+        conf->adminfile     = apr_pstrdup(p, GRST_ADMIN_FILE);
+                                /* GridSiteAdminFile      File-value   */
+        conf->adminuri      = NULL;  /* GridSiteAdminURI      URI-value    */
+        conf->helpuri       = NULL;  /* GridSiteHelpURI       URI-value    */
+        conf->loginuri      = NULL;  /* GridSiteLoginURI      URI-value    */
+        conf->dnlists       = NULL;  /* GridSiteDNlists       Search-path  */
+        conf->dnlistsuri    = NULL;  /* GridSiteDNlistsURI    URI-value    */
+        conf->adminlist     = NULL;  /* GridSiteAdminList     URI-value    */
+        conf->gsiproxylimit = 1000;  /* GridSiteGSIProxyLimit number       */
+        conf->unzip         = NULL;  /* GridSiteUnzip         file-path    */
+
+        conf->methods    = apr_pstrdup(p, " GET ");
+                                        /* GridSiteMethods      methods    */
+
+        conf->editable = apr_pstrdup(p, " txt shtml html htm css js php jsp ");
+                                        /* GridSiteEditable     types   */
+
+        conf->headfile = apr_pstrdup(p, GRST_HEADFILE);
+        conf->footfile = apr_pstrdup(p, GRST_FOOTFILE);
+               /* GridSiteHeadFile and GridSiteFootFile  file name */
+
+        conf->gridhttp      = 0;     /* GridSiteGridHTTP      on/off       */
+	conf->aclformat     = apr_pstrdup(p, "GACL");
+                                     /* GridSiteACLFormat     gacl/xacml   */
+	conf->aclpath       = NULL;  /* GridSiteACLPath       acl-path     */
+	conf->delegationuri = NULL;  /* GridSiteDelegationURI URI-value    */
+	conf->execmethod    = NULL;
+               /* GridSiteExecMethod  nosetuid/suexec/X509DN/directory */
+               
+        conf->execugid.uid     = 0;	/* GridSiteUserGroup User Group */
+        conf->execugid.gid     = 0;	/* ditto */
+        conf->execugid.userdir = 0;	/* ditto */
+        
+        conf->diskmode	= APR_UREAD | APR_UWRITE; 
+              /* GridSiteDiskMode group-mode world-mode
+                 GroupNone | GroupRead | GroupWrite   WorldNone | WorldRead */
+
+        conf->putbuffer      = GRST_PUT_BUFFER_SIZE;
+                                     /* GridSitePutBuffer     bytes        */
+        conf->putallocate    = 1;    /* GridSitePutAllocate   on/off       */
+        conf->putwritebehind = 0;    /* GridSitePutWriteBehind bytes       */
+        conf->putsync        = 0;    /* GridSitePutSync       on/off       */
+        conf->putdirect      = 0;    /* GridSitePutDirect     on/off       */
+      }
+    else
+      {
+        conf->auth          = UNSET; /* GridSiteAuth          on/off       */
+        conf->autopasscode  = UNSET; /* GridSiteAutoPasscode  on/off       */
+        conf->requirepasscode = UNSET; /* GridSiteRequirePasscode on/off   */
+        conf->zoneslashes   = UNSET; /* GridSiteZoneSlashes   number       */
+        conf->envs          = UNSET; /* GridSiteEnvs          on/off       */
+        conf->format        = UNSET; /* GridSiteHtmlFormat    on/off       */
+        conf->indexes       = UNSET; /* GridSiteIndexes       on/off       */
+        conf->indexheader   = NULL;  /* GridSiteIndexHeader   File-value   */
+        conf->gridsitelink  = UNSET; /* GridSiteLink          on/off       */
+        conf->adminfile     = NULL;  /* GridSiteAdminFile     File-value   */
+        conf->adminuri      = NULL;  /* GridSiteAdminURI      URI-value    */
+        conf->helpuri       = NULL;  /* GridSiteHelpURI       URI-value    */
+        conf->loginuri      = NULL;  /* GridSiteLoginURI      URI-value    */
+        conf->dnlists       = NULL;  /* GridSiteDNlists       Search-path  */
+        conf->dnlistsuri    = NULL;  /* GridSiteDNlistsURI    URI-value    */
+        conf->adminlist     = NULL;  /* GridSiteAdminList     URI-value    */
+        conf->gsiproxylimit = UNSET; /* GridSiteGSIProxyLimit number       */
+        conf->unzip         = NULL;  /* GridSiteUnzip         file-path    */
+        conf->methods       = NULL;  /* GridSiteMethods       methods      */
+        conf->editable      = NULL;  /* GridSiteEditable      types        */
+        conf->headfile      = NULL;  /* GridSiteHeadFile      file name    */
+        conf->footfile      = NULL;  /* GridSiteFootFile      file name    */
+        conf->gridhttp      = UNSET; /* GridSiteGridHTTP      on/off       */
+	conf->aclformat     = NULL;  /* GridSiteACLFormat     gacl/xacml   */
+	conf->aclpath       = NULL;  /* GridSiteACLPath       acl-path     */
+	conf->delegationuri = NULL;  /* GridSiteDelegationURI URI-value    */
+	conf->execmethod    = NULL;  /* GridSiteExecMethod */
+        conf->execugid.uid     = UNSET;	/* GridSiteUserGroup User Group */
+        conf->execugid.gid     = UNSET; /* ditto */
+        conf->execugid.userdir = UNSET; /* ditto */
+        conf->diskmode	    = UNSET; /* GridSiteDiskMode group world */
+        conf->putbuffer      = UNSET; /* GridSitePutBuffer     bytes       */
+        conf->putallocate    = UNSET; /* GridSitePutAllocate   on/off      */
+        conf->putwritebehind = UNSET; /* GridSitePutWriteBehind bytes      */
+        conf->putsync        = UNSET; /* GridSitePutSync       on/off      */
+        conf->putdirect      = UNSET; /* GridSitePutDirect     on/off      */
+      }
+
+    return conf;
+}
+
+static void *merge_gridsite_dir_config(apr_pool_t *p, void *vserver,
+                                                      void *vdirect)
+/* merge directory with server-wide directory configs */
+{
+    mod_gridsite_dir_cfg *conf, *server, *direct;
+
+    server = (mod_gridsite_dir_cfg *) vserver;
+    direct = (mod_gridsite_dir_cfg *) vdirect;
+    conf = apr_palloc(p, sizeof(*conf));
+
+    if (direct->auth != UNSET) conf->auth = direct->auth;
+    else                       conf->auth = server->auth;
+
+    if (direct->autopasscode != UNSET) conf->autopasscode = direct->autopasscode;
+    else                               conf->autopasscode = server->autopasscode;
+
+    if (direct->requirepasscode != UNSET) conf->requirepasscode = direct->requirepasscode;
+    else                               conf->requirepasscode = server->requirepasscode;
+
+    if (direct->zoneslashes != UNSET) conf->zoneslashes = direct->zoneslashes;
+    else                              conf->zoneslashes = server->zoneslashes;
+
+    if (direct->envs != UNSET) conf->envs = direct->envs;
+    else                       conf->envs = server->envs;
+        
+    if (direct->format != UNSET) conf->format = direct->format;
+    else                         conf->format = server->format;
+        
+    if (direct->indexes != UNSET) conf->indexes = direct->indexes;
+    else                          conf->indexes = server->indexes;
+        
+    if (direct->gridsitelink != UNSET) conf->gridsitelink=direct->gridsitelink;
+    else                               conf->gridsitelink=server->gridsitelink;
+
+    if (direct->indexheader != NULL) conf->indexheader = direct->indexheader;
+    else                             conf->indexheader = server->indexheader;
+        
+    if (direct->adminfile != NULL) conf->adminfile = direct->adminfile;
+    else                           conf->adminfile = server->adminfile;
+        
+    if (direct->adminuri != NULL) conf->adminuri = direct->adminuri;
+    else                          conf->adminuri = server->adminuri;
+        
+    if (direct->helpuri != NULL) conf->helpuri = direct->helpuri;
+    else                         conf->helpuri = server->helpuri;
+        
+    if (direct->loginuri != NULL) conf->loginuri = direct->loginuri;
+    else                          conf->loginuri = server->loginuri;
+
+    if (direct->dnlists != NULL) conf->dnlists = direct->dnlists;
+    else                         conf->dnlists = server->dnlists;
+        
+    if (direct->dnlistsuri != NULL) conf->dnlistsuri = direct->dnlistsuri;
+    else                            conf->dnlistsuri = server->dnlistsuri;
+
+    if (direct->adminlist != NULL) conf->adminlist = direct->adminlist;
+    else                           conf->adminlist = server->adminlist;
+
+    if (direct->gsiproxylimit != UNSET)
+                         conf->gsiproxylimit = direct->gsiproxylimit;
+    else                 conf->gsiproxylimit = server->gsiproxylimit;
+
+    if (direct->unzip != NULL) conf->unzip = direct->unzip;
+    else                       conf->unzip = server->unzip;
+
+    if (direct->methods != NULL) conf->methods = direct->methods;
+    else                         conf->methods = server->methods;
+
+    if (direct->editable != NULL) conf->editable = direct->editable;
+    else                          conf->editable = server->editable;
+
+    if (direct->headfile != NULL) conf->headfile = direct->headfile;
+    else                          conf->headfile = server->headfile;
+
+    if (direct->footfile != NULL) conf->footfile = direct->footfile;
+    else                          conf->footfile = server->footfile;
+
+    if (direct->gridhttp != UNSET) conf->gridhttp = direct->gridhttp;
+    else                           conf->gridhttp = server->gridhttp;
+        
+    if (direct->aclformat != NULL) conf->aclformat = direct->aclformat;
+    else                           conf->aclformat = server->aclformat;
+
+    if (direct->aclpath != NULL)   conf->aclpath = direct->aclpath;
+    else                           conf->aclpath = server->aclpath;
+
+    if (direct->delegationuri != NULL) conf->delegationuri = direct->delegationuri;
+    else                               conf->delegationuri = server->delegationuri;
+
+    if (direct->execmethod != NULL) conf->execmethod = direct->execmethod;
+    else                            conf->execmethod = server->execmethod;
+
+    if (direct->execugid.uid != UNSET)
+      { conf->execugid.uid = direct->execugid.uid;
+        conf->execugid.gid = direct->execugid.gid;
+        conf->execugid.userdir = direct->execugid.userdir; }
+    else
+      { conf->execugid.uid = server->execugid.uid;
+        conf->execugid.gid = server->execugid.gid;
+        conf->execugid.userdir = server->execugid.userdir; }
+
+    if (direct->diskmode != UNSET) conf->diskmode = direct->diskmode;
+    else                            conf->diskmode = server->diskmode;
+
+    if (direct->putbuffer != UNSET) conf->putbuffer = direct->putbuffer;
+    else                            conf->putbuffer = server->putbuffer;
+
+    if (direct->putallocate != UNSET) conf->putallocate = direct->putallocate;
+    else                              conf->putallocate = server->putallocate;
+
+    if (direct->putwritebehind != UNSET) 
+                             conf->putwritebehind = direct->putwritebehind;
+    else                     conf->putwritebehind = server->putwritebehind;
+
+    if (direct->putsync != UNSET) conf->putsync = direct->putsync;
+    else                          conf->putsync = server->putsync;
+
+    if (direct->putdirect != UNSET) conf->putdirect = direct->putdirect;
+    else                            conf->putdirect = server->putdirect;
+        
+    return conf;
+}
+
+static const char *mod_gridsite_take1_cmds(cmd_parms *a, void *cfg,
+                                           const char *parm)
+{
+    int   n, i;
+    char *p;
+  
+    if (strcasecmp(a->cmd->name, "GridSiteSessionsDir") == 0)
+    {
+      if (a->server->is_virtual)
+       return "GridSiteSessionsDir cannot be used inside a virtual server";
+    
+      sessionsdir = apr_pstrdup(a->pool, parm);
+    }
+/* GridSiteOnetimesDir is deprecated in favour of GridSiteSessionsDir */
+    else if (strcasecmp(a->cmd->name, "GridSiteOnetimesDir") == 0)
+    {
+      if (a->server->is_virtual)
+       return "GridSiteOnetimesDir cannot be used inside a virtual server";
+    
+      sessionsdir = apr_pstrdup(a->pool, parm);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteSessionsStore") == 0)
+    {
+      if (a->server->is_virtual)
+       return "GridSiteSessionsStore cannot be used inside a virtual server";
+
+      if (strcasecmp(parm, "files") == 0)
+        {
+#ifdef GRST_AP_SOCACHE
+          sessionsstore_provider = NULL;
+          sessionsstore          = NULL;
+#endif
+          return NULL;
+        }
+
+#ifdef GRST_AP_SOCACHE
+      {
+        const char *err, *sep, *name;
+
+        sep  = ap_strchr_c(parm, ':');
+        name = (sep == NULL) ? parm 
+                             : apr_pstrmemdup(a->temp_pool, parm, sep - parm);
+
+        sessionsstore_provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP,
+                                        name, AP_SOCACHE_PROVIDER_VERSION);
+        if (sessionsstore_provider == NULL)
+          return apr_psprintf(a->pool, "GridSiteSessionsStore: unknown "
+                   "store %s (is mod_socache_%s loaded?)", name, name);
+
+        err = sessionsstore_provider->create(&sessionsstore, 
+                          (sep == NULL) ? NULL : &sep[1], 
+                          a->temp_pool, a->pool);
+        if (err != NULL)
+          return apr_psprintf(a->pool, "GridSiteSessionsStore: %s", err);
+      }
+#else
+      return "GridSiteSessionsStore must be files with this Apache version";
+#endif
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteACLCache") == 0)
+    {
+      if (a->server->is_virtual)
+       return "GridSiteACLCache cannot be used inside a virtual server";
+
+      if (sscanf(parm, "%" APR_SIZE_T_FMT, &aclcachesize) != 1)
+        return "Failed parsing GridSiteACLCache numeric value";
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteSessionsSweep") == 0)
+    {
+      if (a->server->is_virtual)
+       return "GridSiteSessionsSweep cannot be used inside a virtual server";
+
+      sessionssweep = atoi(parm);
+
+      if (sessionssweep < 0)
+       return "GridSiteSessionsSweep must be 0 or greater";
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteSessionsSweepRate") == 0)
+    {
+      if (a->server->is_virtual)
+       return "GridSiteSessionsSweepRate cannot be used inside a virtual server";
+
+      sessionssweeprate = atoi(parm);
+
+      if (sessionssweeprate < 1)
+       return "GridSiteSessionsSweepRate must be greater than 0";
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteZoneSlashes") == 0)
     {
       ((mod_gridsite_dir_cfg *) cfg)->zoneslashes = atoi(parm);
       
       if (((mod_gridsite_dir_cfg *) cfg)->zoneslashes < 1)
        return "GridSiteZoneSlashes must be greater than 0";
     }
+    else if (strcasecmp(a->cmd->name, "GridSitePutBuffer") == 0)
+    {
+      n = -1;
+
+      if ((sscanf(parm, "%d", &n) != 1) || (n < GRST_PUT_ALIGN))
+       return "GridSitePutBuffer must be a number >= 4096";
+
+      /* whole pages, so O_DIRECT writes stay aligned */
+      ((mod_gridsite_dir_cfg *) cfg)->putbuffer = 
+                     (n + GRST_PUT_ALIGN - 1) & ~(GRST_PUT_ALIGN - 1);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSitePutWriteBehind") == 0)
+    {
+      if ((apr_strtoff(&(((mod_gridsite_dir_cfg *) cfg)->putwritebehind),
+                       parm, NULL, 10) != APR_SUCCESS) ||
+          (((mod_gridsite_dir_cfg *) cfg)->putwritebehind < 0))
+       return "GridSitePutWriteBehind must be a number >= 0";
+    }
     else if (strcasecmp(a->cmd->name, "GridSiteGridHTTPport") == 0)
     {
       gridhttpport = atoi(parm);
@@ -1940,758 +3114,1352 @@ static const char *mod_gridsite_take1_cmds(cmd_parms *a, void *cfg,
     {
       if (*parm != '/') return "GridSiteHelpURI must begin with /";
 
-      ((mod_gridsite_dir_cfg *) cfg)->helpuri =
-        apr_pstrdup(a->pool, parm);
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteDNlists") == 0)
+      ((mod_gridsite_dir_cfg *) cfg)->helpuri =
+        apr_pstrdup(a->pool, parm);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteDNlists") == 0)
+    {
+      ((mod_gridsite_dir_cfg *) cfg)->dnlists =
+        apr_pstrdup(a->pool, parm);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteDNlistsURI") == 0)
+    {
+      if (*parm != '/') return "GridSiteDNlistsURI must begin with /";
+
+      if ((*parm != '\0') && (parm[strlen(parm) - 1] == '/'))
+       ((mod_gridsite_dir_cfg *) cfg)->dnlistsuri =
+        apr_pstrdup(a->pool, parm);
+      else
+       ((mod_gridsite_dir_cfg *) cfg)->dnlistsuri =
+        apr_pstrcat(a->pool, parm, "/", NULL);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteAdminList") == 0)
+    {
+      ((mod_gridsite_dir_cfg *) cfg)->adminlist =
+        apr_pstrdup(a->pool, parm);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteGSIProxyLimit") == 0)
+    {
+      n = -1;
+    
+      if ((sscanf(parm, "%d", &n) == 1) && (n >= 0)) {
+		  if (n == 0)
+		      n = 1000; /* thousand is an African for "unlimited" */
+                  ((mod_gridsite_dir_cfg *) cfg)->gsiproxylimit = n;
+      }
+      else return "GridSiteGSIProxyLimit must be a number >= 0";     
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteUnzip") == 0)
+    {
+      if (*parm != '/') return "GridSiteUnzip must begin with /";
+     
+      ((mod_gridsite_dir_cfg *) cfg)->unzip =
+        apr_pstrdup(a->pool, parm);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteMethods") == 0)
+    {
+      ((mod_gridsite_dir_cfg *) cfg)->methods =
+        apr_psprintf(a->pool, " %s ", parm);
+       
+      for (p = ((mod_gridsite_dir_cfg *) cfg)->methods;
+           *p != '\0';
+           ++p) if (*p == '\t') *p = ' ';
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteOCSP") == 0)
+    {
+      ocspmodes = apr_psprintf(a->pool, " %s ", parm);
+       
+      for (p = ocspmodes; *p != '\0'; ++p)
+               if (*p == '\t') *p = ' ';
+               else *p = tolower(*p);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteEditable") == 0)
+    {
+      ((mod_gridsite_dir_cfg *) cfg)->editable =
+        apr_psprintf(a->pool, " %s ", parm);
+     
+      for (p = ((mod_gridsite_dir_cfg *) cfg)->editable;
+           *p != '\0';
+           ++p) if (*p == '\t') *p = ' ';
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteHeadFile") == 0)
+    {
+      ((mod_gridsite_dir_cfg *) cfg)->headfile =
+        apr_pstrdup(a->pool, parm);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteFootFile") == 0)
+    {
+      ((mod_gridsite_dir_cfg *) cfg)->footfile =
+        apr_pstrdup(a->pool, parm);
+    }  
+    else if (strcasecmp(a->cmd->name, "GridSiteIndexHeader") == 0)
+    {
+      if (index(parm, '/') != NULL) 
+           return "/ not permitted in GridSiteIndexHeader";
+
+      ((mod_gridsite_dir_cfg *) cfg)->indexheader =
+        apr_pstrdup(a->pool, parm);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteACLFormat") == 0)
+    {
+      if ((strcasecmp(parm,"GACL") != 0) &&
+          (strcasecmp(parm,"XACML") != 0))
+          return "GridsiteACLFormat must be either GACL or XACML";
+      
+      ((mod_gridsite_dir_cfg *) cfg)->aclformat = apr_pstrdup(a->pool, parm);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteACLPath") == 0)
+    {
+      ((mod_gridsite_dir_cfg *) cfg)->aclpath = apr_pstrdup(a->pool, parm);
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteDelegationURI") == 0)
+    {
+      if (*parm != '/') return "GridSiteDelegationURI must begin with /";
+
+      if (*parm != '\0')
+       ((mod_gridsite_dir_cfg *) cfg)->delegationuri =
+        apr_pstrdup(a->pool, parm);
+
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteExecMethod") == 0)
+    {
+      if (strcasecmp(parm, "nosetuid") == 0)
+        {
+          ((mod_gridsite_dir_cfg *) cfg)->execmethod = NULL;
+          return NULL;
+        }
+
+      if ((strcasecmp(parm, "suexec")    != 0) &&
+          (strcasecmp(parm, "X509DN")    != 0) &&
+          (strcasecmp(parm, "directory") != 0))
+          return "GridsiteExecMethod must be nosetuid, suexec, X509DN or directory";
+
+      ((mod_gridsite_dir_cfg *) cfg)->execmethod = apr_pstrdup(a->pool, parm);
+    }
+
+    return NULL;
+}
+
+static const char *mod_gridsite_take2_cmds(cmd_parms *a, void *cfg,
+                                       const char *parm1, const char *parm2)
+{
+    int   i;
+    char *p, *q, buf[APRMAXHOSTLEN + 1] = "localhost";
+    
+    if (strcasecmp(a->cmd->name, "GridSiteUserGroup") == 0)
+    {
+      if (!(ap_unixd_config.suexec_enabled))
+          return "Using GridSiteUserGroup will "
+                 "require rebuilding Apache with suexec support!";
+    
+      /* NB ap_uname2id/ap_gname2id are NOT thread safe - but OK
+         as long as not used in .htaccess, just at server start time */
+
+      ((mod_gridsite_dir_cfg *) cfg)->execugid.uid = ap_uname2id(parm1);
+      ((mod_gridsite_dir_cfg *) cfg)->execugid.gid = ap_gname2id(parm2);
+      ((mod_gridsite_dir_cfg *) cfg)->execugid.userdir = 0;
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteDiskMode") == 0)
+    {
+      if ((strcasecmp(parm1, "GroupNone" ) != 0) &&
+          (strcasecmp(parm1, "GroupRead" ) != 0) &&
+          (strcasecmp(parm1, "GroupWrite") != 0))
+        return "First parameter of GridSiteDiskMode must be "
+               "GroupNone, GroupRead or GroupWrite!";
+          
+      if ((strcasecmp(parm2, "WorldNone" ) != 0) &&
+          (strcasecmp(parm2, "WorldRead" ) != 0))
+        return "Second parameter of GridSiteDiskMode must be "
+               "WorldNone or WorldRead!";
+          
+      ((mod_gridsite_dir_cfg *) cfg)->diskmode = 
+       APR_UREAD | APR_UWRITE 
+       | ( APR_GREAD               * (strcasecmp(parm1, "GroupRead") == 0))
+       | ((APR_GREAD | APR_GWRITE) * (strcasecmp(parm1, "GroupWrite") == 0))
+       | ((APR_GREAD | APR_WREAD)  * (strcasecmp(parm2, "WorldRead") == 0));
+    }
+    else if (strcasecmp(a->cmd->name, "GridSiteCastAlias") == 0)
+    {
+      if ((parm1[strlen(parm1)-1] != '/') || (parm2[strlen(parm2)-1] != '/'))
+        return "GridSiteCastAlias URL and path must end with /";
+    
+      for (i=0; i < GRST_SITECAST_ALIASES; ++i) /* look for free slot */
+         {
+           if (sitecastaliases[i].sitecast_url == NULL)
+             {
+               sitecastaliases[i].scheme = apr_pstrdup(a->pool, parm1);
+
+               if (((p = index(sitecastaliases[i].scheme, ':')) == NULL)
+                   || (p[1] != '/') || (p[2] != '/'))
+                 return "GridSiteCastAlias URL must begin with scheme (http/https/gsiftp/...) and ://";
+
+               *p = '\0';
+               ++p;
+               while (*p == '/') ++p;
+             
+               if ((q = index(p, '/')) == NULL)
+                return "GridSiteCastAlias URL must be of form scheme://domain:port/dirs";
+
+               *q = '\0';
+
+               p = index(p, ':');
+               if (p == NULL)
+                 {
+                   return "GridSiteCastAlias URL must include the port number";
+                 }
+
+               if (sscanf(p, ":%d", &(sitecastaliases[i].port)) != 1)
+                 return "Unable to parse numeric port number in GridSiteCastAlias";
+
+               sitecastaliases[i].sitecast_url   = apr_pstrdup(a->pool, parm1);
+               sitecastaliases[i].local_path     = apr_pstrdup(a->pool, parm2);
+               
+               if (a->server->server_hostname == NULL)
+                 {
+                   apr_gethostname(buf, APRMAXHOSTLEN + 1, a->pool);
+                   sitecastaliases[i].local_hostname = apr_pstrdup(a->pool, buf);
+                 }
+               else sitecastaliases[i].local_hostname = apr_pstrdup(a->pool, 
+                                                   a->server->server_hostname);
+
+               break;
+             }
+         }
+    }
+    
+    return NULL;
+}
+
+static const char *mod_gridsite_flag_cmds(cmd_parms *a, void *cfg,
+                                      int flag)
+{
+    if      (strcasecmp(a->cmd->name, "GridSiteAuth") == 0)
     {
-      ((mod_gridsite_dir_cfg *) cfg)->dnlists =
-        apr_pstrdup(a->pool, parm);
+      ((mod_gridsite_dir_cfg *) cfg)->auth = flag;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteDNlistsURI") == 0)
+    else if (strcasecmp(a->cmd->name, "GridSiteAutoPasscode") == 0)
     {
-      if (*parm != '/') return "GridSiteDNlistsURI must begin with /";
-
-      if ((*parm != '\0') && (parm[strlen(parm) - 1] == '/'))
-       ((mod_gridsite_dir_cfg *) cfg)->dnlistsuri =
-        apr_pstrdup(a->pool, parm);
-      else
-       ((mod_gridsite_dir_cfg *) cfg)->dnlistsuri =
-        apr_pstrcat(a->pool, parm, "/", NULL);
+      ((mod_gridsite_dir_cfg *) cfg)->autopasscode = flag;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteAdminList") == 0)
+    else if (strcasecmp(a->cmd->name, "GridSiteRequirePasscode") == 0)
     {
-      ((mod_gridsite_dir_cfg *) cfg)->adminlist =
-        apr_pstrdup(a->pool, parm);
+      ((mod_gridsite_dir_cfg *) cfg)->requirepasscode = flag;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteGSIProxyLimit") == 0)
+    else if (strcasecmp(a->cmd->name, "GridSiteEnvs") == 0)
     {
-      n = -1;
-    
-      if ((sscanf(parm, "%d", &n) == 1) && (n >= 0)) {
-		  if (n == 0)
-		      n = 1000; /* thousand is an African for "unlimited" */
-                  ((mod_gridsite_dir_cfg *) cfg)->gsiproxylimit = n;
-      }
-      else return "GridSiteGSIProxyLimit must be a number >= 0";     
+      ((mod_gridsite_dir_cfg *) cfg)->envs = flag;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteUnzip") == 0)
+    else if (strcasecmp(a->cmd->name, "GridSiteHtmlFormat") == 0)
     {
-      if (*parm != '/') return "GridSiteUnzip must begin with /";
-     
-      ((mod_gridsite_dir_cfg *) cfg)->unzip =
-        apr_pstrdup(a->pool, parm);
+      ((mod_gridsite_dir_cfg *) cfg)->format = flag;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteMethods") == 0)
+    else if (strcasecmp(a->cmd->name, "GridSiteIndexes") == 0)
     {
-      ((mod_gridsite_dir_cfg *) cfg)->methods =
-        apr_psprintf(a->pool, " %s ", parm);
-       
-      for (p = ((mod_gridsite_dir_cfg *) cfg)->methods;
-           *p != '\0';
-           ++p) if (*p == '\t') *p = ' ';
+      ((mod_gridsite_dir_cfg *) cfg)->indexes = flag;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteOCSP") == 0)
+    else if (strcasecmp(a->cmd->name, "GridSiteLink") == 0)
     {
-      ocspmodes = apr_psprintf(a->pool, " %s ", parm);
-       
-      for (p = ocspmodes; *p != '\0'; ++p)
-               if (*p == '\t') *p = ' ';
-               else *p = tolower(*p);
+      ((mod_gridsite_dir_cfg *) cfg)->gridsitelink = flag;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteEditable") == 0)
+    else if (strcasecmp(a->cmd->name, "GridSiteGridHTTP") == 0)
     {
-      ((mod_gridsite_dir_cfg *) cfg)->editable =
-        apr_psprintf(a->pool, " %s ", parm);
-     
-      for (p = ((mod_gridsite_dir_cfg *) cfg)->editable;
-           *p != '\0';
-           ++p) if (*p == '\t') *p = ' ';
+// TODO: return error if try this on non-HTTPS virtual server
+
+      ((mod_gridsite_dir_cfg *) cfg)->gridhttp = flag;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteHeadFile") == 0)
+    else if (strcasecmp(a->cmd->name, "GridSitePutAllocate") == 0)
     {
-      ((mod_gridsite_dir_cfg *) cfg)->headfile =
-        apr_pstrdup(a->pool, parm);
+      ((mod_gridsite_dir_cfg *) cfg)->putallocate = flag;
     }
-    else if (strcasecmp(a->cmd->name, "GridSiteFootFile") == 0)
+    else if (strcasecmp(a->cmd->name, "GridSitePutSync") == 0)
     {
-      ((mod_gridsite_dir_cfg *) cfg)->footfile =
-        apr_pstrdup(a->pool, parm);
-    }  
-    else if (strcasecmp(a->cmd->name, "GridSiteIndexHeader") == 0)
+      ((mod_gridsite_dir_cfg *) cfg)->putsync = flag;
+    }
+    else if (strcasecmp(a->cmd->name, "GridSitePutDirect") == 0)
     {
-      if (index(parm, '/') != NULL) 
-           return "/ not permitted in GridSiteIndexHeader";
+      ((mod_gridsite_dir_cfg *) cfg)->putdirect = flag;
+    }
+
+    return NULL;
+}
+
+static const command_rec mod_gridsite_cmds[] =
+{
+// TODO: need to check and document valid contexts for each command!
+
+    AP_INIT_FLAG("GridSiteAuth", mod_gridsite_flag_cmds, 
+                 NULL, OR_FILEINFO, "on or off"),
+    AP_INIT_FLAG("GridSiteAutoPasscode", mod_gridsite_flag_cmds,
+                 NULL, OR_FILEINFO, "on or off"),
+    AP_INIT_FLAG("GridSiteRequirePasscode", mod_gridsite_flag_cmds,
+                 NULL, OR_FILEINFO, "on or off"),
+    AP_INIT_FLAG("GridSiteEnvs", mod_gridsite_flag_cmds, 
+                 NULL, OR_FILEINFO, "on or off"),
+    AP_INIT_FLAG("GridSiteHtmlFormat", mod_gridsite_flag_cmds, 
+                 NULL, OR_FILEINFO, "on or off"),
+    AP_INIT_FLAG("GridSiteIndexes", mod_gridsite_flag_cmds, 
+                 NULL, OR_FILEINFO, "on or off"),
+    AP_INIT_FLAG("GridSiteLink", mod_gridsite_flag_cmds, 
+                 NULL, OR_FILEINFO, "on or off"),
+                 
+    AP_INIT_TAKE1("GridSiteAdminFile", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "Ghost per-directory admin CGI"),
+    AP_INIT_TAKE1("GridSiteAdminURI", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "URI of real gridsite-admin.cgi"),
+    AP_INIT_TAKE1("GridSiteHelpURI", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "URI of Website Help pages"),
+    AP_INIT_TAKE1("GridSiteLoginURI", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "URI prefix of login/logout page"),
+    AP_INIT_TAKE1("GridSiteDNlists", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "DN Lists directories search path"),
+    AP_INIT_TAKE1("GridSiteDNlistsURI", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "URI of published DN lists"),
+    AP_INIT_TAKE1("GridSiteAdminList", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "URI of admin DN List"),
+    AP_INIT_TAKE1("GridSiteGSIProxyLimit", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "Max level of GSI proxy validity"),
+    AP_INIT_TAKE1("GridSiteUnzip", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "Absolute path to unzip command"),
+
+    AP_INIT_RAW_ARGS("GridSiteMethods", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "permitted HTTP methods"),
+    AP_INIT_RAW_ARGS("GridSiteOCSP", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "Set OCSP lookups"),
+    AP_INIT_RAW_ARGS("GridSiteEditable", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "editable file extensions"),
+    AP_INIT_TAKE1("GridSiteHeadFile", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "filename of HTML header"),
+    AP_INIT_TAKE1("GridSiteFootFile", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "filename of HTML footer"),
+    AP_INIT_TAKE1("GridSiteIndexHeader", mod_gridsite_take1_cmds,
+                   NULL, OR_FILEINFO, "filename of directory header"),
+    
+    AP_INIT_FLAG("GridSiteGridHTTP", mod_gridsite_flag_cmds,
+                 NULL, OR_FILEINFO, "on or off"),
+    AP_INIT_TAKE1("GridSiteGridHTTPport", mod_gridsite_take1_cmds,
+                   NULL, RSRC_CONF, "GridHTTP port"),
+    AP_INIT_TAKE1("GridSiteSessionsDir", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "directory with GridHTTP passcodes and SSL session creds"),
+/* GridSiteOnetimesDir is deprecated in favour of GridSiteSessionsDir */
+    AP_INIT_TAKE1("GridSiteOnetimesDir", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "directory with GridHTTP passcodes"),
+    AP_INIT_TAKE1("GridSiteSessionsStore", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "files or shared object cache for SSL session creds"),
+    AP_INIT_TAKE1("GridSiteSessionsSweep", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "seconds between sweeps of the sessions directory"),
+    AP_INIT_TAKE1("GridSiteSessionsSweepRate", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "files per second examined by the sweeper"),
+    AP_INIT_TAKE1("GridSiteZoneSlashes", mod_gridsite_take1_cmds,
+                 NULL, OR_FILEINFO, "number of slashes in passcode cookie paths"),
+
+    AP_INIT_TAKE1("GridSiteCastDNlists", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "DN Lists directories search path for SiteCast"),
+    AP_INIT_TAKE1("GridSiteCastUniPort", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "UDP port for unicast/replies"),
+    AP_INIT_TAKE1("GridSiteCastGroup", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "multicast group[:port] to listen for HTCP on"),
+    AP_INIT_TAKE2("GridSiteCastAlias", mod_gridsite_take2_cmds,
+                 NULL, RSRC_CONF, "URL and local path mapping"),
+
+    AP_INIT_TAKE1("GridSiteACLFormat", mod_gridsite_take1_cmds,
+                 NULL, OR_FILEINFO, "format to save access control lists in"),
+    AP_INIT_TAKE1("GridSiteACLPath", mod_gridsite_take1_cmds,
+                 NULL, OR_FILEINFO, "explicit location of access control file"),
+    AP_INIT_TAKE1("GridSiteACLCache", mod_gridsite_take1_cmds,
+                 NULL, RSRC_CONF, "bytes of shared memory for parsed ACLs"),
+
+    AP_INIT_TAKE1("GridSiteDelegationURI", mod_gridsite_take1_cmds,
+                 NULL, OR_FILEINFO, "URI of the delegation service CGI"),
+
+    AP_INIT_TAKE1("GridSiteExecMethod", mod_gridsite_take1_cmds,
+                 NULL, OR_FILEINFO, "execution strategy used by gsexec"),
+                 
+    AP_INIT_TAKE2("GridSiteUserGroup", mod_gridsite_take2_cmds, 
+                  NULL, OR_FILEINFO,
+                  "user and group of gsexec processes in suexec mode"),
+          
+    AP_INIT_TAKE2("GridSiteDiskMode", mod_gridsite_take2_cmds, 
+                  NULL, OR_FILEINFO,
+                  "group and world file modes for new files/directories"),
+
+    AP_INIT_TAKE1("GridSitePutBuffer", mod_gridsite_take1_cmds,
+                 NULL, OR_FILEINFO, "bytes of aligned buffer for PUT bodies"),
+    AP_INIT_FLAG("GridSitePutAllocate", mod_gridsite_flag_cmds,
+                 NULL, OR_FILEINFO, "on or off"),
+    AP_INIT_TAKE1("GridSitePutWriteBehind", mod_gridsite_take1_cmds,
+                 NULL, OR_FILEINFO, "bytes written by PUT between writebacks"),
+    AP_INIT_FLAG("GridSitePutSync", mod_gridsite_flag_cmds,
+                 NULL, OR_FILEINFO, "on or off"),
+    AP_INIT_FLAG("GridSitePutDirect", mod_gridsite_flag_cmds,
+                 NULL, OR_FILEINFO, "on or off"),
+          
+    {NULL}
+};
+
+/*  Blank unset these HTTP headers, to prevent injection attacks.
+    This is run before mod_shib's check_user_id hook, which may
+    legitimately create such headers.                           */
+
+static int mod_gridsite_check_user_id(request_rec *r)
+{
+    apr_table_unset(r->headers_in, "User-Distinguished-Name");
+#if 0
+    apr_table_unset(r->headers_in, "User-Distinguished-Name-2");
+#endif
+    apr_table_unset(r->headers_in, "Nist-LoA");
+    apr_table_unset(r->headers_in, "LoA");
+    apr_table_unset(r->headers_in, "VOMS-Attribute");
+
+    return DECLINED; /* ie carry on processing request */
+}
+
+static int mod_gridsite_first_fixups(request_rec *r)
+{
+    mod_gridsite_dir_cfg *conf;
+
+    if (r->finfo.filetype != APR_DIR) return DECLINED;
+
+    conf = (mod_gridsite_dir_cfg *)
+                    ap_get_module_config(r->per_dir_config, &gridsite_module);
+
+    /* we handle DN Lists as regular files, even if they also match
+       directory names  */
+
+    if ((conf != NULL) &&
+        (conf->dnlistsuri != NULL) &&
+        (strncmp(r->uri, conf->dnlistsuri, strlen(conf->dnlistsuri)) == 0) &&
+        (strcmp(r->uri, conf->dnlistsuri) != 0))
+      {
+        r->finfo.filetype = APR_REG; 
+      }
+
+    return DECLINED;
+}  
+
+
+static void GRST_parse_ssl_creds(conn_rec *conn, char *line)
+/*
+    Parse one line of a saved SSL creds record into the connection notes
+*/
+{
+   int   i;
+   char *p;
+   
+   if ((p = index(line, '\n')) != NULL) *p = '\0';
+   if ((p = index(line, '=')) == NULL) return;
+
+   if ((sscanf(line, "GRST_CRED_AURI_%d=", &i) == 1) ||
+       (sscanf(line, "GRST_CRED_VALID_%d=", &i) == 1) ||
+       (sscanf(line, "GRST_OCSP_URL_%d=", &i) == 1))
+     {
+       apr_table_setn(conn->notes, apr_pstrmemdup(conn->pool, line, p - line),
+                                   apr_pstrdup(conn->pool, &p[1]));
+     }
+}
+
+int GRST_get_session_id(SSL *ssl, char *session_id, size_t len)
+{
+   int          i;
+   SSL_SESSION *session;
+   unsigned int sess_len;
+   const unsigned char *sess_id;
+
+   session = SSL_get_session(ssl);
+   if (session == NULL)
+      return GRST_RET_FAILED;
+
+   sess_id = SSL_SESSION_get_id(session, &sess_len);
+   if (sess_len == 0)
+      return GRST_RET_FAILED;
+
+   if (2 * sess_len + 1 > len) 
+      return GRST_RET_FAILED;
+
+   for (i=0; i < sess_len; ++i)
+    sprintf(&(session_id[i*2]), "%02X", sess_id[i]);
 
-      ((mod_gridsite_dir_cfg *) cfg)->indexheader =
-        apr_pstrdup(a->pool, parm);
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteACLFormat") == 0)
-    {
-      if ((strcasecmp(parm,"GACL") != 0) &&
-          (strcasecmp(parm,"XACML") != 0))
-          return "GridsiteACLFormat must be either GACL or XACML";
+   session_id[i*2] = '\0';
+   
+   return GRST_RET_OK;
+}
+
+int GRST_load_ssl_creds(SSL *ssl, conn_rec *conn)
+{
+   char session_id[(SSL_MAX_SSL_SESSION_ID_LENGTH+1)*2+1], *sessionfile = NULL,
+        line[512], *record, *p, *q;
+   apr_file_t  *fp = NULL;
+   apr_status_t status;
       
-      ((mod_gridsite_dir_cfg *) cfg)->aclformat = apr_pstrdup(a->pool, parm);
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteACLPath") == 0)
-    {
-      ((mod_gridsite_dir_cfg *) cfg)->aclpath = apr_pstrdup(a->pool, parm);
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteDelegationURI") == 0)
-    {
-      if (*parm != '/') return "GridSiteDelegationURI must begin with /";
+   if (GRST_get_session_id(ssl, session_id, sizeof(session_id)) != GRST_RET_OK)
+     return GRST_RET_FAILED;
 
-      if (*parm != '\0')
-       ((mod_gridsite_dir_cfg *) cfg)->delegationuri =
-        apr_pstrdup(a->pool, parm);
+   status = sessionsstore_get(conn->base_server,
+                 apr_pstrcat(conn->pool, "sslcreds-", session_id, NULL),
+                 &record, conn->pool);
 
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteExecMethod") == 0)
-    {
-      if (strcasecmp(parm, "nosetuid") == 0)
-        {
-          ((mod_gridsite_dir_cfg *) cfg)->execmethod = NULL;
-          return NULL;
-        }
+   if (status == APR_SUCCESS)
+     {
+       for (p = record; *p != '\0'; p = q)
+          {
+            if ((q = index(p, '\n')) != NULL) *(q++) = '\0';
+            else q = &p[strlen(p)];
+            
+            GRST_parse_ssl_creds(conn, p);
+          }
+     }
+   else /* no store, or creds too big for it, were saved in a file */
+     {
+       sessionfile = apr_psprintf(conn->pool, "%s/sslcreds-%s",
+                         ap_server_root_relative(conn->pool, sessionsdir),
+                         session_id);
 
-      if ((strcasecmp(parm, "suexec")    != 0) &&
-          (strcasecmp(parm, "X509DN")    != 0) &&
-          (strcasecmp(parm, "directory") != 0))
-          return "GridsiteExecMethod must be nosetuid, suexec, X509DN or directory";
+       if (apr_file_open(&fp, sessionfile, APR_READ, 0, conn->pool) 
+                                                           != APR_SUCCESS)
+         return GRST_RET_FAILED;
+   
+       while (apr_file_gets(line, sizeof(line), fp) == APR_SUCCESS)
+            GRST_parse_ssl_creds(conn, line);
+        
+       apr_file_close(fp);
+     }
 
-      ((mod_gridsite_dir_cfg *) cfg)->execmethod = apr_pstrdup(a->pool, parm);
-    }
+   /* connection notes created by GRST_save_ssl_creds() are now reloaded */
+   apr_table_set(conn->notes, "GRST_save_ssl_creds", "yes");
 
-    return NULL;
+   return GRST_RET_OK;
 }
 
-static const char *mod_gridsite_take2_cmds(cmd_parms *a, void *cfg,
-                                       const char *parm1, const char *parm2)
+/*
+    Save result of AURIs and validity info from chain into connection notes,
+    and write out in an SSL session creds file.
+*/
+
+void GRST_save_ssl_creds(conn_rec *conn, GRSTx509Chain *grst_chain)
 {
-    int   i;
-    char *p, *q, buf[APRMAXHOSTLEN + 1] = "localhost";
-    
-    if (strcasecmp(a->cmd->name, "GridSiteUserGroup") == 0)
-    {
-      if (!(ap_unixd_config.suexec_enabled))
-          return "Using GridSiteUserGroup will "
-                 "require rebuilding Apache with suexec support!";
-    
-      /* NB ap_uname2id/ap_gname2id are NOT thread safe - but OK
-         as long as not used in .htaccess, just at server start time */
+   int          i, lowest_voms_delegation = 65535;
+   char        *tempfile = NULL, *encoded, *voms_fqans = NULL, *record = "",
+               *sessionfile, session_id[(SSL_MAX_SSL_SESSION_ID_LENGTH+1)*2];
+   apr_file_t  *fp = NULL;
+   SSL         *ssl;
+   SSLConnRec  *sslconn;
+   int          have_session_id = 0;
+   GRSTx509Cert  *grst_cert = NULL;
 
-      ((mod_gridsite_dir_cfg *) cfg)->execugid.uid = ap_uname2id(parm1);
-      ((mod_gridsite_dir_cfg *) cfg)->execugid.gid = ap_gname2id(parm2);
-      ((mod_gridsite_dir_cfg *) cfg)->execugid.userdir = 0;
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteDiskMode") == 0)
-    {
-      if ((strcasecmp(parm1, "GroupNone" ) != 0) &&
-          (strcasecmp(parm1, "GroupRead" ) != 0) &&
-          (strcasecmp(parm1, "GroupWrite") != 0))
-        return "First parameter of GridSiteDiskMode must be "
-               "GroupNone, GroupRead or GroupWrite!";
+   /* check if already done */
+
+   if ((grst_chain != NULL) && (conn->notes != NULL) &&
+       (apr_table_get(conn->notes, "GRST_save_ssl_creds") != NULL)) return;
+
+   /* we at least need to say we've been run - even if creds not save-able*/
+
+   apr_table_set(conn->notes, "GRST_save_ssl_creds", "yes");
+   ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
+                                            "set GRST_save_ssl_creds");
+
+   sslconn = (SSLConnRec *)ap_get_module_config(conn->conn_config,&ssl_module);
+
+   if ((sslconn != NULL) && 
+       ((ssl = sslconn->ssl) != NULL) &&
+       (GRST_get_session_id(ssl,session_id,sizeof(session_id)) == GRST_RET_OK))
+     have_session_id = 1;
+
+   i=0;
+   
+   for (grst_cert = grst_chain->firstcert;
+        grst_cert != NULL; grst_cert = grst_cert->next)
+      {
+        if (grst_cert->errors) continue;
+        
+        if (grst_cert->type == GRST_CERT_TYPE_VOMS)
+          {
+            /* want to record the delegation level 
+               of the last proxy with VOMS attributes */
           
-      if ((strcasecmp(parm2, "WorldNone" ) != 0) &&
-          (strcasecmp(parm2, "WorldRead" ) != 0))
-        return "Second parameter of GridSiteDiskMode must be "
-               "WorldNone or WorldRead!";
+            lowest_voms_delegation = grst_cert->delegation;
+          }
+        else if ((grst_cert->type == GRST_CERT_TYPE_EEC) ||
+                 (grst_cert->type == GRST_CERT_TYPE_PROXY))
+          {
+            encoded = GRSThttpUrlMildencode(grst_cert->dn);
           
-      ((mod_gridsite_dir_cfg *) cfg)->diskmode = 
-       APR_UREAD | APR_UWRITE 
-       | ( APR_GREAD               * (strcasecmp(parm1, "GroupRead") == 0))
-       | ((APR_GREAD | APR_GWRITE) * (strcasecmp(parm1, "GroupWrite") == 0))
-       | ((APR_GREAD | APR_WREAD)  * (strcasecmp(parm2, "WorldRead") == 0));
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteCastAlias") == 0)
-    {
-      if ((parm1[strlen(parm1)-1] != '/') || (parm2[strlen(parm2)-1] != '/'))
-        return "GridSiteCastAlias URL and path must end with /";
-    
-      for (i=0; i < GRST_SITECAST_ALIASES; ++i) /* look for free slot */
-         {
-           if (sitecastaliases[i].sitecast_url == NULL)
-             {
-               sitecastaliases[i].scheme = apr_pstrdup(a->pool, parm1);
+            apr_table_setn(conn->notes,
+                   apr_psprintf(conn->pool, "GRST_CRED_AURI_%d", i),
+                   apr_pstrcat(conn->pool, "dn:", encoded, NULL));
 
-               if (((p = index(sitecastaliases[i].scheme, ':')) == NULL)
-                   || (p[1] != '/') || (p[2] != '/'))
-                 return "GridSiteCastAlias URL must begin with scheme (http/https/gsiftp/...) and ://";
+            record = apr_psprintf(conn->pool, "%sGRST_CRED_AURI_%d=dn:%s\n",
+                                                record, i, encoded);
 
-               *p = '\0';
-               ++p;
-               while (*p == '/') ++p;
-             
-               if ((q = index(p, '/')) == NULL)
-                return "GridSiteCastAlias URL must be of form scheme://domain:port/dirs";
+            apr_table_setn(conn->notes,
+                   apr_psprintf(conn->pool, "GRST_CRED_VALID_%d", i),
+                   apr_psprintf(conn->pool, 
+                      "notbefore=%ld notafter=%ld delegation=%d nist-loa=%d", 
+                      grst_cert->notbefore,
+                      grst_cert->notafter,
+                      grst_cert->delegation, 0));
+
+            record = apr_psprintf(conn->pool,
+"%sGRST_CRED_VALID_%d=notbefore=%ld notafter=%ld delegation=%d nist-loa=%d\n",
+                                            record, i, grst_cert->notbefore,
+                                               grst_cert->notafter, 
+                                               grst_cert->delegation, 0);
+
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
+                      "store GRST_CRED_AURI_%d=dn:%s", i, encoded);
+
+            free(encoded);
+
+            ++i;
+          }
+        else if (grst_cert->type == GRST_CERT_TYPE_ROBOT)
+          {
+            apr_table_setn(conn->notes, "GRST_ROBOT_DN", apr_pstrdup(conn->pool, grst_cert->dn));
+            /* I ignore the sslcreds cache here */
+          }
+      }
+
+   for (grst_cert = grst_chain->firstcert; 
+        grst_cert != NULL; grst_cert = grst_cert->next)
+      {
+        if (grst_cert->errors) continue;
+        
+        if ((grst_cert->type == GRST_CERT_TYPE_VOMS) &&
+            (grst_cert->delegation == lowest_voms_delegation))
+          {
+            /* only export attributes from the last proxy to contain them */
+
+            encoded = GRSThttpUrlMildencode(grst_cert->value);
+          
+            apr_table_setn(conn->notes,
+                   apr_psprintf(conn->pool, "GRST_CRED_AURI_%d", i),
+                   apr_pstrcat(conn->pool, "fqan:", encoded, NULL));
+
+            if (voms_fqans != NULL)
+              {
+                voms_fqans = apr_pstrcat(conn->pool, encoded, ";", voms_fqans, NULL);
+              }
+            else
+              {
+                voms_fqans = apr_pstrcat(conn->pool, encoded, NULL);
+              }
+            record = apr_psprintf(conn->pool, "%sGRST_CRED_AURI_%d=fqan:%s\n",
+                                                record, i, encoded);
+
+            apr_table_setn(conn->notes,
+                   apr_psprintf(conn->pool, "GRST_CRED_VALID_%d", i),
+                   apr_psprintf(conn->pool, 
+                      "notbefore=%ld notafter=%ld delegation=%d nist-loa=%d", 
+                      grst_cert->notbefore,
+                      grst_cert->notafter, 
+                      grst_cert->delegation, 0));
+
+            record = apr_psprintf(conn->pool,
+"%sGRST_CRED_VALID_%d=notbefore=%ld notafter=%ld delegation=%d nist-loa=%d\n",
+                                            record, i, grst_cert->notbefore,
+                                               grst_cert->notafter,
+                                               grst_cert->delegation, 0);
+
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
+                      "store GRST_CRED_AURI_%d=fqan:%s", i, encoded);
+
+            free(encoded);
+
+            ++i;
+          }
+      }
+
+   if (voms_fqans != NULL)
+     {
+       apr_table_setn(conn->notes, "GRST_VOMS_FQANS", voms_fqans);
+       record = apr_psprintf(conn->pool, "%sGRST_VOMS_FQANS=%s\n", 
+                                         record, voms_fqans);
+       ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
+                      "store GRST_VOMS_FQANS=%s", voms_fqans);
+     }
+
+
+   /* this needs to be merged into grst_x509? */
+#if 0
+   if (ocspmodes != NULL)
+   {
+     int   j;
+     const char *ex_sn;
+     char s[80];
+     X509 *cert;     
+     X509_EXTENSION *ex;
+     
+     for (j=sk_X509_num(certstack)-1; j >= 0; --j)
+        {
+          cert = sk_X509_value(certstack, j);
+          
+          for (i=0; i < X509_get_ext_count(cert); ++i)
+             {
+               ex = X509_get_ext(cert, i);
 
-               *q = '\0';
+               OBJ_obj2txt(s, sizeof(s), X509_EXTENSION_get_object(ex), 0);
 
-               p = index(p, ':');
-               if (p == NULL)
+               if (strcmp(s, "authorityInfoAccess") == 0) /* OCSP */
                  {
-                   return "GridSiteCastAlias URL must include the port number";
-                 }
+                   apr_table_setn(conn->notes, "GRST_OCSP_URL",
+                                  (const char *) X509_EXTENSION_get_data(ex));
 
-               if (sscanf(p, ":%d", &(sitecastaliases[i].port)) != 1)
-                 return "Unable to parse numeric port number in GridSiteCastAlias";
+                   /* strategy is to remove what has been checked, 
+                      for this connnection */
+                   apr_table_set(conn->notes, "GRST_OCSP_UNCHECKED",
+                                 ocspmodes);
 
-               sitecastaliases[i].sitecast_url   = apr_pstrdup(a->pool, parm1);
-               sitecastaliases[i].local_path     = apr_pstrdup(a->pool, parm2);
-               
-               if (a->server->server_hostname == NULL)
-                 {
-                   apr_gethostname(buf, APRMAXHOSTLEN + 1, a->pool);
-                   sitecastaliases[i].local_hostname = apr_pstrdup(a->pool, buf);
-                 }
-               else sitecastaliases[i].local_hostname = apr_pstrdup(a->pool, 
-                                                   a->server->server_hostname);
+                   ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
+                "store GRST_OCSP_URL_%d=%s", i, X509_EXTENSION_get_data(ex));
 
-               break;
+                   record = apr_psprintf(conn->pool, "%sGRST_OCSP_URL_%d=%s\n",
+                                   record, i, X509_EXTENSION_get_data(ex));
+                 }
              }
-         }
-    }
-    
-    return NULL;
-}
-
-static const char *mod_gridsite_flag_cmds(cmd_parms *a, void *cfg,
-                                      int flag)
-{
-    if      (strcasecmp(a->cmd->name, "GridSiteAuth") == 0)
-    {
-      ((mod_gridsite_dir_cfg *) cfg)->auth = flag;
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteAutoPasscode") == 0)
-    {
-      ((mod_gridsite_dir_cfg *) cfg)->autopasscode = flag;
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteRequirePasscode") == 0)
-    {
-      ((mod_gridsite_dir_cfg *) cfg)->requirepasscode = flag;
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteEnvs") == 0)
-    {
-      ((mod_gridsite_dir_cfg *) cfg)->envs = flag;
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteHtmlFormat") == 0)
-    {
-      ((mod_gridsite_dir_cfg *) cfg)->format = flag;
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteIndexes") == 0)
-    {
-      ((mod_gridsite_dir_cfg *) cfg)->indexes = flag;
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteLink") == 0)
-    {
-      ((mod_gridsite_dir_cfg *) cfg)->gridsitelink = flag;
-    }
-    else if (strcasecmp(a->cmd->name, "GridSiteGridHTTP") == 0)
-    {
-// TODO: return error if try this on non-HTTPS virtual server
-
-      ((mod_gridsite_dir_cfg *) cfg)->gridhttp = flag;
-    }
+        }   
+   }
+#endif
+   /* end of bit that needs to go into grst_x509 */
+     
+   if (!have_session_id) return;
 
-    return NULL;
-}
+   /* use the shared sessions store if we have one, otherwise a file */
 
-static const command_rec mod_gridsite_cmds[] =
-{
-// TODO: need to check and document valid contexts for each command!
+   if (sessionsstore_put(conn->base_server,
+                 apr_pstrcat(conn->pool, "sslcreds-", session_id, NULL),
+                 record, sessionsstore_expiry(conn->base_server),
+                 conn->pool) == APR_SUCCESS) return;
 
-    AP_INIT_FLAG("GridSiteAuth", mod_gridsite_flag_cmds, 
-                 NULL, OR_FILEINFO, "on or off"),
-    AP_INIT_FLAG("GridSiteAutoPasscode", mod_gridsite_flag_cmds,
-                 NULL, OR_FILEINFO, "on or off"),
-    AP_INIT_FLAG("GridSiteRequirePasscode", mod_gridsite_flag_cmds,
-                 NULL, OR_FILEINFO, "on or off"),
-    AP_INIT_FLAG("GridSiteEnvs", mod_gridsite_flag_cmds, 
-                 NULL, OR_FILEINFO, "on or off"),
-    AP_INIT_FLAG("GridSiteHtmlFormat", mod_gridsite_flag_cmds, 
-                 NULL, OR_FILEINFO, "on or off"),
-    AP_INIT_FLAG("GridSiteIndexes", mod_gridsite_flag_cmds, 
-                 NULL, OR_FILEINFO, "on or off"),
-    AP_INIT_FLAG("GridSiteLink", mod_gridsite_flag_cmds, 
-                 NULL, OR_FILEINFO, "on or off"),
-                 
-    AP_INIT_TAKE1("GridSiteAdminFile", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "Ghost per-directory admin CGI"),
-    AP_INIT_TAKE1("GridSiteAdminURI", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "URI of real gridsite-admin.cgi"),
-    AP_INIT_TAKE1("GridSiteHelpURI", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "URI of Website Help pages"),
-    AP_INIT_TAKE1("GridSiteLoginURI", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "URI prefix of login/logout page"),
-    AP_INIT_TAKE1("GridSiteDNlists", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "DN Lists directories search path"),
-    AP_INIT_TAKE1("GridSiteDNlistsURI", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "URI of published DN lists"),
-    AP_INIT_TAKE1("GridSiteAdminList", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "URI of admin DN List"),
-    AP_INIT_TAKE1("GridSiteGSIProxyLimit", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "Max level of GSI proxy validity"),
-    AP_INIT_TAKE1("GridSiteUnzip", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "Absolute path to unzip command"),
+   sessionfile = apr_psprintf(conn->pool, "%s/sslcreds-%s",
+                         ap_server_root_relative(conn->pool, sessionsdir),
+                         session_id);
 
-    AP_INIT_RAW_ARGS("GridSiteMethods", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "permitted HTTP methods"),
-    AP_INIT_RAW_ARGS("GridSiteOCSP", mod_gridsite_take1_cmds,
-                 NULL, RSRC_CONF, "Set OCSP lookups"),
-    AP_INIT_RAW_ARGS("GridSiteEditable", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "editable file extensions"),
-    AP_INIT_TAKE1("GridSiteHeadFile", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "filename of HTML header"),
-    AP_INIT_TAKE1("GridSiteFootFile", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "filename of HTML footer"),
-    AP_INIT_TAKE1("GridSiteIndexHeader", mod_gridsite_take1_cmds,
-                   NULL, OR_FILEINFO, "filename of directory header"),
-    
-    AP_INIT_FLAG("GridSiteGridHTTP", mod_gridsite_flag_cmds,
-                 NULL, OR_FILEINFO, "on or off"),
-    AP_INIT_TAKE1("GridSiteGridHTTPport", mod_gridsite_take1_cmds,
-                   NULL, RSRC_CONF, "GridHTTP port"),
-    AP_INIT_TAKE1("GridSiteSessionsDir", mod_gridsite_take1_cmds,
-                 NULL, RSRC_CONF, "directory with GridHTTP passcodes and SSL session creds"),
-/* GridSiteOnetimesDir is deprecated in favour of GridSiteSessionsDir */
-    AP_INIT_TAKE1("GridSiteOnetimesDir", mod_gridsite_take1_cmds,
-                 NULL, RSRC_CONF, "directory with GridHTTP passcodes"),
-    AP_INIT_TAKE1("GridSiteZoneSlashes", mod_gridsite_take1_cmds,
-                 NULL, OR_FILEINFO, "number of slashes in passcode cookie paths"),
+   tempfile = apr_pstrcat(conn->pool, 
+                          ap_server_root_relative(conn->pool, sessionsdir), 
+                          "/tmp-XXXXXX", NULL);
+   
+   if ((tempfile != NULL) && (tempfile[0] != '\0') &&
+       (apr_file_mktemp(&fp, tempfile, APR_CREATE | APR_WRITE | APR_EXCL,
+                        conn->pool) == APR_SUCCESS))
+     {
+       apr_file_puts(record, fp);
+       apr_file_close(fp);
+       apr_file_rename(tempfile, sessionfile, conn->pool);
+     }
+}
 
-    AP_INIT_TAKE1("GridSiteCastDNlists", mod_gridsite_take1_cmds,
-                 NULL, RSRC_CONF, "DN Lists directories search path for SiteCast"),
-    AP_INIT_TAKE1("GridSiteCastUniPort", mod_gridsite_take1_cmds,
-                 NULL, RSRC_CONF, "UDP port for unicast/replies"),
-    AP_INIT_TAKE1("GridSiteCastGroup", mod_gridsite_take1_cmds,
-                 NULL, RSRC_CONF, "multicast group[:port] to listen for HTCP on"),
-    AP_INIT_TAKE2("GridSiteCastAlias", mod_gridsite_take2_cmds,
-                 NULL, RSRC_CONF, "URL and local path mapping"),
+static char *get_aclpath_component(request_rec *r, int n)
+/*
+    Get the nth component of REQUEST_URI, or component 0
+    which is the server name.
 
-    AP_INIT_TAKE1("GridSiteACLFormat", mod_gridsite_take1_cmds,
-                 NULL, OR_FILEINFO, "format to save access control lists in"),
-    AP_INIT_TAKE1("GridSiteACLPath", mod_gridsite_take1_cmds,
-                 NULL, OR_FILEINFO, "explicit location of access control file"),
+*/
+{
+    int ii, i, nn;
 
-    AP_INIT_TAKE1("GridSiteDelegationURI", mod_gridsite_take1_cmds,
-                 NULL, OR_FILEINFO, "URI of the delegation service CGI"),
+    if (n == 0) return r->server->server_hostname;
 
-    AP_INIT_TAKE1("GridSiteExecMethod", mod_gridsite_take1_cmds,
-                 NULL, OR_FILEINFO, "execution strategy used by gsexec"),
-                 
-    AP_INIT_TAKE2("GridSiteUserGroup", mod_gridsite_take2_cmds, 
-                  NULL, OR_FILEINFO,
-                  "user and group of gsexec processes in suexec mode"),
-          
-    AP_INIT_TAKE2("GridSiteDiskMode", mod_gridsite_take2_cmds, 
-                  NULL, OR_FILEINFO,
-                  "group and world file modes for new files/directories"),
-          
-    {NULL}
-};
+    if (r->uri == NULL) return NULL; /* some kind of internal error? */
 
-/*  Blank unset these HTTP headers, to prevent injection attacks.
-    This is run before mod_shib's check_user_id hook, which may
-    legitimately create such headers.                           */
+    i  = 1; /* start of first component */
+    nn = 1;
+    
+    for (ii=1; r->uri[ii] != '\0'; ++ii) /* look for this component */
+       {
+         if (r->uri[ii] == '/') /* end of a component */
+           {
+             if (nn == n) break;
+             
+             ++nn;
+             i = ii + 1;
+           }
+         else if ((r->uri[ii] == '.') && (r->uri[ii+1] == '.'))
+           {
+             return NULL; /* can this happen? dont allow anyway */
+           }         
+       }
+       
+    if (nn != n) return NULL; /* no component for this number */
+    
+    return apr_psprintf(r->pool, "%.*s", ii - i, &(r->uri[i]));
+}
 
-static int mod_gridsite_check_user_id(request_rec *r)
+static char *make_aclpath(request_rec *r, char *format)
 {
-    apr_table_unset(r->headers_in, "User-Distinguished-Name");
-#if 0
-    apr_table_unset(r->headers_in, "User-Distinguished-Name-2");
-#endif
-    apr_table_unset(r->headers_in, "Nist-LoA");
-    apr_table_unset(r->headers_in, "LoA");
-    apr_table_unset(r->headers_in, "VOMS-Attribute");
+    int i, n;
+    char *formatted, *p;
+    
+    formatted = apr_pstrdup(r->pool, format);
 
-    return DECLINED; /* ie carry on processing request */
+    while (1)
+         {
+           for (i=0; (formatted[i] != '\0') && (formatted[i] != '%'); ++i) ;
+    
+           if (formatted[i] == '\0') break;
+           
+           if ((formatted[i] == '%') && (formatted[i+1] == '%')) 
+             {
+               ++i;
+               continue;
+             }
+            
+           if (sscanf(&formatted[i+1], "%d", &n) != 1)
+             {
+               return NULL; /* not %% or %0,%1,... */
+             }
+           
+           formatted[i] = '\0';
+           
+           for (i++; isdigit(formatted[i]); ++i) ;
+           
+           if ((p = get_aclpath_component(r, n)) == NULL) return NULL;
+           
+           formatted = apr_pstrcat(r->pool, formatted, p, &formatted[i],NULL);                                   
+           i += strlen(p);
+         }
+            
+    return ap_server_root_relative(r->pool, formatted);
 }
 
-static int mod_gridsite_first_fixups(request_rec *r)
+/*
+    Cache of parsed ACL files, shared between all children in an anonymous
+    shared memory segment of GridSiteACLCache bytes. ACLs are stored in a
+    flat form (an entry header followed by its creds, each cred followed
+    by its AURI string, if it has one) which can be turned back into a GRSTgaclAcl in a
+    request pool without touching libxml. Slots are keyed on the path of
+    the ACL file plus its inode, device, mtime and size, so any change to
+    the file makes the old slot miss. When the arena fills up, the
+    generation counter is bumped and the whole cache starts again.
+*/
+
+typedef struct
 {
-    mod_gridsite_dir_cfg *conf;
+   GRSTgaclPerm		allowed;
+   GRSTgaclPerm		denied;
+   int			ncreds;
+}  grst_aclcache_entry;
 
-    if (r->finfo.filetype != APR_DIR) return DECLINED;
+typedef struct
+{
+   int			delegation;
+   int			nist_loa;
+   time_t		notbefore;
+   time_t		notafter;
+   apr_size_t		aurilen;
+}  grst_aclcache_cred;
 
-    conf = (mod_gridsite_dir_cfg *)
-                    ap_get_module_config(r->per_dir_config, &gridsite_module);
+typedef struct
+{
+   unsigned int		hash;
+   unsigned long	generation;
+   apr_ino_t		inode;
+   apr_dev_t		device;
+   apr_time_t		mtime;
+   apr_off_t		size;
+   apr_size_t		offset;    /* path, then flat ACL, in arena */
+   apr_size_t		pathlen;
+   apr_size_t		length;    /* of the flat ACL */
+}  grst_aclcache_slot;
 
-    /* we handle DN Lists as regular files, even if they also match
-       directory names  */
+typedef struct
+{
+   unsigned long	generation;
+   apr_size_t		nslots;
+   apr_size_t		arenasize;
+   apr_size_t		arenaused;
+}  grst_aclcache_header;
 
-    if ((conf != NULL) &&
-        (conf->dnlistsuri != NULL) &&
-        (strncmp(r->uri, conf->dnlistsuri, strlen(conf->dnlistsuri)) == 0) &&
-        (strcmp(r->uri, conf->dnlistsuri) != 0))
-      {
-        r->finfo.filetype = APR_REG; 
-      }
+#define GRST_ACLCACHE_SLOT_RATIO 16 /* ~1/16 of the segment for slots */
 
-    return DECLINED;
-}  
+#define GRST_ACLCACHE_NOAURI ((apr_size_t) -1) /* aurilen of a NULL auri */
 
+#define GRST_ACLCACHE_SLOTS(h) ((grst_aclcache_slot *) \
+            ((char *) (h) + APR_ALIGN_DEFAULT(sizeof(grst_aclcache_header))))
 
-int GRST_get_session_id(SSL *ssl, char *session_id, size_t len)
+#define GRST_ACLCACHE_ARENA(h) ((char *) GRST_ACLCACHE_SLOTS(h) + \
+            APR_ALIGN_DEFAULT((h)->nslots * sizeof(grst_aclcache_slot)))
+
+static void aclcache_init(apr_pool_t *pPool, server_rec *main_server)
 {
-   int          i;
-   SSL_SESSION *session;
-   unsigned int sess_len;
-   const unsigned char *sess_id;
+   apr_status_t          status;
+   apr_size_t            slotsize;
+   grst_aclcache_header *header;
 
-   session = SSL_get_session(ssl);
-   if (session == NULL)
-      return GRST_RET_FAILED;
+   aclcache_shm   = NULL;
+   aclcache_mutex = NULL;
 
-   sess_id = SSL_SESSION_get_id(session, &sess_len);
-   if (sess_len == 0)
-      return GRST_RET_FAILED;
+   if (aclcachesize == 0) return;
 
-   if (2 * sess_len + 1 > len) 
-      return GRST_RET_FAILED;
+   slotsize = aclcachesize / GRST_ACLCACHE_SLOT_RATIO;
+   if (slotsize < sizeof(grst_aclcache_slot)) slotsize = sizeof(grst_aclcache_slot);
 
-   for (i=0; i < sess_len; ++i)
-    sprintf(&(session_id[i*2]), "%02X", sess_id[i]);
+   if ((status = apr_shm_create(&aclcache_shm, 
+                   APR_ALIGN_DEFAULT(sizeof(grst_aclcache_header)) +
+                   APR_ALIGN_DEFAULT(slotsize) + aclcachesize,
+                   NULL, pPool)) != APR_SUCCESS)
+     {
+       ap_log_error(APLOG_MARK, APLOG_ERR, status, main_server,
+              "mod_gridsite: Failed to create ACL cache, continuing without");
+       aclcache_shm = NULL;
+       return;
+     }
 
-   session_id[i*2] = '\0';
-   
-   return GRST_RET_OK;
+   if (((status = apr_global_mutex_create(&aclcache_mutex, NULL, 
+                                 APR_LOCK_DEFAULT, pPool)) != APR_SUCCESS) ||
+       ((status = ap_unixd_set_global_mutex_perms(aclcache_mutex)) 
+                                                            != APR_SUCCESS))
+     {
+       ap_log_error(APLOG_MARK, APLOG_ERR, status, main_server,
+              "mod_gridsite: Failed to create ACL cache mutex, "
+              "continuing without ACL cache");
+       apr_shm_destroy(aclcache_shm);
+       aclcache_shm   = NULL;
+       aclcache_mutex = NULL;
+       return;
+     }
+
+   header = (grst_aclcache_header *) apr_shm_baseaddr_get(aclcache_shm);
+
+   header->generation = 1;
+   header->nslots     = slotsize / sizeof(grst_aclcache_slot);
+   header->arenasize  = aclcachesize;
+   header->arenaused  = 0;
+
+   memset(GRST_ACLCACHE_SLOTS(header), 0, 
+          header->nslots * sizeof(grst_aclcache_slot));
+
+   ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, main_server,
+          "mod_gridsite: ACL cache of %" APR_SIZE_T_FMT " bytes, "
+          "%" APR_SIZE_T_FMT " slots", aclcachesize, header->nslots);
 }
 
-int GRST_load_ssl_creds(SSL *ssl, conn_rec *conn)
+static char *aclcache_flatten(apr_pool_t *pool, GRSTgaclAcl *acl,
+                              apr_size_t *length)
+/*
+    Return the flat form of *acl allocated from pool, and its length
+*/
 {
-   char session_id[(SSL_MAX_SSL_SESSION_ID_LENGTH+1)*2+1], *sessionfile = NULL,
-        line[512], *p;
-   apr_file_t  *fp = NULL;
-   int i;
-      
-   if (GRST_get_session_id(ssl, session_id, sizeof(session_id)) != GRST_RET_OK)
-     return GRST_RET_FAILED;
+   char               *flat, *p;
+   apr_size_t          len = 0;
+   GRSTgaclEntry      *entry;
+   GRSTgaclCred       *cred;
+   grst_aclcache_entry flatentry;
+   grst_aclcache_cred  flatcred;
    
-   sessionfile = apr_psprintf(conn->pool, "%s/sslcreds-%s",
-                         ap_server_root_relative(conn->pool, sessionsdir),
-                         session_id);
+   for (entry = acl->firstentry; entry != NULL; entry = entry->next)
+      {
+        len += APR_ALIGN_DEFAULT(sizeof(grst_aclcache_entry));
+        
+        for (cred = entry->firstcred; cred != NULL; cred = cred->next)
+           {
+             len += APR_ALIGN_DEFAULT(sizeof(grst_aclcache_cred));
 
-   if (apr_file_open(&fp, sessionfile, APR_READ, 0, conn->pool) != APR_SUCCESS)
-       return GRST_RET_FAILED;
-   
-   while (apr_file_gets(line, sizeof(line), fp) == APR_SUCCESS)
-        {
-          if (sscanf(line, "GRST_CRED_AURI_%d=", &i) == 1)
-            {
-              if ((p = index(line, '\n')) != NULL) *p = '\0';              
-              p = index(line, '=');
+             if (cred->auri != NULL)
+                          len += APR_ALIGN_DEFAULT(strlen(cred->auri) + 1);
+           }
+      }
 
-              apr_table_setn(conn->notes,
-                         apr_psprintf(conn->pool, "GRST_CRED_AURI_%d", i),
-                         apr_pstrdup(conn->pool, &p[1]));
-            }
-          else if (sscanf(line, "GRST_CRED_VALID_%d=", &i) == 1)
-            {
-              if ((p = index(line, '\n')) != NULL) *p = '\0';              
-              p = index(line, '=');
+   p = flat = apr_pcalloc(pool, len + 1);
+   *length = len;
 
-              apr_table_setn(conn->notes,
-                         apr_psprintf(conn->pool, "GRST_CRED_VALID_%d", i),
-                         apr_pstrdup(conn->pool, &p[1]));
-            }
-          else if (sscanf(line, "GRST_OCSP_URL_%d=", &i) == 1)
-            {
-              if ((p = index(line, '\n')) != NULL) *p = '\0';              
-              p = index(line, '=');
+   for (entry = acl->firstentry; entry != NULL; entry = entry->next)
+      {
+        flatentry.allowed = entry->allowed;
+        flatentry.denied  = entry->denied;
+        flatentry.ncreds  = 0;
 
-              apr_table_setn(conn->notes,
-                         apr_psprintf(conn->pool, "GRST_OCSP_URL_%d", i),
-                         apr_pstrdup(conn->pool, &p[1]));
-            }
-        }
+        for (cred = entry->firstcred; cred != NULL; cred = cred->next)
+                                                       ++(flatentry.ncreds);
         
-   apr_file_close(fp);
+        memcpy(p, &flatentry, sizeof(grst_aclcache_entry));
+        p += APR_ALIGN_DEFAULT(sizeof(grst_aclcache_entry));
 
-   /* connection notes created by GRST_save_ssl_creds() are now reloaded */
-   apr_table_set(conn->notes, "GRST_save_ssl_creds", "yes");
+        for (cred = entry->firstcred; cred != NULL; cred = cred->next)
+           {
+             flatcred.delegation = cred->delegation;
+             flatcred.nist_loa   = cred->nist_loa;
+             flatcred.notbefore  = cred->notbefore;
+             flatcred.notafter   = cred->notafter;
+             flatcred.aurilen    = (cred->auri == NULL) ? 
+                                   GRST_ACLCACHE_NOAURI : strlen(cred->auri);
 
-   return GRST_RET_OK;
+             memcpy(p, &flatcred, sizeof(grst_aclcache_cred));
+             p += APR_ALIGN_DEFAULT(sizeof(grst_aclcache_cred));
+
+             if (cred->auri == NULL) continue;
+
+             memcpy(p, cred->auri, flatcred.aurilen + 1);
+             p += APR_ALIGN_DEFAULT(flatcred.aurilen + 1);
+           }
+      }
+
+   return flat;
 }
 
+static GRSTgaclAcl *aclcache_unflatten(apr_pool_t *pool, char *flat,
+                                       apr_size_t length)
 /*
-    Save result of AURIs and validity info from chain into connection notes,
-    and write out in an SSL session creds file.
+    Rebuild a GRSTgaclAcl from its flat form. Everything, including the
+    AURI strings which point into flat itself, belongs to pool and must
+    not be passed to GRSTgaclAclFree()
 */
+{
+   int                  i;
+   char                *p;
+   GRSTgaclAcl         *acl;
+   GRSTgaclEntry       *entry, *lastentry = NULL;
+   GRSTgaclCred        *cred,  *lastcred;
+   grst_aclcache_entry *flatentry;
+   grst_aclcache_cred  *flatcred;
+
+   acl = apr_palloc(pool, sizeof(GRSTgaclAcl));
+   acl->firstentry = NULL;
+
+   for (p = flat; p < flat + length; )
+      {
+        flatentry = (grst_aclcache_entry *) p;
+        p += APR_ALIGN_DEFAULT(sizeof(grst_aclcache_entry));
+
+        entry = apr_palloc(pool, sizeof(GRSTgaclEntry));
+        entry->firstcred = NULL;
+        entry->allowed   = flatentry->allowed;
+        entry->denied    = flatentry->denied;
+        entry->next      = NULL;
+        
+        if (lastentry == NULL) acl->firstentry = entry;
+        else                   lastentry->next = entry;
+        lastentry = entry;
 
-void GRST_save_ssl_creds(conn_rec *conn, GRSTx509Chain *grst_chain)
+        lastcred = NULL;
+
+        for (i=0; i < flatentry->ncreds; ++i)
+           {
+             flatcred = (grst_aclcache_cred *) p;
+             p += APR_ALIGN_DEFAULT(sizeof(grst_aclcache_cred));
+
+             cred = apr_palloc(pool, sizeof(GRSTgaclCred));
+             cred->auri       = NULL;
+             cred->delegation = flatcred->delegation;
+             cred->nist_loa   = flatcred->nist_loa;
+             cred->notbefore  = flatcred->notbefore;
+             cred->notafter   = flatcred->notafter;
+             cred->next       = NULL;
+
+             if (flatcred->aurilen != GRST_ACLCACHE_NOAURI)
+               {
+                 cred->auri = p;
+                 p += APR_ALIGN_DEFAULT(flatcred->aurilen + 1);
+               }
+             
+             if (lastcred == NULL) entry->firstcred = cred;
+             else                  lastcred->next   = cred;
+             lastcred = cred;
+           }
+      }
+
+   return acl;
+}
+
+static apr_status_t aclcache_free_acl(void *acl)
 {
-   int          i, lowest_voms_delegation = 65535;
-   char        *tempfile = NULL, *encoded, *voms_fqans = NULL,
-               *sessionfile, session_id[(SSL_MAX_SSL_SESSION_ID_LENGTH+1)*2];
-   apr_file_t  *fp = NULL;
-   SSL         *ssl;
-   SSLConnRec  *sslconn;
-   GRSTx509Cert  *grst_cert = NULL;
+   GRSTgaclAclFree((GRSTgaclAcl *) acl);
+   free(acl);
 
-   /* check if already done */
+   return APR_SUCCESS;
+}
 
-   if ((grst_chain != NULL) && (conn->notes != NULL) &&
-       (apr_table_get(conn->notes, "GRST_save_ssl_creds") != NULL)) return;
+static GRSTgaclAcl *GRST_load_shared_acl(request_rec *r, char *aclfile,
+                                         apr_finfo_t *finfo)
+/*
+    Equivalent of GRSTgaclAclLoadFile(), but going via the shared ACL
+    cache if one exists and finfo (from apr_stat of aclfile) is not NULL.
+    The ACL returned belongs to r->pool and must not be freed by the caller.
+*/
+{
+   char                 *flat, *arena;
+   unsigned int          hash;
+   apr_ssize_t           pathlen;
+   apr_size_t            length, needed;
+   GRSTgaclAcl          *acl;
+   grst_aclcache_header *header;
+   grst_aclcache_slot   *slot;
+
+   if ((aclcache_shm == NULL) || (finfo == NULL))
+     {
+       acl = GRSTgaclAclLoadFile(aclfile);
 
-   /* we at least need to say we've been run - even if creds not save-able*/
+       if (acl != NULL) apr_pool_cleanup_register(r->pool, acl, 
+                                 aclcache_free_acl, apr_pool_cleanup_null);
+       return acl;
+     }
 
-   apr_table_set(conn->notes, "GRST_save_ssl_creds", "yes");
-   ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
-                                            "set GRST_save_ssl_creds");
+   pathlen = APR_HASH_KEY_STRING;
+   hash    = apr_hashfunc_default(aclfile, &pathlen);
+   header  = (grst_aclcache_header *) apr_shm_baseaddr_get(aclcache_shm);
+   slot    = &(GRST_ACLCACHE_SLOTS(header)[hash % header->nslots]);
+   arena   = GRST_ACLCACHE_ARENA(header);
+   flat    = NULL;
 
-   sslconn = (SSLConnRec *)ap_get_module_config(conn->conn_config,&ssl_module);
+   if (apr_global_mutex_lock(aclcache_mutex) == APR_SUCCESS)
+     {
+       if ((slot->generation == header->generation) &&
+           (slot->hash       == hash)               &&
+           (slot->inode      == finfo->inode)        &&
+           (slot->device     == finfo->device)       &&
+           (slot->mtime      == finfo->mtime)        &&
+           (slot->size       == finfo->size)         &&
+           (slot->pathlen    == (apr_size_t) pathlen) &&
+           (memcmp(&arena[slot->offset], aclfile, pathlen) == 0))
+         {
+           length = slot->length;
+           flat   = apr_palloc(r->pool, length + 1);
+           memcpy(flat, &arena[slot->offset + APR_ALIGN_DEFAULT(pathlen + 1)],
+                  length);
+         }
 
-   if ((sslconn != NULL) && 
-       ((ssl = sslconn->ssl) != NULL) &&
-       (GRST_get_session_id(ssl,session_id,sizeof(session_id)) == GRST_RET_OK))
+       apr_global_mutex_unlock(aclcache_mutex);
+     }
+
+   if (flat != NULL)
      {
-       sessionfile = apr_psprintf(conn->pool, "%s/sslcreds-%s",
-                         ap_server_root_relative(conn->pool, sessionsdir),
-                         session_id);
+       ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                    "ACL file %s found in ACL cache", aclfile);
 
-       tempfile = apr_pstrcat(conn->pool, 
-                          ap_server_root_relative(conn->pool, sessionsdir), 
-                          "/tmp-XXXXXX", NULL);
-   
-       if ((tempfile != NULL) && (tempfile[0] != '\0'))
-               apr_file_mktemp(&fp, tempfile, 
-                               APR_CREATE | APR_WRITE | APR_EXCL, conn->pool);
+       return aclcache_unflatten(r->pool, flat, length);
      }
 
-   i=0;
+   acl = GRSTgaclAclLoadFile(aclfile);
+   if (acl == NULL) return NULL;
+
+   apr_pool_cleanup_register(r->pool, acl, 
+                             aclcache_free_acl, apr_pool_cleanup_null);
+
+   /* files changed within the last second may change again without
+      their mtime changing, so we wait for them to settle before caching */
+
+   if (apr_time_sec(finfo->mtime) >= apr_time_sec(r->request_time) - 1)
+                                                                return acl;
+
+   flat   = aclcache_flatten(r->pool, acl, &length);
+   needed = APR_ALIGN_DEFAULT(pathlen + 1) + APR_ALIGN_DEFAULT(length);
    
-   for (grst_cert = grst_chain->firstcert;
-        grst_cert != NULL; grst_cert = grst_cert->next)
-      {
-        if (grst_cert->errors) continue;
-        
-        if (grst_cert->type == GRST_CERT_TYPE_VOMS)
-          {
-            /* want to record the delegation level 
-               of the last proxy with VOMS attributes */
-          
-            lowest_voms_delegation = grst_cert->delegation;
-          }
-        else if ((grst_cert->type == GRST_CERT_TYPE_EEC) ||
-                 (grst_cert->type == GRST_CERT_TYPE_PROXY))
-          {
-            encoded = GRSThttpUrlMildencode(grst_cert->dn);
-          
-            apr_table_setn(conn->notes,
-                   apr_psprintf(conn->pool, "GRST_CRED_AURI_%d", i),
-                   apr_pstrcat(conn->pool, "dn:", encoded, NULL));
+   if (needed > header->arenasize / 4) return acl; /* hog */
 
-            if (fp != NULL) apr_file_printf(fp, "GRST_CRED_AURI_%d=dn:%s\n",
-                                                i, encoded);
+   if (apr_global_mutex_lock(aclcache_mutex) == APR_SUCCESS)
+     {
+       if (header->arenaused + needed > header->arenasize)
+         {
+           /* arena full: invalidate every slot at once and start again */
+           ++(header->generation);
+           header->arenaused = 0;
+         }
 
-            apr_table_setn(conn->notes,
-                   apr_psprintf(conn->pool, "GRST_CRED_VALID_%d", i),
-                   apr_psprintf(conn->pool, 
-                      "notbefore=%ld notafter=%ld delegation=%d nist-loa=%d", 
-                      grst_cert->notbefore,
-                      grst_cert->notafter,
-                      grst_cert->delegation, 0));
+       slot->hash       = hash;
+       slot->generation = header->generation;
+       slot->inode      = finfo->inode;
+       slot->device     = finfo->device;
+       slot->mtime      = finfo->mtime;
+       slot->size       = finfo->size;
+       slot->offset     = header->arenaused;
+       slot->pathlen    = pathlen;
+       slot->length     = length;
+
+       memcpy(&arena[slot->offset], aclfile, pathlen + 1);
+       memcpy(&arena[slot->offset + APR_ALIGN_DEFAULT(pathlen + 1)], 
+              flat, length);
+       
+       header->arenaused += needed;
 
-            if (fp != NULL) apr_file_printf(fp, 
-  "GRST_CRED_VALID_%d=notbefore=%ld notafter=%ld delegation=%d nist-loa=%d\n",
-                                            i, grst_cert->notbefore,
-                                               grst_cert->notafter, 
-                                               grst_cert->delegation, 0);
+       apr_global_mutex_unlock(aclcache_mutex);
 
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
-                      "store GRST_CRED_AURI_%d=dn:%s", i, encoded);
+       ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+                    "ACL file %s added to ACL cache", aclfile);
+     }
 
-            free(encoded);
+   return acl;
+}
 
-            ++i;
-          }
-        else if (grst_cert->type == GRST_CERT_TYPE_ROBOT)
-          {
-            apr_table_setn(conn->notes, "GRST_ROBOT_DN", apr_pstrdup(conn->pool, grst_cert->dn));
-            /* I ignore the sslcreds cache here */
-          }
-      }
+/*
+    Compiled ACLs are kept in each child, keyed on the path of the ACL file
+    and invalidated by the same inode, device, mtime and size as the shared
+    cache, so each ACL file is only compiled once per child while it stays
+    unchanged. Entries are reference counted by the requests using them.
+*/
 
-   for (grst_cert = grst_chain->firstcert; 
-        grst_cert != NULL; grst_cert = grst_cert->next)
-      {
-        if (grst_cert->errors) continue;
-        
-        if ((grst_cert->type == GRST_CERT_TYPE_VOMS) &&
-            (grst_cert->delegation == lowest_voms_delegation))
-          {
-            /* only export attributes from the last proxy to contain them */
+typedef struct
+{
+   char			*path;
+   apr_ino_t		inode;
+   apr_dev_t		device;
+   apr_time_t		mtime;
+   apr_off_t		size;
+   GRSTgaclCompiledAcl	*cacl;
+   int			refs;
+   int			retired;
+}  grst_compiled_acl;
+
+static apr_hash_t *compiled_acl_cache = NULL;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *compiled_acl_mutex = NULL;
+#endif
 
-            encoded = GRSThttpUrlMildencode(grst_cert->value);
-          
-            apr_table_setn(conn->notes,
-                   apr_psprintf(conn->pool, "GRST_CRED_AURI_%d", i),
-                   apr_pstrcat(conn->pool, "fqan:", encoded, NULL));
+static void compiled_acl_lock(void)
+{
+#if APR_HAS_THREADS
+   if (compiled_acl_mutex != NULL) apr_thread_mutex_lock(compiled_acl_mutex);
+#endif
+}
 
-            if (voms_fqans != NULL)
-              {
-                voms_fqans = apr_pstrcat(conn->pool, encoded, ";", voms_fqans, NULL);
-              }
-            else
-              {
-                voms_fqans = apr_pstrcat(conn->pool, encoded, NULL);
-              }
-            if (fp != NULL) apr_file_printf(fp, "GRST_CRED_AURI_%d=fqan:%s\n",
-                                                i, encoded);
+static void compiled_acl_unlock(void)
+{
+#if APR_HAS_THREADS
+   if (compiled_acl_mutex != NULL) apr_thread_mutex_unlock(compiled_acl_mutex);
+#endif
+}
 
-            apr_table_setn(conn->notes,
-                   apr_psprintf(conn->pool, "GRST_CRED_VALID_%d", i),
-                   apr_psprintf(conn->pool, 
-                      "notbefore=%ld notafter=%ld delegation=%d nist-loa=%d", 
-                      grst_cert->notbefore,
-                      grst_cert->notafter, 
-                      grst_cert->delegation, 0));
+static void compiled_acl_cache_init(apr_pool_t *pPool)
+{
+   compiled_acl_cache = apr_hash_make(pPool);
+#if APR_HAS_THREADS
+   if (apr_thread_mutex_create(&compiled_acl_mutex, APR_THREAD_MUTEX_DEFAULT,
+                               pPool) != APR_SUCCESS) compiled_acl_cache = NULL;
+#endif
+}
+
+static void compiled_acl_free(grst_compiled_acl *compiled)
+{
+   GRSTgaclCompiledAclFree(compiled->cacl);
+   free(compiled->path);
+   free(compiled);
+}
+
+static apr_status_t compiled_acl_release(void *data)
+{
+   grst_compiled_acl *compiled = (grst_compiled_acl *) data;
+
+   compiled_acl_lock();
+
+   if ((--(compiled->refs) == 0) && compiled->retired)
+                                                 compiled_acl_free(compiled);
+   compiled_acl_unlock();
+
+   return APR_SUCCESS;
+}
+
+static GRSTgaclCompiledAcl *GRST_load_cached_acl(request_rec *r, 
+                                                 char *aclfile)
+/*
+    Equivalent of GRSTgaclAclCompile(GRSTgaclAclLoadFile()), reusing this
+    child's compiled copy of the ACL file if it is unchanged. The compiled
+    ACL returned belongs to r->pool and must not be freed by the caller.
+    NULL means no ACL, or no memory to compile it, and so no permissions.
+*/
+{
+   int                  have_finfo;
+   apr_finfo_t          finfo;
+   GRSTgaclAcl         *acl;
+   grst_compiled_acl   *compiled = NULL, *old;
+
+   have_finfo = (apr_stat(&finfo, aclfile, APR_FINFO_MTIME | APR_FINFO_SIZE |
+                          APR_FINFO_IDENT, r->pool) == APR_SUCCESS);
+
+   if (have_finfo && (compiled_acl_cache != NULL))
+     {
+       compiled_acl_lock();
+
+       compiled = apr_hash_get(compiled_acl_cache, aclfile, 
+                               APR_HASH_KEY_STRING);
+
+       if ((compiled != NULL) &&
+           (compiled->inode  == finfo.inode)  &&
+           (compiled->device == finfo.device) &&
+           (compiled->mtime  == finfo.mtime)  &&
+           (compiled->size   == finfo.size))
+         {
+           ++(compiled->refs);
+           compiled_acl_unlock();
+
+           apr_pool_cleanup_register(r->pool, compiled, compiled_acl_release,
+                                     apr_pool_cleanup_null);
+           return compiled->cacl;
+         }
 
-            if (fp != NULL) apr_file_printf(fp, 
-  "GRST_CRED_VALID_%d=notbefore=%ld notafter=%ld delegation=%d nist-loa=%d\n",
-                                            i, grst_cert->notbefore,
-                                               grst_cert->notafter,
-                                               grst_cert->delegation, 0);
+       compiled_acl_unlock();
+     }
 
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
-                      "store GRST_CRED_AURI_%d=fqan:%s", i, encoded);
+   acl = GRST_load_shared_acl(r, aclfile, have_finfo ? &finfo : NULL);
+   if (acl == NULL) return NULL;
 
-            free(encoded);
+   if ((compiled = calloc(1, sizeof(grst_compiled_acl))) == NULL) return NULL;
 
-            ++i;
-          }
-      }
+   compiled->path = strdup(aclfile);
+   compiled->cacl = GRSTgaclAclCompile(acl);
 
-   if (voms_fqans != NULL)
+   if ((compiled->path == NULL) || (compiled->cacl == NULL))
      {
-       apr_table_setn(conn->notes, "GRST_VOMS_FQANS", voms_fqans);
-       if (fp != NULL) apr_file_printf(fp, "GRST_VOMS_FQANS=%s\n", voms_fqans);
-       ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
-                      "store GRST_VOMS_FQANS=%s", voms_fqans);
+       compiled_acl_free(compiled);
+       return NULL;
      }
 
+   compiled->refs   = 1; /* this request */
 
-   /* this needs to be merged into grst_x509? */
-#if 0
-   if (ocspmodes != NULL)
-   {
-     int   j;
-     const char *ex_sn;
-     char s[80];
-     X509 *cert;     
-     X509_EXTENSION *ex;
-     
-     for (j=sk_X509_num(certstack)-1; j >= 0; --j)
-        {
-          cert = sk_X509_value(certstack, j);
-          
-          for (i=0; i < X509_get_ext_count(cert); ++i)
-             {
-               ex = X509_get_ext(cert, i);
+   if (have_finfo)
+     {
+       compiled->inode  = finfo.inode;
+       compiled->device = finfo.device;
+       compiled->mtime  = finfo.mtime;
+       compiled->size   = finfo.size;
+     }
 
-               OBJ_obj2txt(s, sizeof(s), X509_EXTENSION_get_object(ex), 0);
+   /* as for the shared cache, files still being changed are not cached */
 
-               if (strcmp(s, "authorityInfoAccess") == 0) /* OCSP */
-                 {
-                   apr_table_setn(conn->notes, "GRST_OCSP_URL",
-                                  (const char *) X509_EXTENSION_get_data(ex));
+   if (!have_finfo || (compiled_acl_cache == NULL) ||
+       (apr_time_sec(finfo.mtime) >= apr_time_sec(r->request_time) - 1))
+     compiled->retired = 1;
+   else
+     {
+       compiled_acl_lock();
 
-                   /* strategy is to remove what has been checked, 
-                      for this connnection */
-                   apr_table_set(conn->notes, "GRST_OCSP_UNCHECKED",
-                                 ocspmodes);
+       old = apr_hash_get(compiled_acl_cache, aclfile, APR_HASH_KEY_STRING);
 
-                   ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, conn->base_server,
-                "store GRST_OCSP_URL_%d=%s", i, X509_EXTENSION_get_data(ex));
+       if (old != NULL)
+         {
+           apr_hash_set(compiled_acl_cache, old->path, 
+                        APR_HASH_KEY_STRING, NULL);
+           old->retired = 1;
+           if (old->refs == 0) compiled_acl_free(old);
+         }
 
-                   if (fp != NULL) apr_file_printf(fp, "GRST_OCSP_URL_%d=%s\n",
-                                             i, X509_EXTENSION_get_data(ex));
-                 }
-             }
-        }   
-   }
-#endif
-   /* end of bit that needs to go into grst_x509 */
-     
-   if (fp != NULL)
-     {
-       apr_file_close(fp);
-       apr_file_rename(tempfile, sessionfile, conn->pool);
+       if ((old != NULL) ||
+           (apr_hash_count(compiled_acl_cache) < GRST_COMPILED_ACL_ENTRIES))
+         {
+           apr_hash_set(compiled_acl_cache, compiled->path, 
+                        APR_HASH_KEY_STRING, compiled);
+         }
+       else compiled->retired = 1; /* cache full, freed after this request */
+
+       compiled_acl_unlock();
      }
+
+   apr_pool_cleanup_register(r->pool, compiled, compiled_acl_release,
+                             apr_pool_cleanup_null);
+   return compiled->cacl;
 }
 
-static char *get_aclpath_component(request_rec *r, int n)
+static GRSTgaclCompiledAcl *GRST_load_cached_aclforfile(request_rec *r, 
+                                                         char *pathandfile)
 /*
-    Get the nth component of REQUEST_URI, or component 0
-    which is the server name.
-
+    Equivalent of GRSTgaclAclLoadforFile(), using the ACL caches
 */
 {
-    int ii, i, nn;
-
-    if (n == 0) return r->server->server_hostname;
-
-    if (r->uri == NULL) return NULL; /* some kind of internal error? */
+   char                *aclfile;
+   GRSTgaclCompiledAcl *cacl;
 
-    i  = 1; /* start of first component */
-    nn = 1;
-    
-    for (ii=1; r->uri[ii] != '\0'; ++ii) /* look for this component */
-       {
-         if (r->uri[ii] == '/') /* end of a component */
-           {
-             if (nn == n) break;
-             
-             ++nn;
-             i = ii + 1;
-           }
-         else if ((r->uri[ii] == '.') && (r->uri[ii+1] == '.'))
-           {
-             return NULL; /* can this happen? dont allow anyway */
-           }         
-       }
-       
-    if (nn != n) return NULL; /* no component for this number */
-    
-    return apr_psprintf(r->pool, "%.*s", ii - i, &(r->uri[i]));
-}
+   aclfile = GRSTgaclFileFindAclname(pathandfile);
+   if (aclfile == NULL) return NULL;
 
-static char *make_aclpath(request_rec *r, char *format)
-{
-    int i, n;
-    char *formatted, *p;
-    
-    formatted = apr_pstrdup(r->pool, format);
+   cacl = GRST_load_cached_acl(r, aclfile);
+   free(aclfile);
 
-    while (1)
-         {
-           for (i=0; (formatted[i] != '\0') && (formatted[i] != '%'); ++i) ;
-    
-           if (formatted[i] == '\0') break;
-           
-           if ((formatted[i] == '%') && (formatted[i+1] == '%')) 
-             {
-               ++i;
-               continue;
-             }
-            
-           if (sscanf(&formatted[i+1], "%d", &n) != 1)
-             {
-               return NULL; /* not %% or %0,%1,... */
-             }
-           
-           formatted[i] = '\0';
-           
-           for (i++; isdigit(formatted[i]); ++i) ;
-           
-           if ((p = get_aclpath_component(r, n)) == NULL) return NULL;
-           
-           formatted = apr_pstrcat(r->pool, formatted, p, &formatted[i],NULL);                                   
-           i += strlen(p);
-         }
-            
-    return ap_server_root_relative(r->pool, formatted);
+   return cacl;
 }
 
 static int mod_gridsite_perm_handler(request_rec *r)
@@ -2704,11 +4472,11 @@ static int mod_gridsite_perm_handler(request_rec *r)
 {
     int          retcode = DECLINED, i, j, n, file_is_acl = 0, cc_delegation,
                  destination_is_acl = 0, ishttps = 0, nist_loa, delegation,
-                 from_cookie = 0;
+                 from_cookie = 0, from_store = 0;
     char        *p, *q, envname1[30], envname2[30], 
                 *grst_cred_auri_0 = NULL, *dir_path,
                 *remotehost, *grst_cred_auri_i, *cookies, *file,
-                *cookiefile, oneline[1025], *decoded,
+                *cookiefile, *oneline, *passcode = NULL, *decoded,
                 *destination = NULL, *destination_uri = NULL, *querytmp, 
                 *destination_prefix = NULL, *destination_translated = NULL,
                 *aclpath = NULL, *grst_cred_valid_0 = NULL, *grst_cred_valid_i,
@@ -2718,11 +4486,12 @@ static int mod_gridsite_perm_handler(request_rec *r)
     apr_table_t *env;
     apr_finfo_t  cookiefile_info;
     apr_file_t  *fp;
+    apr_size_t   nbytes;
     request_rec *destreq;
     GRSTgaclCred    *cred = NULL, *cred_0 = NULL;
     GRSTgaclUser    *user = NULL;
     GRSTgaclPerm     perm = GRST_PERM_NONE, destination_perm = GRST_PERM_NONE;
-    GRSTgaclAcl     *acl = NULL;
+    GRSTgaclCompiledAcl *cacl = NULL;
     mod_gridsite_dir_cfg *cfg;
     SSLConnRec      *sslconn;
 
@@ -2792,37 +4561,61 @@ static int mod_gridsite_perm_handler(request_rec *r)
           }
       }
 
-    /* try to load user structure from passcode file */
+    /* try to load user structure from passcode store or file */
 
     if ((user == NULL) && 
         (gridauthpasscode != NULL) &&
         (gridauthpasscode[0] != '\0'))
       {
-        cookiefile = apr_psprintf(r->pool, "%s/passcode-%s",
+        /* passcodes are looked up in the sessions store first, then
+           in files (which may also be made by site login scripts) */
+
+        cookiefile = apr_pstrcat(r->pool, "passcode-", gridauthpasscode, NULL);
+        
+        if (sessionsstore_get(r->server, cookiefile, 
+                              &passcode, r->pool) == APR_SUCCESS)
+          {
+            from_store = 1;
+          }
+        else
+          {
+            cookiefile = apr_psprintf(r->pool, "%s/passcode-%s",
                  ap_server_root_relative(r->pool,
                  sessionsdir),
                  gridauthpasscode);
                                       
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
                              "Opening GridHTTP passcode file %s", cookiefile);
               
-        if ((apr_stat(&cookiefile_info, cookiefile, 
-                          APR_FINFO_TYPE, r->pool) == APR_SUCCESS) &&
-            (cookiefile_info.filetype == APR_REG) &&
-            (apr_file_open(&fp, cookiefile, APR_READ, 0, r->pool)
+            if ((apr_stat(&cookiefile_info, cookiefile, 
+                          APR_FINFO_TYPE | APR_FINFO_SIZE, r->pool) 
+                                                         == APR_SUCCESS) &&
+                (cookiefile_info.filetype == APR_REG) &&
+                (apr_file_open(&fp, cookiefile, APR_READ, 0, r->pool)
                                                          == APR_SUCCESS))
+              {
+                passcode = apr_palloc(r->pool, cookiefile_info.size + 1);
+                
+                if (apr_file_read_full(fp, passcode, cookiefile_info.size, 
+                                       &nbytes) != APR_SUCCESS) nbytes = 0;
+
+                passcode[nbytes] = '\0';
+                apr_file_close(fp);
+              }
+          }
+
+        if (passcode != NULL)
               {
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
-                             "Reading GridHTTP passcode file %s", cookiefile);
+                             "Reading GridHTTP passcode %s", cookiefile);
                
                 i = -1;
                 cred = NULL;
               
-                while (apr_file_gets(oneline, 
-                                     sizeof(oneline), fp) == APR_SUCCESS)
+                for (oneline = passcode; *oneline != '\0'; oneline = q)
                      {
-                       p = index(oneline, '\n');
-                       if (p != NULL) *p = '\0';
+                       if ((q = index(oneline, '\n')) != NULL) *(q++) = '\0';
+                       else q = &oneline[strlen(oneline)];
                        
                        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
                                     "%s: %s", cookiefile, oneline);
@@ -2913,10 +4706,13 @@ static int mod_gridsite_perm_handler(request_rec *r)
                          }
                      }
 
-                apr_file_close(fp);
-
-                /* delete passcode file if used over HTTP not HTTPS */
-                if (!ishttps) remove(cookiefile);
+                /* delete passcode if used over HTTP not HTTPS */
+                if (!ishttps) 
+                  {
+                    if (from_store) sessionsstore_remove(r->server, 
+                                                         cookiefile, r->pool);
+                    else remove(cookiefile);
+                  }
 
                 /* if successful and we got passcode from a cookie, then
                    we put cookie value into environment variables, so
@@ -3211,6 +5007,9 @@ static int mod_gridsite_perm_handler(request_rec *r)
     
     if (perm != GRST_PERM_ALL) /* cannot improve on perfection... */
       {
+        /* pick up any .gacl changes once for this request */
+        GRSTgaclFileFindAclnameUpdate();
+
         if (((mod_gridsite_dir_cfg *) cfg)->aclpath != NULL)
           {
             aclpath = make_aclpath(r,((mod_gridsite_dir_cfg *) cfg)->aclpath);
@@ -3221,7 +5020,7 @@ static int mod_gridsite_perm_handler(request_rec *r)
                         "Examine ACL file %s (from ACL path %s)",
                         aclpath, ((mod_gridsite_dir_cfg *) cfg)->aclpath);
 
-                acl = GRSTgaclAclLoadFile(aclpath);
+                cacl = GRST_load_cached_acl(r, aclpath);
               }
             else ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server,
                         "Failed to make ACL file from ACL path %s, URI %s)",
@@ -3233,17 +5032,16 @@ static int mod_gridsite_perm_handler(request_rec *r)
                           strlen(((mod_gridsite_dir_cfg *) cfg)->dnlistsuri)) != 0) ||
                  (strlen(r->uri) <= strlen(((mod_gridsite_dir_cfg *) cfg)->dnlistsuri)))
           {
-            acl = GRSTgaclAclLoadforFile(r->filename);
+            cacl = GRST_load_cached_aclforfile(r, r->filename);
           }
 
-        if (acl != NULL) perm = GRSTgaclAclTestUser(acl, user);
-        GRSTgaclAclFree(acl);
+        if (cacl != NULL) perm = GRSTgaclCompiledAclTestUser(cacl, user);
         
         if (destination_translated != NULL)
           {
-            acl = GRSTgaclAclLoadforFile(destination_translated);
-            if (acl != NULL) destination_perm = GRSTgaclAclTestUser(acl, user);
-            GRSTgaclAclFree(acl);
+            cacl = GRST_load_cached_aclforfile(r, destination_translated);
+            if (cacl != NULL) 
+                     destination_perm = GRSTgaclCompiledAclTestUser(cacl, user);
 
             apr_table_setn(r->notes, "GRST_DESTINATION_PERM",
                               apr_psprintf(r->pool, "%d", destination_perm));
@@ -3885,6 +5683,268 @@ void sitecast_responder(server_rec *main_server)
        } /* **** end of main listening loop **** */
 }
 
+typedef struct
+{
+   apr_uint64_t		sweeps;
+   apr_uint64_t		scanned;
+   apr_uint64_t		deleted;
+   apr_uint64_t		bytes;
+   apr_time_t		started;
+   apr_time_t		last_start;
+   apr_time_t		last_finish;
+   apr_uint64_t		last_scanned;
+   apr_uint64_t		last_deleted;
+}  grst_sweeper_stats;
+
+static int sessions_sweep_expired(apr_pool_t *pool, const char *path, 
+                                  apr_finfo_t *finfo, apr_time_t timeout)
+/*
+    Decide whether a file in the sessions directory has expired. Passcode
+    files are expired by their expires= line, or after a day without one.
+    SSL creds and left over tmp-* files last as long as SSL sessions.
+*/
+{
+   apr_file_t *fp;
+   char        line[80], *p;
+   apr_time_t  now = apr_time_now();
+   int         expired = -1;
+
+   if ((strncmp(finfo->name, "sslcreds-", 9) == 0) ||
+       (strncmp(finfo->name, "tmp-", 4) == 0))
+     return (finfo->ctime < now - timeout);
+
+   if (strncmp(finfo->name, "passcode-", 9) != 0) return 0;
+
+   if (apr_file_open(&fp, path, APR_READ, 0, pool) == APR_SUCCESS)
+     {
+       while (apr_file_gets(line, sizeof(line), fp) == APR_SUCCESS)
+            {
+              if (strncmp(line, "expires=", 8) == 0)
+                {
+                  if ((p = index(line, '\n')) != NULL) *p = '\0';
+                  expired = (apr_time_from_sec(atoll(&line[8])) < now);
+                  break;
+                }
+            }
+
+       apr_file_close(fp);
+     }
+
+   if (expired >= 0) return expired;
+
+   return (finfo->mtime < now - apr_time_from_sec(GRST_PASSCODE_STORE_EXPIRY));
+}
+
+static void sessions_sweep(server_rec *main_server, apr_pool_t *pool,
+                           const char *dirname, apr_time_t timeout,
+                           grst_sweeper_stats *stats)
+/*
+    One pass over the sessions directory, removing expired files in
+    batches of GRST_SESSIONS_SWEEP_BATCH at no more than 
+    GridSiteSessionsSweepRate files per second.
+*/
+{
+   apr_dir_t   *dir;
+   apr_finfo_t  finfo;
+   apr_pool_t  *subpool;
+   char        *path;
+   int          batch = 0;
+
+   if (apr_dir_open(&dir, dirname, pool) != APR_SUCCESS) return;
+
+   apr_pool_create(&subpool, pool);
+
+   stats->last_start   = apr_time_now();
+   stats->last_scanned = 0;
+   stats->last_deleted = 0;
+
+   while (apr_dir_read(&finfo, APR_FINFO_NAME, dir) == APR_SUCCESS)
+        {
+          if (finfo.name[0] == '.') continue;
+
+          ++(stats->scanned);
+          ++(stats->last_scanned);
+
+          path = apr_pstrcat(subpool, dirname, "/", finfo.name, NULL);
+
+          if ((apr_stat(&finfo, path, APR_FINFO_NAME | APR_FINFO_TYPE |
+                        APR_FINFO_SIZE | APR_FINFO_CTIME | APR_FINFO_MTIME,
+                        subpool) == APR_SUCCESS) &&
+              (finfo.filetype == APR_REG) &&
+              sessions_sweep_expired(subpool, path, &finfo, timeout) &&
+              (apr_file_remove(path, subpool) == APR_SUCCESS))
+            {
+              ++(stats->deleted);
+              ++(stats->last_deleted);
+              stats->bytes += finfo.size;
+            }
+
+          if (++batch >= GRST_SESSIONS_SWEEP_BATCH)
+            {
+              apr_pool_clear(subpool);
+              apr_sleep(apr_time_from_sec(GRST_SESSIONS_SWEEP_BATCH) 
+                        / sessionssweeprate);
+              batch = 0;
+            }
+        }
+
+   apr_dir_close(dir);
+   apr_pool_destroy(subpool);
+
+   stats->last_finish = apr_time_now();
+   ++(stats->sweeps);
+
+   ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, main_server,
+              "mod_gridsite: swept %s, %" APR_UINT64_T_FMT " scanned, "
+              "%" APR_UINT64_T_FMT " deleted", dirname,
+              stats->last_scanned, stats->last_deleted);
+}
+
+static void sessions_sweeper(server_rec *main_server, apr_pool_t *pool,
+                             apr_time_t timeout)
+/*
+    Body of the sweeper process: sweep every GridSiteSessionsSweep seconds
+    until the parent goes away.
+*/
+{
+   pid_t               parent = getppid();
+   char               *dirname;
+   int                 i;
+   grst_sweeper_stats *stats;
+
+   if ((geteuid() == 0) &&
+       ((setgid(ap_unixd_config.group_id) != 0) ||
+        (setuid(ap_unixd_config.user_id) != 0)))
+     {
+       ap_log_error(APLOG_MARK, APLOG_ERR, errno, main_server,
+              "mod_gridsite: sessions sweeper cannot change user, exiting");
+       return;
+     }
+
+   dirname = ap_server_root_relative(pool, sessionsdir);
+   stats   = (grst_sweeper_stats *) apr_shm_baseaddr_get(sweeper_shm);
+
+   while (getppid() == parent)
+        {
+          sessions_sweep(main_server, pool, dirname, timeout, stats);
+
+          for (i=0; (i < sessionssweep) && (getppid() == parent); ++i)
+                                               apr_sleep(apr_time_from_sec(1));
+        }
+}
+
+static void sessions_sweeper_init(apr_pool_t *pPool, server_rec *main_server)
+/*
+    Fork the sessions directory sweeper for this configuration, with its
+    counters in shared memory for the GRST_SESSIONS_STATUS_HANDLER.
+*/
+{
+   apr_proc_t         *procnew;
+   apr_status_t        status;
+   SSLSrvConfigRec    *sc;
+   apr_time_t          timeout = apr_time_from_sec(300);
+   void               *data = NULL;
+   const char         *userdata_key = "gridsite_sweeper_init";
+   grst_sweeper_stats *stats;
+
+   sweeper_shm = NULL;
+
+   /* nothing to do on the first pass, when only checking the config */
+
+   apr_pool_userdata_get(&data, userdata_key, main_server->process->pool);
+
+   if (data == NULL)
+     {
+       apr_pool_userdata_set((const void *) 1, userdata_key,
+                     apr_pool_cleanup_null, main_server->process->pool);
+       return;
+     }
+
+   if (sessionssweep == 0) return;
+
+   sc = ap_get_module_config(main_server->module_config, &ssl_module);
+
+   if ((sc != NULL) && (sc->session_cache_timeout > 0))
+     timeout = apr_time_from_sec(sc->session_cache_timeout);
+
+   if ((status = apr_shm_create(&sweeper_shm, sizeof(grst_sweeper_stats),
+                                NULL, pPool)) != APR_SUCCESS)
+     {
+       ap_log_error(APLOG_MARK, APLOG_ERR, status, main_server,
+              "mod_gridsite: Failed to create sweeper counters, "
+              "expiring sessions files in child processes instead");
+       sweeper_shm = NULL;
+       return;
+     }
+
+   stats = (grst_sweeper_stats *) apr_shm_baseaddr_get(sweeper_shm);
+   memset(stats, 0, sizeof(grst_sweeper_stats));
+   stats->started = apr_time_now();
+
+   procnew = apr_pcalloc(pPool, sizeof(*procnew));
+
+   status = apr_proc_fork(procnew, pPool);
+
+   if (status == APR_INCHILD)
+     {
+       ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, main_server,
+              "mod_gridsite: Spawning sessions sweeper process");
+       sessions_sweeper(main_server, pPool, timeout);
+       exit(0);
+     }
+   else if (status != APR_INPARENT)
+     {
+       ap_log_error(APLOG_MARK, APLOG_ERR, status, main_server,
+              "mod_gridsite: Failed to spawn sessions sweeper process, "
+              "expiring sessions files in child processes instead");
+       apr_shm_destroy(sweeper_shm);
+       sweeper_shm = NULL;
+       return;
+     }
+
+   /* killed when this configuration is unloaded, ie at restarts */
+   apr_pool_note_subprocess(pPool, procnew, APR_KILL_AFTER_TIMEOUT);
+}
+
+static int mod_gridsite_sessions_status_handler(request_rec *r)
+/*
+    Report the sweeper's counters in plain text, in the style of
+    mod_status ?auto
+*/
+{
+   grst_sweeper_stats *stats;
+
+   if (sweeper_shm == NULL) return HTTP_NOT_FOUND;
+
+   if (r->method_number != M_GET) return HTTP_METHOD_NOT_ALLOWED;
+
+   stats = (grst_sweeper_stats *) apr_shm_baseaddr_get(sweeper_shm);
+
+   ap_set_content_type(r, "text/plain");
+   
+   if (r->header_only) return OK;
+
+   ap_rprintf(r, "SessionsDir: %s\n", 
+                 ap_server_root_relative(r->pool, sessionsdir));
+   ap_rprintf(r, "SweepInterval: %d\n", sessionssweep);
+   ap_rprintf(r, "SweepRate: %d\n", sessionssweeprate);
+   ap_rprintf(r, "SweeperStarted: %ld\n", (long) apr_time_sec(stats->started));
+   ap_rprintf(r, "Sweeps: %" APR_UINT64_T_FMT "\n", stats->sweeps);
+   ap_rprintf(r, "Scanned: %" APR_UINT64_T_FMT "\n", stats->scanned);
+   ap_rprintf(r, "Deleted: %" APR_UINT64_T_FMT "\n", stats->deleted);
+   ap_rprintf(r, "BytesReclaimed: %" APR_UINT64_T_FMT "\n", stats->bytes);
+   ap_rprintf(r, "LastSweepStart: %ld\n", 
+                 (long) apr_time_sec(stats->last_start));
+   ap_rprintf(r, "LastSweepFinish: %ld\n", 
+                 (long) apr_time_sec(stats->last_finish));
+   ap_rprintf(r, "LastSweepScanned: %" APR_UINT64_T_FMT "\n", 
+                 stats->last_scanned);
+   ap_rprintf(r, "LastSweepDeleted: %" APR_UINT64_T_FMT "\n", 
+                 stats->last_deleted);
+
+   return OK;
+}
+
 static int mod_gridsite_server_post_config(apr_pool_t *pPool,
                   apr_pool_t *pLog, apr_pool_t *pTemp, server_rec *main_server)
 {
@@ -3990,12 +6050,24 @@ static int mod_gridsite_server_post_config(apr_pool_t *pPool,
           }
       }
 
+   /* shared cache of parsed ACL files */
+
+   aclcache_init(pPool, main_server);
+
+   /* shared store of SSL session creds, if not files */
+
+   sessionsstore_init(pPool, main_server);
+
    /* create sessions directory if necessary */
 
    path = ap_server_root_relative(pPool, sessionsdir);
    apr_dir_make_recursive(path, APR_UREAD | APR_UWRITE | APR_UEXECUTE, pPool);
    chown(path, ap_unixd_config.user_id, ap_unixd_config.group_id);
 
+   /* expire files in the sessions directory in the background */
+
+   sessions_sweeper_init(pPool, main_server);
+
    canl_free_ctx(c_ctx);
    return OK;
 }
@@ -4038,9 +6110,49 @@ static void mod_gridsite_child_init(apr_pool_t *pPool, server_rec *pServer)
    mod_gridsite_log_func_server = pServer;
    GRSTerrorLogFunc = mod_gridsite_log_func;
 
-   /* expire old ssl creds files */
+   /* cache header and footer files for formatted pages in this child */
+   fragment_cache_init(pPool);
+
+   /* and sorted directory listings for JSON listings */
+   listing_cache_init(pPool);
+
+   /* and compiled ACLs */
+   compiled_acl_cache_init(pPool);
+
+   /* cache .gacl lookups in this child, invalidated by inotify */
+   if (!GRSTgaclFileFindAclnameCache(GRST_ACLNAME_CACHE_ENTRIES))
+     ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, pServer,
+                  "mod_gridsite: inotify unavailable, ACL lookups not cached");
+
+   /* index DN Lists membership in this child, updated by inotify */
+   if (!GRSTgaclDNlistsIndex(1))
+     ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, pServer,
+                  "mod_gridsite: inotify unavailable, DN Lists not indexed");
+
+   if ((aclcache_mutex != NULL) &&
+       (apr_global_mutex_child_init(&aclcache_mutex, NULL, pPool) 
+                                                            != APR_SUCCESS))
+     {
+       ap_log_error(APLOG_MARK, APLOG_ERR, 0, pServer,
+                    "mod_gridsite: ACL cache mutex unusable in child");
+       aclcache_shm = NULL;
+     }
+
+#ifdef GRST_AP_SOCACHE
+   if ((sessionsstore_mutex != NULL) &&
+       (apr_global_mutex_child_init(&sessionsstore_mutex, NULL, pPool)
+                                                            != APR_SUCCESS))
+     {
+       ap_log_error(APLOG_MARK, APLOG_ERR, 0, pServer,
+                    "mod_gridsite: sessions store mutex unusable in child, "
+                    "using files in %s instead", sessionsdir);
+       sessionsstore = NULL;
+     }
+#endif
+
+   /* expire old ssl creds files, if there is no sessions sweeper */
                                     
-   if (sc != NULL)
+   if ((sc != NULL) && (sweeper_shm == NULL))
      {
        cutoff_time = apr_time_now() 
                       - apr_time_from_sec(sc->session_cache_timeout);
@@ -4078,6 +6190,9 @@ static int mod_gridsite_handler(request_rec *r)
 {
    mod_gridsite_dir_cfg *conf;
     
+   if (strcmp(r->handler, GRST_SESSIONS_STATUS_HANDLER) == 0)
+              return mod_gridsite_sessions_status_handler(r);
+
    conf = (mod_gridsite_dir_cfg *)
                     ap_get_module_config(r->per_dir_config, &gridsite_module);
 
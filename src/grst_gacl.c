@@ -47,6 +47,9 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <fnmatch.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/inotify.h>
 
 #include <libxml/xmlmemory.h>
 #include <libxml/tree.h>
@@ -845,17 +848,248 @@ int GRSTgaclFileIsAcl(char *pathandfile)
   return (strncmp(filename, GRST_ACL_FILE, sizeof(GRST_ACL_FILE) - 1) == 0);
 }
 
+/*                                                              *
+ * Per-process cache of the directory walk done by              *
+ * GRSTgaclFileFindAclname(), kept up to date with inotify      *
+ *                                                              */
+
+#define GRST_ACLNAME_BUCKETS 1024
+
+typedef struct { char *path;
+                 char *aclpath;
+                 void *next;    } GRSTgaclAclnameEntry;
+
+static pthread_mutex_t       grst_aclname_mutex = PTHREAD_MUTEX_INITIALIZER;
+static GRSTgaclAclnameEntry *grst_aclname_buckets[GRST_ACLNAME_BUCKETS];
+static int                   grst_aclname_max        = 0;
+static int                   grst_aclname_count      = 0;
+static int                   grst_aclname_fd         = -1;
+static unsigned long         grst_aclname_generation = 0;
+
+static unsigned int GRSTgaclAclnameHash(char *s)
+{
+  unsigned int hash = 5381;
+  
+  while (*s != '\0') hash = hash * 33 + (unsigned char) *(s++);
+  
+  return hash % GRST_ACLNAME_BUCKETS;
+}
+
+static void GRSTgaclAclnameFlush(void)
+/*
+    (Private, caller holds grst_aclname_mutex)
+
+    GRSTgaclAclnameFlush - empty the cache and drop all the inotify watches
+*/
+{
+  int                   i;
+  GRSTgaclAclnameEntry *entry, *next;
+  
+  for (i=0; i < GRST_ACLNAME_BUCKETS; ++i)
+     {
+       for (entry = grst_aclname_buckets[i]; entry != NULL; entry = next)
+          {
+            next = entry->next;
+            free(entry->path);
+            if (entry->aclpath != NULL) free(entry->aclpath);
+            free(entry);
+          }
+          
+       grst_aclname_buckets[i] = NULL;
+     }
+
+  if (grst_aclname_fd >= 0) close(grst_aclname_fd);
+  
+  grst_aclname_fd    = -1;
+  grst_aclname_count = 0;
+  ++grst_aclname_generation;
+}
+
+static void GRSTgaclAclnameDrain(void)
+/*
+    (Private, caller holds grst_aclname_mutex)
+
+    GRSTgaclAclnameDrain - read any pending inotify events and flush the 
+    cache if an ACL file has appeared or gone, or if a directory on any
+    cached path has been created, removed or renamed (a file may have been
+    replaced by a directory with its own ACL.)
+*/
+{
+  int     flush = 0;
+  char    buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  char   *p;
+  ssize_t len;
+  struct inotify_event *event;
+  
+  if (grst_aclname_fd < 0) return;
+
+  while ((len = read(grst_aclname_fd, buf, sizeof(buf))) > 0)
+       {
+         for (p = buf; p < buf + len; 
+              p += sizeof(struct inotify_event) + event->len)
+            {
+              event = (struct inotify_event *) p;
+              
+              if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | 
+                                 IN_IGNORED | IN_Q_OVERFLOW)) flush = 1;
+              else if ((event->mask & IN_ISDIR) &&
+                       (event->mask & (IN_CREATE | IN_DELETE | 
+                                       IN_MOVED_FROM | IN_MOVED_TO))) flush = 1;
+              else if ((event->len > 0) &&
+                       (strncmp(event->name, GRST_ACL_FILE,
+                                sizeof(GRST_ACL_FILE) - 1) == 0)) flush = 1;
+            }
+       }
+
+  if ((len < 0) && (errno != EAGAIN) && (errno != EINTR)) flush = 1;
+
+  if (flush) GRSTgaclAclnameFlush();
+}
+
+static int GRSTgaclAclnameWatch(char *dir)
+/*
+    (Private, caller holds grst_aclname_mutex)
+
+    GRSTgaclAclnameWatch - add an inotify watch on directory dir, 
+    returning 1 on success or 0 on error.
+*/
+{
+  if (grst_aclname_fd < 0)
+    {
+      grst_aclname_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (grst_aclname_fd < 0) return 0;
+    }
+
+  return (inotify_add_watch(grst_aclname_fd, (dir[0] == '\0') ? "/" : dir,
+                            IN_CREATE | IN_DELETE | IN_MOVED_FROM | 
+                            IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                            IN_ONLYDIR) >= 0);
+}
+
+static char *GRSTgaclAclnameWalk(char *path, int *watched)
+/*
+    (Private)
+
+    GRSTgaclAclnameWalk - walk up from directory path (which is modified
+    on the way) looking for an ACL file, and return a malloc()ed copy of
+    its name or NULL. If *watched is set, every directory up to / is also
+    watched, and *watched is cleared if any of those watches fail.
+*/
+{
+  char        *p, *found = NULL;
+  struct stat  statbuf;
+
+  while (path[0] != '\0')
+       {
+         if (*watched && !GRSTgaclAclnameWatch(path)) *watched = 0;
+
+         if (found == NULL)
+           {
+             strcat(path, "/");
+             strcat(path, GRST_ACL_FILE);
+         
+             if (stat(path, &statbuf) == 0) 
+               {
+                 found = strdup(path);
+                 if (!*watched) return found;
+               }
+           
+             p = rindex(path, '/');
+             *p = '\0';     /* strip off the / we added for ACL */
+           }
+           
+         p = rindex(path, '/');
+         if (p == NULL) break; /* must start without / and we there now ??? */
+
+         *p = '\0';     /* strip off another layer of / */                 
+       }
+
+  if (*watched && !GRSTgaclAclnameWatch("/")) *watched = 0;
+
+  return found;
+}
+
+int GRSTgaclFileFindAclnameCache(int maxentries)
+/*
+    GRSTgaclFileFindAclnameCache - enable caching of the results of 
+    GRSTgaclFileFindAclname() directory walks in this process, for up to
+    maxentries directories, or disable it if maxentries is 0. Returns 1
+    on success or 0 if inotify is unavailable.
+*/
+{
+  int fd;
+
+  pthread_mutex_lock(&grst_aclname_mutex);
+
+  GRSTgaclAclnameFlush();
+  grst_aclname_max = 0;
+
+  if (maxentries > 0)
+    {
+      if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+        {
+          pthread_mutex_unlock(&grst_aclname_mutex);
+          return 0;
+        }
+    
+      close(fd);
+      grst_aclname_max = maxentries;
+    }
+
+  pthread_mutex_unlock(&grst_aclname_mutex);
+  return 1;
+}
+
+void GRSTgaclFileFindAclnameUpdate(void)
+/*
+    GRSTgaclFileFindAclnameUpdate - apply any changes to the filesystem
+    reported by inotify to the GRSTgaclFileFindAclname() cache. Lookups
+    trust the cache as it stands, so this should be called once at the
+    start of each request rather than before every lookup.
+*/
+{
+  if (grst_aclname_max <= 0) return;
+
+  pthread_mutex_lock(&grst_aclname_mutex);
+  GRSTgaclAclnameDrain();
+  pthread_mutex_unlock(&grst_aclname_mutex);
+}
+
 char *GRSTgaclFileFindAclname(char *pathandfile)
 /* Return malloc()ed ACL filename that governs the given file or directory 
    (for directories, the ACL file is in the directory itself), or NULL if none
-   can be found. */
+   can be found. If GRSTgaclFileFindAclnameCache() has been called, the 
+   result is cached for pathandfile and a repeat lookup makes no system
+   calls, until GRSTgaclFileFindAclnameUpdate() sees a change. */
 {
-  int          len;
-  char        *path, *file, *p;
+  int          len, watched;
+  unsigned int hash;
+  unsigned long generation;
+  char        *path, *file, *p, *aclpath, *fileacl;
   struct stat  statbuf;
+  GRSTgaclAclnameEntry *entry;
 
   len = strlen(pathandfile);
   if (len == 0) return NULL;
+
+  if (grst_aclname_max > 0)
+    {
+      hash = GRSTgaclAclnameHash(pathandfile);
+
+      pthread_mutex_lock(&grst_aclname_mutex);
+
+      for (entry = grst_aclname_buckets[hash]; entry != NULL; 
+           entry = entry->next)
+         if (strcmp(entry->path, pathandfile) == 0)
+           {
+             aclpath = (entry->aclpath == NULL) ? NULL 
+                                                : strdup(entry->aclpath);
+             pthread_mutex_unlock(&grst_aclname_mutex);
+             return aclpath;
+           }
+
+      pthread_mutex_unlock(&grst_aclname_mutex);
+    }
   
   path = malloc(len + sizeof(GRST_ACL_FILE) + 2);
   strcpy(path, pathandfile);
@@ -867,6 +1101,8 @@ char *GRSTgaclFileFindAclname(char *pathandfile)
       strcat(path, "/");
       ++len;
     }
+
+  fileacl = NULL;
     
   if (path[len-1] != '/')
     {
@@ -877,30 +1113,59 @@ char *GRSTgaclFileFindAclname(char *pathandfile)
           p = rindex(path, '/');          
           sprintf(p, "/%s:%s", GRST_ACL_FILE, file);
 
-          if (stat(path, &statbuf) == 0) return path;
+          if (stat(path, &statbuf) == 0) 
+            {
+              if (grst_aclname_max <= 0) return path;
+              fileacl = strdup(path);
+            }
 
           *p = '\0'; /* otherwise strip off any filename */
         }
     }
 
-  while (path[0] != '\0')
-       {
-         strcat(path, "/");
-         strcat(path, GRST_ACL_FILE);
-         
-         if (stat(path, &statbuf) == 0) return path;
-           
-         p = rindex(path, '/');
-         *p = '\0';     /* strip off the / we added for ACL */
+  if (grst_aclname_max <= 0) /* no cache */
+    {
+      watched = 0;
+      aclpath = GRSTgaclAclnameWalk(path, &watched);
+      free(path);
+      return aclpath;
+    }
 
-         p = rindex(path, '/');
-         if (p == NULL) break; /* must start without / and we there now ??? */
+  pthread_mutex_lock(&grst_aclname_mutex);
 
-         *p = '\0';     /* strip off another layer of / */                 
-       }
-       
+  GRSTgaclAclnameDrain();
+
+  if (grst_aclname_count >= grst_aclname_max) GRSTgaclAclnameFlush();
+
+  generation = grst_aclname_generation;
+
+  /* the walk is still needed for a per-file ACL, to watch the directories
+     above it in case they are renamed */
+
+  watched = 1;
+  aclpath = GRSTgaclAclnameWalk(path, &watched);
   free(path);
-  return NULL;
+
+  if (fileacl != NULL)
+    {
+      if (aclpath != NULL) free(aclpath);
+      aclpath = fileacl;
+    }
+
+  GRSTgaclAclnameDrain(); /* anything change while we were walking? */
+
+  if (watched && (generation == grst_aclname_generation))
+    {
+      entry = malloc(sizeof(GRSTgaclAclnameEntry));
+      entry->path    = strdup(pathandfile);
+      entry->aclpath = (aclpath == NULL) ? NULL : strdup(aclpath);
+      entry->next    = grst_aclname_buckets[hash];
+      grst_aclname_buckets[hash] = entry;
+      ++grst_aclname_count;
+    }
+
+  pthread_mutex_unlock(&grst_aclname_mutex);
+  return aclpath;
 }
 
 GRSTgaclAcl *GRSTgaclAclLoadforFile(char *pathandfile)
@@ -1174,7 +1439,7 @@ static void recurse4dnlists(GRSTgaclUser *user, char *dir,
              munmap(mapped, statbuf.st_size);
            }
 
-         if (fd < 0) close(fd);
+         if (fd >= 0) close(fd);
          free(fullfilename);
        }
 
@@ -1182,6 +1447,626 @@ static void recurse4dnlists(GRSTgaclUser *user, char *dir,
   closedir(dirDIR);  
 }
 
+/*                                                              *
+ * Per-process index of DN List membership, built on first use  *
+ * and kept up to date with inotify                             *
+ *                                                              */
+
+#define GRST_DNLISTS_BUCKETS    4096
+#define GRST_DNLISTS_LINK_CHECK 60 /* seconds between checks of symlinks */
+
+typedef struct { char  *dn;
+                 int    nfiles;
+                 int    allocated;
+                 int   *files;
+                 void  *next;      } GRSTgaclDNlistsMember;
+
+typedef struct { char  *path;      /* NULL once gone, and slot reusable */
+                 char  *name;      /* URL-decoded filename, ie list URL */
+                 int    islink;
+                 time_t mtime;
+                 off_t  size;
+                 ino_t  inode;
+                 int    nmembers;
+                 int    allocated;
+                 GRSTgaclDNlistsMember **members; } GRSTgaclDNlistsFile;
+
+typedef struct { int    wd;
+                 int    level;
+                 char  *path;      } GRSTgaclDNlistsDir;
+
+typedef struct { char  *dnlists;
+                 int    fd;        /* -1 if index unusable */
+                 int    missing;   /* some dnlists directory is missing */
+                 time_t linkcheck;
+                 int    nfiles;
+                 int    allocfiles;
+                 GRSTgaclDNlistsFile  *files;
+                 int    ndirs;
+                 int    allocdirs;
+                 GRSTgaclDNlistsDir   *dirs;
+                 GRSTgaclDNlistsMember *buckets[GRST_DNLISTS_BUCKETS];
+                 void  *next;      } GRSTgaclDNlistsTable;
+
+static pthread_mutex_t       grst_dnlists_mutex   = PTHREAD_MUTEX_INITIALIZER;
+static int                   grst_dnlists_enabled = 0;
+static GRSTgaclDNlistsTable *grst_dnlists_first   = NULL;
+
+static unsigned int GRSTgaclDNlistsHash(char *s, size_t len)
+{
+  unsigned int hash = 5381;
+  
+  while (len-- > 0) hash = hash * 33 + (unsigned char) *(s++);
+  
+  return hash % GRST_DNLISTS_BUCKETS;
+}
+
+static GRSTgaclDNlistsMember *GRSTgaclDNlistsFind(GRSTgaclDNlistsTable *table,
+                                          char *dn, size_t len, int create)
+/*
+    (Private)
+    
+    GRSTgaclDNlistsFind - find the member record for the len characters
+    of DN dn, creating one if necessary and create is set.
+*/
+{
+  unsigned int           hash;
+  GRSTgaclDNlistsMember *member;
+
+  hash = GRSTgaclDNlistsHash(dn, len);
+
+  for (member = table->buckets[hash]; member != NULL; member = member->next)
+     if ((strncmp(member->dn, dn, len) == 0) && (member->dn[len] == '\0'))
+                                                              return member;
+
+  if (!create) return NULL;
+
+  member = malloc(sizeof(GRSTgaclDNlistsMember));
+  member->dn        = strndup(dn, len);
+  member->nfiles    = 0;
+  member->allocated = 0;
+  member->files     = NULL;
+  member->next      = table->buckets[hash];
+  table->buckets[hash] = member;
+
+  return member;
+}
+
+static void GRSTgaclDNlistsUnindexFile(GRSTgaclDNlistsTable *table, int ifile)
+/*
+    (Private)
+    
+    GRSTgaclDNlistsUnindexFile - remove all the memberships recorded for
+    file number ifile, freeing any member records that become empty.
+*/
+{
+  int                     i, j;
+  unsigned int            hash;
+  GRSTgaclDNlistsFile    *file = &(table->files[ifile]);
+  GRSTgaclDNlistsMember  *member, **prev;
+  
+  for (i=0; i < file->nmembers; ++i)
+     {
+       member = file->members[i];
+
+       for (j=0; j < member->nfiles; ++j) if (member->files[j] == ifile) break;
+
+       if (j < member->nfiles)
+         {
+           memmove(&(member->files[j]), &(member->files[j+1]),
+                   (member->nfiles - j - 1) * sizeof(int));
+           --(member->nfiles);
+         }
+
+       if (member->nfiles > 0) continue;
+
+       hash = GRSTgaclDNlistsHash(member->dn, strlen(member->dn));
+       
+       for (prev = &(table->buckets[hash]); *prev != NULL; 
+            prev = (GRSTgaclDNlistsMember **) &((*prev)->next))
+          if (*prev == member)
+            {
+              *prev = member->next;
+              break;
+            }
+
+       free(member->dn);
+       free(member->files);
+       free(member);
+     }
+
+  file->nmembers = 0;
+}
+
+static void GRSTgaclDNlistsIndexFile(GRSTgaclDNlistsTable *table, int ifile)
+/*
+    (Private)
+    
+    GRSTgaclDNlistsIndexFile - record every line of file number ifile as
+    a member of that list. Lines are separated by any run of \n and \r,
+    exactly as recurse4dnlists() compares them.
+*/
+{
+  int                    fd;
+  off_t                  i, linestart;
+  char                  *mapped;
+  struct stat            statbuf;
+  GRSTgaclDNlistsFile   *file = &(table->files[ifile]);
+  GRSTgaclDNlistsMember *member;
+
+  if (file->path == NULL) return;
+  
+  if ((fd = open(file->path, O_RDONLY)) < 0) return;
+  
+  if ((fstat(fd, &statbuf) != 0) || !S_ISREG(statbuf.st_mode))
+    {
+      close(fd);
+      return;
+    }
+
+  file->mtime = statbuf.st_mtime;
+  file->size  = statbuf.st_size;
+  file->inode = statbuf.st_ino;
+
+  if ((statbuf.st_size == 0) ||
+      ((mapped = mmap(NULL, statbuf.st_size, 
+                      PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+    {
+      close(fd);
+      return;
+    }
+
+  for (linestart = 0; linestart < statbuf.st_size; linestart = i)
+     {
+       for (i=linestart; (i < statbuf.st_size) &&
+                         (mapped[i] != '\n') && (mapped[i] != '\r'); ++i) ;
+
+       if (i > linestart)
+         {
+           member = GRSTgaclDNlistsFind(table, &mapped[linestart],
+                                        i - linestart, 1);
+
+           if ((member->nfiles == 0) || 
+               (member->files[member->nfiles - 1] != ifile))
+             {
+               if (member->nfiles >= member->allocated)
+                 {
+                   member->allocated += 4;
+                   member->files = realloc(member->files,
+                                           member->allocated * sizeof(int));
+                 }
+               
+               member->files[(member->nfiles)++] = ifile;
+
+               if (file->nmembers >= file->allocated)
+                 {
+                   file->allocated += 256;
+                   file->members = realloc(file->members,
+                        file->allocated * sizeof(GRSTgaclDNlistsMember *));
+                 }
+
+               file->members[(file->nmembers)++] = member;
+             }
+         }
+
+       while ((i < statbuf.st_size) && 
+              ((mapped[i] == '\n') || (mapped[i] == '\r'))) ++i;
+     }
+
+  munmap(mapped, statbuf.st_size);
+  close(fd);
+}
+
+static int GRSTgaclDNlistsAddFile(GRSTgaclDNlistsTable *table, char *path,
+                                  char *name)
+/*
+    (Private)
+    
+    GRSTgaclDNlistsAddFile - add a new file to the table, returning its
+    number. The slot of a file which has gone is reused if there is one,
+    so lists replaced by renaming do not make the table grow. path is
+    used as is, but name is URL-decoded.
+*/
+{
+  int                  ifile;
+  struct stat          statbuf;
+  GRSTgaclDNlistsFile *file;
+
+  for (ifile=0; ifile < table->nfiles; ++ifile)
+     if (table->files[ifile].path == NULL) break;
+
+  if (ifile >= table->allocfiles)
+    {
+      table->allocfiles += 64;
+      table->files = realloc(table->files, 
+                             table->allocfiles * sizeof(GRSTgaclDNlistsFile));
+    }
+
+  if (ifile >= table->nfiles) ++(table->nfiles);
+
+  file = &(table->files[ifile]);
+  
+  file->path      = path;
+  file->name      = GRSThttpUrlDecode(name);
+  file->islink    = (lstat(path, &statbuf) == 0) && S_ISLNK(statbuf.st_mode);
+  file->mtime     = 0;
+  file->size      = 0;
+  file->inode     = 0;
+  file->nmembers  = 0;
+  file->allocated = 0;
+  file->members   = NULL;
+
+  GRSTgaclDNlistsIndexFile(table, ifile);
+
+  return ifile;
+}
+
+static int GRSTgaclDNlistsScanDir(GRSTgaclDNlistsTable *table, char *dir,
+                                  int level)
+/*
+    (Private)
+    
+    GRSTgaclDNlistsScanDir - watch and index all the lists in dir and its
+    subdirectories, to the same depth as recurse4dnlists(). Returns 0 if
+    a watch could not be set up, so the index cannot be trusted.
+*/
+{
+  int            wd, ret = 1;
+  char          *fullfilename;
+  struct stat    statbuf;
+  DIR           *dirDIR;
+  struct dirent *file_ent;
+
+  if (level >= GRST_RECURS_LIMIT) return 1;
+
+  wd = inotify_add_watch(table->fd, dir, IN_CREATE | IN_DELETE | 
+                         IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO |
+                         IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+  if (wd < 0) return (errno == ENOENT) || (errno == ENOTDIR);
+
+  if (table->ndirs >= table->allocdirs)
+    {
+      table->allocdirs += 16;
+      table->dirs = realloc(table->dirs, 
+                            table->allocdirs * sizeof(GRSTgaclDNlistsDir));
+    }
+
+  table->dirs[table->ndirs].wd    = wd;
+  table->dirs[table->ndirs].level = level;
+  table->dirs[table->ndirs].path  = strdup(dir);
+  ++(table->ndirs);
+
+  if ((dirDIR = opendir(dir)) == NULL) return 1;
+
+  while ((file_ent = readdir(dirDIR)) != NULL)
+       {
+         if (file_ent->d_name[0] == '.') continue;
+       
+         asprintf(&fullfilename, "%s/%s", dir, file_ent->d_name);
+
+         if (stat(fullfilename, &statbuf) != 0) free(fullfilename);
+         else if (S_ISDIR(statbuf.st_mode))
+           {
+             if (!GRSTgaclDNlistsScanDir(table, fullfilename, level + 1))
+                                                                    ret = 0;
+             free(fullfilename);
+           }
+         else if (S_ISREG(statbuf.st_mode))
+           GRSTgaclDNlistsAddFile(table, fullfilename, file_ent->d_name);
+         else free(fullfilename);
+       }
+
+  closedir(dirDIR);
+  return ret;
+}
+
+static void GRSTgaclDNlistsEmpty(GRSTgaclDNlistsTable *table)
+/*
+    (Private)
+    
+    GRSTgaclDNlistsEmpty - free everything in the index except its
+    dnlists string, and close its inotify descriptor.
+*/
+{
+  int i;
+
+  for (i=0; i < table->nfiles; ++i)
+     {
+       GRSTgaclDNlistsUnindexFile(table, i);
+       if (table->files[i].path != NULL) free(table->files[i].path);
+       free(table->files[i].name);
+       free(table->files[i].members);
+     }
+
+  for (i=0; i < table->ndirs; ++i) free(table->dirs[i].path);
+
+  free(table->files);
+  free(table->dirs);
+
+  if (table->fd >= 0) close(table->fd);
+
+  table->fd         = -1;
+  table->nfiles     = 0;
+  table->allocfiles = 0;
+  table->files      = NULL;
+  table->ndirs      = 0;
+  table->allocdirs  = 0;
+  table->dirs       = NULL;
+}
+
+static void GRSTgaclDNlistsBuild(GRSTgaclDNlistsTable *table)
+/*
+    (Private)
+    
+    GRSTgaclDNlistsBuild - (re)build the whole index from scratch. On 
+    failure table->fd is left as -1 and callers must scan the files.
+*/
+{
+  char *dn_lists_dirs, *dn_list_ptr, *dirname;
+  int   ok = 1;
+
+  GRSTgaclDNlistsEmpty(table);
+
+  GRSTerrorLog(GRST_LOG_DEBUG, "Building DN Lists index for %s", 
+               table->dnlists);
+
+  if ((table->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) return;
+
+  dn_lists_dirs = strdup(table->dnlists);
+  dn_list_ptr   = dn_lists_dirs;
+
+  table->missing = 0;
+
+  while ((dirname = strsep(&dn_list_ptr, ":")) != NULL)
+       {
+         if (access(dirname, F_OK) != 0) table->missing = 1;
+         else if (!GRSTgaclDNlistsScanDir(table, dirname, 0)) ok = 0;
+       }
+       
+  free(dn_lists_dirs);
+  
+  table->linkcheck = time(NULL) + GRST_DNLISTS_LINK_CHECK;
+
+  if (!ok) GRSTgaclDNlistsEmpty(table);
+}
+
+static void GRSTgaclDNlistsUpdate(GRSTgaclDNlistsTable *table)
+/*
+    (Private)
+    
+    GRSTgaclDNlistsUpdate - apply pending inotify events to the table,
+    reindexing just the files which have changed. Anything which changes
+    the directory tree itself causes a full rebuild.
+*/
+{
+  int          i, idir, rebuild = 0;
+  char         buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  char        *p, *path, *dn_lists_dirs, *dn_list_ptr, *dirname;
+  ssize_t      len;
+  time_t       now;
+  struct stat  statbuf;
+  struct inotify_event *event;
+  
+  if (table->fd < 0) return;
+
+  while (!rebuild && ((len = read(table->fd, buf, sizeof(buf))) > 0))
+       {
+         for (p = buf; p < buf + len; 
+              p += sizeof(struct inotify_event) + event->len)
+            {
+              event = (struct inotify_event *) p;
+              
+              if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | 
+                                 IN_IGNORED | IN_Q_OVERFLOW | IN_ISDIR))
+                {
+                  rebuild = 1;
+                  break;
+                }
+
+              if ((event->len == 0) || (event->name[0] == '.')) continue;
+
+              for (idir=0; idir < table->ndirs; ++idir)
+                 if (table->dirs[idir].wd == event->wd) break;
+
+              if (idir >= table->ndirs) continue;
+
+              asprintf(&path, "%s/%s", table->dirs[idir].path, event->name);
+
+              if ((stat(path, &statbuf) == 0) && S_ISDIR(statbuf.st_mode))
+                {
+                  free(path); /* eg a new symlink to a directory */
+                  rebuild = 1;
+                  break;
+                }
+
+              for (i=0; i < table->nfiles; ++i)
+                 if ((table->files[i].path != NULL) &&
+                     (strcmp(table->files[i].path, path) == 0)) break;
+
+              if (i < table->nfiles)
+                {
+                  GRSTerrorLog(GRST_LOG_DEBUG, "Reindexing DN List %s", path);
+                  
+                  GRSTgaclDNlistsUnindexFile(table, i);
+                  free(path);
+
+                  if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                    {
+                      free(table->files[i].path);
+                      free(table->files[i].name);
+                      free(table->files[i].members);
+                      table->files[i].path      = NULL;
+                      table->files[i].name      = NULL;
+                      table->files[i].members   = NULL;
+                      table->files[i].allocated = 0;
+                    }
+                  else GRSTgaclDNlistsIndexFile(table, i);
+                }
+              else if (!(event->mask & (IN_DELETE | IN_MOVED_FROM)) &&
+                       (stat(path, &statbuf) == 0) && S_ISREG(statbuf.st_mode))
+                {
+                  GRSTerrorLog(GRST_LOG_DEBUG, "Indexing new DN List %s", path);
+                  GRSTgaclDNlistsAddFile(table, path, event->name);
+                }
+              else free(path);
+            }
+       }
+
+  if (rebuild) 
+    {
+      GRSTgaclDNlistsBuild(table);
+      return;
+    }
+
+  /* changes to the targets of symlinks are not seen by inotify */
+
+  now = time(NULL);
+  
+  if (now < table->linkcheck) return;
+  
+  table->linkcheck = now + GRST_DNLISTS_LINK_CHECK;
+
+  if (table->missing) /* have any missing directories appeared? */
+    {
+      dn_lists_dirs = strdup(table->dnlists);
+      dn_list_ptr   = dn_lists_dirs;
+
+      while ((dirname = strsep(&dn_list_ptr, ":")) != NULL)
+       if (access(dirname, F_OK) == 0)
+         {
+           for (idir=0; idir < table->ndirs; ++idir)
+              if ((table->dirs[idir].level == 0) &&
+                  (strcmp(table->dirs[idir].path, dirname) == 0)) break;
+           
+           if (idir >= table->ndirs) rebuild = 1;
+         }
+
+      free(dn_lists_dirs);
+
+      if (rebuild)
+        {
+          GRSTgaclDNlistsBuild(table);
+          return;
+        }
+    }
+
+  for (i=0; i < table->nfiles; ++i)
+     if (table->files[i].islink && (table->files[i].path != NULL) &&
+         ((stat(table->files[i].path, &statbuf) != 0) ||
+          (statbuf.st_mtime != table->files[i].mtime) ||
+          (statbuf.st_size  != table->files[i].size)  ||
+          (statbuf.st_ino   != table->files[i].inode)))
+       {
+         GRSTgaclDNlistsUnindexFile(table, i);
+         GRSTgaclDNlistsIndexFile(table, i);
+       }
+}
+
+int GRSTgaclDNlistsIndex(int enable)
+/*
+    GRSTgaclDNlistsIndex - if enable is set, GRSTgaclUserLoadDNlists() in
+    this process finds memberships with an index of the DN Lists, built
+    on first use and updated from inotify events, rather than by reading
+    every list each time. Returns 1 on success or 0 if inotify is
+    unavailable.
+*/
+{
+  int                   fd;
+  GRSTgaclDNlistsTable *table, *next;
+
+  pthread_mutex_lock(&grst_dnlists_mutex);
+
+  for (table = grst_dnlists_first; table != NULL; table = next)
+     {
+       next = table->next;
+       GRSTgaclDNlistsEmpty(table);
+       free(table->dnlists);
+       free(table);
+     }
+
+  grst_dnlists_first   = NULL;
+  grst_dnlists_enabled = 0;
+
+  if (enable)
+    {
+      if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+        {
+          pthread_mutex_unlock(&grst_dnlists_mutex);
+          return 0;
+        }
+    
+      close(fd);
+      grst_dnlists_enabled = 1;
+    }
+
+  pthread_mutex_unlock(&grst_dnlists_mutex);
+  return 1;
+}
+
+static int GRSTgaclDNlistsLoadIndexed(GRSTgaclUser *user, char *dnlists,
+                                      GRSTgaclCred *dn_cred)
+/*
+    (Private)
+    
+    GRSTgaclDNlistsLoadIndexed - the indexed equivalent of calling
+    recurse4dnlists() for each directory in dnlists. Returns 0 if the
+    index cannot be used.
+*/
+{
+  int                    i;
+  char                  *dn_decoded;
+  GRSTgaclCred          *cred;
+  GRSTgaclDNlistsTable  *table;
+  GRSTgaclDNlistsMember *member;
+
+  pthread_mutex_lock(&grst_dnlists_mutex);
+
+  for (table = grst_dnlists_first; table != NULL; table = table->next)
+     if (strcmp(table->dnlists, dnlists) == 0) break;
+
+  if (table == NULL)
+    {
+      table = calloc(1, sizeof(GRSTgaclDNlistsTable));
+      table->dnlists = strdup(dnlists);
+      table->fd      = -1;
+      table->next    = grst_dnlists_first;
+      grst_dnlists_first = table;
+
+      GRSTgaclDNlistsBuild(table);
+    }
+  else GRSTgaclDNlistsUpdate(table);
+
+  if (table->fd < 0)
+    {
+      pthread_mutex_unlock(&grst_dnlists_mutex);
+      return 0;
+    }
+
+  dn_decoded = GRSThttpUrlDecode(&(dn_cred->auri[3]));
+
+  if ((member = GRSTgaclDNlistsFind(table, dn_decoded, 
+                                    strlen(dn_decoded), 0)) != NULL)
+    {
+      for (i=0; i < member->nfiles; ++i)
+         {
+           cred = GRSTgaclCredCreate(table->files[member->files[i]].name, NULL);
+           GRSTerrorLog(GRST_LOG_DEBUG, "GRSTgaclDNlistsLoadIndexed adds %s",
+                        table->files[member->files[i]].name);
+
+           GRSTgaclCredSetNotBefore(cred,  dn_cred->notbefore);
+           GRSTgaclCredSetNotAfter(cred,   dn_cred->notafter);
+           GRSTgaclCredSetDelegation(cred, dn_cred->delegation);
+           GRSTgaclCredSetNistLoa(cred,    dn_cred->nist_loa);
+
+           GRSTgaclUserAddCred(user, cred);
+         }
+    }
+
+  free(dn_decoded);
+  pthread_mutex_unlock(&grst_dnlists_mutex);
+  return 1;
+}
+
 int GRSTgaclUserLoadDNlists(GRSTgaclUser *user, char *dnlists)
 /*
     Examine DN Lists for attributes belonging to this user and
@@ -1210,7 +2095,12 @@ int GRSTgaclUserLoadDNlists(GRSTgaclUser *user, char *dnlists)
      
   if (dn_cred == NULL) return 1; /* User has no DN! */
 
-  /* look through DN List files */
+  /* use the index if we have one */
+
+  if (grst_dnlists_enabled &&
+      GRSTgaclDNlistsLoadIndexed(user, dnlists, dn_cred)) return 1;
+
+  /* otherwise look through DN List files */
   
   dn_lists_dirs = strdup(dnlists); /* we need to keep this for free() later! */
   dn_list_ptr   = dn_lists_dirs;   /* copy, for naughty function strsep()    */
@@ -1340,6 +2230,274 @@ GRSTgaclPerm GRSTgaclAclTestUser(GRSTgaclAcl *acl, GRSTgaclUser *user)
   /* for each perm type, any deny we saw kills any allow */
 }
 
+/*                                                             *
+ * Compiled ACLs, which GRSTgaclCompiledAclTestUser() evaluates *
+ * with the same results as GRSTgaclAclTestUser(), but using   *
+ * integer and bitset operations instead of string matching    *
+ *                                                             */
+
+#define GRST_LONG_BITS (8 * sizeof(unsigned long))
+
+static unsigned int GRSTgaclAtomHash(char *s)
+{
+  unsigned int hash = 5381;
+  
+  while (*s != '\0') hash = hash * 33 + (unsigned char) *(s++);
+  
+  return hash;
+}
+
+static int GRSTgaclCompiledFindAtom(GRSTgaclCompiledAcl *cacl, char *auri)
+/*
+    (Private)
+    
+    GRSTgaclCompiledFindAtom - return the atom number of exact AURI auri,
+    or -1 if it does not appear in the ACL.
+*/
+{
+  int i;
+  
+  for (i = GRSTgaclAtomHash(auri) & (cacl->nhash - 1);
+       cacl->hash[i] != 0;
+       i = (i + 1) & (cacl->nhash - 1))
+     if (strcmp(cacl->atoms[cacl->hash[i] - 1], auri) == 0)
+                                                    return cacl->hash[i] - 1;
+
+  return -1;
+}
+
+static int GRSTgaclCompiledAddAtom(GRSTgaclCompiledAcl *cacl, char *auri,
+                                   int isdns)
+/*
+    (Private)
+    
+    GRSTgaclCompiledAddAtom - return the atom number for auri, adding it
+    if necessary. dns: globs are not put in the hash table since they are
+    never compared with strcmp().
+*/
+{
+  int i;
+
+  if (isdns)
+    {
+      for (i=0; i < cacl->natoms; ++i)
+         if (cacl->isdns[i] && (strcmp(cacl->atoms[i], auri) == 0)) return i;
+    }
+  else if ((i = GRSTgaclCompiledFindAtom(cacl, auri)) >= 0) return i;
+
+  cacl->atoms[cacl->natoms] = strdup(auri);
+  cacl->isdns[cacl->natoms] = isdns;
+
+  if (!isdns)
+    {
+      for (i = GRSTgaclAtomHash(auri) & (cacl->nhash - 1);
+           cacl->hash[i] != 0;
+           i = (i + 1) & (cacl->nhash - 1)) ;
+
+      cacl->hash[i] = cacl->natoms + 1;
+    }
+
+  return (cacl->natoms)++;
+}
+
+GRSTgaclCompiledAcl *GRSTgaclAclCompile(GRSTgaclAcl *acl)
+/*
+    GRSTgaclAclCompile - classify the credentials of each entry of *acl 
+    in the same order of precedence as GRSTgaclUserHasCred(), and return 
+    a malloc()ed compiled ACL, or NULL on error. Exact AURIs and dns:
+    globs become numbered atoms, and each entry records the atoms it 
+    requires as a bitset.
+*/
+{
+  int                    ncreds = 0, i, atom, nist_loa;
+  GRSTgaclEntry         *entry;
+  GRSTgaclCred          *cred;
+  GRSTgaclCompiledAcl   *cacl;
+  GRSTgaclCompiledEntry *centry;
+  unsigned long         *bits;
+  
+  if (acl == NULL) return NULL;
+  
+  cacl = calloc(1, sizeof(GRSTgaclCompiledAcl));
+  if (cacl == NULL) return NULL;
+  
+  for (entry = acl->firstentry; entry != NULL; entry = entry->next)
+     {
+       ++(cacl->nentries);
+       for (cred = entry->firstcred; cred != NULL; cred = cred->next) ++ncreds;
+     }
+
+  /* hash table at most half full, and always with a free slot */
+
+  for (cacl->nhash = 2; cacl->nhash < 2 * ncreds + 2; cacl->nhash *= 2) ;
+
+  cacl->entries = calloc(cacl->nentries + 1, sizeof(GRSTgaclCompiledEntry));
+  cacl->atoms   = calloc(ncreds + 1, sizeof(char *));
+  cacl->isdns   = calloc(ncreds + 1, sizeof(int));
+  cacl->hash    = calloc(cacl->nhash, sizeof(int));
+  cacl->nwords  = (ncreds + GRST_LONG_BITS - 1) / GRST_LONG_BITS;
+  bits          = calloc(cacl->nentries * cacl->nwords + 1, 
+                         sizeof(unsigned long));
+
+  if ((cacl->entries == NULL) || (cacl->atoms == NULL) ||
+      (cacl->isdns   == NULL) || (cacl->hash  == NULL) || (bits == NULL))
+    {
+      free(bits);
+      GRSTgaclCompiledAclFree(cacl);
+      return NULL;
+    }
+
+  if (cacl->nentries == 0) free(bits); /* otherwise freed via entries[0] */
+  
+  for (entry = acl->firstentry, i = 0; entry != NULL; entry = entry->next, ++i)
+     {
+       centry = &(cacl->entries[i]);
+       
+       centry->allowed     = entry->allowed;
+       centry->denied      = entry->denied;
+       centry->anyuseronly = 1;
+       centry->atoms       = &bits[i * cacl->nwords];
+       
+       for (cred = entry->firstcred; cred != NULL; cred = cred->next)
+          {
+            if (cred->auri == NULL) 
+              {
+                centry->never = 1;
+                continue;
+              }
+
+            if (strcmp(cred->auri, "gacl:any-user") == 0) continue;
+          
+            centry->anyuseronly = 0;
+          
+            if (strncmp(cred->auri, "dns:", 4) == 0)
+              {
+                atom = GRSTgaclCompiledAddAtom(cacl, cred->auri, 1);
+                centry->atoms[atom / GRST_LONG_BITS] |= 
+                                           1UL << (atom % GRST_LONG_BITS);
+              }
+            else if (strcmp(cred->auri, "gacl:auth-user") == 0)
+              {
+                centry->authuser = 1;
+              }
+            else if (sscanf(cred->auri, "nist-loa:%d", &nist_loa) == 1)
+              {
+                if (!centry->hasnistloa || (nist_loa > centry->nistloa))
+                                                 centry->nistloa = nist_loa;
+                centry->hasnistloa = 1;
+              }
+            else
+              {
+                atom = GRSTgaclCompiledAddAtom(cacl, cred->auri, 0);
+                centry->atoms[atom / GRST_LONG_BITS] |= 
+                                           1UL << (atom % GRST_LONG_BITS);
+              }
+          }
+     }
+
+  return cacl;
+}
+
+int GRSTgaclCompiledAclFree(GRSTgaclCompiledAcl *cacl)
+/*
+    GRSTgaclCompiledAclFree - free a compiled ACL. Always returns 1.
+*/
+{
+  int i;
+
+  if (cacl == NULL) return 1;
+  
+  if (cacl->atoms != NULL)
+    {
+      for (i=0; i < cacl->natoms; ++i) free(cacl->atoms[i]);
+      free(cacl->atoms);
+    }
+    
+  if ((cacl->entries != NULL) && (cacl->nentries > 0))
+                                           free(cacl->entries[0].atoms);
+  free(cacl->entries);
+  free(cacl->isdns);
+  free(cacl->hash);
+  free(cacl);
+  
+  return 1;
+}
+
+GRSTgaclPerm GRSTgaclCompiledAclTestUser(GRSTgaclCompiledAcl *cacl,
+                                         GRSTgaclUser *user)
+/*
+    GRSTgaclCompiledAclTestUser - return the same perms as 
+    GRSTgaclAclTestUser() would for the ACL cacl was compiled from. The
+    user's credentials are first reduced to a bitset of the ACL's atoms
+    they match, plus whether they have a DN and its highest NIST LoA.
+*/
+{
+  int                    i, w, atom, hasdn = 0, maxloa = 0;
+  char                  *dnsauri = NULL;
+  unsigned long          userbits_static[8], *userbits;
+  GRSTgaclPerm           allowperms = 0, denyperms = 0;
+  GRSTgaclCred          *cred;
+  GRSTgaclCompiledEntry *centry;
+
+  if (cacl == NULL) return 0;
+  
+  if (cacl->nwords <= 8) userbits = userbits_static;
+  else if ((userbits = malloc(cacl->nwords * sizeof(unsigned long))) == NULL)
+                                                                  return 0;
+
+  memset(userbits, 0, cacl->nwords * sizeof(unsigned long));
+
+  if (user != NULL)
+   for (cred = user->firstcred; cred != NULL; cred = cred->next)
+      {
+        if (cred->auri == NULL) continue;
+        
+        if (strncmp(cred->auri, "dn:", 3) == 0)
+          {
+            if (!hasdn || (cred->nist_loa > maxloa)) maxloa = cred->nist_loa;
+            hasdn = 1;
+          }
+        else if ((dnsauri == NULL) && (strncmp(cred->auri, "dns:", 4) == 0))
+          dnsauri = cred->auri; /* only first dns: is used */
+
+        if ((atom = GRSTgaclCompiledFindAtom(cacl, cred->auri)) >= 0)
+              userbits[atom / GRST_LONG_BITS] |= 1UL << (atom % GRST_LONG_BITS);
+      }
+
+  if (dnsauri != NULL)
+   for (atom=0; atom < cacl->natoms; ++atom)
+      if (cacl->isdns[atom] && 
+          (fnmatch(cacl->atoms[atom], dnsauri, FNM_CASEFOLD) == 0))
+              userbits[atom / GRST_LONG_BITS] |= 1UL << (atom % GRST_LONG_BITS);
+
+  for (i=0; i < cacl->nentries; ++i)
+     {
+       centry = &(cacl->entries[i]);
+     
+       if (centry->never)                        continue;
+       if (centry->authuser   && !hasdn)         continue;
+       if (centry->hasnistloa && 
+           (!hasdn || (maxloa < centry->nistloa))) continue;
+
+       for (w=0; w < cacl->nwords; ++w)
+          if ((centry->atoms[w] & ~userbits[w]) != 0) break;
+
+       if (w < cacl->nwords) continue;
+
+       /* we dont allow Write or Admin on the basis of any-user alone */
+       
+       if (centry->anyuseronly)
+            allowperms |= centry->allowed & ~GRST_PERM_WRITE & ~GRST_PERM_ADMIN;
+       else allowperms |= centry->allowed;
+       
+       denyperms |= centry->denied;
+     }
+
+  if (userbits != userbits_static) free(userbits);
+
+  return (allowperms & (~ denyperms));
+}
+
 GRSTgaclPerm GRSTgaclAclTestexclUser(GRSTgaclAcl *acl, GRSTgaclUser *user)
 /*
     GRSTgaclAclTestexclUser - 
@@ -53,6 +53,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <utime.h>
+#include <time.h>
 #include <curl/curl.h>
 #include <errno.h>
 #include <netdb.h>
@@ -73,6 +75,10 @@
 
 #define HTCP_SITECAST_GROUPS 32
 
+#define HTCP_STRIPE_MIN      (1024 * 1024)
+#define HTCP_STRIPE_MAX      (64 * 1024 * 1024)
+#define HTCP_JOURNAL_SUFFIX  ".htcp-journal"
+
 #define HTCP_HOST_CONF       "/etc/htcp.conf"
 #define HTCP_USER_CONF       ".htcp.conf"
 
@@ -93,7 +99,12 @@ struct grst_stream_data { char *source;
                           int   timeout;
                           char *groups;
                           int   sitecast;
-                          char *domain;    } ;
+                          char *domain;
+                          int   parallel;
+                          int   streams;
+                          int   resume;
+                          int   recursive;
+                          int   sync;      } ;
                           
 struct grst_index_blob { char   *text;
                          size_t  used;
@@ -105,6 +116,9 @@ struct grst_dir_list { char   *filename;
                        time_t  modified;
                        int     modified_set; } ; 
 
+struct grst_range { off_t start;
+                    off_t finish; } ;
+
 struct grst_header_data { int    retcode;                         
                           char  *location;
                           char  *gridhttppasscode;
@@ -117,6 +131,22 @@ struct grst_header_data { int    retcode;
 struct grst_sitecast_group { struct addrinfo *ai;
                              int timewait; int ttl; };
 
+struct grst_transfer { CURL  *easyhandle;
+                       char  *source;
+                       char  *destination;
+                       FILE  *fp;
+                       int    fd;
+                       off_t  start;
+                       off_t  offset;
+                       off_t  finish;
+                       struct curl_slist *header_slist;
+                       struct curl_slist *redirect_slist;
+                       int    redirected;
+                       int    index;
+                       struct grst_index_blob rawindex;
+                       char   errorbuf[CURL_ERROR_SIZE];
+                       struct grst_header_data header_data; } ;
+
 size_t headers_callback(void *ptr, size_t size, size_t nmemb, void *p)
 /* Find the values of the return code, Content-Length, Last-Modified
    and Location headers */
@@ -130,10 +160,11 @@ size_t headers_callback(void *ptr, size_t size, size_t nmemb, void *p)
   header_data = (struct grst_header_data *) p;
   realsize = size * nmemb;
   s = malloc(realsize + 1);
+  memset(&modified_tm, 0, sizeof(modified_tm));
   memcpy(s, ptr, realsize);
   s[realsize] = '\0';
 
-  if      (sscanf(s, "Content-Length: %d", &(header_data->length)) == 1) 
+  if      (sscanf(s, "Content-Length: %zu", &(header_data->length)) == 1) 
             header_data->length_set = 1;
   else if (sscanf(s, "HTTP/%f %d ", &f, &(header_data->retcode)) == 2) ;
   else if (strncmp(s, "Location: ", 10) == 0) 
@@ -163,17 +194,17 @@ size_t headers_callback(void *ptr, size_t size, size_t nmemb, void *p)
 
         if (strptime(&s[15], "%a, %d %b %Y %T GMT", &modified_tm) != NULL)
           {
-            header_data->modified = mktime(&modified_tm);
+            header_data->modified = timegm(&modified_tm);
             header_data->modified_set = 1;
           }
         else if (strptime(&s[15], "%a, %d-%b-%y %T GMT", &modified_tm) != NULL)
           {
-            header_data->modified = mktime(&modified_tm);
+            header_data->modified = timegm(&modified_tm);
             header_data->modified_set = 1;
           }
         else if (strptime(&s[15], "%a %b %d %T %Y", &modified_tm) != NULL)
           {
-            header_data->modified = mktime(&modified_tm);
+            header_data->modified = timegm(&modified_tm);
             header_data->modified_set = 1;
           }
       }
@@ -345,244 +376,1123 @@ int do_rmtcp(char *sources[], char *destination,
 
 }
 
-int do_copies(char *sources[], char *destination,
-              struct grst_stream_data *common_data)
+CURL *transfer_handle(struct grst_transfer *transfer,
+                      struct grst_stream_data *common_data)
+/* Make the easy handle for one transfer slot, with the options that
+   stay the same for every request made through that slot */
 {
-  char        *p, *thisdestination;
-  int          isrc, anyerror = 0, thiserror, isdirdest;
-  CURL        *easyhandle;
-  struct stat  statbuf;
-  struct       grst_header_data header_data;
-  struct curl_slist *gh_header_slist = NULL, *nogh_header_slist = NULL;
-  
+  CURL *easyhandle;
+
   easyhandle = curl_easy_init();
-  
-  if (common_data->gridhttp)
-    {               
-      asprintf(&p, "Upgrade: GridHTTP/1.0");
-      gh_header_slist = curl_slist_append(gh_header_slist, p);
-      free(p);
-      
-      nogh_header_slist = curl_slist_append(nogh_header_slist, "Upgrade:");
-    }
-  
+  if (easyhandle == NULL) return NULL;
+
   curl_easy_setopt(easyhandle, CURLOPT_USERAGENT, common_data->useragent);
   if (common_data->verbose > 1)
                    curl_easy_setopt(easyhandle, CURLOPT_VERBOSE, 1);
 
   curl_easy_setopt(easyhandle, CURLOPT_HEADERFUNCTION, headers_callback);
-  curl_easy_setopt(easyhandle, CURLOPT_WRITEHEADER,   &header_data);
+  curl_easy_setopt(easyhandle, CURLOPT_WRITEHEADER,   &(transfer->header_data));
+  curl_easy_setopt(easyhandle, CURLOPT_ERRORBUFFER,   transfer->errorbuf);
+  curl_easy_setopt(easyhandle, CURLOPT_PRIVATE,       (char *) transfer);
 
   set_std_opts(easyhandle, common_data);
 
-  curl_easy_setopt(easyhandle, CURLOPT_ERRORBUFFER, common_data->errorbuf);
+  transfer->easyhandle = easyhandle;
+  transfer->header_data.common_data = common_data;
+  transfer->source      = NULL;
+  transfer->destination = NULL;
+  transfer->fp          = NULL;
 
-  if (destination[strlen(destination) - 1] != '/') 
+  return easyhandle;
+}
+
+void set_modified(char *filename, time_t modified)
+/* Give a fetched file the modification time of the original, so that a
+   later --sync can see that it is unchanged */
+{
+  struct utimbuf times;
+
+  times.actime  = time(NULL);
+  times.modtime = modified;
+
+  utime(filename, &times);
+}
+
+void reset_header_data(struct grst_header_data *header_data)
+{
+  if (header_data->location != NULL) free(header_data->location);
+  if (header_data->gridhttppasscode != NULL) 
+                                     free(header_data->gridhttppasscode);
+
+  header_data->retcode          = 0;
+  header_data->location         = NULL;
+  header_data->gridhttppasscode = NULL;
+  header_data->length_set       = 0;
+  header_data->modified_set     = 0;
+}
+
+CURL *next_finished(CURLM *multihandle, int *thiserror)
+/* Drive all the transfers in the multi handle until one of them finishes,
+   and return its easy handle with the curl result in *thiserror. NULL is
+   returned once there are no transfers left. */
+{
+  int      running = -1, msgs_left, maxfd;
+  long     timeout;
+  CURL    *easyhandle;
+  CURLMsg *msg;
+  fd_set   readfds, writefds, exceptfds;
+  struct timeval wait_timeval;
+
+  while (1)
+       {
+         while ((msg = curl_multi_info_read(multihandle, &msgs_left)) != NULL)
+              if (msg->msg == CURLMSG_DONE)
+                {
+                  easyhandle = msg->easy_handle;
+                  *thiserror = msg->data.result;
+                  curl_multi_remove_handle(multihandle, easyhandle);
+                  return easyhandle;
+                }
+
+         if (running == 0) return NULL;
+
+         if (running > 0)
+           {
+             FD_ZERO(&readfds);
+             FD_ZERO(&writefds);
+             FD_ZERO(&exceptfds);
+             maxfd = -1;
+             timeout = -1;
+
+             curl_multi_fdset(multihandle, &readfds, &writefds, 
+                                           &exceptfds, &maxfd);
+             curl_multi_timeout(multihandle, &timeout);
+
+             if ((timeout < 0) || (timeout > 1000)) timeout = 1000;
+             if (maxfd == -1) timeout = 100; /* curl has nothing to wait on */
+
+             wait_timeval.tv_sec  = timeout / 1000;
+             wait_timeval.tv_usec = (timeout % 1000) * 1000;
+
+             select(maxfd + 1, &readfds, &writefds, &exceptfds,&wait_timeval);
+           }
+
+         if (curl_multi_perform(multihandle, &running) != CURLM_OK)
+                                                                return NULL;
+       }
+}
+
+int report_transfer(struct grst_transfer *transfer, int thiserror, 
+                    struct grst_stream_data *common_data)
+/* Print the outcome of a finished transfer and return its error, or 0.
+   With several transfers in flight, the URL is given too. */
+{
+  char *name = "";
+  
+  if (common_data->parallel > 1) name = transfer->source;
+
+  if ((thiserror != 0) ||
+      (transfer->header_data.retcode >= 300))
     {
-      isdirdest = 0;
-      thisdestination = destination;
+      fprintf(stderr, "... %s%scurl error: %s (%d), HTTP error: %d\n",
+              name, (*name != '\0') ? " " : "",
+              transfer->errorbuf, thiserror, transfer->header_data.retcode);
+                   
+      if (thiserror != 0) return thiserror;
+      else                return transfer->header_data.retcode;
     }
-  else isdirdest = 1;
 
-  for (isrc=0; sources[isrc] != NULL; ++isrc)
-     {
-       if (isdirdest)
-         {
-           p = rindex(sources[isrc], '/');
-           if (p == NULL) p = sources[isrc];
-           else           p++;
+  if (common_data->verbose > 0) 
+    fprintf(stderr, "... %s%sOK (%d)\n", name, (*name != '\0') ? " " : "",
+                                         transfer->header_data.retcode);
 
-           asprintf(&thisdestination, "%s%s", destination, p);
-         }
+  return 0;
+}
+
+int is_gridhttp_redirect(struct grst_transfer *transfer, int thiserror,
+                         struct grst_stream_data *common_data)
+/* Whether a finished transfer was answered with a GridHTTP redirect to 
+   plain HTTP, which should be followed with the passcode cookie */
+{
+  if ((common_data->gridhttp) &&
+      (!transfer->redirected) &&
+      (thiserror == 0) &&
+      (transfer->header_data.retcode == 302) &&
+      (transfer->header_data.location != NULL) &&
+      (strncmp(transfer->header_data.location, "http://", 7) == 0) &&
+      (transfer->header_data.gridhttppasscode != NULL))
+    {
+      if (common_data->verbose > 0)
+        fprintf(stderr, "... Found (%d)\nGridHTTP redirect to %s\n",
+                transfer->header_data.retcode, 
+                transfer->header_data.location);
+
+      return 1;
+    }
+
+  return 0;
+}
+
+void redirect_transfer(struct grst_transfer *transfer, CURLM *multihandle,
+                       struct curl_slist *header_slist)
+/* Resend a transfer to its GridHTTP Location, with the passcode cookie. 
+   The caller must already have rewound the data being sent or received. */
+{
+  curl_easy_setopt(transfer->easyhandle, CURLOPT_URL, 
+                                         transfer->header_data.location);
+  curl_easy_setopt(transfer->easyhandle, CURLOPT_HTTPHEADER, header_slist);
+  curl_easy_setopt(transfer->easyhandle, CURLOPT_COOKIE, 
+                                         transfer->header_data.gridhttppasscode);
+
+  transfer->header_data.retcode = 0;
+  transfer->redirected = 1;
+  curl_multi_add_handle(multihandle, transfer->easyhandle);
+}
+
+int start_copy(struct grst_transfer *transfer, char *source,
+               char *destination, CURLM *multihandle,
+               struct curl_slist *gh_header_slist,
+               struct curl_slist *nogh_header_slist,
+               struct grst_stream_data *common_data)
+/* Open the local file for one copy and add it to the multi handle. 
+   Returns 0 if the transfer was started. */
+{
+  CURL        *easyhandle = transfer->easyhandle;
+  struct stat  statbuf;
+
+  transfer->destination = destination;
  
-       if (common_data->verbose > 0)
-            fprintf(stderr, "Copy %s -> %s\n", sources[isrc], thisdestination);
+  if (common_data->verbose > 0)
+       fprintf(stderr, "Copy %s -> %s\n", source, transfer->destination);
 
-       if (common_data->method == HTCP_GET)
-         {
-           common_data->fp = fopen(thisdestination, "w");
-           if (common_data->fp == NULL)
-             {
-               fprintf(stderr,"... failed to open destination source file %s\n",
-                               thisdestination);
-               anyerror = 99;
-               if (isdirdest) free(thisdestination);
-               continue;
-             }
+  if (common_data->method == HTCP_GET)
+    {
+      transfer->fp = fopen(transfer->destination, "w");
+      if (transfer->fp == NULL)
+        {
+          fprintf(stderr,"... failed to open destination source file %s\n",
+                          transfer->destination);
+          return 99;
+        }
 
-           curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, common_data->fp);
-           curl_easy_setopt(easyhandle, CURLOPT_URL,       sources[isrc]);
+      curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, transfer->fp);
+      curl_easy_setopt(easyhandle, CURLOPT_URL,       source);
            
-           if ((common_data->gridhttp) &&
-               (strncmp(sources[isrc], "https://", 8) == 0))
-             {
-               if (common_data->verbose > 0)
-                 fprintf(stderr, "Add  Upgrade: GridHTTP/1.0\n");
+      if ((common_data->gridhttp) &&
+          (strncmp(source, "https://", 8) == 0))
+        {
+          if (common_data->verbose > 0)
+            fprintf(stderr, "Add  Upgrade: GridHTTP/1.0\n");
                  
-               curl_easy_setopt(easyhandle,CURLOPT_HTTPHEADER,gh_header_slist);
-             }
-           else 
-             curl_easy_setopt(easyhandle,CURLOPT_HTTPHEADER,nogh_header_slist);
-         }
-       else if (common_data->method == HTCP_PUT)
-         {
-           if (stat(sources[isrc], &statbuf) != 0)
-             {
-               fprintf(stderr, "... source file %s not found\n", sources[isrc]);
-               anyerror = 99;
-               if (isdirdest) free(thisdestination);
-               continue;
-             }
+          curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, gh_header_slist);
+        }
+      else 
+        curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, nogh_header_slist);
+    }
+  else if (common_data->method == HTCP_PUT)
+    {
+      if (stat(source, &statbuf) != 0)
+        {
+          fprintf(stderr, "... source file %s not found\n", source);
+          return 99;
+        }
            
-           common_data->fp = fopen(sources[isrc], "r");
-           if (common_data->fp == NULL)
-             {
-               fprintf(stderr, "... failed to open source file %s\n",
-                               sources[isrc]);
-               anyerror = 99;
-               if (isdirdest) free(thisdestination);
-               continue;
-             }
+      transfer->fp = fopen(source, "r");
+      if (transfer->fp == NULL)
+        {
+          fprintf(stderr, "... failed to open source file %s\n", source);
+          return 99;
+        }
 
-           curl_easy_setopt(easyhandle, CURLOPT_READDATA,   common_data->fp);
-           curl_easy_setopt(easyhandle, CURLOPT_URL,        thisdestination);
-           curl_easy_setopt(easyhandle, CURLOPT_INFILESIZE, statbuf.st_size);
-           curl_easy_setopt(easyhandle, CURLOPT_UPLOAD,   1);
+      curl_easy_setopt(easyhandle, CURLOPT_READDATA,   transfer->fp);
+      curl_easy_setopt(easyhandle, CURLOPT_URL,        transfer->destination);
+      curl_easy_setopt(easyhandle, CURLOPT_INFILESIZE_LARGE, 
+                                               (curl_off_t) statbuf.st_size);
+      curl_easy_setopt(easyhandle, CURLOPT_UPLOAD,     1);
+
+      if ((common_data->gridhttp) &&
+          (strncmp(transfer->destination, "https://", 8) == 0))
+          curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, gh_header_slist);
+      else 
+        curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, nogh_header_slist);
+    }
 
-           if ((common_data->gridhttp) &&
-               (strncmp(thisdestination, "https://", 8) == 0))
-               curl_easy_setopt(easyhandle,CURLOPT_HTTPHEADER,gh_header_slist);
-           else 
-             curl_easy_setopt(easyhandle,CURLOPT_HTTPHEADER,nogh_header_slist);
-         }
+  curl_easy_setopt(easyhandle, CURLOPT_COOKIE, NULL);
 
-       header_data.retcode  = 0;
-       header_data.location = NULL;
-       header_data.gridhttppasscode = NULL;
-       header_data.common_data = common_data;
-       thiserror = curl_easy_perform(easyhandle);
-       
-       fclose(common_data->fp);
+  reset_header_data(&(transfer->header_data));
+  transfer->errorbuf[0] = '\0';
+  transfer->source     = source;
+  transfer->redirected = 0;
 
-       if ((common_data->gridhttp) &&
-           (thiserror == 0) &&
-           (header_data.retcode == 302) &&
-           (header_data.location != NULL) &&
-           (strncmp(header_data.location, "http://", 7) == 0) &&
-           (header_data.gridhttppasscode != NULL))
-         {
-           if (common_data->verbose > 0)
-             fprintf(stderr, "... Found (%d)\nGridHTTP redirect to %s\n",
-                     header_data.retcode, header_data.location);
+  curl_multi_add_handle(multihandle, easyhandle);
+
+  return 0;
+}
+
+int parallel_copies(char *sources[], char *destinations[],
+                    struct grst_stream_data *common_data)
+/* Copy each source to its destination, with up to --parallel of these
+   single stream transfers in flight at once */
+{
+  char        *p;
+  int          isrc = 0, islot, active = 0, anyerror = 0, thiserror;
+  CURL        *easyhandle;
+  CURLM       *multihandle;
+  struct       grst_transfer *transfers, *transfer;
+  struct curl_slist *gh_header_slist = NULL, *nogh_header_slist = NULL;
+  
+  if (common_data->gridhttp)
+    {               
+      asprintf(&p, "Upgrade: GridHTTP/1.0");
+      gh_header_slist = curl_slist_append(gh_header_slist, p);
+      free(p);
+      
+      nogh_header_slist = curl_slist_append(nogh_header_slist, "Upgrade:");
+    }
+
+  /* one easy handle per slot, kept for the whole run so that connections
+     to each server stay open and are reused by the following transfers */
 
+  multihandle = curl_multi_init();
+  transfers   = (struct grst_transfer *)
+                 calloc(common_data->parallel, sizeof(struct grst_transfer));
+
+  for (islot=0; islot < common_data->parallel; ++islot)
+     transfer_handle(&transfers[islot], common_data);
+
+  while (1)
+     {
+       while ((active < common_data->parallel) && (sources[isrc] != NULL))
+            {
+              for (islot=0; transfers[islot].source != NULL; ++islot) ;
+
+              thiserror = start_copy(&transfers[islot], sources[isrc],
+                                     destinations[isrc], multihandle,
+                                     gh_header_slist, nogh_header_slist,
+                                     common_data);
+              if (thiserror == 0) ++active;
+              else anyerror = thiserror;
+              
+              ++isrc;
+            }
+
+       if (active == 0) break;
+
+       easyhandle = next_finished(multihandle, &thiserror);
+       if (easyhandle == NULL) break;
+
+       curl_easy_getinfo(easyhandle, CURLINFO_PRIVATE, (char **) &transfer);
+
+       fclose(transfer->fp);
+       transfer->fp = NULL;
+
+       if (is_gridhttp_redirect(transfer, thiserror, common_data))
+         {
            /* try again with new URL and all the previous CURL options */
 
            if (common_data->method == HTCP_GET)
              {
-               common_data->fp = fopen(thisdestination, "w");
-               if (common_data->fp == NULL)
-                 {
+               transfer->fp = fopen(transfer->destination, "w");
+               if (transfer->fp == NULL)
                    fprintf(stderr, "... failed to open destination source "
-                                   "file %s\n", thisdestination);
-                   anyerror = 99;
-                   if (isdirdest) free(thisdestination);
-                   continue;
-                 }
+                                   "file %s\n", transfer->destination);
+               else curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, 
+                                                             transfer->fp);
              }
            else if (common_data->method == HTCP_PUT)
              {
-               common_data->fp = fopen(sources[isrc], "r");
-               if (common_data->fp == NULL)
-                 {
+               transfer->fp = fopen(transfer->source, "r");
+               if (transfer->fp == NULL)
                    fprintf(stderr, "... failed to open source file %s\n",
-                               sources[isrc]);
-                   anyerror = 99;
-                   if (isdirdest) free(thisdestination);
-                   continue;
-                 }
+                               transfer->source);
+               else curl_easy_setopt(easyhandle, CURLOPT_READDATA, 
+                                                             transfer->fp);
              }
 
-           header_data.retcode  = 0;           
-           curl_easy_setopt(easyhandle, CURLOPT_URL, header_data.location);
-           curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, nogh_header_slist);
-           curl_easy_setopt(easyhandle, CURLOPT_COOKIE, 
-                                                  header_data.gridhttppasscode);
-           thiserror = curl_easy_perform(easyhandle);
+           if (transfer->fp != NULL)
+             {
+               redirect_transfer(transfer, multihandle, nogh_header_slist);
+               continue;
+             }
 
-           fclose(common_data->fp);
+           thiserror = 99;
          }
+       else thiserror = report_transfer(transfer, thiserror, common_data);
 
-       if ((thiserror != 0) ||
-           (header_data.retcode >= 300))
-         {
-           fprintf(stderr, "... curl error: %s (%d), HTTP error: %d\n",
-                   common_data->errorbuf, thiserror, header_data.retcode);
-                   
-           if (thiserror != 0) anyerror = thiserror;
-           else                anyerror = header_data.retcode;
-         }
-       else if (common_data->verbose > 0) 
-                  fprintf(stderr, "... OK (%d)\n", header_data.retcode);
+       if (thiserror != 0) anyerror = thiserror;
+       else if ((common_data->recursive) && 
+                (common_data->method == HTCP_GET) &&
+                (transfer->header_data.modified_set))
+         set_modified(transfer->destination, transfer->header_data.modified);
         
-       if (isdirdest) free(thisdestination);
+       transfer->source = NULL;
+       --active;
      }
 
-  curl_easy_cleanup(easyhandle);
+  for (islot=0; islot < common_data->parallel; ++islot)
+     {
+       reset_header_data(&(transfers[islot].header_data));
+       curl_easy_cleanup(transfers[islot].easyhandle);
+     }
+
+  curl_multi_cleanup(multihandle);
+  free(transfers);
+  curl_slist_free_all(gh_header_slist);
+  curl_slist_free_all(nogh_header_slist);
      
   return anyerror;
 }
 
-int do_deletes(char *sources[], struct grst_stream_data *common_data)
+size_t stripe_write_callback(void *ptr, size_t size, size_t nmemb, void *p)
+/* Write part of a ranged GET into its place in the destination file */
+{
+  ssize_t written;
+  size_t  realsize, done = 0;
+  struct grst_transfer *transfer;
+
+  transfer = (struct grst_transfer *) p;
+  realsize = size * nmemb;
+
+  if (transfer->header_data.retcode == 200) return 0; /* ignored our Range */
+  if (transfer->header_data.retcode != 206) return realsize; /* error body */
+
+  if (transfer->offset + (off_t) realsize > transfer->finish + 1) return 0;
+
+  while (done < realsize)
+       {
+         written = pwrite(transfer->fd, (char *) ptr + done, 
+                          realsize - done, transfer->offset + done);
+         if (written <= 0) return 0;
+         done += written;
+       }
+
+  transfer->offset += realsize;
+  return realsize;
+}
+
+size_t stripe_read_callback(void *ptr, size_t size, size_t nmemb, void *p)
+/* Read the next part of a ranged PUT from its place in the source file */
+{
+  ssize_t got;
+  size_t  realsize;
+  struct grst_transfer *transfer;
+
+  transfer = (struct grst_transfer *) p;
+  realsize = size * nmemb;
+
+  if ((off_t) realsize > transfer->finish + 1 - transfer->offset)
+                     realsize = transfer->finish + 1 - transfer->offset;
+  if (realsize == 0) return 0;
+
+  got = pread(transfer->fd, ptr, realsize, transfer->offset);
+  if (got <= 0) return CURL_READFUNC_ABORT;
+
+  transfer->offset += got;
+  return got;
+}
+
+int request_length(char *url, char *content_range, off_t *length,
+                   time_t *modified, struct grst_stream_data *common_data)
+/* Make a bodyless request to url: a HEAD to find the length and time of
+   a remote file, or a PUT of a GridSite Content-Range truncation if 
+   content_range is given. Returns 0 on success, with the Content-Length
+   in *length and the Last-Modified time (or 0) in *modified. */
 {
-  int    isrc, anyerror = 0, thiserror;
+  int    thiserror;
   CURL  *easyhandle;
-  struct grst_header_data header_data;
+  struct grst_transfer transfer;
+  struct curl_slist *header_slist = NULL;
+
+  memset(&transfer, 0, sizeof(transfer));
+  transfer.source = url;
   
-  header_data.common_data = common_data;
+  easyhandle = transfer_handle(&transfer, common_data);
+  if (easyhandle == NULL) return CURLE_FAILED_INIT;
 
-  easyhandle = curl_easy_init();
+  curl_easy_setopt(easyhandle, CURLOPT_URL, url);
+
+  if (content_range != NULL)
+    {
+      header_slist = curl_slist_append(header_slist, content_range);
+      curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, header_slist);
+      curl_easy_setopt(easyhandle, CURLOPT_UPLOAD, 1);
+      curl_easy_setopt(easyhandle, CURLOPT_INFILESIZE_LARGE, (curl_off_t) 0);
+      curl_easy_setopt(easyhandle, CURLOPT_READFUNCTION, 
+                                                stripe_read_callback);
+      curl_easy_setopt(easyhandle, CURLOPT_READDATA, &transfer);
+      transfer.finish = -1; /* nothing to send */
+    }
+  else curl_easy_setopt(easyhandle, CURLOPT_NOBODY, 1);
+
+  thiserror = curl_easy_perform(easyhandle);
+
+  if ((thiserror == 0) && 
+      ((transfer.header_data.retcode < 200) || 
+       (transfer.header_data.retcode > 299)))
+                                  thiserror = transfer.header_data.retcode;
+
+  if ((thiserror == 0) && (length != NULL))
+    {
+      if (transfer.header_data.length_set) 
+                                  *length = transfer.header_data.length;
+      else thiserror = CURLE_FAILED_INIT;
+    }
+
+  if ((thiserror == 0) && (modified != NULL))
+    {
+      if (transfer.header_data.modified_set) 
+                                  *modified = transfer.header_data.modified;
+      else *modified = 0;
+    }
+
+  reset_header_data(&(transfer.header_data));
+  curl_easy_cleanup(easyhandle);
+  curl_slist_free_all(header_slist);
+
+  return thiserror;
+}
+
+int grst_range_cmp(const void *a, const void *b)
+{
+  if (((struct grst_range *) a)->start < ((struct grst_range *) b)->start)
+                                                                 return -1;
+  if (((struct grst_range *) a)->start > ((struct grst_range *) b)->start)
+                                                                 return 1;
+  return 0;
+}
+
+int read_journal(char *journalname, char *url, off_t length, time_t modified,
+                 struct grst_range **done, int *ndone)
+/* Load the ranges already copied from the journal of an earlier attempt.
+   Returns 1 if the journal was for this URL and this version of the file,
+   0 if there is no journal, or -1 if it was for something else and none
+   of the local copy can be trusted. */
+{
+  int        n, allocated = 0;
+  char       line[8193], *p;
+  long long  start, finish, journal_length;
+  long       journal_modified;
+  FILE      *fp;
+
+  *done  = NULL;
+  *ndone = 0;
+
+  if ((fp = fopen(journalname, "r")) == NULL) return 0;
+
+  if ((fgets(line, sizeof(line), fp) == NULL) ||
+      (sscanf(line, "htcp-journal %lld %ld %n", 
+              &journal_length, &journal_modified, &n) != 2) ||
+      (journal_length != (long long) length) ||
+      (journal_modified != (long) modified))
+    {
+      fclose(fp);
+      return -1;
+    }
+
+  if ((p = index(&line[n], '\n')) != NULL) *p = '\0';
   
-  curl_easy_setopt(easyhandle, CURLOPT_USERAGENT, common_data->useragent);
-  if (common_data->verbose > 1)
-                   curl_easy_setopt(easyhandle, CURLOPT_VERBOSE, 1);
+  if (strcmp(&line[n], url) != 0)
+    {
+      fclose(fp);
+      return -1;
+    }
 
-  curl_easy_setopt(easyhandle, CURLOPT_HEADERFUNCTION, headers_callback);
-  curl_easy_setopt(easyhandle, CURLOPT_WRITEHEADER,   &header_data);
+  while (fgets(line, sizeof(line), fp) != NULL)
+       {
+         if ((sscanf(line, "%lld-%lld", &start, &finish) != 2) ||
+             (start < 0) || (finish < start) || (finish >= length)) continue;
 
-  curl_easy_setopt(easyhandle, CURLOPT_ERRORBUFFER,   common_data->errorbuf);
-  curl_easy_setopt(easyhandle, CURLOPT_CUSTOMREQUEST, "DELETE");
-  curl_easy_setopt(easyhandle, CURLOPT_NOBODY,        1);
+         if (*ndone >= allocated)
+           {
+             allocated += 64;
+             *done = (struct grst_range *) 
+                      realloc(*done, allocated * sizeof(struct grst_range));
+           }
 
-  set_std_opts(easyhandle, common_data);
+         (*done)[*ndone].start  = start;
+         (*done)[*ndone].finish = finish;
+         ++(*ndone);
+       }
+
+  fclose(fp);
+  return 1;
+}
+
+int missing_ranges(off_t length, struct grst_range *done, int ndone,
+                   off_t piece, struct grst_range **pieces)
+/* Cut the parts of 0 to length-1 not covered by the done ranges into
+   pieces of about piece bytes. A short tail is merged into the piece 
+   before it rather than being sent as a request of its own. Returns the
+   number of pieces. */
+{
+  int    i, npieces = 0;
+  off_t  next = 0, gapend;
+
+  qsort((void *) done, ndone, sizeof(struct grst_range), grst_range_cmp);
+
+  *pieces = (struct grst_range *) malloc(sizeof(struct grst_range) *
+                                         (ndone + 1 + length / piece + 1));
+
+  for (i=0; i <= ndone; ++i)
+     {
+       gapend = (i < ndone) ? done[i].start - 1 : length - 1;
+
+       while (next <= gapend)
+            {
+              (*pieces)[npieces].start  = next;
+              
+              if (gapend + 1 - next < piece + HTCP_STRIPE_MIN) next = gapend+1;
+              else next += piece;
+              
+              (*pieces)[npieces].finish = next - 1;
+              ++npieces;
+            }
+
+       if ((i < ndone) && (done[i].finish + 1 > next)) 
+                                                 next = done[i].finish + 1;
+     }
+
+  return npieces;
+}
+
+int copy_striped(char *source, char *destination, 
+                 CURLM *multihandle, struct grst_transfer *transfers,
+                 struct curl_slist *gh_header_slist,
+                 struct curl_slist *nogh_header_slist,
+                 struct grst_stream_data *common_data)
+/* Copy one file as byte ranges, up to --streams of them at once, using
+   ranged GETs written with pwrite() into a preallocated destination, or
+   Content-Range PUTs read with pread(). Each range is recorded in a 
+   journal beside the local file when it completes, so that --resume can
+   later copy only the ranges still missing. Returns -1 if the file is too
+   small to be worth splitting (or its length is unknown), or if the 
+   server turns out to ignore Range, so that it can be copied as a single
+   stream instead. */
+{
+  int          fd, npieces, ipiece, istream, ndone = 0, active = 0,
+               anyerror = 0, thiserror, retcode, hasjournal = 0, 
+               unranged = 0;
+  char        *p, *url, *journalname;
+  off_t        length, localsize = -1, missing, piece;
+  time_t       modified = 0;
+  CURL        *easyhandle;
+  FILE        *journal;
+  struct stat  statbuf;
+  struct       grst_range    *done = NULL, *pieces;
+  struct       grst_transfer *transfer;
+
+  if (common_data->method == HTCP_GET)
+    {
+      url = source;
+    
+      if (request_length(source, NULL, &length, &modified, common_data) != 0)
+                                                                  return -1;
+
+      asprintf(&journalname, "%s%s", destination, HTCP_JOURNAL_SUFFIX);
+
+      if (stat(destination, &statbuf) == 0) localsize = statbuf.st_size;
+    }
+  else if (stat(source, &statbuf) == 0) 
+    {
+      url      = destination;
+      length   = statbuf.st_size;
+      modified = statbuf.st_mtime;
+
+      asprintf(&journalname, "%s%s", source, HTCP_JOURNAL_SUFFIX);
+    }
+  else return -1;
+
+  if (length < (common_data->resume ? 1 : 2) * HTCP_STRIPE_MIN) 
+    {
+      free(journalname);
+      return -1;
+    }
+  
+  /* find out which ranges an earlier attempt has already copied: from 
+     its journal if there is one, or else from how much of the file has 
+     already arrived, since a single stream is written from the start */
+
+  if (common_data->resume)
+    {
+      hasjournal = read_journal(journalname, url, length, modified,
+                                &done, &ndone);
+
+      if ((hasjournal == 0) && (common_data->method == HTCP_GET) && 
+          (localsize > 0) && (localsize <= length))
+        {
+          done = (struct grst_range *) malloc(sizeof(struct grst_range));
+          done[0].start  = 0;
+          done[0].finish = localsize - 1;
+          ndone = 1;
+        }
+      else if ((hasjournal == 0) && (common_data->method == HTCP_PUT))
+        {
+          retcode = request_length(destination, NULL, &localsize, NULL,
+                                   common_data);
+                                   
+          if ((retcode == 0) && (localsize > 0) && (localsize <= length))
+            {
+              done = (struct grst_range *) malloc(sizeof(struct grst_range));
+              done[0].start  = 0;
+              done[0].finish = localsize - 1;
+              ndone = 1;
+            }
+        }
+    }
+
+  for (missing = length, ipiece = 0; ipiece < ndone; ++ipiece)
+     missing -= done[ipiece].finish + 1 - done[ipiece].start;
+
+  piece = missing / common_data->streams;
+  if (piece < HTCP_STRIPE_MIN)  piece = HTCP_STRIPE_MIN;
+  if (piece > HTCP_STRIPE_MAX)  piece = HTCP_STRIPE_MAX;
+
+  npieces = missing_ranges(length, done, ndone, piece, &pieces);
+  
+  if (common_data->verbose > 0)
+       fprintf(stderr, "Copy %s -> %s as %d ranges\n", 
+                       source, destination, npieces);
+
+  if (common_data->method == HTCP_GET)
+    {
+      fd = open(destination, O_WRONLY | O_CREAT | 
+                             ((ndone == 0) ? O_TRUNC : 0), 0666);
+      if (fd == -1)
+        {
+          fprintf(stderr,"... failed to open destination source file %s\n",
+                         destination);
+          free(journalname);
+          free(done);
+          free(pieces);
+          return 99;
+        }
+
+      /* reserve the space in one go, so the ranges can land anywhere */
+
+      if ((posix_fallocate(fd, 0, length) != 0) && 
+          (ftruncate(fd, length) != 0))
+        {
+          fprintf(stderr, "... failed to preallocate %s\n", destination);
+          close(fd);
+          free(journalname);
+          free(done);
+          free(pieces);
+          return 99;
+        }
+    }
+  else if ((fd = open(source, O_RDONLY)) == -1)
+    {
+      fprintf(stderr, "... failed to open source file %s\n", source);
+      free(journalname);
+      free(done);
+      free(pieces);
+      return 99;
+    }
+
+  /* the journal is only an optimisation, so carry on without one if it
+     cannot be written */
+
+  if (hasjournal == 1) journal = fopen(journalname, "a");
+  else
+    {
+      journal = fopen(journalname, "w");
+
+      if (journal != NULL)
+        {
+          fprintf(journal, "htcp-journal %lld %ld %s\n", 
+                           (long long) length, (long) modified, url);
+
+          for (ipiece=0; ipiece < ndone; ++ipiece)
+             fprintf(journal, "%lld-%lld\n", (long long) done[ipiece].start,
+                                             (long long) done[ipiece].finish);
+          fflush(journal);
+        }
+    }
+
+  for (istream=0; istream < common_data->streams; ++istream)
+     transfers[istream].source = NULL;
+
+  ipiece = 0;
+
+  while (1)
+     {
+       while ((active < common_data->streams) && (ipiece < npieces))
+          {
+            for (istream=0; transfers[istream].source != NULL; ++istream) ;
+
+            transfer   = &transfers[istream];
+            easyhandle = transfer->easyhandle;
+     
+            transfer->source      = source;
+            transfer->destination = destination;
+            transfer->fd          = fd;
+            transfer->start       = pieces[ipiece].start;
+            transfer->offset      = pieces[ipiece].start;
+            transfer->finish      = pieces[ipiece].finish;
+            transfer->redirected  = 0;
+            transfer->errorbuf[0] = '\0';
+            reset_header_data(&(transfer->header_data));
+
+            if (common_data->method == HTCP_GET)
+              {
+                asprintf(&p, "%lld-%lld", (long long) transfer->start, 
+                                          (long long) transfer->finish);
+                curl_easy_setopt(easyhandle, CURLOPT_RANGE, p);
+                free(p);
+
+                curl_easy_setopt(easyhandle, CURLOPT_URL, source);
+                curl_easy_setopt(easyhandle, CURLOPT_WRITEFUNCTION, 
+                                                     stripe_write_callback);
+                curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, transfer);
+
+                if ((common_data->gridhttp) && 
+                    (strncmp(source, "https://", 8) == 0))
+                     curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, 
+                                                       gh_header_slist);
+                else curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, 
+                                                       nogh_header_slist);
+              }
+            else
+              {
+                /* each range needs its own Content-Range, both for the 
+                   first request and for any GridHTTP redirected one */
+
+                asprintf(&p, "Content-Range: bytes %lld-%lld/%lld",
+                         (long long) transfer->start, 
+                         (long long) transfer->finish, (long long) length);
+
+                transfer->header_slist   = curl_slist_append(NULL, p);
+                transfer->redirect_slist = curl_slist_append(NULL, p);
+                free(p);
+
+                if ((common_data->gridhttp) && 
+                    (strncmp(destination, "https://", 8) == 0))
+                  {
+                    transfer->header_slist = curl_slist_append(
+                           transfer->header_slist, "Upgrade: GridHTTP/1.0");
+                    transfer->redirect_slist = curl_slist_append(
+                           transfer->redirect_slist, "Upgrade:");
+                  }
+
+                curl_easy_setopt(easyhandle, CURLOPT_URL, destination);
+                curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, 
+                                                    transfer->header_slist);
+                curl_easy_setopt(easyhandle, CURLOPT_UPLOAD, 1);
+                curl_easy_setopt(easyhandle, CURLOPT_INFILESIZE_LARGE,
+                      (curl_off_t) (transfer->finish + 1 - transfer->start));
+                curl_easy_setopt(easyhandle, CURLOPT_READFUNCTION, 
+                                                      stripe_read_callback);
+                curl_easy_setopt(easyhandle, CURLOPT_READDATA, transfer);
+              }
+
+            curl_easy_setopt(easyhandle, CURLOPT_COOKIE, NULL);
+            curl_multi_add_handle(multihandle, easyhandle);
+
+            ++active;
+            ++ipiece;
+          }
+  
+       if (active == 0) break;
+
+       easyhandle = next_finished(multihandle, &thiserror);
+       if (easyhandle == NULL) break;
+
+       curl_easy_getinfo(easyhandle, CURLINFO_PRIVATE, (char **) &transfer);
+       
+       if (is_gridhttp_redirect(transfer, thiserror, common_data))
+         {
+           transfer->offset = transfer->start;
+           redirect_transfer(transfer, multihandle, 
+                             (common_data->method == HTCP_GET) ? 
+                             nogh_header_slist : transfer->redirect_slist);
+           continue;
+         }
+
+       if ((common_data->method == HTCP_GET) &&
+           (transfer->header_data.retcode == 200))
+         {
+           /* the whole file was sent for a range, and stopped by
+              stripe_write_callback(): cancel the other ranges too */
+
+           if (common_data->verbose > 0)
+             fprintf(stderr, "... %s ignores Range, copying as one stream\n",
+                             source);
+
+           unranged = 1;
+           transfer->source = NULL;
+
+           for (istream=0; istream < common_data->streams; ++istream)
+              if (transfers[istream].source != NULL)
+                {
+                  curl_multi_remove_handle(multihandle, 
+                                           transfers[istream].easyhandle);
+                  transfers[istream].source = NULL;
+                }
+
+           break;
+         }
+
+       if ((thiserror == 0) && 
+           (transfer->header_data.retcode < 300) &&
+           (transfer->offset != transfer->finish + 1))
+         {
+           fprintf(stderr, "... %s bytes %lld-%lld incomplete (%lld sent)\n",
+                   source, (long long) transfer->start, 
+                   (long long) transfer->finish,
+                   (long long) (transfer->offset - transfer->start));
+           thiserror = 99;
+         }
+       else thiserror = report_transfer(transfer, thiserror, common_data);
+
+       if (thiserror != 0) anyerror = thiserror;
+       else if (journal != NULL)
+         {
+           fprintf(journal, "%lld-%lld\n", (long long) transfer->start,
+                                           (long long) transfer->finish);
+           fflush(journal);
+         }
+       
+       if (common_data->method == HTCP_PUT)
+         {
+           curl_slist_free_all(transfer->header_slist);
+           curl_slist_free_all(transfer->redirect_slist);
+           transfer->header_slist   = NULL;
+           transfer->redirect_slist = NULL;
+         }
+
+       transfer->source = NULL;
+       --active;
+     }
+
+  close(fd);
+  free(done);
+  free(pieces);
+
+  if (unranged) /* the single stream rewrites the whole file */
+    {
+      if (journal != NULL) fclose(journal);
+      unlink(journalname);
+      free(journalname);
+      return -1;
+    }
+
+  /* a ranged PUT never shrinks the remote file, so cut it to length */
+
+  if ((anyerror == 0) && (common_data->method == HTCP_PUT))
+    {
+      asprintf(&p, "Content-Range: bytes *-*/%lld", (long long) length);
+      anyerror = request_length(destination, p, NULL, NULL, common_data);
+      free(p);
+
+      if (anyerror != 0)
+        fprintf(stderr, "... failed to set length of %s (%d)\n", 
+                        destination, anyerror);
+    }
+
+  if (journal != NULL) fclose(journal);
+
+  if ((anyerror == 0) && (common_data->recursive) && 
+      (common_data->method == HTCP_GET) && (modified != 0))
+                                      set_modified(destination, modified);
+
+  if (anyerror == 0) unlink(journalname);
+  else if (journal != NULL)
+    fprintf(stderr, "... copy of %s incomplete, use --resume to finish it\n",
+                    source);
+
+  free(journalname);
+
+  return anyerror;
+}
+
+int striped_copies(char *sources[], char *destinations[],
+                   struct grst_stream_data *common_data)
+/* Copy each file in turn with --streams byte ranges in parallel, or just
+   the ranges still missing with --resume. Files that are too small to 
+   split, or whose server ignores Range, are left for parallel_copies() at
+   the end, where --parallel applies to them instead. */
+{
+  char       **unstriped, **unstriped_destinations;
+  int          isrc, islot, nunstriped = 0, anyerror = 0, thiserror;
+  CURLM       *multihandle;
+  struct       grst_transfer *transfers;
+  struct curl_slist *gh_header_slist = NULL, *nogh_header_slist = NULL;
+
+  if (common_data->gridhttp)
+    {               
+      gh_header_slist = curl_slist_append(gh_header_slist, 
+                                          "Upgrade: GridHTTP/1.0");
+      nogh_header_slist = curl_slist_append(nogh_header_slist, "Upgrade:");
+    }
+
+  for (isrc=0; sources[isrc] != NULL; ++isrc) ;
+  unstriped = (char **) malloc(sizeof(char *) * (isrc + 1));
+  unstriped_destinations = (char **) malloc(sizeof(char *) * (isrc + 1));
+
+  multihandle = curl_multi_init();
+  transfers   = (struct grst_transfer *)
+                 calloc(common_data->streams, sizeof(struct grst_transfer));
+
+  for (islot=0; islot < common_data->streams; ++islot)
+     transfer_handle(&transfers[islot], common_data);
 
   for (isrc=0; sources[isrc] != NULL; ++isrc)
      {
-       if (common_data->verbose > 0)
-            fprintf(stderr, "Deleting %s\n", sources[isrc]);
+       thiserror = copy_striped(sources[isrc], destinations[isrc], 
+                                multihandle, transfers, gh_header_slist, 
+                                nogh_header_slist, common_data);
+
+       if (thiserror == -1) 
+         {
+           unstriped[nunstriped] = sources[isrc];
+           unstriped_destinations[nunstriped] = destinations[isrc];
+           ++nunstriped;
+         }
+       else if (thiserror != 0) anyerror = thiserror;
+     }
+
+  unstriped[nunstriped] = NULL;
+  unstriped_destinations[nunstriped] = NULL;
+
+  for (islot=0; islot < common_data->streams; ++islot)
+     {
+       reset_header_data(&(transfers[islot].header_data));
+       curl_easy_cleanup(transfers[islot].easyhandle);
+     }
+
+  curl_multi_cleanup(multihandle);
+  free(transfers);
+  curl_slist_free_all(gh_header_slist);
+  curl_slist_free_all(nogh_header_slist);
+
+  if (nunstriped > 0)
+    {
+      thiserror = parallel_copies(unstriped, unstriped_destinations, 
+                                  common_data);
+      if (thiserror != 0) anyerror = thiserror;
+    }
+
+  free(unstriped);
+  free(unstriped_destinations);
+  
+  return anyerror;
+}
+
+int copy_files(char *sources[], char *destinations[],
+               struct grst_stream_data *common_data)
+{
+  if ((common_data->streams > 1) || common_data->resume)
+       return striped_copies(sources, destinations, common_data);
+  
+  return parallel_copies(sources, destinations, common_data);
+}
+
+int do_copies(char *sources[], char *destination,
+              struct grst_stream_data *common_data)
+{
+  char  *p, **destinations;
+  int    isrc, anyerror;
+
+  for (isrc=0; sources[isrc] != NULL; ++isrc) ;
+  destinations = (char **) malloc(sizeof(char *) * (isrc + 1));
+
+  for (isrc=0; sources[isrc] != NULL; ++isrc)
+     {
+       if (destination[strlen(destination) - 1] == '/')
+         {
+           p = rindex(sources[isrc], '/');
+           if (p == NULL) p = sources[isrc];
+           else           p++;
+
+           asprintf(&destinations[isrc], "%s%s", destination, p);
+         }
+       else destinations[isrc] = strdup(destination);
+     }
+
+  destinations[isrc] = NULL;
+
+  anyerror = copy_files(sources, destinations, common_data);
+
+  for (isrc=0; destinations[isrc] != NULL; ++isrc) free(destinations[isrc]);
+  free(destinations);
+
+  return anyerror;
+}
+
+int do_requests(char *sources[], struct grst_stream_data *common_data,
+                char *request, char *description)
+/* Send the same bodyless request, DELETE or PUT of a directory, to each
+   of the URLs given, keeping up to --parallel of them in flight */
+{
+  int    isrc = 0, islot, active = 0, anyerror = 0, thiserror;
+  CURL  *easyhandle;
+  CURLM *multihandle;
+  struct grst_transfer *transfers, *transfer;
+
+  multihandle = curl_multi_init();
+  transfers   = (struct grst_transfer *)
+                 calloc(common_data->parallel, sizeof(struct grst_transfer));
+
+  for (islot=0; islot < common_data->parallel; ++islot)
+     {
+       easyhandle = transfer_handle(&transfers[islot], common_data);
+
+       curl_easy_setopt(easyhandle, CURLOPT_CUSTOMREQUEST, request);
+       curl_easy_setopt(easyhandle, CURLOPT_NOBODY,        1);
+     }
+
+  while (1)
+     {
+       while ((active < common_data->parallel) && (sources[isrc] != NULL))
+            {
+              for (islot=0; transfers[islot].source != NULL; ++islot) ;
+              transfer = &transfers[islot];
+
+              if (common_data->verbose > 0)
+                   fprintf(stderr, "%s %s\n", description, sources[isrc]);
+
+              curl_easy_setopt(transfer->easyhandle, CURLOPT_URL, 
+                                                     sources[isrc]);
+              reset_header_data(&(transfer->header_data));
+              transfer->errorbuf[0] = '\0';
+              transfer->source = sources[isrc];
+
+              curl_multi_add_handle(multihandle, transfer->easyhandle);
+              ++active;
+              ++isrc;
+            }
 
-       curl_easy_setopt(easyhandle, CURLOPT_URL, sources[isrc]);
+       if (active == 0) break;
 
-       header_data.retcode = 0;
-       thiserror = curl_easy_perform(easyhandle);
+       easyhandle = next_finished(multihandle, &thiserror);
+       if (easyhandle == NULL) break;
+
+       curl_easy_getinfo(easyhandle, CURLINFO_PRIVATE, (char **) &transfer);
        
-       if ((thiserror != 0) ||
-           (header_data.retcode >= 300))
-         {
-           fprintf(stderr, "... curl error: %s (%d), HTTP error: %d\n",
-                   common_data->errorbuf, thiserror, header_data.retcode);
-           
-           if (thiserror != 0) anyerror = thiserror;
-           else                anyerror = header_data.retcode;
-         }
-       else if (common_data->verbose > 0) 
-                     fprintf(stderr, "... OK (%d)\n", header_data.retcode);
+       thiserror = report_transfer(transfer, thiserror, common_data);
+       if (thiserror != 0) anyerror = thiserror;
+
+       transfer->source = NULL;
+       --active;
      }
 
-  curl_easy_cleanup(easyhandle);
+  for (islot=0; islot < common_data->parallel; ++islot)
+     {
+       reset_header_data(&(transfers[islot].header_data));
+       curl_easy_cleanup(transfers[islot].easyhandle);
+     }
+
+  curl_multi_cleanup(multihandle);
+  free(transfers);
      
   return anyerror;
 }
 
+int do_deletes(char *sources[], struct grst_stream_data *common_data)
+{
+  return do_requests(sources, common_data, "DELETE", "Deleting");
+}
+
 int do_move(char *source, char *destination, 
             struct grst_stream_data *common_data)
 {
@@ -642,53 +1552,7 @@ int do_move(char *source, char *destination,
 
 int do_mkdirs(char *sources[], struct grst_stream_data *common_data)
 {
-  int    isrc, anyerror = 0, thiserror;
-  CURL  *easyhandle;
-  struct grst_header_data header_data;
-  
-  header_data.common_data = common_data;
-
-  easyhandle = curl_easy_init();
-  
-  curl_easy_setopt(easyhandle, CURLOPT_USERAGENT, common_data->useragent);
-  if (common_data->verbose > 1)
-                   curl_easy_setopt(easyhandle, CURLOPT_VERBOSE, 1);
-
-  curl_easy_setopt(easyhandle, CURLOPT_HEADERFUNCTION, headers_callback);
-  curl_easy_setopt(easyhandle, CURLOPT_WRITEHEADER,   &header_data);
-
-  curl_easy_setopt(easyhandle, CURLOPT_ERRORBUFFER,   common_data->errorbuf);
-  curl_easy_setopt(easyhandle, CURLOPT_CUSTOMREQUEST, "PUT");
-  curl_easy_setopt(easyhandle, CURLOPT_NOBODY,        1);
-
-  set_std_opts(easyhandle, common_data);
-
-  for (isrc=0; sources[isrc] != NULL; ++isrc)
-     {
-       if (common_data->verbose > 0)
-            fprintf(stderr, "Make directory %s\n", sources[isrc]);
-
-       curl_easy_setopt(easyhandle, CURLOPT_URL, sources[isrc]);
-
-       header_data.retcode = 0;
-       thiserror = curl_easy_perform(easyhandle);
-       
-       if ((thiserror != 0) ||
-           (header_data.retcode >= 300))
-         {
-           fprintf(stderr, "... curl error: %s (%d), HTTP error: %d\n",
-                   common_data->errorbuf, thiserror, header_data.retcode);
-           
-           if (thiserror != 0) anyerror = thiserror;
-           else                anyerror = header_data.retcode;
-         }
-       else if (common_data->verbose > 0)  
-                        fprintf(stderr, "... OK (%d)\n", header_data.retcode);
-     }
-
-  curl_easy_cleanup(easyhandle);
-     
-  return anyerror;
+  return do_requests(sources, common_data, "PUT", "Make directory");
 }
 
 static int
@@ -1551,6 +2415,532 @@ int do_listings(char *sources[], struct grst_stream_data *common_data,
   return anyerror;
 }
 
+struct grst_sync_list { char **sources;
+                        char **destinations;
+                        int   *depths;
+                        int    used;
+                        int    allocated; } ;
+
+void sync_list_add(struct grst_sync_list *list, char *source, 
+                   char *destination, int depth)
+/* Append a source/destination pair, keeping both lists NULL terminated.
+   The list takes over the malloc'd strings. */
+{
+  if (list->used + 1 >= list->allocated)
+    {
+      list->allocated += 256;
+      list->sources = (char **) 
+              realloc(list->sources, list->allocated * sizeof(char *));
+      list->destinations = (char **) 
+              realloc(list->destinations, list->allocated * sizeof(char *));
+      list->depths = (int *) 
+              realloc(list->depths, list->allocated * sizeof(int));
+    }
+
+  list->sources[list->used]      = source;
+  list->destinations[list->used] = destination;
+  list->depths[list->used]       = depth;
+  ++(list->used);
+  list->sources[list->used]      = NULL;
+  list->destinations[list->used] = NULL;
+}
+
+void sync_list_free(struct grst_sync_list *list)
+{
+  int i;
+  
+  for (i=0; i < list->used; ++i)
+     {
+       free(list->sources[i]);
+       free(list->destinations[i]);
+     }
+
+  free(list->sources);
+  free(list->destinations);
+  free(list->depths);
+  memset(list, 0, sizeof(struct grst_sync_list));
+}
+
+int fetch_listings(char *urls[], struct grst_dir_list *lists[],
+                   struct grst_stream_data *common_data)
+/* Fetch and parse the listings of the directory URLs given, up to 
+   --parallel of them at once. lists[i] is set to NULL for a directory 
+   that could not be listed. Returns the last error, apart from 404 which
+   the caller may expect when putting to a new directory. */
+{
+  int    iurl = 0, islot, active = 0, anyerror = 0, thiserror;
+  CURL  *easyhandle;
+  CURLM *multihandle;
+  struct grst_transfer *transfers, *transfer;
+
+  multihandle = curl_multi_init();
+  transfers   = (struct grst_transfer *)
+                 calloc(common_data->parallel, sizeof(struct grst_transfer));
+
+  for (islot=0; islot < common_data->parallel; ++islot)
+     {
+       easyhandle = transfer_handle(&transfers[islot], common_data);
+
+       curl_easy_setopt(easyhandle, CURLOPT_WRITEFUNCTION, rawindex_callback);
+       curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, 
+                                    (void *) &(transfers[islot].rawindex));
+       curl_easy_setopt(easyhandle, CURLOPT_HTTPGET, 1);
+     }
+
+  while (1)
+     {
+       while ((active < common_data->parallel) && (urls[iurl] != NULL))
+            {
+              for (islot=0; transfers[islot].source != NULL; ++islot) ;
+              transfer = &transfers[islot];
+
+              if (common_data->verbose > 0)
+                   fprintf(stderr, "Listing %s\n", urls[iurl]);
+
+              curl_easy_setopt(transfer->easyhandle, CURLOPT_URL, urls[iurl]);
+              reset_header_data(&(transfer->header_data));
+              transfer->errorbuf[0]        = '\0';
+              transfer->source             = urls[iurl];
+              transfer->index              = iurl;
+              transfer->rawindex.text      = NULL;
+              transfer->rawindex.used      = 0;
+              transfer->rawindex.allocated = 0;
+
+              curl_multi_add_handle(multihandle, transfer->easyhandle);
+              ++active;
+              ++iurl;
+            }
+
+       if (active == 0) break;
+
+       easyhandle = next_finished(multihandle, &thiserror);
+       if (easyhandle == NULL) break;
+
+       curl_easy_getinfo(easyhandle, CURLINFO_PRIVATE, (char **) &transfer);
+       
+       lists[transfer->index] = NULL;
+
+       if ((thiserror == 0) && (transfer->header_data.retcode == 404))
+         {
+           if (common_data->verbose > 0)
+                          fprintf(stderr, "... %s not found\n", 
+                                          transfer->source);
+         }
+       else if ((thiserror = report_transfer(transfer, thiserror, 
+                                             common_data)) != 0)
+                                                       anyerror = thiserror;
+       else if (transfer->rawindex.text == NULL)
+         lists[transfer->index] = index_to_dir_list("", transfer->source);
+       else
+         {
+           transfer->rawindex.text[transfer->rawindex.used] = '\0';
+           lists[transfer->index] = index_to_dir_list(transfer->rawindex.text,
+                                                      transfer->source);
+         }
+         
+       if (transfer->rawindex.text != NULL) free(transfer->rawindex.text);
+       transfer->source = NULL;
+       --active;
+     }
+
+  for (islot=0; islot < common_data->parallel; ++islot)
+     {
+       reset_header_data(&(transfers[islot].header_data));
+       curl_easy_cleanup(transfers[islot].easyhandle);
+     }
+
+  curl_multi_cleanup(multihandle);
+  free(transfers);
+
+  return anyerror;
+}
+
+int is_listed_file(struct grst_dir_list *list, int i)
+/* Whether entry i of a listing is a real entry of this directory, rather
+   than a parent link, a query such as the ?C=N;O=D sorting links of an
+   autoindex, or a repeat of the previous entry. Names are only taken
+   if, once URL-decoded, they still stay inside the local directory. */
+{
+  int   ok;
+  char *name, *p;
+
+  if ((list[i].filename[0] == '.')  ||
+      (list[i].filename[0] == '\0') ||
+      (index(list[i].filename, '?') != NULL) ||
+      (strncmp(list[i].filename, "mailto:", 7) == 0)) return 0;
+  
+  if ((i > 0) && (strcmp(list[i].filename, list[i-1].filename) == 0))
+                                                                 return 0;
+
+  name = GRSThttpUrlDecode(list[i].filename);
+
+  p = &name[strlen(name)];
+  if ((p > name) && (p[-1] == '/')) p[-1] = '\0'; /* directories end in / */
+  
+  ok = (name[0] != '\0') && (index(name, '/') == NULL) &&
+       (strcmp(name, ".") != 0) && (strcmp(name, "..") != 0);
+
+  free(name);
+  return ok;
+}
+
+void free_dir_list(struct grst_dir_list *list)
+{
+  int i;
+
+  if (list == NULL) return;
+
+  for (i=0; list[i].filename != NULL; ++i) free(list[i].filename);
+  free(list);
+}
+
+int is_unchanged(struct grst_dir_list *entry, off_t size, time_t modified,
+                 struct grst_stream_data *common_data)
+/* With --sync, a file is left alone if the copy already there has the 
+   same length and is at least as new as the original */
+{
+  if (!common_data->sync || 
+      !entry->length_set || !entry->modified_set) return 0;
+
+  if (common_data->method == HTCP_GET)
+        return ((off_t) entry->length == size) && (modified >= entry->modified);
+
+  return ((off_t) entry->length == size) && (entry->modified >= modified);
+}
+
+int sync_from_remote(struct grst_sync_list *dirs,
+                     struct grst_sync_list *files,
+                     struct grst_stream_data *common_data)
+/* Walk the remote directories in dirs, one level at a time with all the
+   listings of each level fetched together, creating the local directories
+   and adding the files to be fetched to files */
+{
+  int    i, j, first = 0, last, anyerror = 0, thiserror;
+  char  *name, *url, *local;
+  struct stat statbuf;
+  struct grst_dir_list **lists;
+
+  while (first < dirs->used)
+     {
+       last  = dirs->used;
+       lists = (struct grst_dir_list **) 
+                  calloc(last - first, sizeof(struct grst_dir_list *));
+
+       thiserror = fetch_listings(&(dirs->sources[first]), lists, 
+                                  common_data);
+       if (thiserror != 0) anyerror = thiserror;
+
+       for (i=first; i < last; ++i)
+          {
+            if (lists[i - first] == NULL)
+              {
+                fprintf(stderr, "... failed to list %s\n", dirs->sources[i]);
+                if (anyerror == 0) anyerror = 404;
+                continue;
+              }
+          
+            for (j=0; lists[i - first][j].filename != NULL; ++j)
+               {
+                 if (!is_listed_file(lists[i - first], j)) continue;
+
+                 name = GRSThttpUrlDecode(lists[i - first][j].filename);
+                 asprintf(&url, "%s%s", dirs->sources[i], 
+                                        lists[i - first][j].filename);
+                 asprintf(&local, "%s%s", dirs->destinations[i], name);
+                 free(name);
+
+                 if (url[strlen(url) - 1] == '/')
+                   {
+                     if ((mkdir(local, 0777) != 0) && (errno != EEXIST))
+                       {
+                         fprintf(stderr, "... failed to create directory %s\n",
+                                         local);
+                         anyerror = 99;
+                         free(url);
+                         free(local);
+                       }
+                     else sync_list_add(dirs, url, local, dirs->depths[i]+1);
+                   }
+                 else if ((stat(local, &statbuf) == 0) && 
+                          S_ISREG(statbuf.st_mode) &&
+                          is_unchanged(&(lists[i - first][j]), 
+                                       statbuf.st_size, statbuf.st_mtime,
+                                       common_data))
+                   {
+                     if (common_data->verbose > 0)
+                                   fprintf(stderr, "Unchanged %s\n", url);
+                     free(url);
+                     free(local);
+                   }
+                 else sync_list_add(files, url, local, dirs->depths[i] + 1);
+               }
+
+            free_dir_list(lists[i - first]);
+          }
+
+       free(lists);
+       first = last;
+     }
+
+  return anyerror;
+}
+
+int sync_to_remote(struct grst_sync_list *dirs,
+                   struct grst_sync_list *files,
+                   struct grst_stream_data *common_data)
+/* Walk the local directories in dirs, list the matching remote ones all
+   together, create any remote directories that are missing (parents 
+   before children) and add the files to be put to files */
+{
+  int    i, j, first, anyerror = 0, thiserror;
+  char  *escaped, *url, *local, **missing;
+  DIR   *dir;
+  struct dirent *ent;
+  struct stat statbuf;
+  struct grst_dir_list **lists, *entry, key;
+
+  /* the whole local tree first, since local directories are cheap */
+
+  for (i=0; i < dirs->used; ++i)
+     {
+       if ((dir = opendir(dirs->sources[i])) == NULL)
+         {
+           fprintf(stderr, "... failed to open directory %s\n", 
+                           dirs->sources[i]);
+           anyerror = 99;
+           continue;
+         }
+
+       while ((ent = readdir(dir)) != NULL)
+            {
+              if (ent->d_name[0] == '.') continue;
+
+              asprintf(&local, "%s%s", dirs->sources[i], ent->d_name);
+
+              if ((stat(local, &statbuf) == 0) && S_ISDIR(statbuf.st_mode))
+                {
+                  escaped = curl_easy_escape(NULL, ent->d_name, 0);
+                  asprintf(&url, "%s%s/", dirs->destinations[i], escaped);
+                  curl_free(escaped);
+                  
+                  free(local);
+                  asprintf(&local, "%s%s/", dirs->sources[i], ent->d_name);
+
+                  sync_list_add(dirs, local, url, dirs->depths[i] + 1);
+                }
+              else free(local);
+            }
+
+       closedir(dir);
+     }
+
+  lists = (struct grst_dir_list **) 
+                  calloc(dirs->used + 1, sizeof(struct grst_dir_list *));
+  missing = (char **) malloc(sizeof(char *) * (dirs->used + 1));
+
+  thiserror = fetch_listings(dirs->destinations, lists, common_data);
+  if (thiserror != 0) anyerror = thiserror;
+
+  /* listings name files as URLs, so decode them to match local names */
+
+  for (i=0; i < dirs->used; ++i)
+     if (lists[i] != NULL)
+       {
+         for (j=0; lists[i][j].filename != NULL; ++j)
+            {
+              local = GRSThttpUrlDecode(lists[i][j].filename);
+              free(lists[i][j].filename);
+              lists[i][j].filename = local;
+            }
+            
+         qsort((void *) lists[i], j, sizeof(struct grst_dir_list), 
+               grst_dir_list_cmp);
+       }
+
+  /* make missing directories a level at a time, so parents come first */
+
+  for (first=0; first < dirs->used; first = i)
+     {
+       for (i=first, j=0; (i < dirs->used) && 
+                          (dirs->depths[i] == dirs->depths[first]); ++i)
+          if (lists[i] == NULL) missing[j++] = dirs->destinations[i];
+
+       missing[j] = NULL;
+
+       if (j > 0)
+         {
+           thiserror = do_mkdirs(missing, common_data);
+           if (thiserror != 0) anyerror = thiserror;
+         }
+     }
+
+  for (i=0; i < dirs->used; ++i)
+     {
+       if ((dir = opendir(dirs->sources[i])) == NULL) continue;
+
+       for (j=0; (lists[i] != NULL) && (lists[i][j].filename != NULL); ++j) ;
+         
+       while ((ent = readdir(dir)) != NULL)
+            {
+              if (ent->d_name[0] == '.') continue;
+
+              asprintf(&local, "%s%s", dirs->sources[i], ent->d_name);
+
+              if ((stat(local, &statbuf) != 0) || !S_ISREG(statbuf.st_mode))
+                {
+                  free(local);
+                  continue;
+                }
+
+              key.filename = ent->d_name;
+              entry = NULL;
+
+              if (lists[i] != NULL)
+                entry = (struct grst_dir_list *) bsearch(&key, lists[i], j,
+                              sizeof(struct grst_dir_list), grst_dir_list_cmp);
+
+              escaped = curl_easy_escape(NULL, ent->d_name, 0);
+              asprintf(&url, "%s%s", dirs->destinations[i], escaped);
+              curl_free(escaped);
+
+              if ((entry != NULL) &&
+                  is_unchanged(entry, statbuf.st_size, statbuf.st_mtime,
+                               common_data))
+                {
+                  if (common_data->verbose > 0)
+                                   fprintf(stderr, "Unchanged %s\n", local);
+                  free(local);
+                  free(url);
+                }
+              else sync_list_add(files, local, url, dirs->depths[i] + 1);
+            }
+
+       closedir(dir);
+       free_dir_list(lists[i]);
+     }
+
+  free(lists);
+  free(missing);
+
+  return anyerror;
+}
+
+int do_sync(char *sources[], char *destination,
+            struct grst_stream_data *common_data)
+/* Copy whole directory trees with -r, or with --sync only the files which
+   are new or have changed according to the lengths and times in the 
+   listings. Source directories are copied into the destination directory
+   under their own names, as with cp -r. */
+{
+  int    isrc, anyerror = 0, thiserror, isdir;
+  char  *p, *name, *escaped, *thisdestination, *todir;
+  struct stat statbuf;
+  struct grst_sync_list dirs, files;
+  
+  memset(&dirs,  0, sizeof(dirs));
+  memset(&files, 0, sizeof(files));
+
+  if (destination[strlen(destination) - 1] == '/') 
+                                         todir = strdup(destination);
+  else asprintf(&todir, "%s/", destination);
+
+  if ((common_data->method == HTCP_GET) && 
+      (mkdir(todir, 0777) != 0) && (errno != EEXIST))
+    {
+      fprintf(stderr, "... failed to create directory %s\n", todir);
+      free(todir);
+      return 99;
+    }
+
+  for (isrc=0; sources[isrc] != NULL; ++isrc)
+     {
+       if (common_data->method == HTCP_GET)
+            isdir = (sources[isrc][strlen(sources[isrc]) - 1] == '/');
+       else isdir = (stat(sources[isrc], &statbuf) == 0) && 
+                    S_ISDIR(statbuf.st_mode);
+
+       /* the last component of the source, without any trailing / */
+       
+       name = strdup(sources[isrc]);
+       while ((name[0] != '\0') && (name[strlen(name) - 1] == '/'))
+                                             name[strlen(name) - 1] = '\0';
+       p = rindex(name, '/');
+       if (p == NULL) p = name;
+       else if ((common_data->method == HTCP_GET) && (p[-1] == '/')) p = "";
+       else ++p;
+       
+       if ((strcmp(p, ".") == 0) || (strcmp(p, "..") == 0)) p = "";
+
+       if (common_data->method == HTCP_GET)
+         {
+           escaped = GRSThttpUrlDecode(p);
+           
+           if (!isdir) asprintf(&thisdestination, "%s%s", todir, escaped);
+           else if (*escaped == '\0') thisdestination = strdup(todir);
+           else
+             {
+               asprintf(&thisdestination, "%s%s/", todir, escaped);
+
+               if ((mkdir(thisdestination, 0777) != 0) && (errno != EEXIST))
+                 {
+                   fprintf(stderr, "... failed to create directory %s\n",
+                                   thisdestination);
+                   anyerror = 99;
+                 }
+             }
+
+           free(escaped);
+         }
+       else
+         {
+           escaped = curl_easy_escape(NULL, p, 0);
+           asprintf(&thisdestination, "%s%s%s", todir, escaped, 
+                                      (isdir && (*p != '\0')) ? "/" : "");
+           curl_free(escaped);
+         }
+
+       if (!isdir) 
+         sync_list_add(&files, strdup(sources[isrc]), thisdestination, 0);
+       else if (common_data->method == HTCP_GET)
+         sync_list_add(&dirs, strdup(sources[isrc]), thisdestination, 0);
+       else
+         {
+           if (sources[isrc][strlen(sources[isrc]) - 1] == '/')
+                sync_list_add(&dirs, strdup(sources[isrc]), 
+                                     thisdestination, 0);
+           else
+             {
+               asprintf(&p, "%s/", sources[isrc]);
+               sync_list_add(&dirs, p, thisdestination, 0);
+             }
+         }
+
+       free(name);
+     }
+
+  if (common_data->method == HTCP_GET)
+       thiserror = sync_from_remote(&dirs, &files, common_data);
+  else thiserror = sync_to_remote(&dirs, &files, common_data);
+  
+  if (thiserror != 0) anyerror = thiserror;
+
+  if (common_data->verbose > 0)
+    fprintf(stderr, "%d files to copy in %d directories\n", 
+                    files.used, dirs.used);
+
+  if (files.used > 0)
+    {
+      thiserror = copy_files(files.sources, files.destinations, common_data);
+      if (thiserror != 0) anyerror = thiserror;
+    }
+
+  sync_list_free(&dirs);
+  sync_list_free(&files);
+  free(todir);
+
+  return anyerror;
+}
+
 #if (LIBCURL_VERSION_NUM < 0x070908)
 char *make_tmp_ca_roots(char *dir)
 /* libcurl before 7.9.8 doesnt support CURLOPT_CAPATH and the directory,
@@ -1638,6 +3028,11 @@ struct option long_options[] = {	{"verbose",		0, 0, 'v'},
                 			{"find",                0, 0, 0},
 					{"rmtcp",		0, 0, 0},
                 			{"conf",                1, 0, 0},
+                			{"parallel",            1, 0, 0},
+                			{"streams",             1, 0, 0},
+                			{"resume",              0, 0, 0},
+                			{"recursive",           0, 0, 'r'},
+                			{"sync",                0, 0, 0},
                 			{0, 0, 0, 0}  };
 
 int update_common_data(struct grst_stream_data *, int, char *);
@@ -1711,6 +3106,16 @@ int update_common_data(struct grst_stream_data *common_data_ptr,
   else if (option_index ==17) common_data_ptr->method     = HTCP_FIND;
   else if (option_index ==18) { printf("OK\n");common_data_ptr->method	  = HTCP_RMTCP;}
   /* option_index == 19 is used by the --conf command line-only option */
+  else if (option_index ==20) { common_data_ptr->parallel = atoi(optarg);
+                                if (common_data_ptr->parallel < 1)
+                                    common_data_ptr->parallel = 1; }
+  else if (option_index ==21) { common_data_ptr->streams  = atoi(optarg);
+                                if (common_data_ptr->streams < 1)
+                                    common_data_ptr->streams = 1; }
+  else if (option_index ==22) common_data_ptr->resume     = 1;
+  else if (option_index ==23) common_data_ptr->recursive  = 1;
+  else if (option_index ==24) { common_data_ptr->recursive = 1;
+                                common_data_ptr->sync      = 1; }
   else return GRST_RET_FAILED;
   
   return GRST_RET_OK;
@@ -1750,6 +3155,11 @@ int main(int argc, char *argv[])
   common_data.timeout   = 0;
   common_data.sitecast  = 0;
   common_data.domain    = NULL;
+  common_data.parallel  = 1;
+  common_data.streams   = 1;
+  common_data.resume    = 0;
+  common_data.recursive = 0;
+  common_data.sync      = 0;
 
   if ((argc > 1) && ((strcmp(argv[1], "--verbose") == 0) || 
                      (strcmp(argv[1], "-v") == 0))) common_data.verbose = 1;
@@ -1772,7 +3182,7 @@ int main(int argc, char *argv[])
        {
          option_index = 0;
 
-         c = getopt_long(argc, argv, "v", long_options, &option_index);
+         c = getopt_long(argc, argv, "vr", long_options, &option_index);
 
          if      (c == -1) break;
          else if (c == 0)
@@ -1781,6 +3191,7 @@ int main(int argc, char *argv[])
              else update_common_data(&common_data, option_index, optarg);
            }
          else if (c == 'v') ++(common_data.verbose);
+         else if (c == 'r') common_data.recursive = 1;
        }
 
   if (common_data.verbose > 0) 
@@ -2049,7 +3460,10 @@ int main(int argc, char *argv[])
              }
          }
          
-  anyerror = do_copies(sources, destination, &common_data);
+  if (common_data.recursive) 
+       anyerror = do_sync(sources, destination, &common_data);
+  else anyerror = do_copies(sources, destination, &common_data);
+
   if (anyerror > 99) anyerror = CURLE_HTTP_RETURNED_ERROR;
   
   return anyerror;
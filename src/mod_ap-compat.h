@@ -5,10 +5,11 @@
 #define GRST_AP_VERSION (AP_SERVER_MAJORVERSION_NUMBER * 10000 + AP_SERVER_MINORVERSION_NUMBER * 100 + AP_SERVER_PATCHLEVEL_NUMBER)
 
 /*
- * since >=2.3.0: unixd_config -> ap_unixd_config
+ * since >=2.3.0: unixd_config -> ap_unixd_config, unixd_set_* -> ap_unixd_set_*
  */
 #if GRST_AP_VERSION < 20300
 #define ap_unixd_config (unixd_config)
+#define ap_unixd_set_global_mutex_perms(MUTEX) unixd_set_global_mutex_perms(MUTEX)
 #endif
 
 /*
@@ -28,3 +29,28 @@
 #else
 #define GRST_AP_CLIENT_IP(CONN) ((CONN)->client_ip)
 #endif
+
+/*
+ * since >=2.4.0: shared object cache providers, ap_socache.h
+ */
+#if GRST_AP_VERSION >= 20400
+#define GRST_AP_SOCACHE 1
+#endif
+
+/*
+ * only in later 2.4.x: ap_map_http_request_error(), so that errors reading
+ * a request body give 413 for LimitRequestBody, 408 for timeouts etc.
+ * Otherwise (including 2.2) map the same statuses here. A short or broken
+ * body (eg APR_INCOMPLETE) gets STATUS, as it does there.
+ */
+#if AP_MODULE_MAGIC_AT_LEAST(20120211,68)
+#define GRST_AP_MAP_REQUEST_ERROR(RV, STATUS) \
+        ap_map_http_request_error((RV), (STATUS))
+#else
+#define GRST_AP_MAP_REQUEST_ERROR(RV, STATUS) \
+        (((RV) == AP_FILTER_ERROR) ? AP_FILTER_ERROR : \
+         ((RV) == APR_ENOSPC) ? HTTP_REQUEST_ENTITY_TOO_LARGE : \
+         ((RV) == APR_ENOTIMPL) ? HTTP_NOT_IMPLEMENTED : \
+         (APR_STATUS_IS_TIMEUP(RV) || APR_STATUS_IS_ETIMEDOUT(RV)) ? \
+                                  HTTP_REQUEST_TIME_OUT : (STATUS))
+#endif
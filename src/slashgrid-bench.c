@@ -0,0 +1,1234 @@
+/*
+   Copyright (c) 2002-7, Andrew McNab, University of Manchester
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or
+   without modification, are permitted provided that the following
+   conditions are met:
+
+     o Redistributions of source code must retain the above
+       copyright notice, this list of conditions and the following
+       disclaimer.
+     o Redistributions in binary form must reproduce the above
+       copyright notice, this list of conditions and the following
+       disclaimer in the documentation and/or other materials
+       provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+   CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+   INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+   BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+   TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+   ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+   OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*---------------------------------------------------------------*
+ * For more about GridSite: http://www.gridsite.org/             *
+ *---------------------------------------------------------------*/
+
+/*
+   Benchmark for SlashGrid, using a stand-in HTTP(S) file server which
+   runs inside this program so every request SlashGrid makes is counted.
+
+   The server supports HEAD, GET with Range and conditional headers, PUT
+   with Content-Range, DELETE and MOVE, and GridSite-style directory
+   listings, with an optional delay before each response. SlashGrid must
+   already be running and mounted on /grid (or --mount PATH) and is then
+   driven through it with these workloads:
+
+     seq     sequential 128KB reads of a large file
+     random  random 4KB reads of the same file
+     meta    listing a directory of small files and stat()ing each one
+     write   several processes' worth of parallel writers
+
+   Each read workload runs --passes times, so cold and warm caches can
+   be compared. For each pass, throughput, p50 and p99 latency per
+   operation, HTTP requests per operation and the fraction of operations
+   which needed no request at all (the cache hit ratio) are reported.
+
+   Build with:
+
+    make slashgrid-bench
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#define BENCH_MAX_HEAD		8192
+#define BENCH_IO_BUFFER		131072
+#define BENCH_SEQ_READ		131072
+#define BENCH_RANDOM_READ	4096
+#define BENCH_WRITE_CHUNK	65536
+#define BENCH_SMALL_FILE	1000
+
+#define BENCH_HEAD		0
+#define BENCH_GET		1
+#define BENCH_PUT		2
+#define BENCH_DELETE		3
+#define BENCH_MOVE		4
+#define BENCH_OTHER		5
+#define BENCH_METHODS		6
+
+struct bench_conn { int    fd;
+                    SSL   *ssl;
+                    char   buf[BENCH_MAX_HEAD + 1];
+                    size_t used;
+                  };
+
+struct bench_result { char          *name;
+                      int            ops;
+                      int            hits;
+                      double         seconds;
+                      double        *latency;
+                      unsigned long  requests;
+                      long long      bytes;
+                    };
+
+struct bench_writer { int            id;
+                      int            ops;
+                      int            error;
+                      double        *latency;
+                    };
+
+const char *method_names[] = { "HEAD", "GET", "PUT", "DELETE", "MOVE",
+                               "other" };
+
+unsigned long   requests[BENCH_METHODS];
+pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+char      *docroot = NULL, *mountdir = "/grid", *hostname = "127.0.0.1",
+          *remotedir = NULL;
+int        port = 0, latency_ms = 0, passes = 2, writers = 4,
+           small_files = 1000, random_reads = 2000, verbose = 0;
+long long  file_size = 67108864, write_size = 16777216;
+SSL_CTX   *ssl_ctx = NULL;
+
+/*
+   Stand-in server
+*/
+
+static unsigned long total_requests(void)
+{
+  int           i;
+  unsigned long n = 0;
+
+  pthread_mutex_lock(&counter_mutex);
+  for (i=0; i < BENCH_METHODS; ++i) n += requests[i];
+  pthread_mutex_unlock(&counter_mutex);
+
+  return n;
+}
+
+static ssize_t conn_recv(struct bench_conn *c, char *p, size_t n)
+/*
+   Read from what is already buffered first, then from the connection
+*/
+{
+  size_t len;
+
+  if (c->used > 0)
+    {
+      len = (n < c->used) ? n : c->used;
+      memcpy(p, c->buf, len);
+      memmove(c->buf, &(c->buf[len]), c->used - len);
+      c->used -= len;
+      return len;
+    }
+
+  if (c->ssl != NULL) return SSL_read(c->ssl, p, n);
+
+  return read(c->fd, p, n);
+}
+
+static int conn_send(struct bench_conn *c, const char *p, size_t n)
+{
+  ssize_t ret;
+
+  while (n > 0)
+       {
+         if (c->ssl != NULL) ret = SSL_write(c->ssl, p, n);
+         else                ret = write(c->fd, p, n);
+
+         if (ret <= 0) return 0;
+
+         p += ret;
+         n -= ret;
+       }
+
+  return 1;
+}
+
+static char *conn_read_head(struct bench_conn *c)
+/*
+   Returns the malloc()ed request line and headers, leaving any of the
+   body already read in c->buf, or NULL at the end of the connection.
+*/
+{
+  char   *end, *head;
+  ssize_t ret;
+  size_t  len;
+
+  while (1)
+       {
+         c->buf[c->used] = '\0';
+
+         if ((end = strstr(c->buf, "\r\n\r\n")) != NULL)
+           {
+             len  = end - c->buf + 4;
+             head = strndup(c->buf, len);
+             memmove(c->buf, &(c->buf[len]), c->used - len);
+             c->used -= len;
+             return head;
+           }
+
+         if (c->used >= BENCH_MAX_HEAD) return NULL;
+
+         if (c->ssl != NULL)
+              ret = SSL_read(c->ssl, &(c->buf[c->used]),
+                             BENCH_MAX_HEAD - c->used);
+         else ret = read(c->fd, &(c->buf[c->used]),
+                         BENCH_MAX_HEAD - c->used);
+
+         if (ret <= 0) return NULL;
+
+         c->used += ret;
+       }
+}
+
+static char *find_header(char *head, char *name)
+/*
+   Returns the malloc()ed value of the named header, or NULL
+*/
+{
+  char  *p, *end;
+  size_t len;
+
+  len = strlen(name);
+
+  for (p = strstr(head, "\r\n"); p != NULL; p = strstr(p, "\r\n"))
+     {
+       p += 2;
+
+       if ((strncasecmp(p, name, len) == 0) && (p[len] == ':'))
+         {
+           p += len + 1;
+           while (*p == ' ') ++p;
+
+           if ((end = strstr(p, "\r\n")) == NULL) return NULL;
+           return strndup(p, end - p);
+         }
+     }
+
+  return NULL;
+}
+
+static char *url_path_decode(char *in)
+/*
+   Returns the malloc()ed local pathname of a request URI path, or NULL
+   if it tries to escape from the document root
+*/
+{
+  char *out, *q;
+  int   c;
+
+  out = malloc(strlen(in) + 1);
+
+  for (q = out; (*in != '\0') && (*in != '?'); ++in)
+     {
+       if ((*in == '%') && (in[1] != '\0') && (in[2] != '\0') &&
+           (sscanf(&in[1], "%2x", &c) == 1))
+         {
+           *(q++) = (char) c;
+           in += 2;
+         }
+       else *(q++) = *in;
+     }
+
+  *q = '\0';
+
+  if ((out[0] != '/') || (strstr(out, "/../") != NULL) ||
+      ((strlen(out) >= 3) && (strcmp(&out[strlen(out) - 3], "/..") == 0)))
+    {
+      free(out);
+      return NULL;
+    }
+
+  return out;
+}
+
+static int send_status(struct bench_conn *c, int status, char *reason,
+                       char *extra)
+{
+  int   ret;
+  char *s;
+
+  asprintf(&s, "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n%s\r\n",
+           status, reason, (extra != NULL) ? extra : "");
+  ret = conn_send(c, s, strlen(s));
+  free(s);
+
+  return ret;
+}
+
+static int send_listing(struct bench_conn *c, char *path, char *localpath,
+                        int head)
+/*
+   Directory listings in the same style as GridSite, with sizes and
+   times as attributes of each link for SlashGrid to read
+*/
+{
+  int            ret;
+  char          *body = NULL, *s, *entry, *resp;
+  size_t         used = 0;
+  DIR           *dir;
+  struct dirent *ent;
+  struct stat    statbuf;
+
+  if ((dir = opendir(localpath)) == NULL)
+                                  return send_status(c, 404, "Not Found", NULL);
+
+  asprintf(&body, "<html><body><h1>Index of %s</h1>\n", path);
+  used = strlen(body);
+
+  while ((ent = readdir(dir)) != NULL)
+       {
+         if (ent->d_name[0] == '.') continue;
+
+         asprintf(&s, "%s/%s", localpath, ent->d_name);
+
+         if (stat(s, &statbuf) == 0)
+           {
+             asprintf(&entry, "<a href=\"%s%s\" content-length=\"%lld\" "
+                      "last-modified=\"%ld\">%s</a>\n", ent->d_name,
+                      S_ISDIR(statbuf.st_mode) ? "/" : "",
+                      (long long) statbuf.st_size, (long) statbuf.st_mtime,
+                      ent->d_name);
+
+             body = realloc(body, used + strlen(entry) + 1);
+             strcpy(&body[used], entry);
+             used += strlen(entry);
+             free(entry);
+           }
+
+         free(s);
+       }
+
+  closedir(dir);
+
+  asprintf(&resp, "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n"
+                  "Content-Length: %ld\r\n\r\n", (long) used);
+
+  ret = conn_send(c, resp, strlen(resp)) && (head || conn_send(c, body, used));
+
+  free(resp);
+  free(body);
+
+  return ret;
+}
+
+static int send_file(struct bench_conn *c, char *head, char *path,
+                     char *localpath, int ishead)
+{
+  int         fd, ret = 1, status = 200;
+  char        etag[64], modified[64], *range, *inm, *ims, *resp,
+              *location, *host, *buf;
+  long long   start = 0, finish, n;
+  ssize_t     len;
+  struct tm   tm;
+  struct stat statbuf;
+
+  if (stat(localpath, &statbuf) != 0)
+                                 return send_status(c, 404, "Not Found", NULL);
+
+  if (S_ISDIR(statbuf.st_mode))
+    {
+      if (path[strlen(path) - 1] == '/')
+                           return send_listing(c, path, localpath, ishead);
+
+      host = find_header(head, "Host");
+      asprintf(&location, "Location: %s://%s%s/\r\n",
+               (ssl_ctx != NULL) ? "https" : "http",
+               (host != NULL) ? host : hostname, path);
+      ret = send_status(c, 301, "Moved Permanently", location);
+      free(location);
+      if (host != NULL) free(host);
+      return ret;
+    }
+
+  snprintf(etag, sizeof(etag), "\"%lx-%llx-%lx\"", (long) statbuf.st_ino,
+           (long long) statbuf.st_size, (long) statbuf.st_mtime);
+  gmtime_r(&statbuf.st_mtime, &tm);
+  strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+  inm = find_header(head, "If-None-Match");
+  ims = find_header(head, "If-Modified-Since");
+
+  if (((inm != NULL) && (strcmp(inm, etag) == 0)) ||
+      ((inm == NULL) && (ims != NULL) && (strcmp(ims, modified) == 0)))
+    {
+      free(inm);
+      if (ims != NULL) free(ims);
+
+      asprintf(&resp, "ETag: %s\r\nLast-Modified: %s\r\n", etag, modified);
+      ret = send_status(c, 304, "Not Modified", resp);
+      free(resp);
+      return ret;
+    }
+
+  if (inm != NULL) free(inm);
+  if (ims != NULL) free(ims);
+
+  finish = (long long) statbuf.st_size - 1;
+
+  if ((range = find_header(head, "Range")) != NULL)
+    {
+      if ((sscanf(range, "bytes=%lld-%lld", &start, &finish) >= 1) &&
+          (start < (long long) statbuf.st_size))
+        {
+          if (finish >= (long long) statbuf.st_size)
+                                   finish = (long long) statbuf.st_size - 1;
+          status = 206;
+        }
+      else
+        {
+          free(range);
+          return send_status(c, 416, "Range Not Satisfiable", NULL);
+        }
+
+      free(range);
+    }
+
+  if (status == 206)
+       asprintf(&resp, "HTTP/1.1 206 Partial Content\r\n"
+                "Content-Range: bytes %lld-%lld/%lld\r\n"
+                "Content-Length: %lld\r\nETag: %s\r\nLast-Modified: %s\r\n\r\n",
+                start, finish, (long long) statbuf.st_size,
+                finish - start + 1, etag, modified);
+  else asprintf(&resp, "HTTP/1.1 200 OK\r\n"
+                "Content-Length: %lld\r\nETag: %s\r\nLast-Modified: %s\r\n\r\n",
+                (long long) statbuf.st_size, etag, modified);
+
+  ret = conn_send(c, resp, strlen(resp));
+  free(resp);
+
+  if (!ret || ishead) return ret;
+
+  if ((fd = open(localpath, O_RDONLY)) == -1) return 0;
+
+  buf = malloc(BENCH_IO_BUFFER);
+
+  for (n = start; ret && (n <= finish); n += len)
+     {
+       len = pread(fd, buf, (finish - n + 1 < BENCH_IO_BUFFER) ?
+                                   finish - n + 1 : BENCH_IO_BUFFER, n);
+
+       if (len <= 0) ret = 0;
+       else ret = conn_send(c, buf, len);
+     }
+
+  free(buf);
+  close(fd);
+
+  return ret;
+}
+
+static int receive_put(struct bench_conn *c, char *head, char *path,
+                       char *localpath)
+/*
+   PUT, with Content-Range for a partial write or for a truncation, as
+   sent by SlashGrid. Directories are created by PUTs to names ending /
+*/
+{
+  int         fd, flags, ok = 1, created;
+  char       *value, *buf;
+  long long   length = 0, start = -1, finish, size = -1;
+  ssize_t     len;
+  struct stat statbuf;
+
+  if ((value = find_header(head, "Content-Length")) != NULL)
+    {
+      length = atoll(value);
+      free(value);
+    }
+
+  if ((value = find_header(head, "Expect")) != NULL)
+    {
+      if (strcasecmp(value, "100-continue") == 0)
+                    conn_send(c, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+      free(value);
+    }
+
+  if ((value = find_header(head, "Content-Range")) != NULL)
+    {
+      if (sscanf(value, "bytes %lld-%lld/", &start, &finish) != 2)
+        {
+          start = -1;
+          if (sscanf(value, "bytes *-*/%lld", &size) != 1) size = -1;
+        }
+
+      free(value);
+    }
+
+  created = (stat(localpath, &statbuf) != 0);
+
+  if (path[strlen(path) - 1] == '/')
+    {
+      if (created && (mkdir(localpath, 0755) != 0)) ok = 0;
+      fd = -1;
+    }
+  else
+    {
+      flags = O_WRONLY | O_CREAT;
+      if ((start < 0) && (size < 0)) flags |= O_TRUNC;
+
+      if ((fd = open(localpath, flags, 0644)) == -1) ok = 0;
+      else if ((size >= 0) && (ftruncate(fd, size) != 0)) ok = 0;
+    }
+
+  if (start < 0) start = 0;
+
+  buf = malloc(BENCH_IO_BUFFER);
+
+  /* always read the whole body, to keep the connection usable */
+
+  while (length > 0)
+       {
+         len = conn_recv(c, buf, (length < BENCH_IO_BUFFER) ?
+                                               length : BENCH_IO_BUFFER);
+         if (len <= 0)
+           {
+             free(buf);
+             if (fd != -1) close(fd);
+             return 0;
+           }
+
+         if ((fd != -1) && (pwrite(fd, buf, len, start) != len)) ok = 0;
+
+         start  += len;
+         length -= len;
+       }
+
+  free(buf);
+  if ((fd != -1) && (close(fd) != 0)) ok = 0;
+
+  if (!ok) return send_status(c, 403, "Forbidden", NULL);
+
+  if (created) return send_status(c, 201, "Created", NULL);
+
+  return send_status(c, 200, "OK", NULL);
+}
+
+static int handle_request(struct bench_conn *c, char *head)
+{
+  int    ret, method;
+  char   verb[16], uri[BENCH_MAX_HEAD], *path, *localpath,
+         *destination, *p, *destpath, *localdest;
+
+  if (sscanf(head, "%15s %8191s", verb, uri) != 2) return 0;
+
+  if      (strcmp(verb, "HEAD")   == 0) method = BENCH_HEAD;
+  else if (strcmp(verb, "GET")    == 0) method = BENCH_GET;
+  else if (strcmp(verb, "PUT")    == 0) method = BENCH_PUT;
+  else if (strcmp(verb, "DELETE") == 0) method = BENCH_DELETE;
+  else if (strcmp(verb, "MOVE")   == 0) method = BENCH_MOVE;
+  else                                  method = BENCH_OTHER;
+
+  pthread_mutex_lock(&counter_mutex);
+  ++requests[method];
+  pthread_mutex_unlock(&counter_mutex);
+
+  if (verbose) fprintf(stderr, "%s %s\n", verb, uri);
+
+  if (latency_ms > 0) usleep(latency_ms * 1000);
+
+  if ((path = url_path_decode(uri)) == NULL)
+                               return send_status(c, 403, "Forbidden", NULL);
+
+  asprintf(&localpath, "%s%s", docroot, path);
+
+  if ((method == BENCH_HEAD) || (method == BENCH_GET))
+    ret = send_file(c, head, path, localpath, (method == BENCH_HEAD));
+  else if (method == BENCH_PUT)
+    ret = receive_put(c, head, path, localpath);
+  else if (method == BENCH_DELETE)
+    {
+      if (((path[strlen(path) - 1] == '/') ?
+                              rmdir(localpath) : unlink(localpath)) == 0)
+           ret = send_status(c, 200, "OK", NULL);
+      else ret = send_status(c, 404, "Not Found", NULL);
+    }
+  else if ((method == BENCH_MOVE) &&
+           ((destination = find_header(head, "Destination")) != NULL))
+    {
+      /* skip over scheme and host to the path */
+
+      p = strstr(destination, "://");
+      p = (p != NULL) ? index(&p[3], '/') : destination;
+
+      if ((p != NULL) && ((destpath = url_path_decode(p)) != NULL))
+        {
+          asprintf(&localdest, "%s%s", docroot, destpath);
+
+          if (rename(localpath, localdest) == 0)
+               ret = send_status(c, 201, "Created", NULL);
+          else ret = send_status(c, 404, "Not Found", NULL);
+
+          free(localdest);
+          free(destpath);
+        }
+      else ret = send_status(c, 403, "Forbidden", NULL);
+
+      free(destination);
+    }
+  else ret = send_status(c, 501, "Not Implemented", NULL);
+
+  free(localpath);
+  free(path);
+
+  return ret;
+}
+
+static void *serve_connection(void *arg)
+{
+  int                one = 1;
+  char              *head, *value;
+  struct bench_conn *c = (struct bench_conn *) arg;
+
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (ssl_ctx != NULL)
+    {
+      c->ssl = SSL_new(ssl_ctx);
+      SSL_set_fd(c->ssl, c->fd);
+
+      if (SSL_accept(c->ssl) != 1)
+        {
+          if (verbose) ERR_print_errors_fp(stderr);
+          SSL_free(c->ssl);
+          close(c->fd);
+          free(c);
+          return NULL;
+        }
+    }
+
+  while ((head = conn_read_head(c)) != NULL)
+       {
+         if ((value = find_header(head, "Transfer-Encoding")) != NULL)
+           {
+             /* not sent by SlashGrid, so not supported */
+             send_status(c, 411, "Length Required", "Connection: close\r\n");
+             free(value);
+             free(head);
+             break;
+           }
+
+         if (!handle_request(c, head))
+           {
+             free(head);
+             break;
+           }
+
+         free(head);
+       }
+
+  if (c->ssl != NULL)
+    {
+      SSL_shutdown(c->ssl);
+      SSL_free(c->ssl);
+    }
+
+  close(c->fd);
+  free(c);
+
+  return NULL;
+}
+
+static void *server_thread(void *arg)
+{
+  int                listenfd = *((int *) arg), fd;
+  pthread_t          thread;
+  struct bench_conn *c;
+
+  while (1)
+       {
+         if ((fd = accept(listenfd, NULL, NULL)) == -1)
+           {
+             if (errno == EINTR) continue;
+             perror("accept");
+             return NULL;
+           }
+
+         c = calloc(1, sizeof(struct bench_conn));
+         c->fd = fd;
+
+         if (pthread_create(&thread, NULL, serve_connection, c) == 0)
+                                                     pthread_detach(thread);
+         else
+           {
+             close(fd);
+             free(c);
+           }
+       }
+}
+
+static int start_server(void)
+{
+  int                one = 1;
+  static int         listenfd;
+  socklen_t          len;
+  pthread_t          thread;
+  struct sockaddr_in addr;
+
+  if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) return 0;
+
+  setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  bzero(&addr, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port        = htons(port);
+
+  if ((bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) != 0) ||
+      (listen(listenfd, 64) != 0)) return 0;
+
+  len = sizeof(addr);
+  getsockname(listenfd, (struct sockaddr *) &addr, &len);
+  port = ntohs(addr.sin_port);
+
+  return (pthread_create(&thread, NULL, server_thread, &listenfd) == 0);
+}
+
+/*
+   Workloads, run through the SlashGrid mount
+*/
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+  double x = *((double *) a), y = *((double *) b);
+
+  return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static void print_result(struct bench_result *r)
+{
+  double p50 = 0.0, p99 = 0.0;
+
+  if (r->ops > 0)
+    {
+      qsort(r->latency, r->ops, sizeof(double), double_cmp);
+      p50 = r->latency[(r->ops - 1) / 2];
+      p99 = r->latency[((r->ops - 1) * 99) / 100];
+    }
+
+  printf("%-12s %7d ops %9.2f MB/s %9.0f ops/s  p50 %8.3f ms  p99 %8.3f ms"
+         "  %6.3f req/op", r->name, r->ops,
+         (r->seconds > 0.0) ? r->bytes / r->seconds / 1048576.0 : 0.0,
+         (r->seconds > 0.0) ? r->ops / r->seconds : 0.0,
+         p50 * 1000.0, p99 * 1000.0,
+         (r->ops > 0) ? (double) r->requests / r->ops : 0.0);
+
+  if (r->hits >= 0) printf("  %5.1f%% hit\n",
+                           (r->ops > 0) ? 100.0 * r->hits / r->ops : 0.0);
+  else printf("\n");
+
+  fflush(stdout);
+}
+
+static int make_file(char *name, long long size)
+/*
+   Create a file of this size directly in the document root
+*/
+{
+  int       fd;
+  char     *localpath, *buf;
+  long long i, done;
+  ssize_t   len;
+
+  asprintf(&localpath, "%s/%s", docroot, name);
+  fd = open(localpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  free(localpath);
+
+  if (fd == -1) return 0;
+
+  buf = malloc(BENCH_IO_BUFFER);
+  for (i=0; i < BENCH_IO_BUFFER; ++i) buf[i] = (char) (i * 31 + 7);
+
+  for (done = 0; done < size; done += len)
+     {
+       len = write(fd, buf, (size - done < BENCH_IO_BUFFER) ?
+                                              size - done : BENCH_IO_BUFFER);
+       if (len <= 0) break;
+     }
+
+  free(buf);
+  close(fd);
+
+  return (done == size);
+}
+
+static void run_read(char *name, int random_mode, int pass)
+{
+  int                 fd, nalloc;
+  char               *path, *buf;
+  unsigned long       before;
+  off_t               offset = 0;
+  ssize_t             len;
+  double              t0, t1;
+  struct bench_result r;
+
+  bzero(&r, sizeof(r));
+  asprintf(&r.name, "%s-%d", random_mode ? "random" : "seq", pass);
+
+  nalloc    = random_mode ? random_reads
+                          : (int) (file_size / BENCH_SEQ_READ + 2);
+  r.latency = malloc(nalloc * sizeof(double));
+  buf       = malloc(BENCH_SEQ_READ);
+
+  asprintf(&path, "%s/%s", remotedir, name);
+
+  r.requests = total_requests();
+  r.seconds  = now_seconds();
+
+  if ((fd = open(path, O_RDONLY)) == -1)
+    {
+      fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+      exit(1);
+    }
+
+  srandom(pass);
+
+  while (r.ops < nalloc)
+       {
+         if (random_mode)
+           offset = (random() % (file_size / BENCH_RANDOM_READ))
+                                                      * BENCH_RANDOM_READ;
+         before = total_requests();
+         t0     = now_seconds();
+
+         if (random_mode) len = pread(fd, buf, BENCH_RANDOM_READ, offset);
+         else             len = read(fd, buf, BENCH_SEQ_READ);
+
+         t1 = now_seconds();
+
+         if (len < 0)
+           {
+             fprintf(stderr, "read of %s fails: %s\n", path, strerror(errno));
+             exit(1);
+           }
+
+         if (!random_mode && (len == 0)) break;
+
+         if (total_requests() == before) ++r.hits;
+
+         r.latency[r.ops++] = t1 - t0;
+         r.bytes += len;
+       }
+
+  close(fd);
+
+  r.seconds  = now_seconds() - r.seconds;
+  r.requests = total_requests() - r.requests;
+
+  if (!random_mode && (r.bytes != file_size))
+    fprintf(stderr, "%s: read %lld bytes but file is %lld bytes\n",
+            r.name, r.bytes, file_size);
+
+  print_result(&r);
+
+  free(r.latency);
+  free(r.name);
+  free(buf);
+  free(path);
+}
+
+static void run_meta(int pass)
+{
+  int                 i, n = 0;
+  char               *dirpath, *path, **names;
+  unsigned long       before;
+  double              t0, t1;
+  DIR                *dir;
+  struct dirent      *ent;
+  struct stat         statbuf;
+  struct bench_result r;
+
+  bzero(&r, sizeof(r));
+  asprintf(&r.name, "meta-%d", pass);
+  r.latency = malloc((small_files + 1) * sizeof(double));
+  names     = malloc(small_files * sizeof(char *));
+
+  asprintf(&dirpath, "%s/meta", remotedir);
+
+  r.requests = total_requests();
+  r.seconds  = now_seconds();
+
+  /* the listing counts as one operation */
+
+  before = total_requests();
+  t0     = now_seconds();
+
+  if ((dir = opendir(dirpath)) == NULL)
+    {
+      fprintf(stderr, "cannot open %s: %s\n", dirpath, strerror(errno));
+      exit(1);
+    }
+
+  while (((ent = readdir(dir)) != NULL) && (n < small_files))
+       if (ent->d_name[0] != '.') names[n++] = strdup(ent->d_name);
+
+  closedir(dir);
+
+  t1 = now_seconds();
+  if (total_requests() == before) ++r.hits;
+  r.latency[r.ops++] = t1 - t0;
+
+  if (n != small_files)
+    fprintf(stderr, "%s: listed %d files but expected %d\n",
+            r.name, n, small_files);
+
+  for (i=0; i < n; ++i)
+     {
+       asprintf(&path, "%s/%s", dirpath, names[i]);
+
+       before = total_requests();
+       t0     = now_seconds();
+
+       if (stat(path, &statbuf) != 0)
+         fprintf(stderr, "stat of %s fails: %s\n", path, strerror(errno));
+       else if (statbuf.st_size != BENCH_SMALL_FILE)
+         fprintf(stderr, "%s has size %lld not %d\n", path,
+                 (long long) statbuf.st_size, BENCH_SMALL_FILE);
+
+       t1 = now_seconds();
+
+       if (total_requests() == before) ++r.hits;
+       r.latency[r.ops++] = t1 - t0;
+
+       free(path);
+       free(names[i]);
+     }
+
+  r.seconds  = now_seconds() - r.seconds;
+  r.requests = total_requests() - r.requests;
+
+  print_result(&r);
+
+  free(names);
+  free(r.latency);
+  free(r.name);
+  free(dirpath);
+}
+
+static void *writer_thread(void *arg)
+{
+  int                  fd;
+  char                *path, *buf;
+  long long            done;
+  ssize_t              len;
+  double               t0;
+  struct bench_writer *w = (struct bench_writer *) arg;
+
+  asprintf(&path, "%s/write-%d.dat", remotedir, w->id);
+  buf = malloc(BENCH_WRITE_CHUNK);
+  memset(buf, 'a' + w->id % 26, BENCH_WRITE_CHUNK);
+
+  t0 = now_seconds();
+
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+    {
+      fprintf(stderr, "cannot create %s: %s\n", path, strerror(errno));
+      w->error = 1;
+      free(buf);
+      free(path);
+      return NULL;
+    }
+
+  w->latency[w->ops++] = now_seconds() - t0;
+
+  for (done = 0; done < write_size; done += len)
+     {
+       t0 = now_seconds();
+
+       len = write(fd, buf, (write_size - done < BENCH_WRITE_CHUNK) ?
+                                      write_size - done : BENCH_WRITE_CHUNK);
+
+       w->latency[w->ops++] = now_seconds() - t0;
+
+       if (len <= 0)
+         {
+           fprintf(stderr, "write to %s fails: %s\n", path, strerror(errno));
+           w->error = 1;
+           break;
+         }
+     }
+
+  /* close() is where buffered writes must be completed */
+
+  t0 = now_seconds();
+  if (close(fd) != 0) w->error = 1;
+  w->latency[w->ops++] = now_seconds() - t0;
+
+  free(buf);
+  free(path);
+
+  return NULL;
+}
+
+static void run_write(void)
+{
+  int                  i, j, nalloc;
+  char                *localpath;
+  pthread_t           *threads;
+  struct stat          statbuf;
+  struct bench_writer *w;
+  struct bench_result  r;
+
+  bzero(&r, sizeof(r));
+  r.name = "write";
+  r.hits = -1;
+
+  nalloc  = (int) (write_size / BENCH_WRITE_CHUNK) + 3;
+  w       = calloc(writers, sizeof(struct bench_writer));
+  threads = calloc(writers, sizeof(pthread_t));
+
+  r.requests = total_requests();
+  r.seconds  = now_seconds();
+
+  for (i=0; i < writers; ++i)
+     {
+       w[i].id      = i;
+       w[i].latency = malloc(nalloc * sizeof(double));
+       pthread_create(&threads[i], NULL, writer_thread, &w[i]);
+     }
+
+  for (i=0; i < writers; ++i) pthread_join(threads[i], NULL);
+
+  r.seconds  = now_seconds() - r.seconds;
+  r.requests = total_requests() - r.requests;
+  r.latency  = malloc(writers * nalloc * sizeof(double));
+
+  for (i=0; i < writers; ++i)
+     {
+       for (j=0; j < w[i].ops; ++j) r.latency[r.ops++] = w[i].latency[j];
+       free(w[i].latency);
+
+       /* check what actually arrived at the server */
+
+       asprintf(&localpath, "%s/write-%d.dat", docroot, i);
+
+       if (w[i].error || (stat(localpath, &statbuf) != 0) ||
+           (statbuf.st_size != write_size))
+         fprintf(stderr, "writer %d did not write %lld bytes\n",
+                 i, write_size);
+       else r.bytes += write_size;
+
+       free(localpath);
+     }
+
+  print_result(&r);
+
+  free(r.latency);
+  free(threads);
+  free(w);
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+   "usage: slashgrid-bench [--mount PATH] [--docroot DIR] [--port N]\n"
+   "         [--latency MS] [--cert FILE --key FILE] [--host NAME]\n"
+   "         [--file-size BYTES] [--random-reads N] [--small-files N]\n"
+   "         [--writers N] [--write-size BYTES] [--passes N]\n"
+   "         [--workloads seq,random,meta,write] [--serve-only] [--verbose]\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int    i, serve_only = 0;
+  char  *workloads = "seq,random,meta,write", *certfile = NULL,
+        *keyfile = NULL, *name, template[] = "/tmp/slashgrid-bench-XXXXXX";
+  struct stat statbuf;
+
+  for (i=1; i < argc; ++i)
+     {
+       if ((strcmp(argv[i], "--mount") == 0) && (i + 1 < argc))
+         mountdir = argv[++i];
+       else if ((strcmp(argv[i], "--docroot") == 0) && (i + 1 < argc))
+         docroot = argv[++i];
+       else if ((strcmp(argv[i], "--port") == 0) && (i + 1 < argc))
+         port = atoi(argv[++i]);
+       else if ((strcmp(argv[i], "--latency") == 0) && (i + 1 < argc))
+         latency_ms = atoi(argv[++i]);
+       else if ((strcmp(argv[i], "--cert") == 0) && (i + 1 < argc))
+         certfile = argv[++i];
+       else if ((strcmp(argv[i], "--key") == 0) && (i + 1 < argc))
+         keyfile = argv[++i];
+       else if ((strcmp(argv[i], "--host") == 0) && (i + 1 < argc))
+         hostname = argv[++i];
+       else if ((strcmp(argv[i], "--file-size") == 0) && (i + 1 < argc))
+         file_size = atoll(argv[++i]);
+       else if ((strcmp(argv[i], "--random-reads") == 0) && (i + 1 < argc))
+         random_reads = atoi(argv[++i]);
+       else if ((strcmp(argv[i], "--small-files") == 0) && (i + 1 < argc))
+         small_files = atoi(argv[++i]);
+       else if ((strcmp(argv[i], "--writers") == 0) && (i + 1 < argc))
+         writers = atoi(argv[++i]);
+       else if ((strcmp(argv[i], "--write-size") == 0) && (i + 1 < argc))
+         write_size = atoll(argv[++i]);
+       else if ((strcmp(argv[i], "--passes") == 0) && (i + 1 < argc))
+         passes = atoi(argv[++i]);
+       else if ((strcmp(argv[i], "--workloads") == 0) && (i + 1 < argc))
+         workloads = argv[++i];
+       else if (strcmp(argv[i], "--serve-only") == 0) serve_only = 1;
+       else if (strcmp(argv[i], "--verbose") == 0)    verbose = 1;
+       else
+         {
+           usage();
+           return 1;
+         }
+     }
+
+  if ((file_size < BENCH_RANDOM_READ) || (random_reads <= 0) ||
+      (small_files <= 0) || (writers <= 0) || (write_size <= 0) ||
+      (passes <= 0) || (latency_ms < 0) || (port < 0) || (port > 65535))
+    {
+      fprintf(stderr, "sizes and counts must be positive, and file-size "
+                      "at least %d\n", BENCH_RANDOM_READ);
+      return 1;
+    }
+
+  if ((certfile != NULL) || (keyfile != NULL))
+    {
+      SSL_library_init();
+      SSL_load_error_strings();
+
+      if ((certfile == NULL) || (keyfile == NULL) ||
+          ((ssl_ctx = SSL_CTX_new(SSLv23_server_method())) == NULL) ||
+          (SSL_CTX_use_certificate_chain_file(ssl_ctx, certfile) != 1) ||
+          (SSL_CTX_use_PrivateKey_file(ssl_ctx, keyfile,
+                                       SSL_FILETYPE_PEM) != 1))
+        {
+          fprintf(stderr, "--cert and --key must both give usable "
+                          "PEM files\n");
+          ERR_print_errors_fp(stderr);
+          return 1;
+        }
+    }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  if ((docroot == NULL) && ((docroot = mkdtemp(template)) == NULL))
+    {
+      perror("mkdtemp");
+      return 1;
+    }
+
+  /* slashgrid runs as root, and must be able to write here */
+  chmod(docroot, 0777);
+
+  if (!start_server())
+    {
+      fprintf(stderr, "unable to listen on port %d\n", port);
+      return 1;
+    }
+
+  asprintf(&remotedir, "%s/%s/%s:%d", mountdir,
+           (ssl_ctx != NULL) ? "https" : "http", hostname, port);
+
+  printf("serving %s as %s://%s:%d/ with %d ms latency\n", docroot,
+         (ssl_ctx != NULL) ? "https" : "http", hostname, port, latency_ms);
+  printf("SlashGrid path is %s\n", remotedir);
+  fflush(stdout);
+
+  if (serve_only)
+    {
+      while (1) pause();
+    }
+
+  if (stat(remotedir, &statbuf) != 0)
+    {
+      fprintf(stderr, "cannot reach %s through SlashGrid: %s\n",
+              remotedir, strerror(errno));
+      return 1;
+    }
+
+  if ((strstr(workloads, "seq") != NULL) ||
+      (strstr(workloads, "random") != NULL))
+    {
+      if (!make_file("bench.dat", file_size))
+        {
+          fprintf(stderr, "unable to create bench.dat in %s\n", docroot);
+          return 1;
+        }
+    }
+
+  if (strstr(workloads, "meta") != NULL)
+    {
+      asprintf(&name, "%s/meta", docroot);
+      mkdir(name, 0755);
+      free(name);
+
+      for (i=0; i < small_files; ++i)
+         {
+           asprintf(&name, "meta/small-%06d", i);
+           make_file(name, BENCH_SMALL_FILE);
+           free(name);
+         }
+    }
+
+  if (strstr(workloads, "seq") != NULL)
+    for (i=1; i <= passes; ++i) run_read("bench.dat", 0, i);
+
+  if (strstr(workloads, "random") != NULL)
+    for (i=1; i <= passes; ++i) run_read("bench.dat", 1, i);
+
+  if (strstr(workloads, "meta") != NULL)
+    for (i=1; i <= passes; ++i) run_meta(i);
+
+  if (strstr(workloads, "write") != NULL) run_write();
+
+  printf("requests:");
+  for (i=0; i < BENCH_METHODS; ++i)
+                          printf(" %s=%lu", method_names[i], requests[i]);
+  printf("\n");
+
+  return 0;
+}
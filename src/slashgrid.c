@@ -38,6 +38,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <utime.h>
 #include <sys/mount.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -56,6 +58,7 @@
 #include <pthread.h>
 #include <pwd.h>
 #include <sys/time.h>
+#include <sys/select.h>
 #include <sys/resource.h>
 
 #include <fuse.h>
@@ -80,9 +83,38 @@
 #define GRST_SLASH_CACHE_EXPIRE		300
 #define GRST_SLASH_DEFAULT_BLOCKSIZE	65536
 #define GRST_SLASH_MAX_BLOCKSIZE	104857600
-#define GRST_SLASH_MAX_HANDLES		16
+#define GRST_SLASH_DEFAULT_CONNECTIONS	4
+#define GRST_SLASH_MAX_CONNECTIONS	64
+#define GRST_SLASH_POOL_BUCKETS		64
+#define GRST_SLASH_HANDLE_IDLE		60
+#define GRST_SLASH_WRITEBACK_SIZE	8388608
+#define GRST_SLASH_WRITEBACK_DELAY	2
+#define GRST_SLASH_WRITEBACK_IDLE	60
+#define GRST_SLASH_ENVIRON_CACHE	257
+#define GRST_SLASH_ENVIRON_TTL		5
+#define GRST_SLASH_ENVIRON_MAXAGE	30
+#define GRST_SLASH_ACLNAME_CACHE	4096
+#define GRST_SLASH_DN_CACHE		257
+#define GRST_SLASH_DN_TTL		60
+#define GRST_SLASH_PERM_CACHE		4099
+#define GRST_SLASH_MEMCACHE_SIZE	67108864
+#define GRST_SLASH_MEMCACHE_BUCKETS	4099
+#define GRST_SLASH_DEFAULT_READAHEAD	4
+#define GRST_SLASH_MAX_READAHEAD	64
+#define GRST_SLASH_MAX_STREAMS		64
+#define GRST_SLASH_ATTR_TIMEOUT		60
+#define GRST_SLASH_ATTRCACHE_SIZE	65536
+#define GRST_SLASH_ATTRCACHE_BUCKETS	4099
 
 #define GRST_SLASH_MAX_LOCATION		1024
+#define GRST_SLASH_MAX_ETAG		255
+
+/* how long unused headers and blocks are kept for revalidation */
+#define GRST_SLASH_CACHE_KEEP		86400
+#define GRST_SLASH_SPOOL_SIZE		1073741824
+#define GRST_SLASH_SPOOL_BUCKETS	4099
+#define GRST_SLASH_EVICT_INTERVAL	5
+#define GRST_SLASH_DROPPED_AGE		10
 
 /* maximum number of SiteCast groups */
 #define GRST_SLASH_MAX_GROUPS		10
@@ -121,6 +153,10 @@ struct grst_request { int     retcode;
                       int     length_set;
                       time_t  modified;                           
                       int     modified_set; 
+                      char    etag[GRST_SLASH_MAX_ETAG+1];
+                      int     etag_set;
+                      char   *if_none_match;
+                      time_t  if_modified_since;
                       void   *readfunction;
                       void   *readdata;
                       void   *writefunction;
@@ -133,112 +169,628 @@ struct grst_request { int     retcode;
                       off_t   start;
                       off_t   finish; } ;
 
-struct grst_handle { pthread_mutex_t	mutex;
-                     CURL		*curl_handle;
-                     uid_t		uid;
-                     char		*proxyfile;
-                     char 		*capath;
-                     time_t		last_used;
-                   }  handles[GRST_SLASH_MAX_HANDLES];
-
-pthread_mutex_t cache_mutex;
+struct grst_handle { struct grst_handle   *next;
+                     struct grst_identity *identity;
+                     CURL                 *curl_handle;
+                     int                   id;
+                     time_t                last_used; } ;
+
+struct grst_identity { struct grst_identity *next;
+                       uid_t                 uid;
+                       char                 *proxyfile;
+                       char                 *capath;
+                       CURLSH               *share;
+                       pthread_mutex_t       share_mutex;
+                       struct grst_handle   *idle;
+                       int                   in_use;
+                       time_t                last_used;
+                     } *identities[GRST_SLASH_POOL_BUCKETS];
+
+struct grst_memblock { struct grst_memblock *hash_next;
+                       struct grst_memblock *lru_prev;
+                       struct grst_memblock *lru_next;
+                       unsigned int          bucket;
+                       uid_t                 uid;
+                       char                 *path;
+                       off_t                 start;
+                       off_t                 blocksize;
+                       char                 *data;
+                       size_t                length;
+                       time_t                fetched; } ;
+
+struct grst_memblock *memcache_table[GRST_SLASH_MEMCACHE_BUCKETS],
+                     *memcache_lru_head = NULL, *memcache_lru_tail = NULL;
+
+struct grst_prefetch { struct grst_prefetch  *next;
+                       struct grst_handle    *handle;
+                       struct curl_slist     *headers_list;
+                       uid_t                  uid;
+                       char                  *path;
+                       char                  *url;
+                       off_t                  start;
+                       off_t                  blocksize;
+                       struct grst_body_text  body;
+                       struct grst_request    request_data;
+                       char                   errorbuffer[CURL_ERROR_SIZE+1];
+                     } *prefetch_queue = NULL, *prefetch_active = NULL;
+
+struct grst_stream { uid_t   uid;
+                     pid_t   pid;
+                     char   *path;
+                     off_t   next_offset;
+                     time_t  last_used;
+                   } streams[GRST_SLASH_MAX_STREAMS];
+
+struct grst_writeback { struct grst_writeback *next;
+                        struct fuse_context    fuse_ctx;
+                        char                  *path;
+                        char                  *data;
+                        size_t                 used;
+                        size_t                 allocated;
+                        off_t                  start;
+                        time_t                 first_write;
+                        time_t                 last_used;
+                        int                    flushing;
+                        int                    waiters;
+                        int                    error;
+                      } *writebacks = NULL;
+
+struct grst_environ { pid_t               pid;
+                      uid_t               uid;
+                      unsigned long long  starttime;
+                      dev_t               exedev;
+                      ino_t               exeino;
+                      time_t              checked;
+                      time_t              loaded;
+                      char               *proxyfile;
+                      char               *capath;
+                      off_t               blocksize;
+                      int                 readahead;
+                    } environs[GRST_SLASH_ENVIRON_CACHE];
+
+struct grst_attr { struct grst_attr *next;
+                   uid_t             uid;
+                   char             *path;
+                   off_t             length;
+                   time_t            modified;
+                   int               isdir;
+                   int               exists;
+                   time_t            listed;
+                   time_t            expires;
+                 } *attrcache_table[GRST_SLASH_ATTRCACHE_BUCKETS];
+
+struct grst_dn { int     used;
+                 uid_t   uid;
+                 char   *dn;
+                 char   *username;
+                 char   *linkpath;
+                 ino_t   inode;
+                 time_t  checked;
+               } dns[GRST_SLASH_DN_CACHE];
+
+struct grst_perm { int              used;
+                   uid_t            uid;
+                   char            *aclpath;
+                   char            *dn;
+                   ino_t            ino;
+                   off_t            size;
+                   struct timespec  mtime;
+                   GRSTgaclPerm     perm;
+                 } perms[GRST_SLASH_PERM_CACHE];
+
+struct grst_spool { struct grst_spool *hash_next;
+                    struct grst_spool *lru_prev;
+                    struct grst_spool *lru_next;
+                    unsigned int       bucket;
+                    char              *key;
+                    off_t              headers_bytes;
+                    off_t              blocks_bytes;
+                    time_t             last_used;
+                  } *spool_table[GRST_SLASH_SPOOL_BUCKETS],
+                    *spool_lru_head = NULL, *spool_lru_tail = NULL;
+
+pthread_mutex_t memcache_mutex, prefetch_mutex, pool_mutex, spool_mutex,
+                writeback_mutex, environ_mutex, attr_mutex, dn_mutex,
+                perm_mutex;
+pthread_cond_t  prefetch_cond, prefetch_done, pool_cond, writeback_cond;
  
 int debugmode         = 0;
+int disk_cache        = 1;
+size_t memcache_size  = GRST_SLASH_MEMCACHE_SIZE, memcache_used = 0,
+       writeback_size = GRST_SLASH_WRITEBACK_SIZE;
 int number_of_tries   = 1, sitecast_domain_len = 0;
 char *sitecast_domain = NULL, *sitecast_groups = NULL, *local_root = NULL,
      *gridmapdir = NULL;
 off_t default_blocksize = GRST_SLASH_DEFAULT_BLOCKSIZE;
+int default_readahead   = GRST_SLASH_DEFAULT_READAHEAD;
+int max_connections     = GRST_SLASH_DEFAULT_CONNECTIONS, handle_ids = 0;
+int attr_timeout        = GRST_SLASH_ATTR_TIMEOUT, attrcache_count = 0;
+off_t spool_size        = GRST_SLASH_SPOOL_SIZE, spool_used = 0;
+int spool_count         = 0;
 uid_t local_uid = 0;
 gid_t local_gid = 0;
 
-int cleanup_recurse(char *currentdirname)
+static int writeback_flush_path(struct fuse_context *fuse_ctx, char *path,
+                                int take_error);
+void drop_cache_blocks(struct fuse_context *fuse_ctx, char *filename);
+
+static unsigned int spool_hash(const char *key)
+{
+  unsigned int h = 5381;
+  
+  while (*key != '\0') h = h * 33 + (unsigned char) *(key++);
+
+  return h % GRST_SLASH_SPOOL_BUCKETS;
+}
+
+static char *spool_key(char *filename, int *isblock)
+/*
+   Returns the malloc()ed index key of a file in the spool, which is the
+   uid and encoded path shared by a headers file and its blocks directory,
+   or NULL if this is not in the headers or blocks trees.
+*/
+{
+  size_t n;
+  char  *p;
+
+  n = strlen(GRST_SLASH_BLOCKS);
+
+  if (strncmp(filename, GRST_SLASH_BLOCKS "/", n + 1) == 0)
+    {
+      p = rindex(filename, '/');
+      if (p <= &filename[n]) return NULL;
+      
+      *isblock = 1;
+      return strndup(&filename[n + 1], p - &filename[n + 1]);
+    }
+
+  n = strlen(GRST_SLASH_HEADERS);
+
+  if (strncmp(filename, GRST_SLASH_HEADERS "/", n + 1) == 0)
+    {
+      *isblock = 0;
+      return strdup(&filename[n + 1]);
+    }
+
+  return NULL;
+}
+
+static struct grst_spool *spool_find(const char *key)
+/*
+   Caller must hold spool_mutex.
+*/
+{
+  struct grst_spool *e;
+
+  for (e = spool_table[spool_hash(key)]; e != NULL; e = e->hash_next)
+     if (strcmp(e->key, key) == 0) return e;
+
+  return NULL;
+}
+
+static void spool_lru_unlink(struct grst_spool *e)
+/*
+   Caller must hold spool_mutex.
+*/
+{
+  if (e->lru_prev != NULL) e->lru_prev->lru_next = e->lru_next;
+  else spool_lru_head = e->lru_next;
+
+  if (e->lru_next != NULL) e->lru_next->lru_prev = e->lru_prev;
+  else spool_lru_tail = e->lru_prev;
+}
+
+static void spool_lru_push(struct grst_spool *e)
+/*
+   Put e at the most recently used end. Caller must hold spool_mutex.
+*/
+{
+  e->lru_prev = NULL;
+  e->lru_next = spool_lru_head;
+
+  if (spool_lru_head != NULL) spool_lru_head->lru_prev = e;
+  else spool_lru_tail = e;
+  
+  spool_lru_head = e;
+}
+
+static char *spool_unlink(struct grst_spool *e)
+/*
+   Remove e from the index and free it, returning its key for the caller
+   to free. Caller must hold spool_mutex.
+*/
+{
+  char               *key;
+  struct grst_spool **pp;
+  
+  for (pp = &spool_table[e->bucket]; *pp != NULL; pp = &((*pp)->hash_next))
+     if (*pp == e)
+       {
+         *pp = e->hash_next;
+         break;
+       }
+
+  spool_lru_unlink(e);
+
+  spool_used -= e->headers_bytes + e->blocks_bytes;
+  --spool_count;
+
+  key = e->key;
+  free(e);
+
+  return key;
+}
+
+static void spool_add_locked(const char *key, int isblock, off_t bytes, 
+                             time_t when)
+/*
+   Record that a headers file (replacing any before) or a block of bytes
+   has been added under key, and when it was last used. Caller holds
+   spool_mutex.
+*/
+{
+  struct grst_spool *e;
+
+  if ((e = spool_find(key)) == NULL)
+    {
+      if ((e = calloc(1, sizeof(struct grst_spool))) == NULL) return;
+      
+      e->key       = strdup(key);
+      e->bucket    = spool_hash(key);
+      e->hash_next = spool_table[e->bucket];
+      spool_table[e->bucket] = e;
+      ++spool_count;
+    }
+  else spool_lru_unlink(e);
+  
+  if (isblock) e->blocks_bytes += bytes;
+  else 
+    {
+      spool_used -= e->headers_bytes;
+      e->headers_bytes = bytes;
+    }
+  
+  spool_used += bytes;
+  
+  if (when > e->last_used) e->last_used = when;
+  spool_lru_push(e);
+}
+
+static void spool_add(const char *key, int isblock, off_t bytes, time_t when)
+{
+  pthread_mutex_lock(&spool_mutex);
+  spool_add_locked(key, isblock, bytes, when);
+  pthread_mutex_unlock(&spool_mutex);
+}
+
+static void spool_account(char *filename, off_t bytes)
+/*
+   Add a headers file or block which has just been put in the spool
+*/
+{
+  int   isblock;
+  char *key;
+  
+  if ((key = spool_key(filename, &isblock)) == NULL) return;
+  
+  spool_add(key, isblock, bytes, time(NULL));
+  free(key);
+}
+
+static int spool_rename(char *tempfile, char *filename, off_t bytes)
+/*
+   Move a new block from tempfile to filename in the spool and account for
+   it, less the size of any copy of the same block which it replaces (eg
+   fetched at the same time by a reader and by read-ahead.) The stat() and
+   rename() are done holding spool_mutex, so concurrent copies are only
+   counted once. Returns 0 or -1 as rename() does.
+*/
+{
+  int          isblock, ret;
+  char        *key;
+  struct stat  statbuf;
+  
+  if ((key = spool_key(filename, &isblock)) == NULL) 
+                                           return rename(tempfile, filename);
+
+  pthread_mutex_lock(&spool_mutex);
+
+  if (isblock && (stat(filename, &statbuf) == 0)) bytes -= statbuf.st_size;
+
+  if ((ret = rename(tempfile, filename)) == 0)
+                          spool_add_locked(key, isblock, bytes, time(NULL));
+
+  pthread_mutex_unlock(&spool_mutex);
+
+  free(key);
+  return ret;
+}
+
+static void spool_touch(char *filename)
+/*
+   Note that a headers file or block in the spool has just been used
+*/
+{
+  int                isblock;
+  char              *key;
+  struct grst_spool *e;
+  
+  if ((key = spool_key(filename, &isblock)) == NULL) return;
+
+  pthread_mutex_lock(&spool_mutex);
+
+  if ((e = spool_find(key)) != NULL)
+    {
+      time(&(e->last_used));
+      spool_lru_unlink(e);
+      spool_lru_push(e);
+    }
+
+  pthread_mutex_unlock(&spool_mutex);
+
+  free(key);
+}
+
+static void spool_forget(const char *key)
+/*
+   Called when the headers and blocks under key have been dropped
+*/
+{
+  struct grst_spool *e;
+
+  pthread_mutex_lock(&spool_mutex);
+  if ((e = spool_find(key)) != NULL) free(spool_unlink(e));
+  pthread_mutex_unlock(&spool_mutex);
+}
+
+static void spool_prune(char *filename, size_t toplen)
+/*
+   rmdir() the directories above filename until one is not empty or we
+   reach the top of its tree, which is toplen chars long. Modifies filename.
+*/
+{
+  char *p;
+  
+  while (((p = rindex(filename, '/')) != NULL) && (p > &filename[toplen]))
+       {
+         *p = '\0';
+         if (rmdir(filename) != 0) break;
+       }
+}
+
+static void spool_remove(char *key)
 /*
-    returns number of files/dirs LEFT in this directory after scan. ie 0=empty
+   Delete the headers file and blocks stored on disk under key
 */
 {
-  int            num_left_here = 0;
+  char          *s, *blockname;
+  DIR           *blocksDIR;
+  struct dirent *ent;
+
+  asprintf(&s, "%s/%s", GRST_SLASH_HEADERS, key);
+  if (unlink(s) == 0) spool_prune(s, strlen(GRST_SLASH_HEADERS));
+  free(s);
+
+  asprintf(&s, "%s/%s", GRST_SLASH_BLOCKS, key);
+
+  if ((blocksDIR = opendir(s)) != NULL)
+    {
+      while ((ent = readdir(blocksDIR)) != NULL)
+           {
+             if (ent->d_name[0] == '.') continue;
+
+             /* subdirectories are blocks of other files, so unlink fails */
+             asprintf(&blockname, "%s/%s", s, ent->d_name);
+             unlink(blockname);
+             free(blockname);
+           }
+
+      closedir(blocksDIR);
+
+      if (rmdir(s) == 0) spool_prune(s, strlen(GRST_SLASH_BLOCKS));
+    }
+
+  free(s);
+}
+
+static void remove_tree(char *dirname)
+{
   char          *s;
   DIR           *currentDIR;
   struct stat    ent_stat;
   struct dirent *ent;
+
+  if ((currentDIR = opendir(dirname)) == NULL) return;
+
+  while ((ent = readdir(currentDIR)) != NULL)
+       {
+         if ((strcmp(ent->d_name, "." ) == 0) ||
+             (strcmp(ent->d_name, "..") == 0)) continue;
+          
+         if (asprintf(&s, "%s/%s", dirname, ent->d_name) == -1) continue;
+
+         if ((lstat(s, &ent_stat) == 0) && S_ISDIR(ent_stat.st_mode))
+              remove_tree(s);
+         else unlink(s);
+
+         free(s);
+       }
+
+  closedir(currentDIR);
+  rmdir(dirname);
+}
+
+static void spool_purge_tmp(void)
+/*
+   Remove temporary files left behind by failed or interrupted requests,
+   and the directories of blocks moved here by drop_cache_blocks().
+*/
+{
+  char          *s;
+  DIR           *tmpDIR;
+  struct stat    ent_stat;
+  struct dirent *ent;
   time_t         now;
-  
+
+  if ((tmpDIR = opendir(GRST_SLASH_TMP)) == NULL) return;
+
   time(&now);
-  
-  if ((currentDIR = opendir(currentdirname)) == NULL)
-    {
-      return 0; /* some error - maybe its empty anyway? */
-    }
-    
+
+  while ((ent = readdir(tmpDIR)) != NULL)
+       {
+         if ((strcmp(ent->d_name, "." ) == 0) ||
+             (strcmp(ent->d_name, "..") == 0)) continue;
+          
+         if (asprintf(&s, "%s/%s", GRST_SLASH_TMP, ent->d_name) == -1) 
+                                                                   continue;
+
+         if (lstat(s, &ent_stat) == 0)
+           {
+             /* a new dropped-XXXXXX may still be waiting for its rename() */
+           
+             if (S_ISDIR(ent_stat.st_mode))
+               {
+                 if (ent_stat.st_ctime < now - GRST_SLASH_DROPPED_AGE)
+                                                            remove_tree(s);
+               }
+             else if (ent_stat.st_mtime < now - GRST_SLASH_CACHE_EXPIRE)
+                                                            unlink(s);
+           }
+
+         free(s);
+       }
+
+  closedir(tmpDIR);
+}
+
+static void spool_scan(char *dirname, size_t toplen, int isblocks)
+/*
+   Add what is already in the spool to the index when we start. This is
+   the only time the whole tree is read.
+*/
+{
+  char          *s;
+  DIR           *currentDIR;
+  struct stat    ent_stat;
+  struct dirent *ent;
+
+  if ((currentDIR = opendir(dirname)) == NULL) return;
+
   while ((ent = readdir(currentDIR)) != NULL)
-    {
-      if ((strcmp(ent->d_name, "." ) == 0) ||
-          (strcmp(ent->d_name, "..") == 0)) continue;
+       {
+         if ((strcmp(ent->d_name, "." ) == 0) ||
+             (strcmp(ent->d_name, "..") == 0)) continue;
           
-      if (asprintf(&s, "%s/%s", currentdirname, ent->d_name) == -1) continue;
-    
-      if (debugmode) syslog(LOG_DEBUG, "cleanup_thread() stat(%s)", s);
+         if (asprintf(&s, "%s/%s", dirname, ent->d_name) == -1) continue;
 
-      pthread_mutex_lock(&cache_mutex);
-      if (stat(s, &ent_stat) == 0) /* ignore if gone already! */
-        {
-          if (S_ISDIR(ent_stat.st_mode))
-            {
-              pthread_mutex_unlock(&cache_mutex); /* unlock during recurse */
-            
-              if (cleanup_recurse(s) == 0) /* directory is now empty */
-                {
-                  pthread_mutex_lock(&cache_mutex); /* lock for stat/rmdir */
-                
-                  if ((stat(s, &ent_stat) == 0)   &&
-                      (S_ISDIR(ent_stat.st_mode)) &&
-                      (ent_stat.st_mtime < now - GRST_SLASH_CACHE_EXPIRE))
-                       rmdir(s);
-                  else ++num_left_here;
-                  
-                  pthread_mutex_unlock(&cache_mutex);
+         if (lstat(s, &ent_stat) == 0)
+           {
+             if (S_ISDIR(ent_stat.st_mode)) spool_scan(s, toplen, isblocks);
+             else if (S_ISREG(ent_stat.st_mode) && (strlen(dirname) > toplen))
+               spool_add(isblocks ? &dirname[toplen + 1] : &s[toplen + 1],
+                         isblocks, ent_stat.st_size, ent_stat.st_mtime);
+           }
 
-                  if (debugmode) syslog(LOG_DEBUG, "cleanup_thread() rmdir(%s)", s);
-                }
-              else ++num_left_here;
-            }
-          else /* not a directory - treat as regular file */
-            {
-              if (ent_stat.st_mtime < now - GRST_SLASH_CACHE_EXPIRE)
-                {
-                  if (debugmode) syslog(LOG_DEBUG, "cleanup_thread() unlink(%s)", s);
-                  unlink(s);
-                }
-              else ++num_left_here;
-              
-              pthread_mutex_unlock(&cache_mutex);
-            }
-        }
-      else pthread_mutex_unlock(&cache_mutex);
+         free(s);
+       }
 
-      free(s);
+  closedir(currentDIR);
+}
+
+static int spool_cmp(const void *a, const void *b)
+{
+  time_t ta = (*((struct grst_spool **) a))->last_used,
+         tb = (*((struct grst_spool **) b))->last_used;
+
+  return (ta > tb) ? -1 : ((ta < tb) ? 1 : 0);
+}
+
+static void spool_sort(void)
+/*
+   Put the LRU list in order after scanning, since the scan finds files 
+   in directory order rather than by age.
+*/
+{
+  int                 i, n = 0;
+  struct grst_spool  *e, **all;
+
+  pthread_mutex_lock(&spool_mutex);
+
+  if ((spool_count > 0) &&
+      ((all = malloc(spool_count * sizeof(struct grst_spool *))) != NULL))
+    {
+      for (e = spool_lru_head; (e != NULL) && (n < spool_count); e = e->lru_next)
+                                                              all[n++] = e;
+
+      qsort(all, n, sizeof(struct grst_spool *), spool_cmp);
+
+      spool_lru_head = NULL;
+      spool_lru_tail = NULL;
+
+      for (i=n-1; i >= 0; --i) spool_lru_push(all[i]);
+
+      free(all);
     }
     
-  closedir(currentDIR);
-  
-  return num_left_here;
+  pthread_mutex_unlock(&spool_mutex);
 }
 
-void *cleanup_thread(void *unused)
+void *evict_thread(void *unused)
+/*
+   Keep the spool within spool_size bytes by deleting least recently
+   used files first, down to 90% once it is exceeded. Files unused for
+   GRST_SLASH_CACHE_KEEP seconds are deleted too. spool_mutex is only
+   held while choosing what to delete and never during disk operations.
+*/
 {
+  char              *key;
+  off_t              target;
+  time_t             now;
+  struct grst_spool *e;
+
+  spool_purge_tmp();
+  spool_scan(GRST_SLASH_HEADERS, strlen(GRST_SLASH_HEADERS), 0);
+  spool_scan(GRST_SLASH_BLOCKS,  strlen(GRST_SLASH_BLOCKS),  1);
+  spool_sort();
+
+  if (debugmode) syslog(LOG_DEBUG, "spool holds %ld bytes in %d files", 
+                                   (long) spool_used, spool_count);
+
   while (1)
    {
-     cleanup_recurse(GRST_SLASH_HEADERS);
-     cleanup_recurse(GRST_SLASH_BLOCKS);
-     cleanup_recurse(GRST_SLASH_TMP);
- 
-     sleep(GRST_SLASH_CACHE_EXPIRE / 2);
+     time(&now);
+
+     pthread_mutex_lock(&spool_mutex);
+
+     if ((spool_size > 0) && (spool_used > spool_size))
+          target = spool_size - spool_size / 10;
+     else target = spool_size;
+
+     while (((e = spool_lru_tail) != NULL) &&
+            (((target > 0) && (spool_used > target)) ||
+             (e->last_used < now - GRST_SLASH_CACHE_KEEP)))
+          {
+            key = spool_unlink(e);
+            pthread_mutex_unlock(&spool_mutex);
+
+            if (debugmode) syslog(LOG_DEBUG, "evicting %s from spool", key);
+            spool_remove(key);
+            free(key);
+
+            pthread_mutex_lock(&spool_mutex);
+          }
+
+     pthread_mutex_unlock(&spool_mutex);
+
+     spool_purge_tmp();
+
+     sleep(GRST_SLASH_EVICT_INTERVAL);
    }   
 }
 
 size_t headers_callback(void *ptr, size_t size, size_t nmemb, void *p)
-/* Find the values of the return code, Content-Length, Last-Modified
-   and Location headers */
+/* Find the values of the return code, Content-Length, Last-Modified,
+   ETag and Location headers */
 {
   float f;
   char  *s, *q;
@@ -262,6 +814,19 @@ size_t headers_callback(void *ptr, size_t size, size_t nmemb, void *p)
         for (q=request_data->location; *q != '\0'; ++q)
          if ((*q == '\r') || (*q == '\n')) *q = '\0';
       }
+  else if (strncasecmp(s, "ETag: ", 6) == 0)
+      {
+        /* stored in the headers cache files, so no whitespace allowed */
+        for (q=&s[6]; (*q != '\0') && !isspace(*q); ++q) ;
+        
+        if ((q > &s[6]) && (q - &s[6] <= GRST_SLASH_MAX_ETAG) &&
+            ((*q == '\r') || (*q == '\n') || (*q == '\0')))
+          {
+            memcpy(request_data->etag, &s[6], q - &s[6]);
+            request_data->etag[q - &s[6]] = '\0';
+            request_data->etag_set = 1;
+          }
+      }
   else if (strncmp(s, "Last-Modified: ", 15) == 0)
       {
         /* follow RFC 2616: first try RFC 822 (kosher), then RFC 850 and 
@@ -465,28 +1030,135 @@ int translate_sitecast_url(char **sitecast_url, char *raw_url)
   return GRST_RET_FAILED;
 }
 
-static void check_user_environ(char **capath, char **proxyfile, 
-                               off_t *blocksize, pid_t pid)
+static unsigned long long process_starttime(pid_t pid)
+/*
+   Returns the start time of the process in clock ticks since boot, 
+   from field 22 of /proc/PID/stat, or 0 on failure. Together with the
+   pid, this identifies one process even if pids are reused.
+*/
 {
-  int fd;
-  size_t allocated = 1024, ret = 0, count = 0;
-  char file[80], *pid_environ, *p;
-  struct stat statbuf;
+  int   fd;
+  ssize_t n;
+  char  file[80], buf[1024], *p;
+  unsigned long long starttime = 0;
   
-  if (proxyfile != NULL) *proxyfile = NULL;
-  if (capath    != NULL) *capath    = NULL;
-  if (blocksize != NULL) *blocksize = default_blocksize;
+  snprintf(file, sizeof(file), "/proc/%d/stat", (int) pid);
   
-  snprintf(file, sizeof(file), "/proc/%d/environ", (int) pid);
+  if ((fd = open(file, O_RDONLY)) == -1) return 0;
   
-  if ((fd = open(file, O_RDONLY)) == -1) return;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
 
-  if (debugmode) 
-        syslog(LOG_DEBUG, "Opened for %d environ in %s", (int) pid, file);
+  if (n <= 0) return 0;
+  buf[n] = '\0';
+
+  /* the command name in brackets may itself contain spaces or brackets */
+  if ((p = rindex(buf, ')')) == NULL) return 0;
   
-  pid_environ = malloc(allocated + 1); /* always space for terminal NUL */
+  if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u "
+                    "%*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+             &starttime) != 1) return 0;
 
-  while ((ret = read(fd, &pid_environ[count], allocated - count)) > 0)
+  return starttime;
+}
+
+static void environ_copy_out(struct grst_environ *e,
+                             char **capath, char **proxyfile, 
+                             off_t *blocksize, int *readahead)
+{
+  if (proxyfile != NULL) 
+       *proxyfile = (e->proxyfile != NULL) ? strdup(e->proxyfile) : NULL;
+  if (capath    != NULL) 
+       *capath    = (e->capath    != NULL) ? strdup(e->capath)    : NULL;
+  if (blocksize != NULL) *blocksize = e->blocksize;
+  if (readahead != NULL) *readahead = e->readahead;
+}
+
+static void check_user_environ(char **capath, char **proxyfile, 
+                               off_t *blocksize, int *readahead, 
+                               pid_t pid, uid_t uid)
+/*
+   Find the settings slashgrid takes from the environment of the calling
+   process. The parsed result is cached per (pid, uid): within 
+   GRST_SLASH_ENVIRON_TTL seconds it is used without any syscalls, and 
+   after that it is kept if the process start time shows the pid still 
+   belongs to the same process and /proc/PID/exe shows it has not exec()ed
+   another program. exec() of the same program is caught by reading
+   /proc/PID/environ again every GRST_SLASH_ENVIRON_MAXAGE seconds.
+*/
+{
+  int fd;
+  ssize_t ret = 0;
+  size_t allocated = 1024, count = 0;
+  char file[80], *pid_environ, *p;
+  struct stat statbuf, exestat;
+  struct grst_environ *e, parsed;
+  time_t now;
+  unsigned long long starttime;
+  
+  e = &environs[((unsigned int) pid) % GRST_SLASH_ENVIRON_CACHE];
+  time(&now);
+
+  pthread_mutex_lock(&environ_mutex);
+  
+  if ((e->pid == pid) && (e->uid == uid) && 
+      (e->checked >= now - GRST_SLASH_ENVIRON_TTL))
+    {
+      environ_copy_out(e, capath, proxyfile, blocksize, readahead);
+      pthread_mutex_unlock(&environ_mutex);
+      return;
+    }
+
+  pthread_mutex_unlock(&environ_mutex);
+  
+  starttime = process_starttime(pid);
+
+  snprintf(file, sizeof(file), "/proc/%d/exe", (int) pid);
+  if (stat(file, &exestat) != 0) memset(&exestat, 0, sizeof(exestat));
+
+  pthread_mutex_lock(&environ_mutex);
+  
+  if ((starttime != 0) && 
+      (e->pid == pid) && (e->uid == uid) && (e->starttime == starttime) &&
+      (e->exedev == exestat.st_dev) && (e->exeino == exestat.st_ino) &&
+      (e->loaded >= now - GRST_SLASH_ENVIRON_MAXAGE))
+    {
+      e->checked = now;
+      environ_copy_out(e, capath, proxyfile, blocksize, readahead);
+      pthread_mutex_unlock(&environ_mutex);
+      return;
+    }
+
+  pthread_mutex_unlock(&environ_mutex);
+
+  /* not cached, so read and parse /proc/PID/environ */
+
+  parsed.pid       = pid;
+  parsed.uid       = uid;
+  parsed.starttime = starttime;
+  parsed.exedev    = exestat.st_dev;
+  parsed.exeino    = exestat.st_ino;
+  parsed.checked   = now;
+  parsed.loaded    = now;
+  parsed.proxyfile = NULL;
+  parsed.capath    = NULL;
+  parsed.blocksize = default_blocksize;
+  parsed.readahead = default_readahead;
+
+  snprintf(file, sizeof(file), "/proc/%d/environ", (int) pid);
+  
+  if ((fd = open(file, O_RDONLY)) == -1) 
+    {
+      environ_copy_out(&parsed, capath, proxyfile, blocksize, readahead);
+      return;
+    }
+
+  if (debugmode) 
+        syslog(LOG_DEBUG, "Opened for %d environ in %s", (int) pid, file);
+  
+  pid_environ = malloc(allocated + 1); /* always space for terminal NUL */
+
+  while ((ret = read(fd, &pid_environ[count], allocated - count)) > 0)
        {
          count += ret;
          
@@ -503,6 +1175,7 @@ static void check_user_environ(char **capath, char **proxyfile,
     {
       free(pid_environ);
       syslog(LOG_ERR, "File error reading %s for %d", file, (int) pid);
+      environ_copy_out(&parsed, capath, proxyfile, blocksize, readahead);
       return;
     }
     
@@ -512,44 +1185,79 @@ static void check_user_environ(char **capath, char **proxyfile,
      {
        if (debugmode) syslog(LOG_DEBUG, "Examine %s in environ", p);
   
-       if ((proxyfile != NULL) &&
-           (strncmp(p, "X509_USER_PROXY=", 16) == 0))
+       if (strncmp(p, "X509_USER_PROXY=", 16) == 0)
          {
            if ((p[16] != '\0') && (stat(&p[16], &statbuf) == 0))
              {
-               if (*proxyfile != NULL) free(*proxyfile);
-               *proxyfile = strdup(&p[16]);
+               if (parsed.proxyfile != NULL) free(parsed.proxyfile);
+               parsed.proxyfile = strdup(&p[16]);
                if (debugmode) syslog(LOG_DEBUG, "Found proxyfile");
              }
          }
-       else if ((capath != NULL) &&
-                (strncmp(p, "X509_CERT_DIR=", 14) == 0))
+       else if (strncmp(p, "X509_CERT_DIR=", 14) == 0)
          {
            if ((p[14] != '\0') && (stat(&p[14], &statbuf) == 0))
              {
-               if (*capath != NULL) free(*capath);
-               *capath = strdup(&p[14]);
+               if (parsed.capath != NULL) free(parsed.capath);
+               parsed.capath = strdup(&p[14]);
                if (debugmode) syslog(LOG_DEBUG, "Found capath");
              }
          }
-       else if ((blocksize != NULL) &&
-                (strncmp(p, "SLASHGRID_BLOCKSIZE=", 20) == 0))
+       else if (strncmp(p, "SLASHGRID_BLOCKSIZE=", 20) == 0)
+         {
+           if (p[20] != '\0') 
+             {
+               parsed.blocksize = (off_t) atol(&p[20]);
+
+               if (parsed.blocksize > GRST_SLASH_MAX_BLOCKSIZE)
+                                 parsed.blocksize = GRST_SLASH_MAX_BLOCKSIZE;
+               else if (parsed.blocksize <= 0) 
+                                 parsed.blocksize = default_blocksize;
+             }
+         }
+       else if (strncmp(p, "SLASHGRID_READAHEAD=", 20) == 0)
          {
            if (p[20] != '\0') 
              {
-               *blocksize = (off_t) atol(&p[20]);
+               parsed.readahead = atoi(&p[20]);
 
-               if (*blocksize > GRST_SLASH_MAX_BLOCKSIZE)
-                                     *blocksize = GRST_SLASH_MAX_BLOCKSIZE;
-               else if (*blocksize <= 0) *blocksize = default_blocksize;
+               if (parsed.readahead > GRST_SLASH_MAX_READAHEAD)
+                                 parsed.readahead = GRST_SLASH_MAX_READAHEAD;
+               else if (parsed.readahead < 0) parsed.readahead = 0;
              }
          }
      }
   
   free(pid_environ);
+
+  environ_copy_out(&parsed, capath, proxyfile, blocksize, readahead);
+
+  /* only cache if we will be able to check it is the same process later */
+  
+  if (starttime == 0)
+    {
+      if (parsed.proxyfile != NULL) free(parsed.proxyfile);
+      if (parsed.capath    != NULL) free(parsed.capath);
+      return;
+    }
+
+  pthread_mutex_lock(&environ_mutex);
+
+  if (e->proxyfile != NULL) free(e->proxyfile);
+  if (e->capath    != NULL) free(e->capath);
+  memcpy(e, &parsed, sizeof(struct grst_environ));
+
+  pthread_mutex_unlock(&environ_mutex);
 }
 
-char *mapdir_uid_to_dn(uid_t uid)
+static char *mapdir_scan(uid_t uid, char **username, ino_t *inode,
+                         char **linkpath)
+/*
+   Find the DN of a pool account by looking through the whole gridmapdir
+   for the other hard link to the account's file. On success, the
+   malloc()ed account name and DN link path, and the inode they share,
+   are returned too.
+*/
 {
      int            ret;
      char           *firstlinkpath, *otherlinkpath, *dn, *buf = NULL;
@@ -600,7 +1308,10 @@ char *mapdir_uid_to_dn(uid_t uid)
                                             mapdirentry->d_name);
 
                       utime(otherlinkpath, (struct utimbuf *) NULL);
-                      free(otherlinkpath);
+                      
+                      *username = strdup(pw.pw_name);
+                      *inode    = firstinode;
+                      *linkpath = otherlinkpath;
                       
                       dn = GRSThttpUrlDecode(mapdirentry->d_name);
             
@@ -620,193 +1331,464 @@ char *mapdir_uid_to_dn(uid_t uid)
      return NULL;
 }
 
-
-int perform_request(struct grst_request *request_data,
-                    struct fuse_context *fuse_ctx)
+char *mapdir_uid_to_dn(uid_t uid)
+/*
+   Returns the malloc()ed DN mapped to uid in the gridmapdir, or NULL.
+   Results are cached and only rechecked after GRST_SLASH_DN_TTL seconds, 
+   by one stat() of the DN's link unless the mapping has changed. The 
+   account's own file keeps its inode when a pool account is released and
+   leased to another DN, so only the DN's link shows the lease is current.
+*/
 {
-  int                ret, i, j, itry, ishttps = 0;
-  char              *proxyfile = NULL, *capath = NULL, *range_header = NULL,
-                    *url;
-  struct stat        statbuf;
-  struct curl_slist *headers_list = NULL;
+  int            ret;
+  char          *dn = NULL, *username = NULL, *linkpath = NULL;
+  ino_t          inode = 0;
+  time_t         now;
+  struct stat    statbuf;
+  struct grst_dn *e;
 
-  if (strncmp(request_data->url, "https://", 8) == 0) /* HTTPS options */
-    {
-      ishttps = 1;
+  if (gridmapdir == NULL) return NULL;
+
+  e = &dns[uid % GRST_SLASH_DN_CACHE];
+  time(&now);
 
-      check_user_environ(&capath, &proxyfile, NULL, fuse_ctx->pid);
+  pthread_mutex_lock(&dn_mutex);
 
-      if (proxyfile == NULL)
+  if (e->used && (e->uid == uid))
+    {
+      if (e->checked < now - GRST_SLASH_DN_TTL)
         {
-          asprintf(&proxyfile, "/tmp/x509up_u%d", fuse_ctx->uid);
-          /* if proxyfile is used, it will be referenced by handles[].proxyfile
-             and freed when this handle is eventually freed */
+          ret = -1;
+        
+          if ((e->dn != NULL) && (e->linkpath != NULL))
+                                        ret = stat(e->linkpath, &statbuf);
 
-          if ((stat(proxyfile, &statbuf) != 0) ||
-              (statbuf.st_uid != fuse_ctx->uid))
+          if ((ret == 0) && (statbuf.st_nlink == 2) &&
+              (statbuf.st_ino == e->inode))
             {
-              free(proxyfile);
-              proxyfile = NULL;
+              /* same lease: just keep it fresh as the full scan does */
+              utime(e->linkpath, (struct utimbuf *) NULL);
+              e->checked = now;
             }
         }
-        
-      if (capath == NULL) capath = strdup("/etc/grid-security/certificates");
+
+      if (e->checked >= now - GRST_SLASH_DN_TTL)
+        {
+          if (e->dn != NULL) dn = strdup(e->dn);
+          pthread_mutex_unlock(&dn_mutex);
+          return dn;
+        }
     }
 
-  if (debugmode && (proxyfile != NULL))
-       syslog(LOG_DEBUG, "Using proxy file %s", proxyfile);
+  pthread_mutex_unlock(&dn_mutex);
 
-  /* try to find an existing handle for this uid/proxyfile */
+  dn = mapdir_scan(uid, &username, &inode, &linkpath);
 
-  for (i=0; i < GRST_SLASH_MAX_HANDLES; ++i)
-     {
-       if ((handles[i].curl_handle != NULL)  &&
-           (handles[i].uid == fuse_ctx->uid) &&
-           (((handles[i].proxyfile == NULL) && (proxyfile == NULL)) ||
-            ((handles[i].proxyfile != NULL) && (proxyfile != NULL) &&
-             (strcmp(handles[i].proxyfile, proxyfile) == 0))) &&
-           (((handles[i].capath == NULL) && (capath == NULL)) ||
-            ((handles[i].capath != NULL) && (capath != NULL) &&
-             (strcmp(handles[i].capath, capath) == 0))))
-         {
-           break;
-         }
-     }
-     
-  if (i >= GRST_SLASH_MAX_HANDLES) /* no existing match found */
+  pthread_mutex_lock(&dn_mutex);
+
+  if (e->used)
     {
-      i=0;
-    
-      for (j=0; j < GRST_SLASH_MAX_HANDLES; ++j)
-         {
-           if (handles[j].curl_handle == NULL) /* unused slot */
-             {
-               i = j;
-               break;
-             }
-             
-           if (handles[j].last_used < handles[i].last_used) i = j;
-         }
+      if (e->dn       != NULL) free(e->dn);
+      if (e->username != NULL) free(e->username);
+      if (e->linkpath != NULL) free(e->linkpath);
     }
 
-  /* now lock this handle and recheck settings inside the mutex lock */
+  /* failures are cached too, so unmapped users don't rescan every time */
 
-  pthread_mutex_lock(&(handles[i].mutex)); /* unlock just before return */
+  e->used     = 1;
+  e->uid      = uid;
+  e->dn       = (dn != NULL) ? strdup(dn) : NULL;
+  e->username = username;
+  e->linkpath = linkpath;
+  e->inode    = inode;
+  e->checked  = now;
 
-  if ((handles[i].curl_handle == NULL)  ||
-      (handles[i].uid != fuse_ctx->uid) ||
-      (((handles[i].proxyfile != NULL) || (proxyfile != NULL)) &&
-       ((handles[i].proxyfile == NULL) || (proxyfile == NULL) ||
-        (strcmp(handles[i].proxyfile, proxyfile) != 0))) ||
-      (((handles[i].capath != NULL) || (capath != NULL)) &&
-       ((handles[i].capath == NULL) || (capath == NULL) ||
-        (strcmp(handles[i].capath, capath) != 0))))
+  pthread_mutex_unlock(&dn_mutex);
+
+  return dn;
+}
+
+
+static void find_user_creds(struct fuse_context *fuse_ctx,
+                            char **capath, char **proxyfile)
+/*
+   Find the proxy file and CA path to use for HTTPS requests made on
+   behalf of this FUSE caller. Both are malloc()ed, and *proxyfile is
+   NULL if no proxy belonging to the user is available.
+*/
+{
+  struct stat statbuf;
+
+  check_user_environ(capath, proxyfile, NULL, NULL, 
+                     fuse_ctx->pid, fuse_ctx->uid);
+
+  if (*proxyfile == NULL)
     {
-      /* we do need to initialise this handle */
-      
-      handles[i].uid = fuse_ctx->uid;
+      asprintf(proxyfile, "/tmp/x509up_u%d", fuse_ctx->uid);
 
-      if (handles[i].curl_handle != NULL)
-                              curl_easy_cleanup(handles[i].curl_handle);
-      handles[i].curl_handle = curl_easy_init();
-      
-      if (handles[i].capath != NULL) free(handles[i].capath);
-      handles[i].capath = capath; /* capath might be NULL itself */
-      
-      if (handles[i].proxyfile != NULL) free(handles[i].proxyfile);
-      handles[i].proxyfile = proxyfile; /* proxyfile might be NULL itself */
-      
-      if (handles[i].proxyfile != NULL)
-        {
-          curl_easy_setopt(handles[i].curl_handle, CURLOPT_SSLCERTTYPE, "PEM");
-          curl_easy_setopt(handles[i].curl_handle, CURLOPT_SSLCERT,
-                                                    handles[i].proxyfile);
-          curl_easy_setopt(handles[i].curl_handle, CURLOPT_SSLKEYTYPE, "PEM");
-          curl_easy_setopt(handles[i].curl_handle, CURLOPT_SSLKEY,  
-                                                    handles[i].proxyfile);
-        }
-      else
+      if ((stat(*proxyfile, &statbuf) != 0) ||
+          (statbuf.st_uid != fuse_ctx->uid))
         {
-          curl_easy_setopt(handles[i].curl_handle, CURLOPT_SSLKEYTYPE,  "ENG");
-          curl_easy_setopt(handles[i].curl_handle, CURLOPT_SSLCERTTYPE, "ENG");
-          curl_easy_setopt(handles[i].curl_handle, CURLOPT_SSLCERT,     NULL);
+          free(*proxyfile);
+          *proxyfile = NULL;
         }
+    }
+        
+  if (*capath == NULL) *capath = strdup("/etc/grid-security/certificates");
+}
 
-      if (debugmode)
-        {
-          curl_easy_setopt(handles[i].curl_handle, CURLOPT_VERBOSE, 1);
-          curl_easy_setopt(handles[i].curl_handle, CURLOPT_DEBUGFUNCTION,
-                                                          debug_callback);
-        }
+static void init_curl_handle(CURL *curl_handle, char *proxyfile, char *capath)
+/*
+   Set the options which depend only on the user's credentials. proxyfile
+   and capath must stay valid for as long as curl_handle is used.
+*/
+{
+  if (proxyfile != NULL)
+    {
+      curl_easy_setopt(curl_handle, CURLOPT_SSLCERTTYPE, "PEM");
+      curl_easy_setopt(curl_handle, CURLOPT_SSLCERT,     proxyfile);
+      curl_easy_setopt(curl_handle, CURLOPT_SSLKEYTYPE,  "PEM");
+      curl_easy_setopt(curl_handle, CURLOPT_SSLKEY,      proxyfile);
+    }
+  else
+    {
+      curl_easy_setopt(curl_handle, CURLOPT_SSLKEYTYPE,  "ENG");
+      curl_easy_setopt(curl_handle, CURLOPT_SSLCERTTYPE, "ENG");
+      curl_easy_setopt(curl_handle, CURLOPT_SSLCERT,     NULL);
+    }
+
+  if (debugmode)
+    {
+      curl_easy_setopt(curl_handle, CURLOPT_VERBOSE, 1);
+      curl_easy_setopt(curl_handle, CURLOPT_DEBUGFUNCTION, debug_callback);
+    }
+
+  curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, 
+                   "SlashGrid http://www.gridsite.org/slashgrid/");
+  curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, 0);
+  curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, headers_callback);
+
+  curl_easy_setopt(curl_handle, CURLOPT_CAPATH, capath);
+
+  curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, 2);
+  curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 2);
+
+  /* FUSE runs us multi-threaded, so DNS timeouts mustn't use signals */
+  curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
+}
+
+static int is_sitecast_url(char *url)
+/*
+   Returns 1 if the DNS name in url is in the SiteCast domain
+*/
+{
+  int offset;
+
+  if ((sitecast_domain == NULL) || (sitecast_groups == NULL)) return 0;
+
+  if      (strncmp(url, "http://",  7) == 0) offset = 7;
+  else if (strncmp(url, "https://", 8) == 0) offset = 8;
+  else return 0;
+
+  return (strncmp(&url[offset], sitecast_domain, sitecast_domain_len) == 0) &&
+         ((url[offset+sitecast_domain_len] == ':') ||
+          (url[offset+sitecast_domain_len] == '/'));
+}
+
+static int samestring(char *a, char *b)
+{
+  if ((a == NULL) || (b == NULL)) return (a == b);
+  
+  return (strcmp(a, b) == 0);
+}
+
+static unsigned int identity_hash(uid_t uid, char *proxyfile, char *capath)
+{
+  unsigned int h = (unsigned int) uid;
+  char *p;
+  
+  if (proxyfile != NULL) for (p = proxyfile; *p != '\0'; ++p) 
+                                         h = h * 33 + (unsigned char) *p;
+  if (capath    != NULL) for (p = capath;    *p != '\0'; ++p) 
+                                         h = h * 33 + (unsigned char) *p;
+
+  return h % GRST_SLASH_POOL_BUCKETS;
+}
+
+static void share_lock(CURL *handle, curl_lock_data data, 
+                       curl_lock_access access, void *userptr)
+{
+  pthread_mutex_lock(&(((struct grst_identity *) userptr)->share_mutex));
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+  pthread_mutex_unlock(&(((struct grst_identity *) userptr)->share_mutex));
+}
+
+static struct grst_handle *pool_get(uid_t uid, char *proxyfile, char *capath,
+                                    int wait)
+/*
+   Check out a curl handle for this (uid, proxyfile, capath) identity,
+   reusing an idle one and its connections if possible. Up to 
+   max_connections handles per identity can be in use at once; beyond
+   that we wait for one to be returned. Speculative requests (wait is 0)
+   never wait, and get NULL rather than the last free handle, which is
+   kept for requests that do wait. Takes ownership of proxyfile and
+   capath, which may be NULL.
+*/
+{
+  unsigned int bucket;
+  struct grst_identity *identity;
+  struct grst_handle   *handle;
+
+  bucket = identity_hash(uid, proxyfile, capath);
+
+  pthread_mutex_lock(&pool_mutex);
+
+  for (identity = identities[bucket]; identity != NULL; 
+       identity = identity->next)
+     if ((identity->uid == uid) && 
+         samestring(identity->proxyfile, proxyfile) &&
+         samestring(identity->capath, capath)) break;
+
+  if (identity != NULL)
+    {
+      if (proxyfile != NULL) free(proxyfile);
+      if (capath    != NULL) free(capath);
+    }
+  else
+    {
+      identity = calloc(1, sizeof(struct grst_identity));
+
+      identity->uid       = uid;
+      identity->proxyfile = proxyfile;
+      identity->capath    = capath;
+
+      /* DNS and TLS sessions are only shared between handles using the
+         same credentials, so one user can't resume another's session */
+
+      pthread_mutex_init(&(identity->share_mutex), NULL);
+      identity->share = curl_share_init();
+      curl_share_setopt(identity->share, CURLSHOPT_LOCKFUNC,   share_lock);
+      curl_share_setopt(identity->share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+      curl_share_setopt(identity->share, CURLSHOPT_USERDATA,   identity);
+      curl_share_setopt(identity->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt(identity->share, CURLSHOPT_SHARE, 
+                                                 CURL_LOCK_DATA_SSL_SESSION);
+
+      identity->next     = identities[bucket];
+      identities[bucket] = identity;
+    }
+
+  if (!wait && (identity->in_use >= max_connections - 1))
+    {
+      pthread_mutex_unlock(&pool_mutex);
+      return NULL;
+    }
+
+  while ((identity->idle == NULL) && (identity->in_use >= max_connections))
+                                 pthread_cond_wait(&pool_cond, &pool_mutex);
+
+  ++(identity->in_use);
+  
+  if ((handle = identity->idle) != NULL)
+    {
+      identity->idle = handle->next;
+      pthread_mutex_unlock(&pool_mutex);
+      return handle;
+    }
+
+  handle = calloc(1, sizeof(struct grst_handle));
+  handle->identity = identity;
+  handle->id       = ++handle_ids;
+
+  pthread_mutex_unlock(&pool_mutex);
+
+  /* identity can't be reaped while one of its handles is in use */
+
+  handle->curl_handle = curl_easy_init();
+  init_curl_handle(handle->curl_handle, identity->proxyfile, identity->capath);
+  curl_easy_setopt(handle->curl_handle, CURLOPT_SHARE,     identity->share);
+  curl_easy_setopt(handle->curl_handle, CURLOPT_DEBUGDATA, &(handle->id));
+
+  if (debugmode) syslog(LOG_DEBUG, "New curl handle %d for uid %d", 
+                                   handle->id, (int) uid);
+  return handle;
+}
+
+static void pool_put(struct grst_handle *handle)
+/*
+   Return a handle to the idle list of its identity
+*/
+{
+  pthread_mutex_lock(&pool_mutex);
+  
+  time(&(handle->last_used));
+  handle->identity->last_used = handle->last_used;
 
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_USERAGENT, 
-                       "SlashGrid http://www.gridsite.org/slashgrid/");
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_FOLLOWLOCATION, 0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_HEADERFUNCTION, headers_callback);
+  handle->next = handle->identity->idle;
+  handle->identity->idle = handle;
+  --(handle->identity->in_use);
 
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_CAPATH, handles[i].capath);
+  pthread_cond_broadcast(&pool_cond);
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+static void pool_reap(time_t now)
+/*
+   Close handles which have been idle for GRST_SLASH_HANDLE_IDLE seconds,
+   and then forget identities with no handles left.
+*/
+{
+  int i;
+  struct grst_identity *identity, **ipp, *dead_identities = NULL;
+  struct grst_handle   *handle, **hpp, *dead_handles = NULL;
+
+  pthread_mutex_lock(&pool_mutex);
+  
+  for (i=0; i < GRST_SLASH_POOL_BUCKETS; ++i)
+     {
+       ipp = &identities[i];
+     
+       while ((identity = *ipp) != NULL)
+            {
+              hpp = &(identity->idle);
+            
+              while ((handle = *hpp) != NULL)
+                 {
+                   if (handle->last_used < now - GRST_SLASH_HANDLE_IDLE)
+                     {
+                       *hpp = handle->next;
+                       handle->next = dead_handles;
+                       dead_handles = handle;
+                     }
+                   else hpp = &(handle->next);
+                 }
+              
+              if ((identity->idle == NULL) && (identity->in_use == 0) &&
+                  (identity->last_used < now - GRST_SLASH_HANDLE_IDLE))
+                {
+                  *ipp = identity->next;
+                  identity->next = dead_identities;
+                  dead_identities = identity;
+                }
+              else ipp = &(identity->next);
+            }
+     }
+
+  pthread_mutex_unlock(&pool_mutex);
+
+  /* handles first, since they may still refer to their identity's share */
+
+  while ((handle = dead_handles) != NULL)
+       {
+         dead_handles = handle->next;
+         
+         if (debugmode) syslog(LOG_DEBUG, "Reaping idle curl handle %d",
+                                          handle->id);
+         curl_easy_cleanup(handle->curl_handle);
+         free(handle);
+       }
+
+  while ((identity = dead_identities) != NULL)
+       {
+         dead_identities = identity->next;
+
+         curl_share_cleanup(identity->share);
+         pthread_mutex_destroy(&(identity->share_mutex));
+         if (identity->proxyfile != NULL) free(identity->proxyfile);
+         if (identity->capath    != NULL) free(identity->capath);
+         free(identity);
+       }
+}
+
+void *reaper_thread(void *unused)
+{
+  while (1)
+   {
+     sleep(GRST_SLASH_HANDLE_IDLE / 2);
+     pool_reap(time(NULL));
+   }
+}
+
+int perform_request(struct grst_request *request_data,
+                    struct fuse_context *fuse_ctx)
+{
+  int                ret, itry;
+  char              *proxyfile = NULL, *capath = NULL, *range_header = NULL,
+                    *url, *inm_header = NULL, ims_header[80];
+  struct tm          ims_tm;
+  struct curl_slist *headers_list = NULL;
+  struct grst_handle *handle;
+
+  if (strncmp(request_data->url, "https://", 8) == 0) /* HTTPS options */
+    {
+      /* proxyfile and capath are handed over to the connection pool */
+      find_user_creds(fuse_ctx, &capath, &proxyfile);
+    }
+
+  if (debugmode && (proxyfile != NULL))
+       syslog(LOG_DEBUG, "Using proxy file %s", proxyfile);
+
+  /* check out a handle for this uid/proxyfile/capath until we return */
 
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_SSL_VERIFYPEER, 2);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_SSL_VERIFYHOST, 2);
-    }   
+  handle = pool_get(fuse_ctx->uid, proxyfile, capath, 1);
 
-  curl_easy_setopt(handles[i].curl_handle, CURLOPT_READFUNCTION, request_data->readfunction);
-  curl_easy_setopt(handles[i].curl_handle, CURLOPT_READDATA, request_data->readdata);
-  curl_easy_setopt(handles[i].curl_handle, CURLOPT_WRITEFUNCTION, request_data->writefunction);
-  curl_easy_setopt(handles[i].curl_handle, CURLOPT_WRITEDATA, request_data->writedata);
+  curl_easy_setopt(handle->curl_handle, CURLOPT_READFUNCTION, request_data->readfunction);
+  curl_easy_setopt(handle->curl_handle, CURLOPT_READDATA, request_data->readdata);
+  curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEFUNCTION, request_data->writefunction);
+  curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEDATA, request_data->writedata);
 
   if (request_data->method == GRST_SLASH_GET)
     {
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_CUSTOMREQUEST, NULL);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_NOBODY,  0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_HTTPGET, 1);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_UPLOAD,  0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_INFILESIZE, -1);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_CUSTOMREQUEST, NULL);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_NOBODY,  0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPGET, 1);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_UPLOAD,  0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_INFILESIZE, -1);
     }
   else if ((request_data->method == GRST_SLASH_PUT) || 
            (request_data->method == GRST_SLASH_TRUNC))
     {
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_CUSTOMREQUEST, NULL);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_NOBODY,  0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_HTTPGET, 0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_UPLOAD,  1);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_INFILESIZE,  
+      curl_easy_setopt(handle->curl_handle, CURLOPT_CUSTOMREQUEST, NULL);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_NOBODY,  0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPGET, 0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_UPLOAD,  1);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_INFILESIZE,  
                                             (long) request_data->infilesize);
     }
   else if (request_data->method == GRST_SLASH_DELETE)
     {
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_NOBODY,  0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_HTTPGET, 0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_UPLOAD,  0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_CUSTOMREQUEST, "DELETE");
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_INFILESIZE, -1);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_NOBODY,  0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPGET, 0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_UPLOAD,  0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_CUSTOMREQUEST, "DELETE");
+      curl_easy_setopt(handle->curl_handle, CURLOPT_INFILESIZE, -1);
     }
   else if (request_data->method == GRST_SLASH_MOVE)
     {
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_NOBODY,  0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_HTTPGET, 0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_UPLOAD,  0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_CUSTOMREQUEST, "MOVE");
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_INFILESIZE, -1);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_NOBODY,  0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPGET, 0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_UPLOAD,  0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_CUSTOMREQUEST, "MOVE");
+      curl_easy_setopt(handle->curl_handle, CURLOPT_INFILESIZE, -1);
     }
   else /* default or GRST_SLASH_HEAD */
     {
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_CUSTOMREQUEST, NULL);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_NOBODY,  1);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_HTTPGET, 0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_UPLOAD,  0);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_INFILESIZE, -1);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_CUSTOMREQUEST, NULL);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_NOBODY,  1);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPGET, 0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_UPLOAD,  0);
+      curl_easy_setopt(handle->curl_handle, CURLOPT_INFILESIZE, -1);
     }
 
-  curl_easy_setopt(handles[i].curl_handle, CURLOPT_WRITEHEADER, request_data);
+  curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEHEADER, request_data);
   
-  if (request_data->errorbuffer != NULL)
-        curl_easy_setopt(handles[i].curl_handle, CURLOPT_ERRORBUFFER,
+  /* always set, so a buffer from an earlier user is never written to */
+  curl_easy_setopt(handle->curl_handle, CURLOPT_ERRORBUFFER,
                                       request_data->errorbuffer);
 
-  if (debugmode)
-        curl_easy_setopt(handles[i].curl_handle, CURLOPT_DEBUGDATA, &i);
-
   if ((request_data->start >= 0) && 
       (request_data->finish >= request_data->start))
     {
@@ -820,9 +1802,25 @@ int perform_request(struct grst_request *request_data,
                (long) request_data->start, (long) request_data->finish);
 
       headers_list = curl_slist_append(headers_list, range_header);
-      curl_easy_setopt(handles[i].curl_handle, CURLOPT_HTTPHEADER, headers_list);
     }
-  else curl_easy_setopt(handles[i].curl_handle, CURLOPT_HTTPHEADER, NULL);
+
+  /* conditional requests, for revalidating what we have cached */
+
+  if (request_data->if_none_match != NULL)
+    {
+      asprintf(&inm_header, "If-None-Match: %s", request_data->if_none_match);
+      headers_list = curl_slist_append(headers_list, inm_header);
+    }
+    
+  if ((request_data->if_modified_since > 0) &&
+      (gmtime_r(&(request_data->if_modified_since), &ims_tm) != NULL))
+    {
+      strftime(ims_header, sizeof(ims_header), 
+               "If-Modified-Since: %a, %d %b %Y %H:%M:%S GMT", &ims_tm);
+      headers_list = curl_slist_append(headers_list, ims_header);
+    }
+
+  curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPHEADER, headers_list);
 
   /* retry loop */
 
@@ -830,26 +1828,13 @@ int perform_request(struct grst_request *request_data,
      {
        request_data->length_set   = 0;
        request_data->modified_set = 0;
+       request_data->etag_set     = 0;
        request_data->retcode      = 0;
        request_data->location[0]  = '\0';
     
-       if ((sitecast_domain != NULL) &&
-           (sitecast_groups != NULL) &&
-
-           ((request_data->method == GRST_SLASH_HEAD) ||
+       if (((request_data->method == GRST_SLASH_HEAD) ||
             (request_data->method == GRST_SLASH_GET)) &&
-
-           ((!ishttps && 
-             (strncmp(&(request_data->url[7]), sitecast_domain, 
-                                   sitecast_domain_len) == 0) &&
-             ((request_data->url[7+sitecast_domain_len] == ':') ||
-              (request_data->url[7+sitecast_domain_len] == '/')) )
-                                                                   ||
-            (ishttps &&
-             (strncmp(&(request_data->url[8]), sitecast_domain, 
-                                    sitecast_domain_len) == 0) &&
-             ((request_data->url[8+sitecast_domain_len] == ':') ||
-              (request_data->url[8+sitecast_domain_len] == '/')) ) ) )
+           is_sitecast_url(request_data->url))
          {
            if (debugmode)
              syslog(LOG_DEBUG, "Apply SiteCast to URL %s", request_data->url);
@@ -857,9 +1842,9 @@ int perform_request(struct grst_request *request_data,
            if (translate_sitecast_url(&url, request_data->url) ==
                 GRST_RET_OK)
              {
-               curl_easy_setopt(handles[i].curl_handle,
+               curl_easy_setopt(handle->curl_handle,
                                             CURLOPT_URL, url);
-               ret = curl_easy_perform(handles[i].curl_handle);
+               ret = curl_easy_perform(handle->curl_handle);
 
                free(url);               
              }
@@ -871,19 +1856,20 @@ int perform_request(struct grst_request *request_data,
          }
        else
          {
-           curl_easy_setopt(handles[i].curl_handle,
+           curl_easy_setopt(handle->curl_handle,
                                             CURLOPT_URL, request_data->url);
-           ret = curl_easy_perform(handles[i].curl_handle);
+           ret = curl_easy_perform(handle->curl_handle);
          }
 
 // tests on whether to retry due to server error / timeout go here...
        break;
      }
 
-  pthread_mutex_unlock(&(handles[i].mutex));
+  pool_put(handle);
   
   if (headers_list != NULL) curl_slist_free_all(headers_list);
   if (range_header != NULL) free(range_header);
+  if (inm_header   != NULL) free(inm_header);
 
   return ret;
 }
@@ -1192,15 +2178,87 @@ static char *GRSThttpUrlMildencode(char *in)
 }
 #endif
 
-GRSTgaclPerm get_gaclPerm(struct fuse_context *fuse_ctx, char *path)
+static unsigned int perm_hash(uid_t uid, const char *aclpath)
 {
-  GRSTgaclPerm perm = GRST_PERM_NONE; 
+  unsigned int h = 5381;
+  
+  while (*aclpath != '\0') h = h * 33 + (unsigned char) *(aclpath++);
+
+  h = h * 33 + (unsigned int) uid;
+
+  return h % GRST_SLASH_PERM_CACHE;
+}
+
+static int perm_lookup(uid_t uid, char *aclpath, char *dn, 
+                       struct stat *aclstat, GRSTgaclPerm *perm)
+/*
+   Find the cached result of testing this user against this ACL file,
+   if the file has not changed since. Returns 1 if found.
+*/
+{
+  int              found = 0;
+  struct grst_perm *e;
+
+  pthread_mutex_lock(&perm_mutex);
+
+  e = &perms[perm_hash(uid, aclpath)];
+
+  if (e->used && (e->uid == uid) && 
+      (strcmp(e->aclpath, aclpath) == 0) &&
+      samestring(e->dn, dn) &&
+      (e->ino == aclstat->st_ino) && (e->size == aclstat->st_size) &&
+      (e->mtime.tv_sec  == aclstat->st_mtim.tv_sec) &&
+      (e->mtime.tv_nsec == aclstat->st_mtim.tv_nsec))
+    {
+      *perm = e->perm;
+      found = 1;
+    }
+
+  pthread_mutex_unlock(&perm_mutex);
+  
+  return found;
+}
+
+static void perm_store(uid_t uid, char *aclpath, char *dn, 
+                       struct stat *aclstat, GRSTgaclPerm perm)
+{
+  struct grst_perm *e;
+
+  pthread_mutex_lock(&perm_mutex);
+
+  e = &perms[perm_hash(uid, aclpath)];
+
+  if (e->used)
+    {
+      free(e->aclpath);
+      if (e->dn != NULL) free(e->dn);
+    }
+    
+  e->used    = 1;
+  e->uid     = uid;
+  e->aclpath = strdup(aclpath);
+  e->dn      = (dn != NULL) ? strdup(dn) : NULL;
+  e->ino     = aclstat->st_ino;
+  e->size    = aclstat->st_size;
+  e->mtime   = aclstat->st_mtim;
+  e->perm    = perm;
+
+  pthread_mutex_unlock(&perm_mutex);
+}
+
+GRSTgaclPerm get_gaclPerm(struct fuse_context *fuse_ctx, char *path)
+/*
+   The permission of this user for this path, cached by user and ACL
+   file and rechecked if the ACL file changes. The DN of the user, and
+   the ACL file governing the path, are found from their own caches.
+*/
+{
+  GRSTgaclPerm perm = GRST_PERM_NONE; 
   GRSTgaclCred *cred;
   GRSTgaclUser *user = NULL;
   GRSTgaclAcl  *acl;
-  char *dn = NULL, *encoded_dn;
-
-// eventually want a UID cache here...
+  char *dn = NULL, *encoded_dn, *aclpath;
+  struct stat aclstat;
 
 /*
 // want root to be able to read anything, and to write to anything under
@@ -1212,22 +2270,42 @@ GRSTgaclPerm get_gaclPerm(struct fuse_context *fuse_ctx, char *path)
       return GRST_PERM_ALL;
     }
 */
+  GRSTgaclFileFindAclnameUpdate(); /* once per request, not per lookup */
+
+  if ((aclpath = GRSTgaclFileFindAclname(path)) == NULL)
+    {
+      if (debugmode) syslog(LOG_DEBUG, "get_gaclPerm finds no ACL for %s", 
+                                       path);
+      return GRST_PERM_NONE;
+    }
+
   dn = mapdir_uid_to_dn(fuse_ctx->uid);
-  
-  if (dn != NULL)
+
+  if ((stat(aclpath, &aclstat) != 0) ||
+      !perm_lookup(fuse_ctx->uid, aclpath, dn, &aclstat, &perm))
     {
-      encoded_dn = GRSThttpUrlMildencode(dn);
+      if (dn != NULL)
+        {
+          encoded_dn = GRSThttpUrlMildencode(dn);
     
-      cred = GRSTgaclCredCreate("dn:", encoded_dn);
-      user = GRSTgaclUserNew(cred);
-      free(dn);
-      free(encoded_dn);
-    }   
+          cred = GRSTgaclCredCreate("dn:", encoded_dn);
+          user = GRSTgaclUserNew(cred);
+          free(encoded_dn);
+        }   
+
+      /* stat before load, so a change during the load means a miss later */
   
-  acl  = GRSTgaclAclLoadforFile(path); 
-  perm = GRSTgaclAclTestUser(acl, user);
-  GRSTgaclAclFree(acl);
-  GRSTgaclUserFree(user);
+      acl  = GRSTgaclAclLoadFile(aclpath);
+      perm = GRSTgaclAclTestUser(acl, user);
+      if (acl != NULL) GRSTgaclAclFree(acl);
+      GRSTgaclUserFree(user);
+      
+      if (acl != NULL) 
+              perm_store(fuse_ctx->uid, aclpath, dn, &aclstat, perm);
+    }
+
+  if (dn != NULL) free(dn);
+  free(aclpath);
   
   if (strstr(path, GRST_ACL_FILE) != NULL) perm &= ~GRST_PERM_WRITE;
 
@@ -1236,15 +2314,11 @@ GRSTgaclPerm get_gaclPerm(struct fuse_context *fuse_ctx, char *path)
   return perm;            
 }
 
-int read_headers_from_cache(struct fuse_context *fuse_ctx, char *filename, 
-                            off_t *length, time_t *modified)
+static char *headers_cache_filename(struct fuse_context *fuse_ctx, 
+                                    char *filename)
 {
   char *encoded_filename, *disk_filename;
-  int   len, fd;
-  long  content_length, last_modified;
-  FILE *fp;
-  struct stat statbuf;
-  time_t now;
+  int   len;
   
   encoded_filename = GRSThttpUrlMildencode(filename);
   
@@ -1257,6 +2331,26 @@ int read_headers_from_cache(struct fuse_context *fuse_ctx, char *filename,
                 GRST_SLASH_HEADERS, fuse_ctx->uid, encoded_filename);
 
   free(encoded_filename);
+  
+  return disk_filename;
+}
+
+static int read_headers_file(struct fuse_context *fuse_ctx, char *filename, 
+                             off_t *length, time_t *modified, char *etag,
+                             time_t *written)
+/*
+   Read the cached headers for filename whatever their age, which is
+   returned in *written. etag must have space for GRST_SLASH_MAX_ETAG+1
+   bytes, and is set to "" if no ETag was cached.
+*/
+{
+  char *disk_filename;
+  int   fd;
+  long  content_length, last_modified;
+  FILE *fp;
+  struct stat statbuf;
+  
+  disk_filename = headers_cache_filename(fuse_ctx, filename);
 
   if ((fd = open(disk_filename, O_RDONLY)) == -1)
     {
@@ -1273,35 +2367,31 @@ int read_headers_from_cache(struct fuse_context *fuse_ctx, char *filename,
       return 0;
     }
 
-  time(&now);
-
-  if (statbuf.st_mtime < now - GRST_SLASH_CACHE_EXPIRE)
-    {
-      close(fd);
-      if (debugmode) syslog(LOG_DEBUG, "%s in cache has expired", disk_filename);
-      unlink(disk_filename); /* tidy up expired cache file */
-      free(disk_filename);
-      return 0;
-    }      
-
   last_modified  = 0;
   content_length = 0;
+  etag[0]        = '\0';
 
   if (debugmode) syslog(LOG_DEBUG, "Opening %s from cache", disk_filename);
 
+  spool_touch(disk_filename);
   free(disk_filename);
 
   if ((fp = fdopen(fd, "r")) != NULL)
     {
-      fscanf(fp, "content-length=%ld last-modified=%ld ", 
-                 &content_length, &last_modified);
+      if (fscanf(fp, "content-length=%ld last-modified=%ld ", 
+                 &content_length, &last_modified) == 2)
+        {
+          if (fscanf(fp, "etag=%255s", etag) != 1) etag[0] = '\0';
+        }
+
       fclose(fp);
 
-      if (debugmode) syslog(LOG_DEBUG, "content-length=%ld last-modified=%ld", 
-                            content_length, last_modified);
+      if (debugmode) syslog(LOG_DEBUG, "content-length=%ld last-modified=%ld etag=%s", 
+                            content_length, last_modified, etag);
 
       *length   = (off_t)  content_length;
       *modified = (time_t) last_modified;
+      *written  = statbuf.st_mtime;
 
       return 1;
     }
@@ -1311,14 +2401,75 @@ int read_headers_from_cache(struct fuse_context *fuse_ctx, char *filename,
   return 0;
 }
 
+int read_headers_from_cache(struct fuse_context *fuse_ctx, char *filename, 
+                            off_t *length, time_t *modified)
+/*
+   Read the cached headers for filename, if they are still fresh. Expired
+   headers are left in place for revalidation.
+*/
+{
+  char   etag[GRST_SLASH_MAX_ETAG+1];
+  time_t written, now;
+  
+  if (!read_headers_file(fuse_ctx, filename, length, modified, 
+                         etag, &written)) return 0;
+
+  time(&now);
+
+  if (written < now - GRST_SLASH_CACHE_EXPIRE)
+    {
+      if (debugmode) syslog(LOG_DEBUG, "headers of %s in cache have expired", 
+                                       filename);
+      return 0;
+    }      
+
+  return 1;
+}
+
 int write_headers_to_cache(struct fuse_context *fuse_ctx, char *filename, 
-                           off_t length, time_t modified)
+                           off_t length, time_t modified, char *etag)
+/*
+   Cache the headers of filename. etag is NULL if these come from a 
+   directory listing rather than from the file's own HTTP headers, and
+   "" if the server gave no ETag. If the file has changed since the
+   headers already cached, its cached blocks are dropped: so blocks in
+   the cache always belong to the version described by its headers.
+*/
 {
   int         fd, len, ret;
+  size_t      headline_len;
   char       *tempfile, *headline, *encoded_filename, *p, *newdir,
-             *new_filename;
+             *new_filename, old_etag[GRST_SLASH_MAX_ETAG+1];
+  off_t       old_length;
+  time_t      old_modified, old_written;
   struct stat statbuf;
 
+  len = strlen(filename);
+
+  if ((len > 0) && (filename[len - 1] != '/') &&
+      read_headers_file(fuse_ctx, filename, &old_length, &old_modified,
+                        old_etag, &old_written))
+    {
+      if (etag == NULL) 
+        {
+          /* listings give sizes but their times may not match 
+             Last-Modified exactly, so keep the headers we had. They are
+             left untouched, since rewriting them would also reset the
+             time they were last validated against the server's headers */
+          
+          if (length == old_length) return 1;
+
+          drop_cache_blocks(fuse_ctx, filename);
+        }
+      else if ((length != old_length) || (modified != old_modified) ||
+               ((etag[0] != '\0') && (old_etag[0] != '\0') && 
+                (strcmp(etag, old_etag) != 0)))
+        {
+          if (debugmode) syslog(LOG_DEBUG, "%s has changed", filename);
+          drop_cache_blocks(fuse_ctx, filename);
+        }
+    }
+
   asprintf(&tempfile, "%s/headers-XXXXXX", GRST_SLASH_TMP);
   fd = mkstemp(tempfile);
 
@@ -1328,10 +2479,15 @@ int write_headers_to_cache(struct fuse_context *fuse_ctx, char *filename,
       return 0;
     }
 
-  asprintf(&headline, "content-length=%ld last-modified=%ld \n", 
+  if ((etag != NULL) && (etag[0] != '\0'))
+       asprintf(&headline, "content-length=%ld last-modified=%ld etag=%s \n", 
+                                (long) length, (long) modified, etag);
+  else asprintf(&headline, "content-length=%ld last-modified=%ld \n", 
                                 (long) length, (long) modified);
   
-  if ((write(fd, headline, strlen(headline)) == -1) ||
+  headline_len = strlen(headline);
+
+  if ((write(fd, headline, headline_len) == -1) ||
       (close(fd) == -1))
     {
       free(tempfile);
@@ -1357,10 +2513,8 @@ int write_headers_to_cache(struct fuse_context *fuse_ctx, char *filename,
          {
            if (!S_ISDIR(statbuf.st_mode)) /* exists already - not a directory! */
              {
-               pthread_mutex_lock(&cache_mutex);
                unlink(newdir);
                mkdir(newdir, S_IRUSR | S_IWUSR | S_IXUSR);
-               pthread_mutex_unlock(&cache_mutex);
              }
            /* else it already exists as a directory - so ok */
          }
@@ -1385,9 +2539,10 @@ int write_headers_to_cache(struct fuse_context *fuse_ctx, char *filename,
       rmdir(new_filename);
     }
 
-  pthread_mutex_lock(&cache_mutex);
   ret = rename(tempfile, new_filename);
-  pthread_mutex_unlock(&cache_mutex);
+  
+  if (ret == 0) spool_account(new_filename, headline_len);
+  else unlink(tempfile);
 
   if (debugmode) syslog(LOG_DEBUG, "Move %s to %s in cache (%d;%ld,%ld)\n", 
                               tempfile, new_filename, ret, length, modified);
@@ -1398,6 +2553,230 @@ int write_headers_to_cache(struct fuse_context *fuse_ctx, char *filename,
   return 1;
 }
 
+static unsigned int attrcache_hash(uid_t uid, const char *path, size_t len)
+{
+  unsigned int h = 5381;
+  size_t       i;
+  
+  for (i=0; i < len; ++i) h = h * 33 + (unsigned char) path[i];
+
+  h = h * 33 + (unsigned int) uid;
+
+  return h % GRST_SLASH_ATTRCACHE_BUCKETS;
+}
+
+static size_t attrcache_keylen(const char *path)
+/* 
+   Directories are sometimes named with a trailing slash and sometimes 
+   not, so we ignore any trailing slash in the cache keys.
+*/
+{
+  size_t len;
+  
+  len = strlen(path);
+  if ((len > 1) && (path[len - 1] == '/')) --len;
+  
+  return len;
+}
+
+static struct grst_attr *attrcache_find(uid_t uid, const char *path, 
+                                        size_t len)
+/*
+   Find the attribute cache entry for the first len chars of path,
+   whatever its age. Caller must hold attr_mutex.
+*/
+{
+  struct grst_attr *a;
+
+  for (a = attrcache_table[attrcache_hash(uid, path, len)];
+       a != NULL; a = a->next)
+     if ((a->uid == uid) && (strlen(a->path) == len) &&
+         (strncmp(a->path, path, len) == 0)) return a;
+
+  return NULL;
+}
+
+static void attrcache_reap(time_t now)
+/*
+   Free all expired entries. Caller must hold attr_mutex.
+*/
+{
+  int               i;
+  struct grst_attr *a, **pp;
+  
+  for (i=0; i < GRST_SLASH_ATTRCACHE_BUCKETS; ++i)
+     {
+       pp = &attrcache_table[i];
+       
+       while ((a = *pp) != NULL)
+            {
+              if (a->expires < now)
+                {
+                  *pp = a->next;
+                  free(a->path);
+                  free(a);
+                  --attrcache_count;
+                }
+              else pp = &(a->next);
+            }
+     }
+}
+
+static void attrcache_store(uid_t uid, const char *path, int exists,
+                            int isdir, off_t length, time_t modified)
+/*
+   Remember the attributes of path for attr_timeout seconds, or that it
+   does not exist if exists is 0.
+*/
+{
+  size_t            len;
+  time_t            now;
+  struct grst_attr *a;
+  unsigned int      h;
+
+  if (attr_timeout <= 0) return;
+
+  len = attrcache_keylen(path);
+  time(&now);
+
+  pthread_mutex_lock(&attr_mutex);
+
+  if ((a = attrcache_find(uid, path, len)) == NULL)
+    {
+      if (attrcache_count >= GRST_SLASH_ATTRCACHE_SIZE) attrcache_reap(now);
+      
+      if ((attrcache_count >= GRST_SLASH_ATTRCACHE_SIZE) ||
+          ((a = calloc(1, sizeof(struct grst_attr))) == NULL))
+        {
+          pthread_mutex_unlock(&attr_mutex);
+          return;
+        }
+
+      a->uid  = uid;
+      a->path = strndup(path, len);
+
+      h = attrcache_hash(uid, path, len);
+      a->next = attrcache_table[h];
+      attrcache_table[h] = a;
+      ++attrcache_count;
+    }
+
+  if (!exists || !isdir || !a->isdir) a->listed = 0;
+
+  a->exists   = exists;
+  a->isdir    = isdir;
+  a->length   = length;
+  a->modified = modified;
+  a->expires  = now + attr_timeout;
+
+  pthread_mutex_unlock(&attr_mutex);
+}
+
+static void attrcache_listed(uid_t uid, const char *path)
+/*
+   Record that we have just stored an entry for everything in the
+   listing of the directory path.
+*/
+{
+  struct grst_attr *a;
+
+  if (attr_timeout <= 0) return;
+
+  pthread_mutex_lock(&attr_mutex);
+  a = attrcache_find(uid, path, attrcache_keylen(path));
+  pthread_mutex_unlock(&attr_mutex);
+
+  if ((a == NULL) || !a->exists || !a->isdir)
+                               attrcache_store(uid, path, 1, 1, 0, 0);
+
+  pthread_mutex_lock(&attr_mutex);
+  
+  if ((a = attrcache_find(uid, path, attrcache_keylen(path))) != NULL)
+                                       a->listed = time(NULL) + attr_timeout;
+
+  pthread_mutex_unlock(&attr_mutex);
+}
+
+static int attrcache_lookup(uid_t uid, const char *path, struct stat *stbuf)
+/*
+   Returns 1 and fills in stbuf if we have fresh attributes for path, 
+   -1 if we know it does not exist, and 0 if we need to ask the server.
+   A name missing from a fresh listing of its directory does not exist,
+   except for dot files which servers often leave out of their listings.
+*/
+{
+  int               ret = 0;
+  size_t            len;
+  time_t            now;
+  char             *p;
+  struct grst_attr *a;
+
+  if (attr_timeout <= 0) return 0;
+
+  len = attrcache_keylen(path);
+  time(&now);
+
+  pthread_mutex_lock(&attr_mutex);
+
+  if (((a = attrcache_find(uid, path, len)) != NULL) && (a->expires >= now))
+    {
+      if (!a->exists) ret = -1;
+      else
+        {
+          stbuf->st_mode  = a->isdir ? (S_IFDIR | 0755) : (S_IFREG | 0755);
+          stbuf->st_size  = a->length;
+          stbuf->st_mtime = a->modified;
+          stbuf->st_ctime = a->modified;
+          stbuf->st_atime = now;
+          ret = 1;
+        }
+    }
+  else if ((a == NULL) && 
+           ((p = memrchr(path, '/', len)) != NULL) && (p[1] != '.') &&
+           ((a = attrcache_find(uid, path, p - path)) != NULL) &&
+           (a->listed >= now)) ret = -1;
+
+  pthread_mutex_unlock(&attr_mutex);
+
+  return ret;
+}
+
+static void attrcache_drop(uid_t uid, const char *path)
+/*
+   Forget what we know about path, and that the listing of its parent
+   directory is complete, since path has been changed by us.
+*/
+{
+  size_t             len;
+  char              *p;
+  struct grst_attr **pp, *a;
+
+  len = attrcache_keylen(path);
+
+  pthread_mutex_lock(&attr_mutex);
+
+  for (pp = &attrcache_table[attrcache_hash(uid, path, len)];
+       *pp != NULL; pp = &((*pp)->next))
+     {
+       a = *pp;
+
+       if ((a->uid == uid) && (strlen(a->path) == len) &&
+           (strncmp(a->path, path, len) == 0))
+         {
+           *pp = a->next;
+           free(a->path);
+           free(a);
+           --attrcache_count;
+           break;
+         }
+     }
+
+  if (((p = memrchr(path, '/', len)) != NULL) &&
+      ((a = attrcache_find(uid, path, p - path)) != NULL)) a->listed = 0;
+
+  pthread_mutex_unlock(&attr_mutex);
+}
+
 static int slashgrid_readdir(const char *path, void *buf, 
                              fuse_fill_dir_t filler,
                              off_t offset, struct fuse_file_info *fi)
@@ -1570,8 +2949,10 @@ static int slashgrid_readdir(const char *path, void *buf,
                          i, list[i].filename);
 
                 asprintf(&s, "%s/%s", path, list[i].filename);
-                write_headers_to_cache(&fuse_ctx, s, list[i].length, 
-                                       list[i].modified);
+                if (!isdir) write_headers_to_cache(&fuse_ctx, s, 
+                                  list[i].length, list[i].modified, NULL);
+                attrcache_store(fuse_ctx.uid, s, 1, isdir, 
+                                list[i].length, list[i].modified);
                 free(s);
            
                 bzero(&stat_tmp, sizeof(struct stat));
@@ -1580,13 +2961,16 @@ static int slashgrid_readdir(const char *path, void *buf,
                 stat_tmp.st_mtime = list[i].modified;
                 stat_tmp.st_ctime = list[i].modified;
                 stat_tmp.st_atime = now;
-                stat_tmp.st_mode  = isdir ? 0777 : 0666;
+                stat_tmp.st_mode  = isdir ? (S_IFDIR | 0777) : (S_IFREG | 0666);
                 filler(buf, list[i].filename, &stat_tmp, 0);
 
                 if (debugmode) syslog(LOG_DEBUG, 
                          "in slashgrid_readdir, filler list[%d].filename=%s %lu %lu",
                          i, list[i].filename, stat_tmp.st_size, stat_tmp.st_mtime);
               }
+
+           /* now every name in this directory has an entry or is absent */
+           attrcache_listed(fuse_ctx.uid, path);
          }
      
   if (debugmode) syslog(LOG_DEBUG, 
@@ -1613,6 +2997,11 @@ static int slashgrid_getattr(const char *rawpath, struct stat *stbuf)
                          "in slashgrid_getattr, rawpath=%s UID=%d\n",
                          rawpath, fuse_ctx.uid);
 
+  /* so the size includes anything still in the write-back buffer */
+  if ((strncmp(rawpath, "/http/",  6) == 0) ||
+      (strncmp(rawpath, "/https/", 7) == 0))
+                       writeback_flush_path(&fuse_ctx, (char *) rawpath, 0);
+
   memset(stbuf, 0, sizeof(struct stat));
   stbuf->st_mode  = S_IFREG | 0755;
   stbuf->st_nlink = 1;
@@ -1729,6 +3118,16 @@ static int slashgrid_getattr(const char *rawpath, struct stat *stbuf)
   
   time(&now);
 
+  if ((ret = attrcache_lookup(fuse_ctx.uid, rawpath, stbuf)) != 0)
+    {
+      if (debugmode) syslog(LOG_DEBUG, 
+          "Retrieving details for %s from attribute cache (%d)\n", url, ret);
+
+      free(url);
+      free(path);
+      return (ret > 0) ? 0 : -ENOENT;
+    }
+
   if (read_headers_from_cache(&fuse_ctx, path, 
                               &(stbuf->st_size), &(stbuf->st_mtime)))
     {
@@ -1739,6 +3138,9 @@ static int slashgrid_getattr(const char *rawpath, struct stat *stbuf)
       stbuf->st_ctime = stbuf->st_mtime;
       stbuf->st_atime = now;
       
+      attrcache_store(fuse_ctx.uid, rawpath, 1, S_ISDIR(stbuf->st_mode),
+                      stbuf->st_size, stbuf->st_mtime);
+
       free(url);
       free(path);
       return 0;    
@@ -1778,6 +3180,9 @@ static int slashgrid_getattr(const char *rawpath, struct stat *stbuf)
            free(url);
            free(path);
            
+           if ((thiserror == 0) && (request_data.retcode == 404))
+                      attrcache_store(fuse_ctx.uid, rawpath, 0, 0, 0, 0);
+
            if (request_data.retcode == 403) return -EACCES;
            else return -ENOENT; 
 /* memory clean up still needed here!!!!!! */
@@ -1841,74 +3246,315 @@ static int slashgrid_getattr(const char *rawpath, struct stat *stbuf)
 
   stbuf->st_atime = now;
 
-  write_headers_to_cache(&fuse_ctx, path, stbuf->st_size, stbuf->st_mtime);
+  write_headers_to_cache(&fuse_ctx, path, stbuf->st_size, stbuf->st_mtime,
+                         request_data.etag_set ? request_data.etag : "");
+
+  attrcache_store(fuse_ctx.uid, rawpath, 1, S_ISDIR(stbuf->st_mode),
+                  stbuf->st_size, stbuf->st_mtime);
 
   free(url);
   free(path);
   return 0;
 }
 
-int write_block_to_cache(struct fuse_context *fuse_ctx, char *filename,  
-                         off_t start, off_t finish)
+static unsigned int memcache_hash(uid_t uid, const char *path, off_t start)
 {
-  int          anyerror = 0, thiserror, i, fd;
-  char        *s, *url, *tempfile, *encoded_filename, *p,
-              *newdir, *new_filename, errorbuffer[CURL_ERROR_SIZE+1] = "";
-  struct       stat statbuf;
-  struct       grst_request request_data;
-  FILE        *fp;
+  unsigned int h = 5381;
+  
+  while (*path != '\0') h = h * 33 + (unsigned char) *(path++);
 
-  asprintf(&tempfile, "%s/blocks-XXXXXX", GRST_SLASH_TMP);
-  fd = mkstemp(tempfile);
+  h = h * 33 + (unsigned int) uid;
+  h = h * 33 + (unsigned int) (((unsigned long long) start) ^
+                               (((unsigned long long) start) >> 32));
 
-  if (fd == -1)
-    {
-      free(tempfile);
-      return -EIO;
-    }
+  return h % GRST_SLASH_MEMCACHE_BUCKETS;
+}
 
-  fp = fdopen(fd, "w");
+static void memcache_unlink(struct grst_memblock *mb)
+/*
+   Remove one block from its hash chain and the LRU list, and free it.
+   Caller must hold memcache_mutex.
+*/
+{
+  struct grst_memblock **pp;
+  
+  for (pp = &memcache_table[mb->bucket]; *pp != NULL; pp = &((*pp)->hash_next))
+     if (*pp == mb)
+       {
+         *pp = mb->hash_next;
+         break;
+       }
 
-  if (strncmp(filename, "/http/", 6) == 0)
-    asprintf(&url, "http://%s", &filename[6]);
-  else if (strncmp(filename, "/https/", 7) == 0)
-    asprintf(&url, "https://%s", &filename[7]);
-  else return -ENOENT;
+  if (mb->lru_prev != NULL) mb->lru_prev->lru_next = mb->lru_next;
+  else memcache_lru_head = mb->lru_next;
 
-  bzero(&request_data, sizeof(struct grst_request));
-  request_data.writefunction = fwrite;
-  request_data.writedata     = (void *) fp;
-  request_data.errorbuffer   = errorbuffer;
-  request_data.url           = url;
-  request_data.method        = GRST_SLASH_GET;
-  request_data.start         = start;
-  request_data.finish        = finish;
+  if (mb->lru_next != NULL) mb->lru_next->lru_prev = mb->lru_prev;
+  else memcache_lru_tail = mb->lru_prev;
 
-  if (debugmode) syslog(LOG_DEBUG, "Get block %ld-%ld from URL %s\n",
-                                   (long) start, (long) finish, url);
-  
-  thiserror = perform_request(&request_data, fuse_ctx);
+  memcache_used -= mb->length;
 
-  free(url);
+  free(mb->path);
+  free(mb->data);
+  free(mb);
+}
 
-  fclose(fp);  
+static struct grst_memblock *memcache_find(uid_t uid, const char *path,
+                                           off_t start, off_t blocksize)
+/*
+   Find a block in the in-memory cache, whatever its age. 
+   Caller must hold memcache_mutex.
+*/
+{
+  struct grst_memblock *mb;
 
-  if ((thiserror != 0) ||
-           (request_data.retcode <  200) ||
-           (request_data.retcode >= 300))
-         {
+  for (mb = memcache_table[memcache_hash(uid, path, start)];
+       mb != NULL; mb = mb->hash_next)
+     if ((mb->start == start) && (mb->uid == uid) && 
+         (mb->blocksize == blocksize) && (strcmp(mb->path, path) == 0))
+                                                                  return mb;
+  return NULL;
+}
+
+static ssize_t memcache_read(uid_t uid, const char *path, 
+                             off_t start, off_t blocksize,
+                             char *buf, off_t skip, size_t count, time_t now)
+/*
+   Copy up to count bytes, starting skip bytes into the cached block, 
+   into buf. Returns the number of bytes copied, -1 if the block is
+   not in the in-memory cache, or -2 if it is older than 
+   GRST_SLASH_CACHE_EXPIRE and must be revalidated before being used.
+   No system calls are made on a hit.
+*/
+{
+  ssize_t len = -1;
+  struct grst_memblock *mb;
+
+  if (memcache_size == 0) return -1;
+
+  pthread_mutex_lock(&memcache_mutex);
+
+  if (((mb = memcache_find(uid, path, start, blocksize)) != NULL) &&
+      (mb->fetched < now - GRST_SLASH_CACHE_EXPIRE)) len = -2;
+  else if (mb != NULL)
+    {
+      /* move to the most recently used end of the list */
+      if (mb != memcache_lru_head)
+        {
+          mb->lru_prev->lru_next = mb->lru_next;
+
+          if (mb->lru_next != NULL) mb->lru_next->lru_prev = mb->lru_prev;
+          else memcache_lru_tail = mb->lru_prev;
+
+          mb->lru_prev = NULL;
+          mb->lru_next = memcache_lru_head;
+          memcache_lru_head->lru_prev = mb;
+          memcache_lru_head = mb;
+        }
+
+      if ((size_t) skip >= mb->length) len = 0;
+      else
+        {
+          len = mb->length - skip;
+          if ((size_t) len > count) len = count;
+          memcpy(buf, mb->data + skip, len);
+        }
+    }
+
+  pthread_mutex_unlock(&memcache_mutex);
+
+  return len;
+}
+
+static int memcache_has(uid_t uid, const char *path,
+                        off_t start, off_t blocksize)
+{
+  int ret;
+
+  if (memcache_size == 0) return 0;
+
+  pthread_mutex_lock(&memcache_mutex);
+  ret = (memcache_find(uid, path, start, blocksize) != NULL);
+  pthread_mutex_unlock(&memcache_mutex);
+
+  return ret;
+}
+
+static void memcache_touch(uid_t uid, const char *path, time_t now)
+/*
+   Extend the lifetime of all the in-memory blocks of this file, once 
+   the file has been revalidated.
+*/
+{
+  struct grst_memblock *mb;
+  
+  if (memcache_size == 0) return;
+
+  pthread_mutex_lock(&memcache_mutex);
+  
+  for (mb = memcache_lru_head; mb != NULL; mb = mb->lru_next)
+     if ((mb->uid == uid) && (strcmp(mb->path, path) == 0)) mb->fetched = now;
+
+  pthread_mutex_unlock(&memcache_mutex);
+}
+
+static void memcache_store(uid_t uid, const char *path,
+                           off_t start, off_t blocksize,
+                           char *data, size_t length, time_t now)
+/*
+   Add a block to the in-memory cache, evicting least recently used blocks
+   until it fits in memcache_size. The cache takes ownership of data, which
+   is freed immediately if the cache is disabled or the block is too big.
+*/
+{
+  struct grst_memblock *mb;
+
+  if ((memcache_size == 0) || (length > memcache_size))
+    {
+      free(data);
+      return;
+    }
+
+  pthread_mutex_lock(&memcache_mutex);
+
+  if ((mb = memcache_find(uid, path, start, blocksize)) != NULL)
+                                                        memcache_unlink(mb);
+  
+  while ((memcache_lru_tail != NULL) && 
+         (memcache_used + length > memcache_size))
+                                           memcache_unlink(memcache_lru_tail);
+
+  mb = malloc(sizeof(struct grst_memblock));
+  
+  mb->bucket    = memcache_hash(uid, path, start);
+  mb->uid       = uid;
+  mb->path      = strdup(path);
+  mb->start     = start;
+  mb->blocksize = blocksize;
+  mb->data      = data;
+  mb->length    = length;
+  mb->fetched   = now;
+
+  mb->hash_next = memcache_table[mb->bucket];
+  memcache_table[mb->bucket] = mb;
+
+  mb->lru_prev  = NULL;
+  mb->lru_next  = memcache_lru_head;
+  if (memcache_lru_head != NULL) memcache_lru_head->lru_prev = mb;
+  else memcache_lru_tail = mb;
+  memcache_lru_head = mb;
+  
+  memcache_used += length;
+
+  pthread_mutex_unlock(&memcache_mutex);
+}
+
+static void memcache_drop(uid_t uid, const char *path)
+/*
+   Drop all the in-memory blocks cached for this file and user.
+*/
+{
+  struct grst_memblock *mb, *next;
+  
+  if (memcache_size == 0) return;
+
+  pthread_mutex_lock(&memcache_mutex);
+  
+  for (mb = memcache_lru_head; mb != NULL; mb = next)
+     {
+       next = mb->lru_next;
+       
+       if ((mb->uid == uid) && (strcmp(mb->path, path) == 0)) 
+                                                         memcache_unlink(mb);
+     }
+
+  pthread_mutex_unlock(&memcache_mutex);
+}
+
+static void check_block_validator(struct fuse_context *fuse_ctx, char *path,
+                                  struct grst_request *request_data)
+/*
+   If the response to a block GET shows the file has changed since its
+   headers were cached, drop everything cached for the file before the
+   new block is added.
+*/
+{
+  char   etag[GRST_SLASH_MAX_ETAG+1];
+  off_t  length;
+  time_t modified, written;
+
+  if (!read_headers_file(fuse_ctx, path, &length, &modified, etag, &written))
+                                                                     return;
+
+  if ((request_data->modified_set && (request_data->modified != modified)) ||
+      (request_data->etag_set && (etag[0] != '\0') && 
+       (strcmp(request_data->etag, etag) != 0)))
+    {
+      if (debugmode) syslog(LOG_DEBUG, "%s has changed", path);
+      drop_cache_blocks(fuse_ctx, path);
+    }
+}
+
+static int get_block(struct fuse_context *fuse_ctx, char *filename,
+                     off_t start, off_t finish, 
+                     void *writefunction, void *writedata)
+/*
+   GET the byte range start-finish of filename, passing the data to
+   writefunction. Returns 0 on success or -errno.
+*/
+{
+  int          thiserror;
+  char        *url, errorbuffer[CURL_ERROR_SIZE+1] = "";
+  struct       grst_request request_data;
+
+  if (strncmp(filename, "/http/", 6) == 0)
+    asprintf(&url, "http://%s", &filename[6]);
+  else if (strncmp(filename, "/https/", 7) == 0)
+    asprintf(&url, "https://%s", &filename[7]);
+  else return -ENOENT;
+
+  bzero(&request_data, sizeof(struct grst_request));
+  request_data.writefunction = writefunction;
+  request_data.writedata     = writedata;
+  request_data.errorbuffer   = errorbuffer;
+  request_data.url           = url;
+  request_data.method        = GRST_SLASH_GET;
+  request_data.start         = start;
+  request_data.finish        = finish;
+
+  if (debugmode) syslog(LOG_DEBUG, "Get block %ld-%ld from URL %s\n",
+                                   (long) start, (long) finish, url);
+  
+  thiserror = perform_request(&request_data, fuse_ctx);
+
+  free(url);
+
+  if ((thiserror != 0) ||
+           (request_data.retcode <  200) ||
+           (request_data.retcode >= 300))
+         {
            if (debugmode)
                 syslog(LOG_DEBUG, "... curl error: %s (%d), HTTP error: %d\n",
                        errorbuffer, thiserror, request_data.retcode);
 
-           if (thiserror != 0) anyerror = thiserror;
-           else                anyerror = request_data.retcode;
-
            if (request_data.retcode == 403) return -EACCES;
            else return -ENOENT; 
-/* memory clean up still needed here!!!!!! */
          }
 
+  check_block_validator(fuse_ctx, filename, &request_data);
+
+  return 0;
+}
+
+static char *block_cache_filename(uid_t uid, char *filename,
+                                  off_t start, off_t finish)
+/*
+   Returns the malloc()ed name of the disk cache file for this block,
+   creating the directories above it if necessary.
+*/
+{
+  char        *encoded_filename, *p, *newdir, *new_filename;
+  struct       stat statbuf;
+
   encoded_filename = GRSThttpUrlMildencode(filename);
 
 // need to protect against .. ?
@@ -1922,11 +3568,11 @@ int write_block_to_cache(struct fuse_context *fuse_ctx, char *filename,
          {
            *p = '\0';
            asprintf(&newdir, "%s/%d%s", 
-                    GRST_SLASH_BLOCKS, fuse_ctx->uid, encoded_filename);
+                    GRST_SLASH_BLOCKS, uid, encoded_filename);
            *p = '/';
          }
        else asprintf(&newdir, "%s/%d%s", 
-                     GRST_SLASH_BLOCKS, fuse_ctx->uid, encoded_filename);
+                     GRST_SLASH_BLOCKS, uid, encoded_filename);
            
        if (stat(newdir, &statbuf) != 0)
                                    mkdir(newdir, S_IRUSR | S_IWUSR | S_IXUSR);
@@ -1935,14 +3581,48 @@ int write_block_to_cache(struct fuse_context *fuse_ctx, char *filename,
        if (*p == '\0') break;
      }
 
-  asprintf(&new_filename, "%s/%d%s/%ld-%ld", GRST_SLASH_BLOCKS, fuse_ctx->uid,
+  asprintf(&new_filename, "%s/%d%s/%ld-%ld", GRST_SLASH_BLOCKS, uid,
                            encoded_filename, (long) start, (long) finish);
 
   free(encoded_filename);
+
+  return new_filename;
+}
+
+int write_block_to_cache(struct fuse_context *fuse_ctx, char *filename,  
+                         off_t start, off_t finish)
+{
+  int          ret, fd;
+  char        *tempfile, *new_filename;
+  off_t        length;
+  FILE        *fp;
+
+  asprintf(&tempfile, "%s/blocks-XXXXXX", GRST_SLASH_TMP);
+  fd = mkstemp(tempfile);
+
+  if (fd == -1)
+    {
+      free(tempfile);
+      return -EIO;
+    }
+
+  fp = fdopen(fd, "w");
+
+  ret = get_block(fuse_ctx, filename, start, finish, fwrite, (void *) fp);
+
+  length = ftello(fp);
+  fclose(fp);  
+
+  if (ret != 0)
+    {
+      unlink(tempfile);
+      free(tempfile);
+      return ret;
+    }
+
+  new_filename = block_cache_filename(fuse_ctx->uid, filename, start, finish);
   
-  pthread_mutex_lock(&cache_mutex);
-  rename(tempfile, new_filename);
-  pthread_mutex_unlock(&cache_mutex);
+  if (spool_rename(tempfile, new_filename, length) != 0) unlink(tempfile);
 
   if (debugmode) syslog(LOG_DEBUG, "Added %s to block cache", new_filename);
 
@@ -1952,197 +3632,1110 @@ int write_block_to_cache(struct fuse_context *fuse_ctx, char *filename,
   return 0;
 }
 
-void drop_cache_blocks(struct fuse_context *fuse_ctx, char *filename)
+static void save_block_to_disk(uid_t uid, char *filename, 
+                               off_t start, off_t finish,
+                               char *data, size_t length)
 /*
-   Drop ALL the blocks cached for this file by moving the whole directory
-   to GRST_SLASH_TMP and letting the cleanup thread deal with them when
-   it has time; and then remove the headers cached for this file.
+   Add a block already held in memory to the disk cache
 */
 {
-  char *encoded_filename, *dirname, *headersname;
-//  DIR *blocksDIR;
-//  struct dirent *blocks_ent;
+  int          fd;
+  char        *tempfile, *new_filename;
+  size_t       written = 0;
+  ssize_t      n;
 
-  encoded_filename = GRSThttpUrlMildencode(filename);
+  asprintf(&tempfile, "%s/blocks-XXXXXX", GRST_SLASH_TMP);
+
+  if ((fd = mkstemp(tempfile)) == -1)
+    {
+      free(tempfile);
+      return;
+    }
+
+  while ((written < length) && 
+         ((n = write(fd, data + written, length - written)) > 0)) written += n;
+
+  close(fd);
+
+  if (written < length)
+    {
+      unlink(tempfile);
+      free(tempfile);
+      return;
+    }
+
+  new_filename = block_cache_filename(uid, filename, start, finish);
   
-  /* move blocks directory */
+  if (spool_rename(tempfile, new_filename, length) != 0) unlink(tempfile);
 
-  asprintf(&dirname, "%s/%d%s",
-                     GRST_SLASH_BLOCKS, fuse_ctx->uid, encoded_filename);
+  if (debugmode) syslog(LOG_DEBUG, "Added %s to block cache", new_filename);
 
-  rename(dirname, GRST_SLASH_TMP);
-  free(dirname);
+  free(tempfile);
+  free(new_filename);
+}
 
-  /* remove headers file */
+static char *read_block_from_fd(int fd, off_t blocksize, size_t *length)
+/*
+   Read a whole cached block from the start of an open block file into
+   a malloc()ed buffer, for adding to the in-memory cache.
+*/
+{
+  char    *data;
+  ssize_t  n;
 
-  asprintf(&headersname, "%s/%d%s",
-                     GRST_SLASH_HEADERS, fuse_ctx->uid, encoded_filename);
+  if ((data = malloc(blocksize)) == NULL) return NULL;
+
+  *length = 0;
+
+  while ((*length < blocksize) &&
+         ((n = pread(fd, data + *length, blocksize - *length, *length)) > 0))
+                                                             *length += n;
+  return data;
+}
+
+static int prefetch_pending(uid_t uid, char *path, 
+                            off_t start, off_t blocksize)
+/*
+   Returns 1 if this block is queued or being fetched by the read-ahead
+   thread. Caller must hold prefetch_mutex.
+*/
+{
+  struct grst_prefetch *job;
+  
+  for (job = prefetch_queue; job != NULL; job = job->next)
+     if ((job->start == start) && (job->uid == uid) && 
+         (job->blocksize == blocksize) && (strcmp(job->path, path) == 0))
+                                                                   return 1;
+
+  for (job = prefetch_active; job != NULL; job = job->next)
+     if ((job->start == start) && (job->uid == uid) && 
+         (job->blocksize == blocksize) && (strcmp(job->path, path) == 0))
+                                                                   return 1;
+  return 0;
+}
+
+static int prefetch_wait(uid_t uid, char *path, off_t start, off_t blocksize)
+/*
+   If the read-ahead thread is already fetching this block, wait for it
+   rather than fetching it again. Returns 1 if we had to wait.
+*/
+{
+  int waited = 0;
+
+  pthread_mutex_lock(&prefetch_mutex);
+
+  while (prefetch_pending(uid, path, start, blocksize))
+       {
+         waited = 1;
+         pthread_cond_wait(&prefetch_done, &prefetch_mutex);
+       }
+
+  pthread_mutex_unlock(&prefetch_mutex);
+  
+  return waited;
+}
+
+static void prefetch_free(struct grst_prefetch *job)
+{
+  if (job->handle != NULL)
+    {
+      curl_easy_setopt(job->handle->curl_handle, CURLOPT_HTTPHEADER, NULL);
+      curl_easy_setopt(job->handle->curl_handle, CURLOPT_WRITEDATA,  NULL);
+      curl_easy_setopt(job->handle->curl_handle, CURLOPT_ERRORBUFFER, NULL);
+      pool_put(job->handle);
+    }
+
+  if (job->headers_list != NULL) curl_slist_free_all(job->headers_list);
+  if (job->body.text    != NULL) free(job->body.text);
+  free(job->url);
+  free(job->path);
+  free(job);
+}
+
+static int readahead_sequential(struct fuse_context *fuse_ctx, char *path,
+                                off_t offset, size_t size, time_t now)
+/*
+   Record this read against the (uid, pid, path) stream and return 1 if
+   it carries on where the previous read of that stream finished.
+*/
+{
+  int i, j = 0, sequential = 0;
+
+  pthread_mutex_lock(&prefetch_mutex);
+
+  for (i=0; i < GRST_SLASH_MAX_STREAMS; ++i)
+     {
+       if ((streams[i].path != NULL) &&
+           (streams[i].uid  == fuse_ctx->uid) &&
+           (streams[i].pid  == fuse_ctx->pid) &&
+           (strcmp(streams[i].path, path) == 0)) break;
+
+       if (streams[i].last_used < streams[j].last_used) j = i;
+     }
+     
+  if (i < GRST_SLASH_MAX_STREAMS) 
+       sequential = (streams[i].next_offset == offset);
+  else /* replace the least recently used stream */
+    {
+      i = j;
+      
+      if (streams[i].path != NULL) free(streams[i].path);
+      streams[i].uid  = fuse_ctx->uid;
+      streams[i].pid  = fuse_ctx->pid;
+      streams[i].path = strdup(path);
+      
+      sequential = (offset == 0);
+    }
+
+  streams[i].next_offset = offset + size;
+  streams[i].last_used   = now;
+
+  pthread_mutex_unlock(&prefetch_mutex);
+
+  return sequential;
+}
+
+static size_t prefetch_body_callback(void *ptr, size_t size, size_t nmemb,
+                                     void *data)
+/*
+   Collect at most one block of a read-ahead response, aborting the
+   transfer once the block is full, or at once if the server ignored
+   Range for a block other than the first, since none of it would be used.
+*/
+{
+  size_t                n = size * nmemb;
+  struct grst_prefetch *job = (struct grst_prefetch *) data;
+
+  if ((job->request_data.retcode != 206) &&
+      ((job->request_data.retcode != 200) || (job->start != 0))) return 0;
+
+  if (job->body.used + n > (size_t) job->blocksize) 
+                                   n = (size_t) job->blocksize - job->body.used;
+
+  if (n > 0) rawbody_callback(ptr, 1, n, &(job->body));
+
+  return (n == size * nmemb) ? n : 0;
+}
+
+static void readahead_queue(struct fuse_context *fuse_ctx, char *path,
+                            off_t first, off_t blocksize, int readahead,
+                            time_t now)
+/*
+   Queue up to readahead blocks starting at first for the read-ahead
+   thread, skipping any which are already cached or being fetched.
+*/
+{
+  int          i, queued = 0;
+  char        *url, *proxyfile = NULL, *capath = NULL, *range_header,
+              *encoded_filename, *disk_filename;
+  off_t        start, length = 0;
+  time_t       modified;
+  struct stat  statbuf;
+  struct grst_prefetch *job, **pp;
+  struct grst_handle   *handle;
+
+  if (strncmp(path, "/http/", 6) == 0)
+    asprintf(&url, "http://%s", &path[6]);
+  else if (strncmp(path, "/https/", 7) == 0)
+    asprintf(&url, "https://%s", &path[7]);
+  else return;
+
+  /* SiteCast lookups are left to the synchronous path */
+  if (is_sitecast_url(url))
+    {
+      free(url);
+      return;
+    }
+
+  /* don't read ahead beyond the end of the file, if we know it */
+  if (!read_headers_from_cache(fuse_ctx, path, &length, &modified)) length = 0;
+
+  if (url[4] == 's') find_user_creds(fuse_ctx, &capath, &proxyfile);
+
+  encoded_filename = GRSThttpUrlMildencode(path);
+
+  for (i=0; i < readahead; ++i)
+     {
+       start = first + i * blocksize;
+       
+       if ((length > 0) && (start >= length)) break;
+
+       /* stale blocks are left for the reader to revalidate */
+       if (memcache_has(fuse_ctx->uid, path, start, blocksize)) continue;
+       
+       if (memcache_size == 0) /* then only the disk cache can hold it */
+         {
+           asprintf(&disk_filename, "%s/%d%s/%ld-%ld", 
+                    GRST_SLASH_BLOCKS, fuse_ctx->uid, encoded_filename, 
+                    (long) start, (long) (start + blocksize - 1));
+
+           if (stat(disk_filename, &statbuf) == 0)
+             {
+               free(disk_filename);
+               continue;
+             }
+
+           free(disk_filename);
+         }
+
+       /* read-ahead never waits for a handle: give up if none are free */
+
+       if ((handle = pool_get(fuse_ctx->uid, 
+                              (proxyfile != NULL) ? strdup(proxyfile) : NULL,
+                              (capath    != NULL) ? strdup(capath)    : NULL,
+                              0)) == NULL) break;
+
+       job = calloc(1, sizeof(struct grst_prefetch));
+
+       job->handle    = handle;
+       job->uid       = fuse_ctx->uid;
+       job->path      = strdup(path);
+       job->url       = strdup(url);
+       job->start     = start;
+       job->blocksize = blocksize;
+
+       curl_easy_setopt(handle->curl_handle, CURLOPT_CUSTOMREQUEST, NULL);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_NOBODY,        0);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_UPLOAD,        0);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_INFILESIZE,    -1);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPGET,       1);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_URL,           job->url);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEFUNCTION, prefetch_body_callback);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEDATA,     job);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_WRITEHEADER,   &(job->request_data));
+       curl_easy_setopt(handle->curl_handle, CURLOPT_ERRORBUFFER,   job->errorbuffer);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_PRIVATE,       job);
+
+       asprintf(&range_header, "Range: bytes=%ld-%ld", 
+                (long) start, (long) (start + blocksize - 1));
+       job->headers_list = curl_slist_append(NULL, range_header);
+       free(range_header);
+       curl_easy_setopt(handle->curl_handle, CURLOPT_HTTPHEADER, job->headers_list);
+
+       pthread_mutex_lock(&prefetch_mutex);
+
+       if (prefetch_pending(fuse_ctx->uid, path, start, blocksize))
+         {
+           pthread_mutex_unlock(&prefetch_mutex);
+           prefetch_free(job);
+           continue;
+         }
+
+       for (pp = &prefetch_queue; *pp != NULL; pp = &((*pp)->next)) ;
+       *pp = job;
+       ++queued;
+
+       pthread_mutex_unlock(&prefetch_mutex);
+
+       if (debugmode) syslog(LOG_DEBUG, "Queued read-ahead of %s %ld-%ld",
+                             url, (long) start, (long) (start + blocksize - 1));
+     }
+
+  if (queued > 0) pthread_cond_signal(&prefetch_cond);
+  
+  free(encoded_filename);
+  free(url);
+  if (proxyfile != NULL) free(proxyfile);
+  if (capath    != NULL) free(capath);
+}
+
+static void prefetch_complete(struct grst_prefetch *job, CURLcode result)
+/*
+   Put a fetched block into the caches and wake up any reader waiting
+   for it. A server which ignores Range only gives us a usable block if
+   it is the first one, and prefetch_body_callback() stops that transfer
+   with a write error once the block is full.
+*/
+{
+  struct grst_prefetch **pp;
+  struct fuse_context    fuse_ctx;
+
+  if (((result == CURLE_OK) ||
+       ((result == CURLE_WRITE_ERROR) && 
+        (job->body.used == (size_t) job->blocksize))) &&
+      (job->body.text != NULL) &&
+      ((job->request_data.retcode == 206) ||
+       ((job->request_data.retcode == 200) && (job->start == 0))))
+    {
+
+      bzero(&fuse_ctx, sizeof(struct fuse_context));
+      fuse_ctx.uid = job->uid;
+      check_block_validator(&fuse_ctx, job->path, &(job->request_data));
+
+      if (disk_cache) save_block_to_disk(job->uid, job->path, job->start, 
+                                         job->start + job->blocksize - 1,
+                                         job->body.text, job->body.used);
+
+      memcache_store(job->uid, job->path, job->start, job->blocksize,
+                     job->body.text, job->body.used, time(NULL));
+      job->body.text = NULL; /* now owned by the memory cache */
+    }
+  else if (debugmode) 
+         syslog(LOG_DEBUG, "Read-ahead of %s %ld failed: %s (%d), HTTP %d",
+                job->url, (long) job->start, job->errorbuffer, 
+                (int) result, job->request_data.retcode);
+
+  pthread_mutex_lock(&prefetch_mutex);
+
+  for (pp = &prefetch_active; *pp != NULL; pp = &((*pp)->next))
+     if (*pp == job)
+       {
+         *pp = job->next;
+         break;
+       }
+
+  pthread_cond_broadcast(&prefetch_done);
+  pthread_mutex_unlock(&prefetch_mutex);
+
+  prefetch_free(job);
+}
+
+void *prefetch_thread(void *unused)
+/*
+   Fetch queued read-ahead blocks concurrently using the curl multi
+   interface, so a sequential reader only waits one round trip for a
+   whole window of blocks.
+*/
+{
+  int       running = 0, msgs_left, maxfd;
+  long      timeout_ms;
+  fd_set    fdread, fdwrite, fdexcep;
+  struct    timeval tv;
+  CURLM    *multi_handle;
+  CURLMsg  *msg;
+  struct grst_prefetch *job;
+
+  multi_handle = curl_multi_init();
+
+  while (1)
+     {
+       pthread_mutex_lock(&prefetch_mutex);
+
+       while ((prefetch_queue == NULL) && (prefetch_active == NULL))
+                           pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+
+       while ((job = prefetch_queue) != NULL)
+            {
+              prefetch_queue  = job->next;
+              job->next       = prefetch_active;
+              prefetch_active = job;
+
+              curl_multi_add_handle(multi_handle, job->handle->curl_handle);
+            }
+
+       pthread_mutex_unlock(&prefetch_mutex);
+
+       while (curl_multi_perform(multi_handle, &running) ==
+                                        CURLM_CALL_MULTI_PERFORM) ;
+
+       while ((msg = curl_multi_info_read(multi_handle, &msgs_left)) != NULL)
+            {
+              if (msg->msg != CURLMSG_DONE) continue;
+
+              curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &job);
+              curl_multi_remove_handle(multi_handle, msg->easy_handle);
+              prefetch_complete(job, msg->data.result);
+            }
+
+       if (running == 0) continue;
+
+       /* wait for activity, but not so long that new jobs are delayed */
+
+       FD_ZERO(&fdread);
+       FD_ZERO(&fdwrite);
+       FD_ZERO(&fdexcep);
+       maxfd = -1;
+       
+       curl_multi_fdset(multi_handle, &fdread, &fdwrite, &fdexcep, &maxfd);
+       curl_multi_timeout(multi_handle, &timeout_ms);
+
+       if ((timeout_ms < 0) || (timeout_ms > 100)) timeout_ms = 100;
+
+       tv.tv_sec  = 0;
+       tv.tv_usec = timeout_ms * 1000;
+
+       if (maxfd == -1) usleep(tv.tv_usec);
+       else select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &tv);
+     }
+}
+
+void drop_cache_blocks(struct fuse_context *fuse_ctx, char *filename)
+/*
+   Drop ALL the blocks cached for this file by moving the whole directory
+   to GRST_SLASH_TMP and letting the evict thread deal with them when
+   it has time; and then remove the headers cached for this file.
+   Blocks held in the in-memory cache and the file's cached attributes
+   are freed straight away.
+*/
+{
+  char *encoded_filename, *dirname, *headersname, *tmpname, *key;
+//  DIR *blocksDIR;
+//  struct dirent *blocks_ent;
+
+  memcache_drop(fuse_ctx->uid, filename);
+  attrcache_drop(fuse_ctx->uid, filename);
+
+  encoded_filename = GRSThttpUrlMildencode(filename);
+  
+  /* move blocks directory onto a new empty directory in GRST_SLASH_TMP */
+
+  asprintf(&dirname, "%s/%d%s",
+                     GRST_SLASH_BLOCKS, fuse_ctx->uid, encoded_filename);
+  asprintf(&tmpname, "%s/dropped-XXXXXX", GRST_SLASH_TMP);
+
+  if (mkdtemp(tmpname) != NULL)
+    {
+      if (rename(dirname, tmpname) != 0) rmdir(tmpname);
+    }
+
+  free(tmpname);
+  free(dirname);
+
+  /* remove headers file */
+
+  asprintf(&headersname, "%s/%d%s",
+                     GRST_SLASH_HEADERS, fuse_ctx->uid, encoded_filename);
+
+  unlink(headersname);
+  free(headersname);
+
+  /* both were under this key in the spool index */
+
+  asprintf(&key, "%d%s", fuse_ctx->uid, encoded_filename);
+  spool_forget(key);
+  free(key);
+
+  /* finish */
+
+  free(encoded_filename);
+  return;
+  
+#if 0
+  blocksDIR = opendir(dirname);
+  
+  if (blocksDIR == NULL) /* no directory to delete (probably) */
+    {
+      free(dirname);
+      return 1;
+    }
+    
+  while ((blocks_ent = readdir(blocksDIR)) != NULL)
+       {
+         asprintf(&blockname, "%s/%s", dirname, blocks_ent->d_name);
+         remove(blockname);
+         free(blockname);
+       }  
+  
+  closedir(blocksDIR);
+    
+  ret = rmdir(dirname);
+  free(dirname);  
+
+  return ret ? 1 : 0; /* return 1 on error, 0 on rmdir() success */
+#endif
+}
+
+static int revalidate_file(struct fuse_context *fuse_ctx, char *path)
+/*
+   Check whether the cached headers, and so the cached blocks, of this
+   file still describe the remote file: straight away if the headers were
+   cached or revalidated in the last GRST_SLASH_CACHE_EXPIRE seconds, or
+   else with a conditional HEAD. Returns 1 if cached blocks can be used.
+*/
+{
+  int    thiserror, ret = 0;
+  char  *url, errorbuffer[CURL_ERROR_SIZE+1] = "", 
+         etag[GRST_SLASH_MAX_ETAG+1];
+  off_t  length, new_length;
+  time_t modified, new_modified, written;
+  struct grst_request request_data;
+
+  if (!read_headers_file(fuse_ctx, path, &length, &modified, etag, &written))
+                                                                   return 0;
+
+  if (written >= time(NULL) - GRST_SLASH_CACHE_EXPIRE) return 1;
+
+  if (strncmp(path, "/http/", 6) == 0)
+    asprintf(&url, "http://%s", &path[6]);
+  else if (strncmp(path, "/https/", 7) == 0)
+    asprintf(&url, "https://%s", &path[7]);
+  else return 0;
+
+  bzero(&request_data, sizeof(struct grst_request));
+  request_data.writefunction = null_callback;
+  request_data.readfunction  = null_callback;
+  request_data.errorbuffer   = errorbuffer;
+  request_data.url           = url;
+  request_data.method        = GRST_SLASH_HEAD;
+  request_data.start         = -1;
+  request_data.finish        = -1;
+
+  if (etag[0] != '\0') request_data.if_none_match     = etag;
+  if (modified > 0)   request_data.if_modified_since = modified;
+
+  thiserror = perform_request(&request_data, fuse_ctx);
+
+  if ((thiserror == 0) && (request_data.retcode == 304))
+    {
+      if (debugmode) syslog(LOG_DEBUG, "%s has not changed", url);
+
+      /* rewriting the headers extends their lifetime */
+      write_headers_to_cache(fuse_ctx, path, length, modified, etag);
+      ret = 1;
+    }
+  else if ((thiserror == 0) && 
+           (request_data.retcode >= 200) && (request_data.retcode < 300))
+    {
+      /* server ignored the conditions, so compare for ourselves */
+    
+      new_length   = request_data.length_set   ? request_data.length   : 0;
+      new_modified = request_data.modified_set ? request_data.modified : 0;
+
+      ret = (new_length == length) && (new_modified == modified) &&
+            (!request_data.etag_set || (etag[0] == '\0') ||
+             (strcmp(request_data.etag, etag) == 0));
+
+      /* drops the cached blocks too, if the file has changed */
+      write_headers_to_cache(fuse_ctx, path, new_length, new_modified,
+                             request_data.etag_set ? request_data.etag : "");
+    }
+  else if (debugmode)
+        syslog(LOG_DEBUG, "... revalidation curl error: %s (%d), HTTP error: %d",
+               errorbuffer, thiserror, request_data.retcode);
+
+  free(url);
+
+  return ret;
+}
+
+static int slashgrid_read(const char *path, char *buf, 
+                          size_t size, off_t offset,
+                          struct fuse_file_info *fi)
+{
+  (void) offset;
+  (void) fi;
+
+  int          anyerror = 0, thiserror, i, fd, readahead, valid = -1;
+  char        *s, *url, *disk_filename, *encoded_filename, *localpath,
+              *bufp, *block;
+  ssize_t      n;
+  off_t        blocksize, block_start, block_finish, block_i, len, skip;
+  size_t       count, block_len;
+  struct       grst_body_text   rawbody;
+  struct       grst_request request_data;
+  struct       tm               modified_tm;
+  struct       stat             statbuf;
+  time_t                        now;
+  GRSTgaclPerm perm;
+  struct fuse_context fuse_ctx;
+
+  memcpy(&fuse_ctx, fuse_get_context(), sizeof(struct fuse_context));
+  
+  if (debugmode) syslog(LOG_DEBUG, "in slashgrid_read size=%ld offset=%ld",
+                                    (long) size, (long) offset);
+
+  if ((local_root != NULL) && (strncmp(path, "/local/", 7) == 0))
+    {
+      asprintf(&localpath, "%s/%s", local_root, &path[7]);
+      
+      perm = get_gaclPerm(&fuse_ctx, localpath);
+      
+      if (GRSTgaclPermHasRead(perm))
+        {
+          fd = open(localpath, O_RDONLY);
+
+          if (lseek(fd, offset, SEEK_SET) < 0) size = -1;
+          else size = read(fd, buf, size);
+
+          close(fd);                  
+        }
+      else size = -1;
+      
+      free(localpath);
+      
+      return size;
+    }
+
+  if ((strncmp(path, "/http/",  6) != 0) &&
+      (strncmp(path, "/https/", 7) != 0)) return -ENOENT;
+
+  /* make sure we read back anything this user has written */
+  if ((thiserror = writeback_flush_path(&fuse_ctx, (char *) path, 0)) != 0)
+                                                            return thiserror;
+
+  check_user_environ(NULL, NULL, &blocksize, &readahead, 
+                     fuse_ctx.pid, fuse_ctx.uid);
+
+  if (debugmode) syslog(LOG_DEBUG, 
+                "in slashgrid_read, process blocksize=%ld offset=%ld",
+                                    (long) blocksize, (long) offset);
+
+  /* start byte of first block required */
+  block_start  = blocksize * (offset / blocksize);
+  
+  /* start byte of last block required */
+  block_finish = blocksize * ((offset + size - 1) / blocksize);
+
+  encoded_filename = GRSThttpUrlMildencode((char *) path);
+  time(&now);
+
+  /* start fetching the following blocks while we deal with these ones */
+
+  if ((readahead > 0) && ((memcache_size > 0) || disk_cache) &&
+      readahead_sequential(&fuse_ctx, (char *) path, offset, size, now))
+    readahead_queue(&fuse_ctx, (char *) path, block_finish + blocksize,
+                    blocksize, readahead, now);
+ 
+  for (block_i = block_start; block_i <= block_finish; block_i += blocksize)
+     {     
+       /* the part of this block which is copied into buf */
+     
+       skip  = (block_i == block_start) ? offset - block_start : 0;
+       count = blocksize - skip;
+       if (block_i + skip + count > offset + size) 
+                                     count = offset + size - block_i - skip;
+       bufp  = buf + (block_i + skip - offset);
+
+       /* hot blocks come straight from memory without any syscalls */
+
+       n = memcache_read(fuse_ctx.uid, path, block_i, blocksize,
+                         bufp, skip, count, now);
+
+       if (n == -2) /* in memory, but needs to be revalidated */
+         {
+           if (valid == -1) valid = revalidate_file(&fuse_ctx, (char *) path);
+         
+           if (valid)
+             {
+               memcache_touch(fuse_ctx.uid, path, now);
+               n = memcache_read(fuse_ctx.uid, path, block_i, blocksize,
+                                 bufp, skip, count, now);
+             }
+         }
+
+       if (n >= 0) continue;
+
+       /* the read-ahead thread may be fetching it for us already */
+
+       if (prefetch_wait(fuse_ctx.uid, (char *) path, block_i, blocksize) &&
+           (memcache_read(fuse_ctx.uid, path, block_i, blocksize,
+                          bufp, skip, count, now) >= 0)) continue;
+
+       block     = NULL;
+       block_len = 0;
+
+       if (!disk_cache)
+         {
+           rawbody.text      = NULL;
+           rawbody.used      = 0;
+           rawbody.allocated = 0;
+         
+           if (get_block(&fuse_ctx, (char *) path, 
+                         block_i, block_i + blocksize - 1,
+                         rawbody_callback, (void *) &rawbody) == 0)
+             {
+               block     = rawbody.text;
+               block_len = rawbody.used;
+             }
+           else if (rawbody.text != NULL) free(rawbody.text);
+         }
+       else
+         {
+           asprintf(&disk_filename, "%s/%d%s/%ld-%ld", 
+                     GRST_SLASH_BLOCKS, fuse_ctx.uid, encoded_filename, 
+                     (long) block_i, (long) (block_i + blocksize - 1));
+
+           if (debugmode) syslog(LOG_DEBUG, "disk_filename=%s", disk_filename);
+                 
+           fd = open(disk_filename, O_RDONLY);
+       
+           if ((fd != -1) &&
+               ((fstat(fd, &statbuf) != 0) ||
+                (statbuf.st_mtime < now - GRST_SLASH_CACHE_EXPIRE)))
+             {
+               /* keep expired blocks if the file hasn't changed */
+             
+               if (valid == -1) 
+                          valid = revalidate_file(&fuse_ctx, (char *) path);
+               
+               if (valid) utime(disk_filename, NULL);
+               else
+                 {
+                   close(fd);
+                   fd = -1;
+                 }
+             }
+
+           if (fd == -1)
+             {
+               write_block_to_cache(&fuse_ctx, (char *) path, 
+                                block_i, block_i + blocksize - 1);
+                            
+               fd = open(disk_filename, O_RDONLY);                            
+             }
+
+           /* even if another thread deletes disk_filename between 
+              open and read, we've still got it open so can carry on */
+
+           if (fd != -1)
+             {
+               spool_touch(disk_filename);
+             
+               if (memcache_size > 0) 
+                 block = read_block_from_fd(fd, blocksize, &block_len);
+               else if (skip > 0) pread(fd, bufp, count, skip);
+               else read(fd, bufp, count);
+             
+               close(fd);
+             }        
+           else syslog(LOG_ERR, "Failed to open %s in cache", disk_filename);
+
+           free(disk_filename);
+         }
+
+       if (block != NULL)
+         {
+           if ((size_t) skip < block_len)
+             memcpy(bufp, block + skip, 
+                    (block_len - skip < count) ? block_len - skip : count);
+
+           memcache_store(fuse_ctx.uid, path, block_i, blocksize,
+                          block, block_len, now);
+         }
+     }
+
+  free(encoded_filename);
+
+  if (debugmode) syslog(LOG_DEBUG, 
+                  "slashgrid_read finishes, process blocksize=%ld offset=%ld",
+                  (long) blocksize, (long) offset);
+  return size;
+}
+
+static int put_range(struct fuse_context *fuse_ctx, char *path,
+                     const char *buf, size_t size, off_t offset)
+/*
+   PUT size bytes from buf at offset in the remote file, using a 
+   Content-Range header. Returns 0 on success or -errno.
+*/
+{
+  int          thiserror;
+  char        *url, errorbuffer[CURL_ERROR_SIZE+1] = "";
+  struct grst_read_data read_data;
+  struct grst_request request_data;
+
+  if (strncmp(path, "/http/", 6) == 0)
+    asprintf(&url, "http://%s", &path[6]);
+  else if (strncmp(path, "/https/", 7) == 0)
+    asprintf(&url, "https://%s", &path[7]);
+  else return -ENOENT;
+
+  read_data.buf     = buf;
+  read_data.sent    = 0;
+  read_data.maxsent = size;
+
+  if (debugmode) syslog(LOG_DEBUG, "Put block %ld-%ld to URL %s", 
+                                   (long) offset, (long) offset+size-1, url);
+
+  drop_cache_blocks(fuse_ctx, path); /* we drop all read-cache blocks first */
+  
+  bzero(&request_data, sizeof(struct grst_request));
+  request_data.writefunction = null_callback;
+  request_data.readfunction  = read_data_callback;
+  request_data.readdata      = &read_data;
+  request_data.infilesize    = size;
+  request_data.errorbuffer   = errorbuffer;
+  request_data.url           = url;
+  request_data.method        = GRST_SLASH_PUT;
+  request_data.start         = offset;
+  request_data.finish        = (off_t) (offset + size - 1);
+
+  thiserror = perform_request(&request_data, fuse_ctx);
+
+  free(url);
+
+  /* in case a getattr() cached the old size while we were sending */
+  attrcache_drop(fuse_ctx->uid, path);
+
+  if ((thiserror != 0) ||
+      (request_data.retcode <  200) ||
+      (request_data.retcode >= 300))
+    {
+           if (debugmode)
+                syslog(LOG_DEBUG, "... curl error: %s (%d), HTTP error: %d\n",
+                       errorbuffer, thiserror, request_data.retcode);
+           
+           if (request_data.retcode == 403) return -EACCES;
+           else return -ENOENT; 
+    }
+
+  return 0;
+}
+
+static struct grst_writeback *writeback_find(uid_t uid, char *path)
+/*
+   Find the write-back buffer for this file. Caller holds writeback_mutex.
+*/
+{
+  struct grst_writeback *wb;
+
+  for (wb = writebacks; wb != NULL; wb = wb->next)
+     if ((wb->fuse_ctx.uid == uid) && (strcmp(wb->path, path) == 0)) 
+                                                                  return wb;
+  return NULL;
+}
+
+static void writeback_wait(struct grst_writeback *wb)
+/*
+   Wait until no flush of this buffer is in progress. Caller holds 
+   writeback_mutex. The buffer is pinned while we wait, so that 
+   writeback_thread can't forget it before we have the mutex again.
+*/
+{
+  ++(wb->waiters);
+  
+  while (wb->flushing) pthread_cond_wait(&writeback_cond, &writeback_mutex);
+  
+  --(wb->waiters);
+}
+
+static int writeback_flush_locked(struct grst_writeback *wb)
+/*
+   PUT the buffered range of this file as one request. Caller holds
+   writeback_mutex, which is released during the PUT; other writers to
+   this file wait until wb->flushing is cleared. Returns 0 or -errno.
+*/
+{
+  int    ret;
+  char  *data;
+  size_t used;
+  off_t  start;
+  struct fuse_context fuse_ctx;
+
+  writeback_wait(wb);
+
+  if (wb->used == 0) return 0;
+
+  wb->flushing = 1;
+  
+  data  = wb->data;
+  used  = wb->used;
+  start = wb->start;
+  memcpy(&fuse_ctx, &(wb->fuse_ctx), sizeof(struct fuse_context));
+
+  wb->data      = NULL;
+  wb->used      = 0;
+  wb->allocated = 0;
+
+  pthread_mutex_unlock(&writeback_mutex);
+
+  ret = put_range(&fuse_ctx, wb->path, data, used, start);
+  free(data);
+
+  pthread_mutex_lock(&writeback_mutex);
+
+  wb->flushing = 0;
+  pthread_cond_broadcast(&writeback_cond);
+
+  return ret;
+}
+
+static int writeback_flush_path(struct fuse_context *fuse_ctx, char *path,
+                                int take_error)
+/*
+   Flush any buffered writes to this file by this user, so that reads
+   and metadata operations see them. If take_error is set, an error left
+   by an earlier background flush is returned (once) too.
+*/
+{
+  int ret = 0;
+  struct grst_writeback *wb;
+
+  if (writeback_size == 0) return 0;
+
+  pthread_mutex_lock(&writeback_mutex);
+  
+  if ((wb = writeback_find(fuse_ctx->uid, path)) != NULL)
+    {
+      ret = writeback_flush_locked(wb);
+
+      if (take_error && (ret == 0)) ret = wb->error;
+      if (take_error) wb->error = 0;
+    }
+
+  pthread_mutex_unlock(&writeback_mutex);
+  
+  return ret;
+}
 
-  unlink(headersname);
-  free(headersname);
+static void writeback_discard_path(struct fuse_context *fuse_ctx, char *path)
+/*
+   Throw away any buffered writes to this file by this user, and any
+   error left by an earlier background flush, as the file is going away.
+*/
+{
+  struct grst_writeback *wb;
 
-  /* finish */
+  if (writeback_size == 0) return;
 
-  free(encoded_filename);
-  return;
-  
-#if 0
-  blocksDIR = opendir(dirname);
+  pthread_mutex_lock(&writeback_mutex);
   
-  if (blocksDIR == NULL) /* no directory to delete (probably) */
+  if ((wb = writeback_find(fuse_ctx->uid, path)) != NULL)
     {
-      free(dirname);
-      return 1;
+      writeback_wait(wb);
+
+      if (wb->data != NULL) free(wb->data);
+
+      wb->data      = NULL;
+      wb->used      = 0;
+      wb->allocated = 0;
+      wb->error     = 0;
     }
-    
-  while ((blocks_ent = readdir(blocksDIR)) != NULL)
-       {
-         asprintf(&blockname, "%s/%s", dirname, blocks_ent->d_name);
-         remove(blockname);
-         free(blockname);
-       }  
-  
-  closedir(blocksDIR);
-    
-  ret = rmdir(dirname);
-  free(dirname);  
 
-  return ret ? 1 : 0; /* return 1 on error, 0 on rmdir() success */
-#endif
+  pthread_mutex_unlock(&writeback_mutex);
 }
 
-static int slashgrid_read(const char *path, char *buf, 
-                          size_t size, off_t offset,
-                          struct fuse_file_info *fi)
+static int writeback_write(struct fuse_context *fuse_ctx, char *path,
+                           const char *buf, size_t size, off_t offset)
+/*
+   Add a write to the buffer for this file, flushing first if it doesn't
+   carry on from the buffered range and afterwards if it fills the buffer.
+   Returns 0 or -errno, including (once) an error left by an earlier
+   background flush.
+*/
 {
-  (void) offset;
-  (void) fi;
-
-  int          anyerror = 0, thiserror, i, fd;
-  char        *s, *url, *disk_filename, *encoded_filename, *localpath;
-  off_t        blocksize, block_start, block_finish, block_i, len;
-  struct       grst_body_text   rawbody;
-  struct       grst_request request_data;
-  struct       tm               modified_tm;
-  struct       stat             statbuf;
-  time_t                        now;
-  GRSTgaclPerm perm;
-  struct fuse_context fuse_ctx;
+  int ret = 0;
+  struct grst_writeback *wb;
 
-  memcpy(&fuse_ctx, fuse_get_context(), sizeof(struct fuse_context));
-  
-  if (debugmode) syslog(LOG_DEBUG, "in slashgrid_read size=%ld offset=%ld",
-                                    (long) size, (long) offset);
+  pthread_mutex_lock(&writeback_mutex);
 
-  if ((local_root != NULL) && (strncmp(path, "/local/", 7) == 0))
+  if ((wb = writeback_find(fuse_ctx->uid, path)) == NULL)
     {
-      asprintf(&localpath, "%s/%s", local_root, &path[7]);
-      
-      perm = get_gaclPerm(&fuse_ctx, localpath);
-      
-      if (GRSTgaclPermHasRead(perm))
-        {
-          fd = open(localpath, O_RDONLY);
+      wb = calloc(1, sizeof(struct grst_writeback));
+      wb->path   = strdup(path);
+      wb->next   = writebacks;
+      writebacks = wb;
+    }
 
-          if (lseek(fd, offset, SEEK_SET) < 0) size = -1;
-          else size = read(fd, buf, size);
+  writeback_wait(wb);
 
-          close(fd);                  
+  if (wb->error != 0)
+    {
+      ret = wb->error;
+      wb->error = 0;
+      pthread_mutex_unlock(&writeback_mutex);
+      return ret;
+    }
+
+  if ((wb->used > 0) && (offset != wb->start + (off_t) wb->used))
+    {
+      if ((ret = writeback_flush_locked(wb)) != 0)
+        {
+          pthread_mutex_unlock(&writeback_mutex);
+          return ret;
         }
-      else size = -1;
-      
-      free(localpath);
-      
-      return size;
     }
 
-  if ((strncmp(path, "/http/",  6) != 0) &&
-      (strncmp(path, "/https/", 7) != 0)) return -ENOENT;
+  /* credentials are found via the most recent writer */
+  memcpy(&(wb->fuse_ctx), fuse_ctx, sizeof(struct fuse_context));
+  time(&(wb->last_used));
 
-  check_user_environ(NULL, NULL, &blocksize, fuse_ctx.pid);
+  if (wb->used == 0)
+    {
+      wb->start       = offset;
+      wb->first_write = wb->last_used;
+    }
 
-  if (debugmode) syslog(LOG_DEBUG, 
-                "in slashgrid_read, process blocksize=%ld offset=%ld",
-                                    (long) blocksize, (long) offset);
+  if (wb->used + size > wb->allocated)
+    {
+      wb->allocated = wb->used + size;
+      if (wb->allocated < writeback_size) wb->allocated = writeback_size;
+      wb->data = realloc(wb->data, wb->allocated);
+    }
 
-  /* start byte of first block required */
-  block_start  = blocksize * (offset / blocksize);
+  memcpy(wb->data + wb->used, buf, size);
+  wb->used += size;
+
+  if (wb->used >= writeback_size) ret = writeback_flush_locked(wb);
   
-  /* start byte of last block required */
-  block_finish = blocksize * ((offset + size - 1) / blocksize);
+  pthread_mutex_unlock(&writeback_mutex);
 
-  encoded_filename = GRSThttpUrlMildencode((char *) path);
-  time(&now);
- 
-  for (block_i = block_start; block_i <= block_finish; block_i += blocksize)
-     {     
-       asprintf(&disk_filename, "%s/%d%s/%ld-%ld", 
-                 GRST_SLASH_BLOCKS, fuse_ctx.uid, encoded_filename, 
-                 (long) block_i, (long) (block_i + blocksize - 1));
+  return ret;
+}
 
-       if (debugmode) syslog(LOG_DEBUG, "disk_filename=%s", disk_filename);
-                 
-       fd = open(disk_filename, O_RDONLY);
-       
-       if ((fd == -1) ||
-           (fstat(fd, &statbuf) != 0) ||
-           (statbuf.st_mtime < now - GRST_SLASH_CACHE_EXPIRE))
-         {
-           if (fd != -1) close(fd);
-         
-           write_block_to_cache(&fuse_ctx, (char *) path, 
-                            block_i, block_i + blocksize - 1);
-                            
-           fd = open(disk_filename, O_RDONLY);                            
-         }
+void *writeback_thread(void *unused)
+/*
+   Flush buffers which have been waiting for GRST_SLASH_WRITEBACK_DELAY
+   seconds, and forget empty buffers of files no longer being written.
+   Errors are kept to be returned by the next write, flush or release.
+*/
+{
+  int ret;
+  time_t now;
+  struct grst_writeback *wb, **pp;
 
-       /* even if another thread deletes disk_filename between 
-          open and read, we've still got it open so can carry on */
+  while (1)
+   {
+     sleep(1);
+     
+     pthread_mutex_lock(&writeback_mutex);
+     time(&now);
+     
+     pp = &writebacks;
+     
+     while ((wb = *pp) != NULL)
+          {
+            if (!wb->flushing && (wb->used > 0) &&
+                (wb->first_write <= now - GRST_SLASH_WRITEBACK_DELAY))
+              {
+                /* mutex is released during flush, so rescan afterwards */
+                if ((ret = writeback_flush_locked(wb)) != 0) wb->error = ret;
+                pp = &writebacks;
+              }
+            else if (!wb->flushing && (wb->waiters == 0) && 
+                     (wb->used == 0) && (wb->error == 0) &&
+                     (wb->last_used < now - GRST_SLASH_WRITEBACK_IDLE))
+              {
+                *pp = wb->next;
+                if (wb->data != NULL) free(wb->data);
+                free(wb->path);
+                free(wb);
+              }
+            else pp = &(wb->next);
+          }
 
-       if (fd != -1)
-         {
-           if (block_i == block_start)              
-             {
-               lseek(fd, offset - block_start, SEEK_SET);
-               read(fd, buf, 
-                        (offset - block_start + size < blocksize) 
-                       ? size : blocksize - offset + block_start);
-             }
-           else if (block_i == block_finish)
-             {
-               read(fd, buf + (block_i - offset),
-                        offset + size - block_i);
-             }
-           else 
-             {
-               read(fd, buf + (block_i - offset), 
-                        blocksize);
-             }
-             
-           close(fd);
-         }        
-       else syslog(LOG_ERR, "Failed to open %s in cache", disk_filename);
-     }
+     pthread_mutex_unlock(&writeback_mutex);
+   }
+}
 
-  free(disk_filename);
-  free(encoded_filename);
+static int slashgrid_flush(const char *path, struct fuse_file_info *fi)
+{
+  struct fuse_context fuse_ctx;
 
-  if (debugmode) syslog(LOG_DEBUG, 
-                  "slashgrid_read finishes, process blocksize=%ld offset=%ld",
-                  (long) blocksize, (long) offset);
-  return size;
+  memcpy(&fuse_ctx, fuse_get_context(), sizeof(struct fuse_context));
+
+  return writeback_flush_path(&fuse_ctx, (char *) path, 1);
+}
+
+static int slashgrid_fsync(const char *path, int datasync,
+                           struct fuse_file_info *fi)
+{
+  return slashgrid_flush(path, fi);
+}
+
+static int slashgrid_release(const char *path, struct fuse_file_info *fi)
+{
+  return slashgrid_flush(path, fi);
 }
 
 static int slashgrid_write(const char *path, const char *buf, 
                            size_t size, off_t offset,
                            struct fuse_file_info *fi)
 {
-  int          anyerror = 0, thiserror, i, fd;
-  char        *s, *url, *p, errorbuffer[CURL_ERROR_SIZE+1] = "", *localpath;
+  int          fd, ret;
+  char        *localpath;
   GRSTgaclPerm perm;
 
-  struct grst_read_data read_data;
-  struct grst_request request_data;
   struct fuse_context fuse_ctx;
   
   memcpy(&fuse_ctx, fuse_get_context(), sizeof(struct fuse_context));  
@@ -2172,53 +4765,16 @@ static int slashgrid_write(const char *path, const char *buf,
       return size;
     }
 
-  if (strncmp(path, "/http/", 6) == 0)
-    asprintf(&url, "http://%s", &path[6]);
-  else if (strncmp(path, "/https/", 7) == 0)
-    asprintf(&url, "https://%s", &path[7]);
-  else return -ENOENT;
-
-  read_data.buf     = buf;
-  read_data.sent    = 0;
-  read_data.maxsent = size;
-
-  if (debugmode) syslog(LOG_DEBUG, "Put block %ld-%ld to URL %s", 
-                                   (long) offset, (long) offset+size-1, url);
-
-  drop_cache_blocks(&fuse_ctx, (char *) path); /* we drop all read-cache blocks first */
-  
-  bzero(&request_data, sizeof(struct grst_request));
-  request_data.writefunction = null_callback;
-  request_data.readfunction  = read_data_callback;
-  request_data.readdata      = &read_data;
-  request_data.infilesize    = size;
-  request_data.errorbuffer   = errorbuffer;
-  request_data.url           = url;
-  request_data.method        = GRST_SLASH_PUT;
-  request_data.start         = offset;
-  request_data.finish        = (off_t) (offset + size - 1);
-
-  thiserror = perform_request(&request_data, &fuse_ctx);
-
-  free(url);
+  if ((strncmp(path, "/http/",  6) != 0) &&
+      (strncmp(path, "/https/", 7) != 0)) return -ENOENT;
 
-  if ((thiserror != 0) ||
-      (request_data.retcode <  200) ||
-      (request_data.retcode >= 300))
-    {
-           if (debugmode)
-                syslog(LOG_DEBUG, "... curl error: %s (%d), HTTP error: %d\n",
-                       errorbuffer, thiserror, request_data.retcode);
-           
-           if (thiserror != 0) anyerror = thiserror;
-           else                anyerror = request_data.retcode;
+  /* coalesce contiguous writes into large ranged PUTs if we can */
 
-           if (request_data.retcode == 403) return -EACCES;
-           else return -ENOENT; 
-/* memory clean up still needed here!!!!!! */
-    }
+  if (writeback_size > 0)
+       ret = writeback_write(&fuse_ctx, (char *) path, buf, size, offset);
+  else ret = put_range(&fuse_ctx, (char *) path, buf, size, offset);
 
-  return size;
+  return (ret == 0) ? size : ret;
 }
 
 int slashgrid_rename(const char *oldpath, const char *newpath)
@@ -2279,6 +4835,8 @@ int slashgrid_rename(const char *oldpath, const char *newpath)
     }
   else return -ENOENT;
 
+  writeback_flush_path(&fuse_ctx, (char *) oldpath, 0);
+
   read_data.buf     = "";
   read_data.sent    = 0;
   read_data.maxsent = 0;
@@ -2315,6 +4873,9 @@ int slashgrid_rename(const char *oldpath, const char *newpath)
 /* memory clean up still needed here!!!!!! */
     }
 
+  drop_cache_blocks(&fuse_ctx, (char *) oldpath);
+  drop_cache_blocks(&fuse_ctx, (char *) newpath);
+
   return 0;
 }
 
@@ -2356,6 +4917,8 @@ int slashgrid_unlink(const char *path)
     }
   else return -ENOENT;
 
+  writeback_discard_path(&fuse_ctx, (char *) path);
+
   read_data.buf     = "";
   read_data.sent    = 0;
   read_data.maxsent = 0;
@@ -2390,6 +4953,8 @@ int slashgrid_unlink(const char *path)
 /* memory clean up still needed here!!!!!! */
          }
 
+  drop_cache_blocks(&fuse_ctx, (char *) path);
+
   return 0;
 }
 
@@ -2410,11 +4975,18 @@ int slashgrid_rmdir(const char *path)
 int slashgrid_mknod(const char *path, mode_t mode, dev_t dev)
 {
   int ret;
+  struct fuse_context fuse_ctx;
+
+  memcpy(&fuse_ctx, fuse_get_context(), sizeof(struct fuse_context));
 
   if (debugmode) syslog(LOG_DEBUG, "slashgrid_mknod called for %s", path);
   
   ret = slashgrid_write(path, "", 0, 0, NULL);
 
+  /* create it now, not when the write-back buffer is next flushed */
+  if ((ret >= 0) && (strncmp(path, "/local/", 7) != 0))
+             ret = writeback_flush_path(&fuse_ctx, (char *) path, 1);
+
   return (ret < 0) ? ret : 0;
 }
 
@@ -2450,6 +5022,8 @@ int slashgrid_mkdir(const char *path, mode_t mode)
 
   asprintf(&pathwithslash, "%s/", path);
   ret = slashgrid_write(pathwithslash, "", 0, 0, NULL);
+
+  if (ret >= 0) ret = writeback_flush_path(&fuse_ctx, pathwithslash, 1);
   free(pathwithslash);
 
   return (ret < 0) ? ret : 0;
@@ -2505,6 +5079,8 @@ int slashgrid_truncate(const char *path, off_t offset)
     }
   else return -ENOENT;
 
+  writeback_flush_path(&fuse_ctx, (char *) path, 0);
+
   read_data.buf     = "";
   read_data.sent    = 0;
   read_data.maxsent = 0;
@@ -2541,6 +5117,8 @@ int slashgrid_truncate(const char *path, off_t offset)
 /* memory clean up still needed here!!!!!! */
          }
 
+  drop_cache_blocks(&fuse_ctx, (char *) path);
+
   return 0;
 }
 
@@ -2561,7 +5139,8 @@ void *slashgrid_init(void)
 */
 {
   FILE *fp;
-  pthread_t cleanup_thread_t;
+  pthread_t evict_thread_t, prefetch_thread_t, reaper_thread_t,
+            writeback_thread_t;
   struct rlimit unlimited = { RLIM_INFINITY, RLIM_INFINITY };
   
   if ((fp = fopen(GRST_SLASH_PIDFILE, "w")) != NULL)
@@ -2576,7 +5155,16 @@ void *slashgrid_init(void)
       setrlimit(RLIMIT_CORE, &unlimited);
     }
 
-  pthread_create(&cleanup_thread_t, NULL, cleanup_thread, NULL);
+  /* must be done before any of our threads use curl */
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  pthread_create(&evict_thread_t, NULL, evict_thread, NULL);
+  pthread_create(&prefetch_thread_t, NULL, prefetch_thread, NULL);
+  pthread_create(&reaper_thread_t, NULL, reaper_thread, NULL);
+  pthread_create(&writeback_thread_t, NULL, writeback_thread, NULL);
+
+  /* inotify fd must be created after the fork, so done here */
+  if (local_root != NULL) GRSTgaclFileFindAclnameCache(GRST_SLASH_ACLNAME_CACHE);
 
   return NULL;
 }
@@ -2594,6 +5182,9 @@ static struct fuse_operations slashgrid_oper = {
   .readdir	= slashgrid_readdir,
   .write	= slashgrid_write,
   .read		= slashgrid_read,
+  .flush	= slashgrid_flush,
+  .release	= slashgrid_release,
+  .fsync	= slashgrid_fsync,
   .mknod	= slashgrid_mknod,
   .mkdir	= slashgrid_mkdir,
   .unlink	= slashgrid_unlink,
@@ -2622,8 +5213,8 @@ int slashgrid_logfunc(char *file, int line, int level, char *fmt, ...)
 int main(int argc, char *argv[])
 {
   char *fuse_argv[] = { "slashgrid", "/grid", "-o", "allow_other,large_read",
-                        "-s", "-d" };
-  int   i, ret, fuse_argc = 4; /* by default, ignore the final 2 args */
+                        NULL, NULL };
+  int   i, ret, fuse_argc = 4, foreground = 0, single_threaded = 0;
   struct passwd *pw;  
   
   for (i=1; i < argc; ++i)
@@ -2634,8 +5225,12 @@ int main(int argc, char *argv[])
          }
        else if (strcmp(argv[i], "--foreground") == 0) 
          {
-           debugmode = 1;
-           fuse_argc = 6;
+           debugmode  = 1;
+           foreground = 1;
+         }
+       else if (strcmp(argv[i], "--single-threaded") == 0) 
+         {
+           single_threaded = 1;
          }
        else if ((strcmp(argv[i], "--domain") == 0) && (i + 1 < argc))
          {
@@ -2689,6 +5284,82 @@ int main(int argc, char *argv[])
              
            ++i;
          }          
+       else if ((strcmp(argv[i], "--memory-cache") == 0) && (i + 1 < argc))
+         {
+           if (atol(argv[i+1]) < 0)
+             {
+               fprintf(stderr, "if present, memory cache size must not be negative\n");
+               return 1;
+             }
+
+           memcache_size = (size_t) atol(argv[i+1]);
+           ++i;
+         }          
+       else if ((strcmp(argv[i], "--readahead") == 0) && (i + 1 < argc))
+         {
+           default_readahead = atoi(argv[i+1]);
+           if ((default_readahead < 0) || 
+               (default_readahead > GRST_SLASH_MAX_READAHEAD))
+             {
+               fprintf(stderr, 
+                       "if present, readahead must be between 0 and %d\n",
+                       GRST_SLASH_MAX_READAHEAD);
+               return 1;
+             }
+
+           ++i;
+         }          
+       else if ((strcmp(argv[i], "--connections") == 0) && (i + 1 < argc))
+         {
+           max_connections = atoi(argv[i+1]);
+           if ((max_connections <= 0) || 
+               (max_connections > GRST_SLASH_MAX_CONNECTIONS))
+             {
+               fprintf(stderr, 
+                       "if present, connections must be between 1 and %d\n",
+                       GRST_SLASH_MAX_CONNECTIONS);
+               return 1;
+             }
+
+           ++i;
+         }          
+       else if ((strcmp(argv[i], "--writeback") == 0) && (i + 1 < argc))
+         {
+           if (atol(argv[i+1]) < 0)
+             {
+               fprintf(stderr, "if present, writeback size must not be negative\n");
+               return 1;
+             }
+
+           writeback_size = (size_t) atol(argv[i+1]);
+           ++i;
+         }          
+       else if ((strcmp(argv[i], "--attr-timeout") == 0) && (i + 1 < argc))
+         {
+           attr_timeout = atoi(argv[i+1]);
+           if (attr_timeout < 0)
+             {
+               fprintf(stderr, "if present, attr-timeout must not be negative\n");
+               return 1;
+             }
+
+           ++i;
+         }          
+       else if ((strcmp(argv[i], "--cache-size") == 0) && (i + 1 < argc))
+         {
+           if (atoll(argv[i+1]) < 0)
+             {
+               fprintf(stderr, "if present, cache size must not be negative\n");
+               return 1;
+             }
+
+           spool_size = (off_t) atoll(argv[i+1]);
+           ++i;
+         }          
+       else if (strcmp(argv[i], "--no-disk-cache") == 0) 
+         {
+           disk_cache = 0;
+         }
        else
          {
            fprintf(stderr, "argument %s not recognised\n", argv[i]);
@@ -2713,15 +5384,28 @@ int main(int argc, char *argv[])
   mkdir(GRST_SLASH_BLOCKS,  0700);
   mkdir(GRST_SLASH_TMP,     0700);
 
-  for (i=0; i < GRST_SLASH_MAX_HANDLES; ++i)
-     {
-       pthread_mutex_init(&(handles[i].mutex), NULL);
-       handles[i].curl_handle = NULL;
-       handles[i].proxyfile   = NULL;
-       handles[i].last_used   = 0;
-     }
-
-  pthread_mutex_init(&cache_mutex, NULL);
+  pthread_mutex_init(&spool_mutex, NULL);
+  pthread_mutex_init(&memcache_mutex, NULL);
+  pthread_mutex_init(&prefetch_mutex, NULL);
+  pthread_cond_init(&prefetch_cond, NULL);
+  pthread_cond_init(&prefetch_done, NULL);
+  pthread_mutex_init(&pool_mutex, NULL);
+  pthread_cond_init(&pool_cond, NULL);
+  pthread_mutex_init(&writeback_mutex, NULL);
+  pthread_mutex_init(&environ_mutex, NULL);
+  pthread_cond_init(&writeback_cond, NULL);
+  pthread_mutex_init(&attr_mutex, NULL);
+  pthread_mutex_init(&dn_mutex, NULL);
+  pthread_mutex_init(&perm_mutex, NULL);
+
+  /* attr_timeout is not passed on to the kernel: its attribute and lookup
+     caches are shared by every uid under allow_other, but owners, modes
+     and whether a name exists depend on the caller's credentials, so
+     only our per-uid cache may keep them */
+
+  /* FUSE is multi-threaded unless we ask for -s */
+  if (foreground)      fuse_argv[fuse_argc++] = "-d";
+  if (single_threaded) fuse_argv[fuse_argc++] = "-s";
 
 //  GRSTerrorLogFunc = slashgrid_logfunc;
  